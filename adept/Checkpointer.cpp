@@ -0,0 +1,175 @@
+/* Checkpointer.cpp -- Binomial checkpointing schedule
+
+    Copyright (C) 2012-2014 University of Reading
+    Copyright (C) 2015 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   The schedule is computed by recursively splitting the steps to be
+   reversed.  If the state at step "first" is stored and n_free
+   further checkpoints are available, the steps first to last-1 are
+   reversed by advancing to an intermediate step "mid", storing the
+   state there, reversing steps mid to last-1 with n_free-1 free
+   checkpoints, and then reversing steps first to mid-1 with n_free
+   free checkpoints (the one at mid having been released).  With no
+   free checkpoints, each step is reached by advancing from "first".
+
+   If no step may be advanced more than r times, the largest number
+   of steps that can be reversed in this way with n_free free
+   checkpoints is the binomial coefficient (n_free+1+r choose r).  The
+   number of advances is minimized by choosing the smallest such r
+   and then a split point such that both parts also need r or r-1
+   advances per step, as in the binomial checkpointing of Griewank
+   and Walther (2000, ACM TOMS 26, 19-45).  The initial forward pass
+   already advances along the first split of each level, so those
+   steps are not counted as recomputed.
+
+*/
+
+#include <adept/Checkpointer.h>
+#include <adept/exception.h>
+
+namespace adept {
+
+  // Largest number of steps that can be reversed with "n_free" free
+  // checkpoints advancing each step no more than "n_repeat" times;
+  // each partial product is itself a binomial coefficient so the
+  // result is exact
+  static
+  double
+  checkpoint_max_steps(uIndex n_free, int n_repeat)
+  {
+    double result = 1.0;
+    for (int i = 1; i <= n_repeat; i++) {
+      result = (result * (n_free+1+i)) / i;
+    }
+    return n_repeat < 0 ? 0.0 : result;
+  }
+
+  // Number of steps to advance before storing the next checkpoint
+  // when reversing "n_steps" steps with "n_free" free checkpoints
+  static
+  uIndex
+  checkpoint_split(uIndex n_steps, uIndex n_free)
+  {
+    int n_repeat = 0;
+    while (checkpoint_max_steps(n_free, n_repeat) < n_steps) {
+      ++n_repeat;
+    }
+    // The first part must be reversible with each step advanced no
+    // more than n_repeat-1 more times, and the second part must be
+    // long enough to need n_repeat-1 advances itself, otherwise steps
+    // of the first part are advanced more often than necessary
+    double split = checkpoint_max_steps(n_free, n_repeat-1);
+    double max_split = n_steps - checkpoint_max_steps(n_free-1, n_repeat-1);
+    if (max_split < split) {
+      split = max_split;
+    }
+    if (split < 1.0) {
+      return 1;
+    }
+    else if (split > n_steps-1) {
+      return n_steps-1;
+    }
+    else {
+      return static_cast<uIndex>(split);
+    }
+  }
+
+  // Compute the schedule
+  CheckpointSchedule::CheckpointSchedule(uIndex n_steps,
+					 uIndex n_checkpoints)
+    : n_steps_(n_steps), n_checkpoints_(n_checkpoints),
+      n_recomputed_steps_(0), current_step_(0)
+  {
+    if (n_steps < 1 || n_checkpoints < 1) {
+      throw invalid_operation("At least one step and one checkpoint are required by CheckpointSchedule"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+    // Forward pass: store the initial state, then advance and store
+    // at the first split of each level until the checkpoints run out
+    std::vector<uIndex> checkpoint_step;
+    uIndex first = 0;
+    uIndex n_free = n_checkpoints-1;
+    add_action(forward_actions_, CHECKPOINT_STORE, 0, 0);
+    checkpoint_step.push_back(0);
+    while (n_free > 0 && n_steps-first > 1) {
+      uIndex mid = first + checkpoint_split(n_steps-first, n_free);
+      add_action(forward_actions_, CHECKPOINT_ADVANCE, 0, first, mid-first);
+      add_action(forward_actions_, CHECKPOINT_STORE,
+		 checkpoint_step.size(), mid);
+      checkpoint_step.push_back(mid);
+      first = mid;
+      --n_free;
+    }
+    add_action(forward_actions_, CHECKPOINT_ADVANCE, 0, first, n_steps-first);
+    current_step_ = n_steps;
+
+    // Reverse pass: reverse the segments between the stored states
+    // from the last to the first
+    uIndex last = n_steps;
+    for (uIndex islot = checkpoint_step.size(); islot > 0; islot--) {
+      reverse_segment(checkpoint_step[islot-1], last, islot-1,
+		      n_checkpoints - islot);
+      last = checkpoint_step[islot-1];
+    }
+  }
+
+  // Add the actions to reverse steps "first" to "last"-1
+  void
+  CheckpointSchedule::reverse_segment(uIndex first, uIndex last,
+				      uIndex slot, uIndex n_free)
+  {
+    if (n_free == 0 || last-first == 1) {
+      for (uIndex istep = last; istep > first; istep--) {
+	if (current_step_ != first) {
+	  add_action(reverse_actions_, CHECKPOINT_RESTORE, slot, first);
+	}
+	if (istep-1 > first) {
+	  add_action(reverse_actions_, CHECKPOINT_ADVANCE, 0,
+		     first, istep-1-first);
+	  n_recomputed_steps_ += istep-1-first;
+	}
+	add_action(reverse_actions_, CHECKPOINT_ADJOINT, 0, istep-1);
+      }
+    }
+    else {
+      uIndex mid = first + checkpoint_split(last-first, n_free);
+      if (current_step_ != first) {
+	add_action(reverse_actions_, CHECKPOINT_RESTORE, slot, first);
+      }
+      add_action(reverse_actions_, CHECKPOINT_ADVANCE, 0, first, mid-first);
+      n_recomputed_steps_ += mid-first;
+      add_action(reverse_actions_, CHECKPOINT_STORE, slot+1, mid);
+      reverse_segment(mid, last, slot+1, n_free-1);
+      reverse_segment(first, mid, slot, n_free);
+    }
+  }
+
+  // Add an action, keeping track of the step that the state will be
+  // at when the schedule reaches this point
+  void
+  CheckpointSchedule::add_action(std::vector<Action>& actions,
+				 ActionType type, uIndex slot,
+				 uIndex step, uIndex n_steps)
+  {
+    Action action;
+    action.type = type;
+    action.slot = slot;
+    action.step = step;
+    action.n_steps = n_steps;
+    actions.push_back(action);
+    if (type == CHECKPOINT_ADVANCE) {
+      current_step_ = step + n_steps;
+    }
+    else if (type == CHECKPOINT_ADJOINT) {
+      current_step_ = step + 1;
+    }
+    else {
+      current_step_ = step;
+    }
+  }
+
+} // End namespace adept
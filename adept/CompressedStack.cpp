@@ -0,0 +1,403 @@
+/* CompressedStack.cpp -- Compressed copy of the statement & operation stacks
+
+    Copyright (C) 2012-2014 University of Reading
+    Copyright (C) 2015 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   The encoding is described in CompressedStack.h.
+
+*/
+
+#include <cstring>
+#include <limits>
+
+#include <adept/CompressedStack.h>
+
+namespace adept {
+  namespace internal {
+
+    // Remove any existing compressed recording, retaining the memory
+    // for the next one
+    void
+    CompressedStack::clear()
+    {
+      statement_.clear();
+      code_.clear();
+      n_statements_ = 0;
+      n_operations_ = 0;
+    }
+
+    // Encode the statements and operations of one block of a
+    // recording
+    void
+    CompressedStack::push_block(const StackBlock& block)
+    {
+      if (statement_.empty()) {
+	// Insert a null statement
+	statement_.push_back(Statement(-1, 0));
+      }
+      for (uIndex ist = 1; ist < block.n_statements; ist++) {
+	uIndex start = block.statement[ist-1].end_plus_one;
+	push_operations(block.multiplier+start, block.index+start,
+			block.statement[ist].end_plus_one-start);
+	statement_.push_back(Statement(block.statement[ist].index,
+				       code_.size()));
+      }
+    }
+
+    // Divide the operations of a statement into groups of consecutive
+    // operations with the same kind of multiplier
+    void
+    CompressedStack::push_operations(const Real* multiplier,
+				     const uIndex* index, uIndex n)
+    {
+      uIndex i = 0;
+      while (i < n) {
+	uIndex kind = GROUP_GENERAL;
+	if (multiplier[i] == 1.0) {
+	  kind = GROUP_PLUS_ONE;
+	}
+	else if (multiplier[i] == -1.0) {
+	  kind = GROUP_MINUS_ONE;
+	}
+	uIndex j = i+1;
+	if (kind == GROUP_PLUS_ONE) {
+	  while (j < n && multiplier[j] == 1.0) ++j;
+	}
+	else if (kind == GROUP_MINUS_ONE) {
+	  while (j < n && multiplier[j] == -1.0) ++j;
+	}
+	else {
+	  while (j < n && multiplier[j] != 1.0 && multiplier[j] != -1.0) ++j;
+	}
+	push_group(kind, multiplier+i, index+i, j-i);
+	i = j;
+      }
+    }
+
+    // Store runs of at least MIN_RUN_LENGTH consecutive gradient
+    // indices as runs, and the operations between them as lists
+    void
+    CompressedStack::push_group(uIndex kind, const Real* multiplier,
+				const uIndex* index, uIndex n)
+    {
+      uIndex list_start = 0;
+      uIndex i = 0;
+      while (i < n) {
+	uIndex j = i+1;
+	while (j < n && index[j] == index[j-1]+1) ++j;
+	if (j-i >= MIN_RUN_LENGTH) {
+	  push_list(kind, multiplier+list_start, index+list_start,
+		    i-list_start);
+	  push_run(kind, multiplier+i, index+i, j-i);
+	  list_start = j;
+	}
+	i = j;
+      }
+      push_list(kind, multiplier+list_start, index+list_start, n-list_start);
+    }
+
+    void
+    CompressedStack::push_run(uIndex kind, const Real* multiplier,
+			      const uIndex* index, uIndex n)
+    {
+      static const uIndex max_length
+	= std::numeric_limits<uIndex>::max() >> GROUP_SHIFT;
+      while (n > 0) {
+	uIndex len = n < max_length ? n : max_length;
+	code_.push_back((len << GROUP_SHIFT) | kind | GROUP_RUN);
+	code_.push_back(index[0]);
+	if (kind == GROUP_GENERAL) {
+	  for (uIndex i = 0; i < len; i++) {
+	    push_multiplier(multiplier[i]);
+	  }
+	}
+	multiplier += len;
+	index += len;
+	n -= len;
+      }
+    }
+
+    void
+    CompressedStack::push_list(uIndex kind, const Real* multiplier,
+			       const uIndex* index, uIndex n)
+    {
+      static const uIndex max_length
+	= std::numeric_limits<uIndex>::max() >> GROUP_SHIFT;
+      while (n > 0) {
+	uIndex len = n < max_length ? n : max_length;
+	code_.push_back((len << GROUP_SHIFT) | kind);
+	for (uIndex i = 0; i < len; i++) {
+	  code_.push_back(index[i]);
+	  if (kind == GROUP_GENERAL) {
+	    push_multiplier(multiplier[i]);
+	  }
+	}
+	multiplier += len;
+	index += len;
+	n -= len;
+      }
+    }
+
+    // Store a multiplier in the next REAL_WORDS code words
+    void
+    CompressedStack::push_multiplier(Real multiplier)
+    {
+      std::size_t pos = code_.size();
+      code_.resize(pos+REAL_WORDS, 0);
+      std::memcpy(&code_[pos], &multiplier, sizeof(Real));
+    }
+
+    // Check an encoding read from a file, so that a truncated or
+    // corrupt file cannot cause decode(), reverse() or forward() to
+    // read beyond the code words or outside the gradient list
+    bool
+    CompressedStack::is_valid(const std::vector<Statement>& statements,
+			      const std::vector<uIndex>& code,
+			      uIndex n_gradients, std::size_t& n_operations)
+    {
+      // Indices are compared as std::size_t so that negative values
+      // of a signed uIndex are also rejected
+      const std::size_t n_grad = n_gradients;
+      n_operations = 0;
+      if (statements.empty() || statements[0].end_plus_one != 0) {
+	return false;
+      }
+      for (std::size_t ist = 1; ist < statements.size(); ist++) {
+	const Statement& statement = statements[ist];
+	if (static_cast<std::size_t>(statement.index) >= n_grad
+	    || statement.end_plus_one < statements[ist-1].end_plus_one
+	    || static_cast<std::size_t>(statement.end_plus_one) > code.size()) {
+	  return false;
+	}
+	std::size_t pos = statements[ist-1].end_plus_one;
+	const std::size_t end = statement.end_plus_one;
+	while (pos < end) {
+	  const std::size_t header = static_cast<std::size_t>(code[pos++]);
+	  if ((header & GROUP_KIND_MASK) == GROUP_KIND_MASK) {
+	    return false;
+	  }
+	  const std::size_t n = header >> GROUP_SHIFT;
+	  const std::size_t multiplier_words
+	    = (header & GROUP_KIND_MASK) == GROUP_GENERAL ? REAL_WORDS : 0;
+	  const std::size_t remaining = end - pos;
+	  if (header & GROUP_RUN) {
+	    if (remaining < 1) {
+	      return false;
+	    }
+	    const std::size_t first_index = static_cast<std::size_t>(code[pos]);
+	    if (first_index >= n_grad || n > n_grad - first_index
+		|| (multiplier_words > 0
+		    && n > (remaining-1) / multiplier_words)) {
+	      return false;
+	    }
+	    pos += 1 + n*multiplier_words;
+	  }
+	  else {
+	    if (n > remaining / (1 + multiplier_words)) {
+	      return false;
+	    }
+	    for (std::size_t i = 0; i < n; i++, pos += 1 + multiplier_words) {
+	      if (static_cast<std::size_t>(code[pos]) >= n_grad) {
+		return false;
+	      }
+	    }
+	  }
+	  n_operations += n;
+	}
+      }
+      return true;
+    }
+
+    // Decode the operations of one statement
+    void
+    CompressedStack::decode(uIndex ist, std::vector<Real>& multiplier,
+			    std::vector<uIndex>& index) const
+    {
+      multiplier.clear();
+      index.clear();
+      if (statement_[ist-1].end_plus_one == statement_[ist].end_plus_one) {
+	return;
+      }
+      const uIndex* p = &code_[0] + statement_[ist-1].end_plus_one;
+      const uIndex* end = &code_[0] + statement_[ist].end_plus_one;
+      while (p < end) {
+	const uIndex header = *p++;
+	const uIndex n = header >> GROUP_SHIFT;
+	const uIndex kind = header & GROUP_KIND_MASK;
+	const bool is_run = header & GROUP_RUN;
+	uIndex first_index = 0;
+	if (is_run) {
+	  first_index = *p++;
+	}
+	for (uIndex i = 0; i < n; i++) {
+	  if (is_run) {
+	    index.push_back(first_index + i);
+	  }
+	  else {
+	    index.push_back(*p++);
+	  }
+	  if (kind == GROUP_GENERAL) {
+	    Real m;
+	    std::memcpy(&m, p, sizeof(Real));
+	    multiplier.push_back(m);
+	    p += REAL_WORDS;
+	  }
+	  else if (kind == GROUP_PLUS_ONE) {
+	    multiplier.push_back(1.0);
+	  }
+	  else {
+	    multiplier.push_back(-1.0);
+	  }
+	}
+      }
+    }
+
+    // Perform adjoint computation (reverse mode), decoding the
+    // operations of each statement as they are needed
+    void
+    CompressedStack::reverse(Real* __restrict gradient) const
+    {
+      if (statement_.empty()) {
+	return;
+      }
+      const Statement* __restrict statement_list = &statement_[0];
+      const uIndex* __restrict code = code_.empty() ? 0 : &code_[0];
+      // Loop backwards through the derivative statements
+      for (uIndex ist = static_cast<uIndex>(statement_.size())-1; ist > 0;
+	   ist--) {
+	const Statement& statement = statement_list[ist];
+	// As in Stack::compute_adjoint, the gradient of the LHS is
+	// copied in case it appears on the RHS
+	Real a = gradient[statement.index];
+	gradient[statement.index] = 0.0;
+	if (a != 0.0) {
+	  const uIndex* __restrict p
+	    = code + statement_list[ist-1].end_plus_one;
+	  const uIndex* end = code + statement.end_plus_one;
+	  // Loop over the groups of operations
+	  while (p < end) {
+	    const uIndex header = *p++;
+	    const uIndex n = header >> GROUP_SHIFT;
+	    switch (header & (GROUP_KIND_MASK | GROUP_RUN)) {
+	    case GROUP_GENERAL:
+	      for (uIndex i = 0; i < n; i++, p += 1+REAL_WORDS) {
+		Real multiplier;
+		std::memcpy(&multiplier, p+1, sizeof(Real));
+		gradient[*p] += multiplier*a;
+	      }
+	      break;
+	    case GROUP_GENERAL | GROUP_RUN: {
+	      Real* __restrict g = gradient + *p++;
+	      for (uIndex i = 0; i < n; i++, p += REAL_WORDS) {
+		Real multiplier;
+		std::memcpy(&multiplier, p, sizeof(Real));
+		g[i] += multiplier*a;
+	      }
+	      break;
+	    }
+	    case GROUP_PLUS_ONE:
+	      for (uIndex i = 0; i < n; i++) {
+		gradient[p[i]] += a;
+	      }
+	      p += n;
+	      break;
+	    case GROUP_PLUS_ONE | GROUP_RUN: {
+	      Real* __restrict g = gradient + *p++;
+	      for (uIndex i = 0; i < n; i++) {
+		g[i] += a;
+	      }
+	      break;
+	    }
+	    case GROUP_MINUS_ONE:
+	      for (uIndex i = 0; i < n; i++) {
+		gradient[p[i]] -= a;
+	      }
+	      p += n;
+	      break;
+	    case GROUP_MINUS_ONE | GROUP_RUN: {
+	      Real* __restrict g = gradient + *p++;
+	      for (uIndex i = 0; i < n; i++) {
+		g[i] -= a;
+	      }
+	      break;
+	    }
+	    }
+	  }
+	}
+      }
+    }
+
+    // Perform tangent-linear computation (forward mode)
+    void
+    CompressedStack::forward(Real* __restrict gradient) const
+    {
+      if (statement_.empty()) {
+	return;
+      }
+      const Statement* __restrict statement_list = &statement_[0];
+      const uIndex* __restrict code = code_.empty() ? 0 : &code_[0];
+      // Loop forward through the statements
+      for (uIndex ist = 1; ist < static_cast<uIndex>(statement_.size());
+	   ist++) {
+	const Statement& statement = statement_list[ist];
+	const uIndex* __restrict p = code + statement_list[ist-1].end_plus_one;
+	const uIndex* end = code + statement.end_plus_one;
+	Real a = 0.0;
+	while (p < end) {
+	  const uIndex header = *p++;
+	  const uIndex n = header >> GROUP_SHIFT;
+	  switch (header & (GROUP_KIND_MASK | GROUP_RUN)) {
+	  case GROUP_GENERAL:
+	    for (uIndex i = 0; i < n; i++, p += 1+REAL_WORDS) {
+	      Real multiplier;
+	      std::memcpy(&multiplier, p+1, sizeof(Real));
+	      a += multiplier*gradient[*p];
+	    }
+	    break;
+	  case GROUP_GENERAL | GROUP_RUN: {
+	    const Real* __restrict g = gradient + *p++;
+	    for (uIndex i = 0; i < n; i++, p += REAL_WORDS) {
+	      Real multiplier;
+	      std::memcpy(&multiplier, p, sizeof(Real));
+	      a += multiplier*g[i];
+	    }
+	    break;
+	  }
+	  case GROUP_PLUS_ONE:
+	    for (uIndex i = 0; i < n; i++) {
+	      a += gradient[p[i]];
+	    }
+	    p += n;
+	    break;
+	  case GROUP_PLUS_ONE | GROUP_RUN: {
+	    const Real* __restrict g = gradient + *p++;
+	    for (uIndex i = 0; i < n; i++) {
+	      a += g[i];
+	    }
+	    break;
+	  }
+	  case GROUP_MINUS_ONE:
+	    for (uIndex i = 0; i < n; i++) {
+	      a -= gradient[p[i]];
+	    }
+	    p += n;
+	    break;
+	  case GROUP_MINUS_ONE | GROUP_RUN: {
+	    const Real* __restrict g = gradient + *p++;
+	    for (uIndex i = 0; i < n; i++) {
+	      a -= g[i];
+	    }
+	    break;
+	  }
+	  }
+	}
+	gradient[statement.index] = a;
+      }
+    }
+
+  }
+}
@@ -0,0 +1,487 @@
+/* MatrixNode.cpp -- Matrix operations stored as single entries of a recording
+
+    Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   The nodes are described in MatrixNode.h.  For each direction of
+   the gradient list the gradients of an operand are gathered into a
+   contiguous row-major matrix, the operation is applied with BLAS,
+   and the result is scattered back.
+
+*/
+
+#include <algorithm>
+
+#include <adept/MatrixNode.h>
+#include <adept/cppblas.h>
+#include <adept/exception.h>
+
+// If ADEPT_SOURCE_H is defined then we are in a header file generated
+// from all the source files, so cpplapack.h will already have been
+// included
+#ifndef AdeptSource_H
+#include "cpplapack.h"
+#endif
+
+namespace adept {
+  namespace internal {
+
+#if ADEPT_REAL_TYPE_SIZE == 16
+    // BLAS and LAPACK have no long double versions, so matmul() and
+    // solve() cannot be applied to long double arrays and the nodes
+    // below are never created; these overloads allow this file to
+    // compile when Real is long double
+    static void
+    no_long_double_blas()
+    {
+      throw feature_not_available("Cannot differentiate matrix operations because BLAS does not support long double"
+				  ADEPT_EXCEPTION_LOCATION);
+    }
+    static void
+    cppblas_gemm(BLAS_ORDER, BLAS_TRANSPOSE, BLAS_TRANSPOSE, int, int, int,
+		 Real, const Real*, int, const Real*, int, Real, Real*, int)
+    { no_long_double_blas(); }
+    static void
+    cppblas_symm(BLAS_ORDER, BLAS_SIDE, BLAS_UPLO, int, int,
+		 Real, const Real*, int, const Real*, int, Real, Real*, int)
+    { no_long_double_blas(); }
+    static void
+    cppblas_gbmv(BLAS_ORDER, BLAS_TRANSPOSE, int, int, int, int, Real,
+		 const Real*, int, const Real*, int, Real, Real*, int)
+    { no_long_double_blas(); }
+#ifdef HAVE_LAPACK
+    static int
+    cpplapack_getrs(char, int, int, const Real*, int, const int*, Real*, int)
+    { no_long_double_blas(); return 0; }
+#endif
+#endif
+
+    // Location of direction "dir" of gradient "index" in a
+    // multi-direction gradient array, formed in std::size_t since
+    // index*stride can exceed the range of uIndex
+    static inline std::size_t
+    gradient_location(uIndex index, uIndex stride, uIndex dir)
+    {
+      return static_cast<std::size_t>(index)*stride + dir;
+    }
+
+    // Copy direction "dir" of the gradients of a rows-by-cols matrix
+    // into "out", returning false if they are all zero
+    static bool
+    gather_matrix_gradients(const Real* gradient, uIndex stride, uIndex dir,
+			    uIndex index, const Index* offset,
+			    Index rows, Index cols, Real* out)
+    {
+      bool is_non_zero = false;
+      for (Index i = 0; i < rows; ++i) {
+	for (Index j = 0; j < cols; ++j) {
+	  Real g = gradient[gradient_location(index + i*offset[0]
+					      + j*offset[1], stride, dir)];
+	  out[i*cols+j] = g;
+	  if (g != 0.0) {
+	    is_non_zero = true;
+	  }
+	}
+      }
+      return is_non_zero;
+    }
+
+    // Add (or assign if is_add is false) the contiguous row-major
+    // matrix "in" to direction "dir" of the gradients of a matrix
+    static void
+    scatter_matrix_gradients(const Real* in, Index rows, Index cols,
+			     uIndex index, const Index* offset, bool is_add,
+			     Real* gradient, uIndex stride, uIndex dir)
+    {
+      for (Index i = 0; i < rows; ++i) {
+	for (Index j = 0; j < cols; ++j) {
+	  Real& g = gradient[gradient_location(index + i*offset[0]
+					       + j*offset[1], stride, dir)];
+	  if (is_add) {
+	    g += in[i*cols+j];
+	  }
+	  else {
+	    g = in[i*cols+j];
+	  }
+	}
+      }
+    }
+
+    // Tangent linear: C_tl = alpha*(A_tl*B + A*B_tl), or C_tl +=
+    // alpha*(A_tl*B + A*B_tl) if the node is accumulated
+    void
+    MatmulNode::forward(Real* gradient, uIndex stride) const
+    {
+      std::vector<Real> ans_tl(m_*n_);
+      std::vector<Real> left_tl(left_is_active_ ? m_*k_ : 0);
+      std::vector<Real> right_tl(right_is_active_ ? k_*n_ : 0);
+      for (uIndex dir = 0; dir < stride; ++dir) {
+	bool is_non_zero = false;
+	if (left_is_active_
+	    && gather_matrix_gradients(gradient, stride, dir, left_index_,
+				       left_offset_, m_, k_, &left_tl[0])) {
+	  cppblas_gemm(BlasRowMajor, BlasNoTrans, BlasNoTrans, m_, n_, k_,
+		       alpha_, &left_tl[0], k_, &right_[0], n_,
+		       0.0, &ans_tl[0], n_);
+	  is_non_zero = true;
+	}
+	if (right_is_active_
+	    && gather_matrix_gradients(gradient, stride, dir, right_index_,
+				       right_offset_, k_, n_, &right_tl[0])) {
+	  cppblas_gemm(BlasRowMajor, BlasNoTrans, BlasNoTrans, m_, n_, k_,
+		       alpha_, &left_[0], k_, &right_tl[0], n_,
+		       is_non_zero ? 1.0 : 0.0, &ans_tl[0], n_);
+	  is_non_zero = true;
+	}
+	if (!is_non_zero) {
+	  if (is_accumulated_) {
+	    continue;
+	  }
+	  ans_tl.assign(m_*n_, 0.0);
+	}
+	scatter_matrix_gradients(&ans_tl[0], m_, n_, ans_index_, ans_offset_,
+				 is_accumulated_, gradient, stride, dir);
+      }
+    }
+
+    // Adjoint: A_ad += alpha*C_ad*B^T, B_ad += alpha*A^T*C_ad, then
+    // C_ad = 0 unless the node is accumulated, in which case the
+    // previous value of C also depends on C_ad
+    void
+    MatmulNode::reverse(Real* gradient, uIndex stride) const
+    {
+      std::vector<Real> ans_ad(m_*n_);
+      std::vector<Real> work(std::max(left_is_active_ ? m_*k_ : 0,
+				      right_is_active_ ? k_*n_ : 0));
+      for (uIndex dir = 0; dir < stride; ++dir) {
+	bool is_non_zero
+	  = gather_matrix_gradients(gradient, stride, dir, ans_index_,
+				    ans_offset_, m_, n_, &ans_ad[0]);
+	if (!is_non_zero) {
+	  continue;
+	}
+	// Set the gradients of the result to zero, since they are
+	// overwritten by the operation
+	if (!is_accumulated_) {
+	  for (Index i = 0; i < m_; ++i) {
+	    for (Index j = 0; j < n_; ++j) {
+	      gradient[gradient_location(ans_index_ + i*ans_offset_[0]
+					 + j*ans_offset_[1],
+					 stride, dir)] = 0.0;
+	    }
+	  }
+	}
+	if (left_is_active_) {
+	  cppblas_gemm(BlasRowMajor, BlasNoTrans, BlasTrans, m_, k_, n_,
+		       alpha_, &ans_ad[0], n_, &right_[0], n_,
+		       0.0, &work[0], k_);
+	  scatter_matrix_gradients(&work[0], m_, k_, left_index_, left_offset_,
+				   true, gradient, stride, dir);
+	}
+	if (right_is_active_) {
+	  cppblas_gemm(BlasRowMajor, BlasTrans, BlasNoTrans, k_, n_, m_,
+		       alpha_, &left_[0], k_, &ans_ad[0], n_,
+		       0.0, &work[0], n_);
+	  scatter_matrix_gradients(&work[0], k_, n_, right_index_, right_offset_,
+				   true, gradient, stride, dir);
+	}
+      }
+    }
+
+    // Tangent linear: C_tl = S_tl*B + S*B_tl, where the lower triangle
+    // of S_tl is gathered into a row-major n-by-n matrix
+    void
+    SymmMatmulNode::forward(Real* gradient, uIndex stride) const
+    {
+      std::vector<Real> ans_tl(n_*m_);
+      std::vector<Real> left_tl(left_is_active_ ? n_*n_ : 0);
+      std::vector<Real> right_tl(right_is_active_ ? n_*m_ : 0);
+      for (uIndex dir = 0; dir < stride; ++dir) {
+	bool is_non_zero = false;
+	if (left_is_active_) {
+	  bool is_left_non_zero = false;
+	  for (Index i = 0; i < n_; ++i) {
+	    for (Index j = 0; j <= i; ++j) {
+	      Real g = gradient[gradient_location(left_index_
+						  + i*left_offset_[0]
+						  + j*left_offset_[1],
+						  stride, dir)];
+	      left_tl[i*n_+j] = g;
+	      if (g != 0.0) {
+		is_left_non_zero = true;
+	      }
+	    }
+	  }
+	  if (is_left_non_zero) {
+	    cppblas_symm(BlasRowMajor, BlasLeft, BlasLower, n_, m_,
+			 1.0, &left_tl[0], n_, &right_[0], m_,
+			 0.0, &ans_tl[0], m_);
+	    is_non_zero = true;
+	  }
+	}
+	if (right_is_active_
+	    && gather_matrix_gradients(gradient, stride, dir, right_index_,
+				       right_offset_, n_, m_, &right_tl[0])) {
+	  cppblas_symm(BlasRowMajor, BlasLeft, BlasLower, n_, m_,
+		       1.0, &left_[0], n_, &right_tl[0], m_,
+		       is_non_zero ? 1.0 : 0.0, &ans_tl[0], m_);
+	  is_non_zero = true;
+	}
+	if (!is_non_zero) {
+	  ans_tl.assign(n_*m_, 0.0);
+	}
+	scatter_matrix_gradients(&ans_tl[0], n_, m_, ans_index_, ans_offset_,
+				 false, gradient, stride, dir);
+      }
+    }
+
+    // Adjoint: B_ad += S*C_ad and, with G = C_ad*B^T, S_ad(i,j) +=
+    // G(i,j)+G(j,i) for i>j and S_ad(i,i) += G(i,i), then C_ad = 0
+    void
+    SymmMatmulNode::reverse(Real* gradient, uIndex stride) const
+    {
+      std::vector<Real> ans_ad(n_*m_);
+      std::vector<Real> work(std::max(left_is_active_ ? n_*n_ : 0,
+				      right_is_active_ ? n_*m_ : 0));
+      for (uIndex dir = 0; dir < stride; ++dir) {
+	if (!gather_matrix_gradients(gradient, stride, dir, ans_index_,
+				     ans_offset_, n_, m_, &ans_ad[0])) {
+	  continue;
+	}
+	for (Index i = 0; i < n_; ++i) {
+	  for (Index j = 0; j < m_; ++j) {
+	    gradient[gradient_location(ans_index_ + i*ans_offset_[0]
+				       + j*ans_offset_[1], stride, dir)] = 0.0;
+	  }
+	}
+	if (right_is_active_) {
+	  cppblas_symm(BlasRowMajor, BlasLeft, BlasLower, n_, m_,
+		       1.0, &left_[0], n_, &ans_ad[0], m_,
+		       0.0, &work[0], m_);
+	  scatter_matrix_gradients(&work[0], n_, m_, right_index_, right_offset_,
+				   true, gradient, stride, dir);
+	}
+	if (left_is_active_) {
+	  cppblas_gemm(BlasRowMajor, BlasNoTrans, BlasTrans, n_, n_, m_,
+		       1.0, &ans_ad[0], m_, &right_[0], m_,
+		       0.0, &work[0], n_);
+	  for (Index i = 0; i < n_; ++i) {
+	    for (Index j = 0; j < i; ++j) {
+	      gradient[gradient_location(left_index_ + i*left_offset_[0]
+					 + j*left_offset_[1], stride, dir)]
+		+= work[i*n_+j] + work[j*n_+i];
+	    }
+	    gradient[gradient_location(left_index_
+				       + i*(left_offset_[0]+left_offset_[1]),
+				       stride, dir)] += work[i*n_+i];
+	  }
+	}
+      }
+    }
+
+    // Tangent linear: C_tl = A_tl*B + A*B_tl, computed one column at
+    // a time with ?gbmv
+    void
+    BandMatmulNode::forward(Real* gradient, uIndex stride) const
+    {
+      const Index ldab = kl_+ku_+1;
+      std::vector<Real> ans_tl(n_*m_);
+      std::vector<Real> left_tl(left_is_active_ ? ldab*n_ : 0);
+      std::vector<Real> right_tl(right_is_active_ ? n_*m_ : 0);
+      for (uIndex dir = 0; dir < stride; ++dir) {
+	ans_tl.assign(n_*m_, 0.0);
+	if (left_is_active_) {
+	  bool is_left_non_zero = false;
+	  for (Index j = 0; j < n_; ++j) {
+	    Index i_end_plus_1 = j+kl_+1 > n_ ? n_ : j+kl_+1;
+	    for (Index i = j < ku_ ? 0 : j-ku_; i < i_end_plus_1; ++i) {
+	      Real g = gradient[gradient_location(left_index_
+						  + i*left_offset_[0]
+						  + j*left_offset_[1],
+						  stride, dir)];
+	      left_tl[ku_+i-j+j*ldab] = g;
+	      if (g != 0.0) {
+		is_left_non_zero = true;
+	      }
+	    }
+	  }
+	  if (is_left_non_zero) {
+	    for (Index k = 0; k < m_; ++k) {
+	      cppblas_gbmv(BlasColMajor, BlasNoTrans, n_, n_, kl_, ku_,
+			   1.0, &left_tl[0], ldab, &right_[k], m_,
+			   1.0, &ans_tl[k], m_);
+	    }
+	  }
+	}
+	if (right_is_active_
+	    && gather_matrix_gradients(gradient, stride, dir, right_index_,
+				       right_offset_, n_, m_, &right_tl[0])) {
+	  for (Index k = 0; k < m_; ++k) {
+	    cppblas_gbmv(BlasColMajor, BlasNoTrans, n_, n_, kl_, ku_,
+			 1.0, &left_[0], ldab, &right_tl[k], m_,
+			 1.0, &ans_tl[k], m_);
+	  }
+	}
+	scatter_matrix_gradients(&ans_tl[0], n_, m_, ans_index_, ans_offset_,
+				 false, gradient, stride, dir);
+      }
+    }
+
+    // Adjoint: B_ad += A^T*C_ad with ?gbmv, A_ad(i,j) += sum_k
+    // C_ad(i,k)*B(j,k) for elements (i,j) within the band, then C_ad
+    // = 0
+    void
+    BandMatmulNode::reverse(Real* gradient, uIndex stride) const
+    {
+      const Index ldab = kl_+ku_+1;
+      std::vector<Real> ans_ad(n_*m_);
+      std::vector<Real> work(right_is_active_ ? n_*m_ : 0);
+      for (uIndex dir = 0; dir < stride; ++dir) {
+	if (!gather_matrix_gradients(gradient, stride, dir, ans_index_,
+				     ans_offset_, n_, m_, &ans_ad[0])) {
+	  continue;
+	}
+	for (Index i = 0; i < n_; ++i) {
+	  for (Index j = 0; j < m_; ++j) {
+	    gradient[gradient_location(ans_index_ + i*ans_offset_[0]
+				       + j*ans_offset_[1], stride, dir)] = 0.0;
+	  }
+	}
+	if (right_is_active_) {
+	  for (Index k = 0; k < m_; ++k) {
+	    cppblas_gbmv(BlasColMajor, BlasTrans, n_, n_, kl_, ku_,
+			 1.0, &left_[0], ldab, &ans_ad[k], m_,
+			 0.0, &work[k], m_);
+	  }
+	  scatter_matrix_gradients(&work[0], n_, m_, right_index_, right_offset_,
+				   true, gradient, stride, dir);
+	}
+	if (left_is_active_) {
+	  for (Index i = 0; i < n_; ++i) {
+	    Index j_end_plus_1 = i+ku_+1 > n_ ? n_ : i+ku_+1;
+	    for (Index j = i < kl_ ? 0 : i-kl_; j < j_end_plus_1; ++j) {
+	      Real a_ad = 0.0;
+	      for (Index k = 0; k < m_; ++k) {
+		a_ad += ans_ad[i*m_+k] * right_[j*m_+k];
+	      }
+	      gradient[gradient_location(left_index_ + i*left_offset_[0]
+					 + j*left_offset_[1],
+					 stride, dir)] += a_ad;
+	    }
+	  }
+	}
+      }
+    }
+
+#ifdef HAVE_LAPACK
+
+    // Tangent linear: X_tl = A^-1*(B_tl - A_tl*X), with all matrices
+    // gathered in column-major order
+    void
+    SolveNode::forward(Real* gradient, uIndex stride) const
+    {
+      std::vector<Real> x_tl(n_*nrhs_);
+      std::vector<Real> a_tl(a_is_active_ ? n_*n_ : 0);
+      for (uIndex dir = 0; dir < stride; ++dir) {
+	bool is_non_zero = false;
+	if (b_is_active_) {
+	  is_non_zero = gather_matrix_gradients(gradient, stride, dir, b_index_,
+						b_offset_, nrhs_, n_, &x_tl[0]);
+	}
+	else {
+	  x_tl.assign(n_*nrhs_, 0.0);
+	}
+	if (a_is_active_
+	    && gather_matrix_gradients(gradient, stride, dir, a_index_,
+				       a_offset_, n_, n_, &a_tl[0])) {
+	  cppblas_gemm(BlasColMajor, BlasNoTrans, BlasNoTrans, n_, nrhs_, n_,
+		       -1.0, &a_tl[0], n_, &x_[0], n_, 1.0, &x_tl[0], n_);
+	  is_non_zero = true;
+	}
+	if (is_non_zero) {
+	  cpplapack_getrs('N', n_, nrhs_, &lu_[0], n_, &ipiv_[0],
+			  &x_tl[0], n_);
+	}
+	scatter_matrix_gradients(&x_tl[0], nrhs_, n_, x_index_, x_offset_,
+				 false, gradient, stride, dir);
+      }
+    }
+
+    // Adjoint: W = A^-T*X_ad, B_ad += W, A_ad -= W*X^T, X_ad = 0
+    void
+    SolveNode::reverse(Real* gradient, uIndex stride) const
+    {
+      std::vector<Real> w(n_*nrhs_);
+      std::vector<Real> a_ad(a_is_active_ ? n_*n_ : 0);
+      for (uIndex dir = 0; dir < stride; ++dir) {
+	if (!gather_matrix_gradients(gradient, stride, dir, x_index_,
+				     x_offset_, nrhs_, n_, &w[0])) {
+	  continue;
+	}
+	for (Index j = 0; j < nrhs_; ++j) {
+	  for (Index i = 0; i < n_; ++i) {
+	    gradient[gradient_location(x_index_ + j*x_offset_[0]
+				       + i*x_offset_[1], stride, dir)] = 0.0;
+	  }
+	}
+	cpplapack_getrs('T', n_, nrhs_, &lu_[0], n_, &ipiv_[0], &w[0], n_);
+	if (b_is_active_) {
+	  scatter_matrix_gradients(&w[0], nrhs_, n_, b_index_, b_offset_,
+				   true, gradient, stride, dir);
+	}
+	if (a_is_active_) {
+	  cppblas_gemm(BlasColMajor, BlasNoTrans, BlasTrans, n_, n_, nrhs_,
+		       -1.0, &w[0], n_, &x_[0], n_, 0.0, &a_ad[0], n_);
+	  scatter_matrix_gradients(&a_ad[0], n_, n_, a_index_, a_offset_,
+				   true, gradient, stride, dir);
+	}
+      }
+    }
+
+#else
+
+    // A SolveNode is only created if LAPACK is available
+    void
+    SolveNode::forward(Real* gradient, uIndex stride) const
+    {
+      throw feature_not_available("Cannot differentiate linear solve because compiled without LAPACK"
+				  ADEPT_EXCEPTION_LOCATION);
+    }
+
+    void
+    SolveNode::reverse(Real* gradient, uIndex stride) const
+    {
+      throw feature_not_available("Cannot differentiate linear solve because compiled without LAPACK"
+				  ADEPT_EXCEPTION_LOCATION);
+    }
+
+#endif
+
+    // Delete all but the first n nodes
+    void
+    MatrixNodeList::resize(std::size_t n)
+    {
+      for (std::size_t i = n; i < node_.size(); ++i) {
+	delete node_[i];
+      }
+      if (n < node_.size()) {
+	node_.resize(n);
+      }
+    }
+
+    // Return the number of bytes used to store the nodes
+    std::size_t
+    MatrixNodeList::memory() const
+    {
+      std::size_t bytes = node_.capacity()*sizeof(MatrixNode*);
+      for (std::size_t i = 0; i < node_.size(); ++i) {
+	bytes += node_[i]->memory();
+      }
+      return bytes;
+    }
+
+  } // End namespace internal
+} // End namespace adept
@@ -0,0 +1,313 @@
+/* ParallelAdjoint.cpp -- Level-scheduled copy of the recording for parallel adjoints
+
+    Copyright (C) 2012-2014 University of Reading
+    Copyright (C) 2015 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   The scheduling is described in ParallelAdjoint.h.
+
+*/
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <adept/ParallelAdjoint.h>
+
+namespace adept {
+  namespace internal {
+
+    // Remove any existing schedule, retaining the memory for the
+    // next one
+    void
+    ParallelAdjoint::clear()
+    {
+      statement_.clear();
+      multiplier_.clear();
+      index_.clear();
+      level_start_.clear();
+      atomic_start_.clear();
+      n_statements_ = 0;
+      n_operations_ = 0;
+    }
+
+    // Prepare to compute the levels of the statements of a recording
+    void
+    ParallelAdjoint::start_levels(uIndex max_gradient)
+    {
+      clear();
+      statement_level_.clear();
+      // Level zero indicates that a variable has not yet been written
+      // or read by any statement
+      last_write_.assign(max_gradient, 0);
+      last_read_.assign(max_gradient, 0);
+      // Initially these hold the number of operations and statements
+      // in each level
+      level_end_operation_.assign(1, 0);
+      next_statement_.assign(1, 0);
+    }
+
+    // Compute the level of each statement of one block: one more than
+    // the highest level of the earlier statements it depends on
+    void
+    ParallelAdjoint::compute_levels(const StackBlock& block)
+    {
+      const uIndex* __restrict index = block.index;
+      uIndex* __restrict last_write = &last_write_[0];
+      uIndex* __restrict last_read = &last_read_[0];
+      for (uIndex ist = 1; ist < block.n_statements; ist++) {
+	const uIndex lhs = block.statement[ist].index;
+	const uIndex start = block.statement[ist-1].end_plus_one;
+	const uIndex end_plus_one = block.statement[ist].end_plus_one;
+	uIndex level = last_write[lhs] > last_read[lhs]
+	  ? last_write[lhs] : last_read[lhs];
+	for (uIndex i = start; i < end_plus_one; i++) {
+	  if (last_write[index[i]] > level) {
+	    level = last_write[index[i]];
+	  }
+	}
+	++level;
+	last_write[lhs] = level;
+	for (uIndex i = start; i < end_plus_one; i++) {
+	  if (last_read[index[i]] < level) {
+	    last_read[index[i]] = level;
+	  }
+	}
+	statement_level_.push_back(level);
+	if (static_cast<std::size_t>(level) >= next_statement_.size()) {
+	  next_statement_.push_back(0);
+	  level_end_operation_.push_back(0);
+	}
+	++next_statement_[level];
+	level_end_operation_[level] += end_plus_one - start;
+      }
+    }
+
+    // Convert the numbers of statements and operations in each level
+    // into the positions at which they will be stored
+    void
+    ParallelAdjoint::start_sort()
+    {
+      const uIndex n_levels = next_statement_.size()-1;
+      uIndex n_statements = 0;
+      uIndex n_operations = 0;
+      level_start_.resize(n_levels+1);
+      for (uIndex ilevel = 1; ilevel <= n_levels; ilevel++) {
+	uIndex n_level_statements = next_statement_[ilevel];
+	uIndex n_level_operations = level_end_operation_[ilevel];
+	// Statement 0 is a null statement
+	next_statement_[ilevel] = n_statements + 1;
+	level_end_operation_[ilevel] = n_operations;
+	level_start_[ilevel-1] = n_statements + 1;
+	n_statements += n_level_statements;
+	n_operations += n_level_operations;
+      }
+      level_start_[n_levels] = n_statements + 1;
+      statement_.resize(n_statements + 1);
+      statement_[0] = Statement(-1, 0);
+      multiplier_.resize(n_operations);
+      index_.resize(n_operations);
+      i_statement_ = 0;
+    }
+
+    // Copy the statements and operations of one block to their
+    // positions sorted by level; since the statements of each level
+    // are stored in order, the operations of each statement still
+    // start where those of the previous statement end
+    void
+    ParallelAdjoint::push_block(const StackBlock& block)
+    {
+      for (uIndex ist = 1; ist < block.n_statements; ist++) {
+	const uIndex level = statement_level_[i_statement_++];
+	uIndex& iop = level_end_operation_[level];
+	for (uIndex i = block.statement[ist-1].end_plus_one;
+	     i < block.statement[ist].end_plus_one; i++, iop++) {
+	  multiplier_[iop] = block.multiplier[i];
+	  index_[iop] = block.index[i];
+	}
+	statement_[next_statement_[level]++]
+	  = Statement(block.statement[ist].index, iop);
+      }
+    }
+
+    // First statement of a level of "n" statements starting at
+    // "begin" to be treated by thread "ithread" of "n_threads"
+    static inline
+    uIndex
+    parallel_adjoint_chunk(uIndex begin, uIndex n, int ithread, int n_threads)
+    {
+      return begin + static_cast<uIndex>((static_cast<std::size_t>(n)*ithread)
+					 / n_threads);
+    }
+
+    // Find the operations that must be accumulated atomically, and
+    // free the memory used in scheduling
+    void
+    ParallelAdjoint::finish(uIndex n_statements, uIndex n_operations,
+			    int n_threads)
+    {
+      n_statements_ = n_statements;
+      n_operations_ = n_operations;
+      n_threads_ = n_threads;
+      atomic_start_.resize(statement_.size());
+      for (std::size_t ist = 0; ist < statement_.size(); ist++) {
+	atomic_start_[ist] = statement_[ist].end_plus_one;
+      }
+      // For each variable, the last level in which it was read, the
+      // thread that read it and the last level in which it was read
+      // by more than one thread
+      const std::size_t max_gradient = last_write_.size();
+      std::vector<uIndex>& read_level = last_write_;
+      std::vector<uIndex>& read_thread = last_read_;
+      std::vector<uIndex> shared_level(max_gradient, 0);
+      read_level.assign(max_gradient, 0);
+      read_thread.assign(max_gradient, 0);
+      std::vector<Real> atomic_multiplier;
+      std::vector<uIndex> atomic_index;
+      for (uIndex ilevel = 1; ilevel <= n_levels() && n_threads > 1; ilevel++) {
+	const uIndex begin = level_start_[ilevel-1];
+	const uIndex n = level_start_[ilevel] - begin;
+	if (n < MIN_PARALLEL_STATEMENTS) {
+	  continue;
+	}
+	for (int ithread = 0; ithread < n_threads; ithread++) {
+	  for (uIndex ist = parallel_adjoint_chunk(begin, n, ithread, n_threads);
+	       ist < parallel_adjoint_chunk(begin, n, ithread+1, n_threads);
+	       ist++) {
+	    for (uIndex i = statement_[ist-1].end_plus_one;
+		 i < statement_[ist].end_plus_one; i++) {
+	      const uIndex index = index_[i];
+	      if (read_level[index] != ilevel) {
+		read_level[index] = ilevel;
+		read_thread[index] = ithread;
+	      }
+	      else if (read_thread[index] != static_cast<uIndex>(ithread)) {
+		shared_level[index] = ilevel;
+	      }
+	    }
+	  }
+	}
+	// Move the operations on shared variables to the end of each
+	// statement, preserving the order of the others
+	for (uIndex ist = begin; ist < begin+n; ist++) {
+	  const uIndex start = statement_[ist-1].end_plus_one;
+	  const uIndex end_plus_one = statement_[ist].end_plus_one;
+	  uIndex j = start;
+	  atomic_multiplier.clear();
+	  atomic_index.clear();
+	  for (uIndex i = start; i < end_plus_one; i++) {
+	    if (shared_level[index_[i]] == ilevel) {
+	      atomic_multiplier.push_back(multiplier_[i]);
+	      atomic_index.push_back(index_[i]);
+	    }
+	    else {
+	      multiplier_[j] = multiplier_[i];
+	      index_[j] = index_[i];
+	      ++j;
+	    }
+	  }
+	  atomic_start_[ist] = j;
+	  for (std::size_t i = 0; i < atomic_index.size(); i++, j++) {
+	    multiplier_[j] = atomic_multiplier[i];
+	    index_[j] = atomic_index[i];
+	  }
+	}
+      }
+      std::vector<uIndex>().swap(statement_level_);
+      std::vector<uIndex>().swap(last_write_);
+      std::vector<uIndex>().swap(last_read_);
+      std::vector<uIndex>().swap(level_end_operation_);
+      std::vector<uIndex>().swap(next_statement_);
+    }
+
+    // Perform adjoint computation (reverse mode) one level at a time,
+    // from the highest to the lowest
+    void
+    ParallelAdjoint::reverse(Real* __restrict gradient) const
+    {
+      const uIndex n_level = n_levels();
+      if (n_level == 0) {
+	return;
+      }
+      const Statement* __restrict statement_list = &statement_[0];
+      const Real* __restrict multiplier
+	= multiplier_.empty() ? 0 : &multiplier_[0];
+      const uIndex* __restrict index = index_.empty() ? 0 : &index_[0];
+      const uIndex* level_start = &level_start_[0];
+
+#ifdef _OPENMP
+      if (n_threads_ > 1) {
+	const uIndex* atomic_start = &atomic_start_[0];
+#pragma omp parallel num_threads(n_threads_)
+	{
+	  const int n_threads = omp_get_num_threads();
+	  const int ithread = omp_get_thread_num();
+	  // If we have not been given the number of threads that was
+	  // scheduled for, all accumulations in parallel levels must
+	  // be atomic
+	  const bool is_scheduled = (n_threads == n_threads_);
+	  for (uIndex ilevel = n_level; ilevel > 0; ilevel--) {
+	    const uIndex begin = level_start[ilevel-1];
+	    const uIndex n = level_start[ilevel] - begin;
+	    if (n >= MIN_PARALLEL_STATEMENTS) {
+	      const uIndex ist_begin
+		= parallel_adjoint_chunk(begin, n, ithread, n_threads);
+	      for (uIndex ist
+		     = parallel_adjoint_chunk(begin, n, ithread+1, n_threads);
+		   ist > ist_begin; ist--) {
+		const Statement& statement = statement_list[ist-1];
+		Real a = gradient[statement.index];
+		gradient[statement.index] = 0.0;
+		if (a != 0.0) {
+		  const uIndex start = statement_list[ist-2].end_plus_one;
+		  const uIndex atomic = is_scheduled ? atomic_start[ist-1] : start;
+		  for (uIndex i = start; i < atomic; i++) {
+		    gradient[index[i]] += multiplier[i]*a;
+		  }
+		  for (uIndex i = atomic; i < statement.end_plus_one; i++) {
+#pragma omp atomic
+		    gradient[index[i]] += multiplier[i]*a;
+		  }
+		}
+	      }
+#pragma omp barrier
+	    }
+	    else {
+#pragma omp single
+	      for (uIndex ist = level_start[ilevel]-1; ist >= begin; ist--) {
+		const Statement& statement = statement_list[ist];
+		Real a = gradient[statement.index];
+		gradient[statement.index] = 0.0;
+		if (a != 0.0) {
+		  for (uIndex i = statement_list[ist-1].end_plus_one;
+		       i < statement.end_plus_one; i++) {
+		    gradient[index[i]] += multiplier[i]*a;
+		  }
+		}
+	      }
+	    }
+	  }
+	}
+	return;
+      }
+#endif
+
+      // Serial version, equivalent to Stack::compute_adjoint
+      for (uIndex ist = level_start[n_level]-1; ist > 0; ist--) {
+	const Statement& statement = statement_list[ist];
+	Real a = gradient[statement.index];
+	gradient[statement.index] = 0.0;
+	if (a != 0.0) {
+	  for (uIndex i = statement_list[ist-1].end_plus_one;
+	       i < statement.end_plus_one; i++) {
+	    gradient[index[i]] += multiplier[i]*a;
+	  }
+	}
+      }
+    }
+
+  } // End namespace internal
+} // End namespace adept
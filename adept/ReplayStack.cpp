@@ -0,0 +1,694 @@
+/* ReplayStack.cpp -- Record of operations enabling a recording to be replayed
+
+    Copyright (C) 2012-2014 University of Reading
+    Copyright (C) 2015 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   The encoding is described in ReplayStack.h.  The values and
+   partial derivatives of each operation are computed using the same
+   policy classes as the expression templates, and the differential
+   statements are pushed with their operations in the same order, so
+   replaying a recording at the values of the independent variables
+   with which it was made reproduces it exactly.
+
+*/
+
+#include <cmath>
+
+#include <adept/Stack.h>
+#include <adept/UnaryOperation.h>
+#include <adept/BinaryOperation.h>
+
+namespace adept {
+  namespace internal {
+
+    // Remove the statements of the previous recording
+    void
+    ReplayStack::clear()
+    {
+      code_.clear();
+      constant_.clear();
+      input_index_.clear();
+      input_value_.clear();
+      is_known_.clear();
+      is_supported_ = true;
+      n_statements_ = 0;
+    }
+
+    // Interpret the stored statements
+    void
+    ReplayStack::replay(Stack& stack,
+			const std::vector<uIndex>& independent_index,
+			const Real* x, Real* __restrict value)
+    {
+      // The values of the variables before the first statement are
+      // those when the recording was made, except for the
+      // independent variables
+      for (std::size_t i = 0; i < input_index_.size(); ++i) {
+	value[input_index_[i]] = input_value_[i];
+      }
+      for (std::size_t i = 0; i < independent_index.size(); ++i) {
+	value[independent_index[i]] = x[i];
+      }
+      // The new recording is made at these input values, which are
+      // therefore the ones used by subsequent calls to replay() and
+      // hessian_product()
+      for (std::size_t i = 0; i < input_index_.size(); ++i) {
+	input_value_[i] = value[input_index_[i]];
+      }
+      if (code_.empty()) {
+	return;
+      }
+
+      const uIndex* __restrict p = &code_[0];
+      const uIndex* end = p + code_.size();
+      const Real* __restrict constant = constant_.empty() ? 0 : &constant_[0];
+
+      // Each statement is evaluated as a tree of "nodes", one per
+      // operand or operation, with node_arg_ holding the nodes that
+      // are the arguments of each operation (or the gradient index
+      // of a variable) and node_extra_ holding a quantity needed to
+      // compute the partial derivatives: the derivative of a unary
+      // function, 1/b for a/b and 1/(a*a+b*b) for atan2(a,b).  A
+      // node is active if it depends on a variable.
+      uIndex n_node = 0;     // Number of nodes in current statement
+      uIndex n_work = 0;     // Number of nodes awaiting an operation
+      uIndex n_variable = 0; // Number of variables in current statement
+      while (p < end) {
+	if (static_cast<std::size_t>(n_node) >= node_value_.size()) {
+	  std::size_t n = 2*node_value_.size() + 16;
+	  node_value_.resize(n);
+	  node_extra_.resize(n);
+	  node_arg_.resize(2*n);
+	  node_opcode_.resize(n);
+	  node_is_active_.resize(n);
+	  work_.resize(n);
+	  work_multiplier_.resize(n);
+	}
+	const uIndex opcode = *p++;
+	const uIndex k = n_node;
+	node_opcode_[k] = opcode;
+	switch (opcode) {
+	case REPLAY_VARIABLE:
+	  node_arg_[2*k] = *p;
+	  node_value_[k] = value[*p++];
+	  node_is_active_[k] = true;
+	  ++n_variable;
+	  work_[n_work++] = n_node++;
+	  continue;
+	case REPLAY_CONSTANT:
+	  node_value_[k] = *constant++;
+	  node_is_active_[k] = false;
+	  work_[n_work++] = n_node++;
+	  continue;
+	case REPLAY_ASSIGN:
+	case REPLAY_ASSIGN_VALUE:
+	  break;
+	default:
+	  if (opcode < REPLAY_Add) {
+	    // Unary operation
+	    const uIndex a = work_[n_work-1];
+	    const Real va = node_value_[a];
+	    Real& v = node_value_[k];
+	    Real& d = node_extra_[k];
+	    switch (opcode) {
+#define ADEPT_REPLAY_UNARY(NAME)					\
+	    case REPLAY_##NAME: {					\
+	      NAME<Real> op;						\
+	      v = op.operation(va);					\
+	      d = op.derivative(va, v);					\
+	      break;							\
+	    }
+	      ADEPT_REPLAY_UNARY(Log)
+	      ADEPT_REPLAY_UNARY(Log10)
+	      ADEPT_REPLAY_UNARY(Sin)
+	      ADEPT_REPLAY_UNARY(Cos)
+	      ADEPT_REPLAY_UNARY(Tan)
+	      ADEPT_REPLAY_UNARY(Asin)
+	      ADEPT_REPLAY_UNARY(Acos)
+	      ADEPT_REPLAY_UNARY(Atan)
+	      ADEPT_REPLAY_UNARY(Sinh)
+	      ADEPT_REPLAY_UNARY(Cosh)
+	      ADEPT_REPLAY_UNARY(Abs)
+	      ADEPT_REPLAY_UNARY(Fabs)
+	      ADEPT_REPLAY_UNARY(Exp)
+	      ADEPT_REPLAY_UNARY(Sqrt)
+	      ADEPT_REPLAY_UNARY(Tanh)
+	      ADEPT_REPLAY_UNARY(Ceil)
+	      ADEPT_REPLAY_UNARY(Floor)
+	      ADEPT_REPLAY_UNARY(Log2)
+	      ADEPT_REPLAY_UNARY(Expm1)
+	      ADEPT_REPLAY_UNARY(Exp2)
+	      ADEPT_REPLAY_UNARY(Log1p)
+	      ADEPT_REPLAY_UNARY(Asinh)
+	      ADEPT_REPLAY_UNARY(Acosh)
+	      ADEPT_REPLAY_UNARY(Atanh)
+	      ADEPT_REPLAY_UNARY(Erf)
+	      ADEPT_REPLAY_UNARY(Erfc)
+	      ADEPT_REPLAY_UNARY(Cbrt)
+	      ADEPT_REPLAY_UNARY(Round)
+	      ADEPT_REPLAY_UNARY(Trunc)
+	      ADEPT_REPLAY_UNARY(Rint)
+	      ADEPT_REPLAY_UNARY(Nearbyint)
+	      ADEPT_REPLAY_UNARY(UnaryPlus)
+	      ADEPT_REPLAY_UNARY(UnaryMinus)
+	      ADEPT_REPLAY_UNARY(Not)
+#undef ADEPT_REPLAY_UNARY
+	    }
+	    node_arg_[2*k] = a;
+	    node_is_active_[k] = node_is_active_[a];
+	    work_[n_work-1] = n_node++;
+	  }
+	  else {
+	    // Binary operation
+	    const uIndex b = work_[--n_work];
+	    const uIndex a = work_[n_work-1];
+	    const Real va = node_value_[a];
+	    const Real vb = node_value_[b];
+	    Real& v = node_value_[k];
+	    switch (opcode) {
+	    case REPLAY_Add:      v = Add().operation(va, vb);      break;
+	    case REPLAY_Subtract: v = Subtract().operation(va, vb); break;
+	    case REPLAY_Multiply: v = Multiply().operation(va, vb); break;
+	    case REPLAY_Divide:
+	      v = Divide().operation_store(va, vb, node_extra_[k]);
+	      break;
+	    case REPLAY_Pow:      v = Pow().operation(va, vb);      break;
+	    case REPLAY_Atan2:
+	      v = Atan2().operation_store(va, vb, node_extra_[k]);
+	      break;
+	    case REPLAY_Max:      v = Max().operation(va, vb);      break;
+	    case REPLAY_Min:      v = Min().operation(va, vb);      break;
+	    }
+	    node_arg_[2*k]   = a;
+	    node_arg_[2*k+1] = b;
+	    node_is_active_[k] = node_is_active_[a] || node_is_active_[b];
+	    work_[n_work-1] = n_node++;
+	  }
+	  continue;
+	}
+
+	// End of a statement
+	const uIndex lhs = *p++;
+	const uIndex root = work_[0];
+	if (opcode == REPLAY_ASSIGN) {
+#ifndef ADEPT_MANUAL_MEMORY_ALLOCATION
+	  stack.check_space(n_variable);
+#endif
+	  // Propagate multipliers from the root of the tree to the
+	  // variables, visiting the left argument of each operation
+	  // before the right so that the operations are pushed in the
+	  // same order as by the expression templates
+	  n_work = 0;
+	  if (node_is_active_[root]) {
+	    work_[0] = root;
+	    work_multiplier_[0] = 1.0;
+	    n_work = 1;
+	  }
+	  while (n_work > 0) {
+	    --n_work;
+	    const uIndex j = work_[n_work];
+	    const Real m = work_multiplier_[n_work];
+	    const uIndex op = node_opcode_[j];
+	    if (op == REPLAY_VARIABLE) {
+	      stack.push_rhs(m, node_arg_[2*j]);
+	    }
+	    else if (op < REPLAY_Add) {
+	      work_[n_work] = node_arg_[2*j];
+	      work_multiplier_[n_work++] = m*node_extra_[j];
+	    }
+	    else {
+	      const uIndex a = node_arg_[2*j];
+	      const uIndex b = node_arg_[2*j+1];
+	      const Real va = node_value_[a];
+	      const Real vb = node_value_[b];
+	      const Real v = node_value_[j];
+	      bool do_a = node_is_active_[a];
+	      bool do_b = node_is_active_[b];
+	      Real ma = 0.0, mb = 0.0;
+	      switch (op) {
+	      case REPLAY_Add:
+		ma = m; mb = m;
+		break;
+	      case REPLAY_Subtract:
+		ma = m; mb = -m;
+		break;
+	      case REPLAY_Multiply:
+		if (do_a) ma = m*vb;
+		if (do_b) mb = m*va;
+		break;
+	      case REPLAY_Divide:
+		if (do_a) ma = m*node_extra_[j];
+		if (do_b) mb = -m*v*node_extra_[j];
+		break;
+	      case REPLAY_Pow:
+		if (do_a) ma = m*vb*std::pow(va, vb - 1.0);
+		if (do_b) mb = m*v*std::log(va);
+		break;
+	      case REPLAY_Atan2:
+		if (do_a) ma = vb*node_extra_[j]*m;
+		if (do_b) mb = -va*node_extra_[j]*m;
+		break;
+	      case REPLAY_Max:
+		// Only the argument that was selected contributes
+		if (va > vb) { ma = m; do_b = false; }
+		else         { mb = m; do_a = false; }
+		break;
+	      case REPLAY_Min:
+		if (va <= vb) { ma = m; do_b = false; }
+		else          { mb = m; do_a = false; }
+		break;
+	      }
+	      // Push the right argument first so that the left is
+	      // visited first
+	      if (do_b) {
+		work_[n_work] = b;
+		work_multiplier_[n_work++] = mb;
+	      }
+	      if (do_a) {
+		work_[n_work] = a;
+		work_multiplier_[n_work++] = ma;
+	      }
+	    }
+	  }
+	  stack.push_lhs(lhs);
+	}
+	value[lhs] = node_value_[root];
+	n_node = 0;
+	n_work = 0;
+	n_variable = 0;
+      }
+    }
+
+    // Second derivative of unary function "opcode" at "x", given its
+    // value "v" and first derivative "d" there
+    static
+    Real
+    replay_second_derivative(uIndex opcode, Real x, Real v, Real d)
+    {
+      switch (opcode) {
+      case REPLAY_Log:   return -d*d;
+      case REPLAY_Log10: return -d/x;
+      case REPLAY_Log2:  return -d/x;
+      case REPLAY_Sin:   return -v;
+      case REPLAY_Cos:   return -v;
+      case REPLAY_Tan:   return 2.0*v*d;
+      case REPLAY_Asin:  return x*d*d*d;
+      case REPLAY_Acos:  return x*d*d*d;
+      case REPLAY_Atan:  return -2.0*x*d*d;
+      case REPLAY_Sinh:  return v;
+      case REPLAY_Cosh:  return v;
+      case REPLAY_Exp:   return v;
+      case REPLAY_Sqrt:  return -0.5*d/x;
+      case REPLAY_Tanh:  return -2.0*v*d;
+      case REPLAY_Expm1: return d;
+      case REPLAY_Exp2:  return 0.6931471805599453094172321214581766*d;
+      case REPLAY_Log1p: return -d*d;
+      case REPLAY_Asinh: return -x*d*d*d;
+      case REPLAY_Acosh: return -x*d*d*d;
+      case REPLAY_Atanh: return 2.0*x*d*d;
+      case REPLAY_Erf:   return -2.0*x*d;
+      case REPLAY_Erfc:  return -2.0*x*d;
+      case REPLAY_Cbrt:  return -2.0*d/(3.0*x);
+      default:
+	// Piecewise constant or linear functions
+	return 0.0;
+      }
+    }
+
+    // Forward-over-reverse differentiation of the stored statements
+    void
+    ReplayStack::hessian_product(uIndex max_gradient,
+				 const std::vector<uIndex>& independent_index,
+				 const std::vector<uIndex>& dependent_index,
+				 const Real* dependent_weight,
+				 uIndex n_directions, const Real* direction,
+				 Real* product) const
+    {
+      const uIndex nd = n_directions;
+
+      // Values of the variables, and their derivatives in each
+      // direction ("tangents")
+      std::vector<Real> value(max_gradient);
+      std::vector<Real> tangent(static_cast<std::size_t>(max_gradient)*nd, 0.0);
+      for (std::size_t i = 0; i < input_index_.size(); ++i) {
+	value[input_index_[i]] = input_value_[i];
+      }
+      for (std::size_t j = 0; j < independent_index.size(); ++j) {
+	for (uIndex k = 0; k < nd; ++k) {
+	  tangent[independent_index[j]*nd+k] = direction[j*nd+k];
+	}
+      }
+
+      // Second-order recording: for each differential statement the
+      // gradient index of its left-hand side and the end of its
+      // operations, and for each operation the gradient index, the
+      // multiplier and the derivative of the multiplier in each
+      // direction
+      std::vector<uIndex> st_lhs, st_end;
+      std::vector<uIndex> op_index;
+      std::vector<Real> op_multiplier, op_dmultiplier;
+
+      // Description of each node of the current statement, as in
+      // replay(), plus the tangents of its value and the partial
+      // derivatives with respect to its arguments, and the tangents of
+      // these partial derivatives
+      std::vector<Real> node_value, node_tangent, node_partial, node_dpartial;
+      std::vector<uIndex> node_arg, node_opcode, work;
+      std::vector<char> node_is_active, node_use_arg;
+      std::vector<Real> work_multiplier, work_dmultiplier;
+
+      const uIndex* p = code_.empty() ? 0 : &code_[0];
+      const uIndex* end = p + code_.size();
+      const Real* constant = constant_.empty() ? 0 : &constant_[0];
+      uIndex n_node = 0;
+      uIndex n_work = 0;
+      while (p < end) {
+	if (static_cast<std::size_t>(n_node) >= node_value.size()) {
+	  std::size_t n = 2*node_value.size() + 16;
+	  node_value.resize(n);
+	  node_tangent.resize(n*nd);
+	  node_partial.resize(2*n);
+	  node_dpartial.resize(2*n*nd);
+	  node_arg.resize(2*n);
+	  node_opcode.resize(n);
+	  node_is_active.resize(n);
+	  node_use_arg.resize(2*n);
+	  work.resize(n);
+	  work_multiplier.resize(n);
+	  work_dmultiplier.resize(n*nd);
+	}
+	const uIndex opcode = *p++;
+	const uIndex k = n_node;
+	Real* vt = &node_tangent[k*nd];
+	node_opcode[k] = opcode;
+	switch (opcode) {
+	case REPLAY_VARIABLE:
+	  node_arg[2*k] = *p;
+	  node_value[k] = value[*p];
+	  for (uIndex i = 0; i < nd; ++i) {
+	    vt[i] = tangent[(*p)*nd+i];
+	  }
+	  ++p;
+	  node_is_active[k] = true;
+	  work[n_work++] = n_node++;
+	  continue;
+	case REPLAY_CONSTANT:
+	  node_value[k] = *constant++;
+	  for (uIndex i = 0; i < nd; ++i) {
+	    vt[i] = 0.0;
+	  }
+	  node_is_active[k] = false;
+	  work[n_work++] = n_node++;
+	  continue;
+	case REPLAY_ASSIGN:
+	case REPLAY_ASSIGN_VALUE:
+	  break;
+	default:
+	  if (opcode < REPLAY_Add) {
+	    // Unary operation
+	    const uIndex a = work[n_work-1];
+	    const Real va = node_value[a];
+	    const Real* at = &node_tangent[a*nd];
+	    Real& v = node_value[k];
+	    Real& d = node_partial[2*k];
+	    switch (opcode) {
+#define ADEPT_REPLAY_UNARY(NAME)					\
+	    case REPLAY_##NAME: {					\
+	      NAME<Real> op;						\
+	      v = op.operation(va);					\
+	      d = op.derivative(va, v);					\
+	      break;							\
+	    }
+	      ADEPT_REPLAY_UNARY(Log)
+	      ADEPT_REPLAY_UNARY(Log10)
+	      ADEPT_REPLAY_UNARY(Sin)
+	      ADEPT_REPLAY_UNARY(Cos)
+	      ADEPT_REPLAY_UNARY(Tan)
+	      ADEPT_REPLAY_UNARY(Asin)
+	      ADEPT_REPLAY_UNARY(Acos)
+	      ADEPT_REPLAY_UNARY(Atan)
+	      ADEPT_REPLAY_UNARY(Sinh)
+	      ADEPT_REPLAY_UNARY(Cosh)
+	      ADEPT_REPLAY_UNARY(Abs)
+	      ADEPT_REPLAY_UNARY(Fabs)
+	      ADEPT_REPLAY_UNARY(Exp)
+	      ADEPT_REPLAY_UNARY(Sqrt)
+	      ADEPT_REPLAY_UNARY(Tanh)
+	      ADEPT_REPLAY_UNARY(Ceil)
+	      ADEPT_REPLAY_UNARY(Floor)
+	      ADEPT_REPLAY_UNARY(Log2)
+	      ADEPT_REPLAY_UNARY(Expm1)
+	      ADEPT_REPLAY_UNARY(Exp2)
+	      ADEPT_REPLAY_UNARY(Log1p)
+	      ADEPT_REPLAY_UNARY(Asinh)
+	      ADEPT_REPLAY_UNARY(Acosh)
+	      ADEPT_REPLAY_UNARY(Atanh)
+	      ADEPT_REPLAY_UNARY(Erf)
+	      ADEPT_REPLAY_UNARY(Erfc)
+	      ADEPT_REPLAY_UNARY(Cbrt)
+	      ADEPT_REPLAY_UNARY(Round)
+	      ADEPT_REPLAY_UNARY(Trunc)
+	      ADEPT_REPLAY_UNARY(Rint)
+	      ADEPT_REPLAY_UNARY(Nearbyint)
+	      ADEPT_REPLAY_UNARY(UnaryPlus)
+	      ADEPT_REPLAY_UNARY(UnaryMinus)
+	      ADEPT_REPLAY_UNARY(Not)
+#undef ADEPT_REPLAY_UNARY
+	    }
+	    node_arg[2*k] = a;
+	    node_is_active[k] = node_is_active[a];
+	    node_use_arg[2*k] = node_is_active[a];
+	    if (node_is_active[a]) {
+	      const Real dd = replay_second_derivative(opcode, va, v, d);
+	      Real* dpt = &node_dpartial[2*k*nd];
+	      for (uIndex i = 0; i < nd; ++i) {
+		vt[i] = d*at[i];
+		dpt[i] = dd*at[i];
+	      }
+	    }
+	    else {
+	      for (uIndex i = 0; i < nd; ++i) {
+		vt[i] = 0.0;
+	      }
+	    }
+	    work[n_work-1] = n_node++;
+	  }
+	  else {
+	    // Binary operation: compute the value, the partial
+	    // derivatives "pa" and "pb" with respect to the active
+	    // arguments and their tangents "dpa" and "dpb"
+	    const uIndex b = work[--n_work];
+	    const uIndex a = work[n_work-1];
+	    const Real va = node_value[a];
+	    const Real vb = node_value[b];
+	    const Real* at = &node_tangent[a*nd];
+	    const Real* bt = &node_tangent[b*nd];
+	    char use_a = node_is_active[a];
+	    char use_b = node_is_active[b];
+	    Real& v = node_value[k];
+	    Real& pa = node_partial[2*k];
+	    Real& pb = node_partial[2*k+1];
+	    Real* dpa = &node_dpartial[2*k*nd];
+	    Real* dpb = &node_dpartial[(2*k+1)*nd];
+	    Real e;
+	    pa = 0.0;
+	    pb = 0.0;
+	    for (uIndex i = 0; i < nd; ++i) {
+	      dpa[i] = 0.0;
+	      dpb[i] = 0.0;
+	    }
+	    switch (opcode) {
+	    case REPLAY_Add:
+	      v = Add().operation(va, vb);
+	      pa = 1.0; pb = 1.0;
+	      break;
+	    case REPLAY_Subtract:
+	      v = Subtract().operation(va, vb);
+	      pa = 1.0; pb = -1.0;
+	      break;
+	    case REPLAY_Multiply:
+	      v = Multiply().operation(va, vb);
+	      pa = vb; pb = va;
+	      for (uIndex i = 0; i < nd; ++i) {
+		dpa[i] = bt[i];
+		dpb[i] = at[i];
+	      }
+	      break;
+	    case REPLAY_Divide:
+	      v = Divide().operation_store(va, vb, e);
+	      pa = e; pb = -v*e;
+	      for (uIndex i = 0; i < nd; ++i) {
+		dpa[i] = -bt[i]*e*e;
+		dpb[i] = (2.0*v*bt[i] - at[i])*e*e;
+	      }
+	      break;
+	    case REPLAY_Pow: {
+	      v = Pow().operation(va, vb);
+	      const Real pow_b_1 = use_a || use_b ? std::pow(va, vb - 1.0) : 0.0;
+	      const Real log_a = use_b ? std::log(va) : 0.0;
+	      if (use_a) {
+		pa = vb*pow_b_1;
+		const Real paa = vb*(vb - 1.0)*std::pow(va, vb - 2.0);
+		for (uIndex i = 0; i < nd; ++i) {
+		  dpa[i] = paa*at[i];
+		}
+	      }
+	      if (use_b) {
+		pb = v*log_a;
+		const Real pab = pow_b_1*(1.0 + vb*log_a);
+		for (uIndex i = 0; i < nd; ++i) {
+		  dpa[i] += pab*bt[i];
+		  dpb[i] = (pa*at[i] + pb*bt[i])*log_a + v*at[i]/va;
+		}
+	      }
+	      break;
+	    }
+	    case REPLAY_Atan2:
+	      v = Atan2().operation_store(va, vb, e);
+	      pa = vb*e; pb = -va*e;
+	      for (uIndex i = 0; i < nd; ++i) {
+		const Real de = -2.0*e*e*(va*at[i] + vb*bt[i]);
+		dpa[i] = bt[i]*e + vb*de;
+		dpb[i] = -at[i]*e - va*de;
+	      }
+	      break;
+	    case REPLAY_Max:
+	      v = Max().operation(va, vb);
+	      if (va > vb) { pa = 1.0; use_b = false; }
+	      else         { pb = 1.0; use_a = false; }
+	      break;
+	    case REPLAY_Min:
+	      v = Min().operation(va, vb);
+	      if (va <= vb) { pa = 1.0; use_b = false; }
+	      else          { pb = 1.0; use_a = false; }
+	      break;
+	    }
+	    for (uIndex i = 0; i < nd; ++i) {
+	      vt[i] = (use_a ? pa*at[i] : 0.0) + (use_b ? pb*bt[i] : 0.0);
+	    }
+	    node_arg[2*k]   = a;
+	    node_arg[2*k+1] = b;
+	    node_is_active[k] = node_is_active[a] || node_is_active[b];
+	    node_use_arg[2*k]   = use_a;
+	    node_use_arg[2*k+1] = use_b;
+	    work[n_work-1] = n_node++;
+	  }
+	  continue;
+	}
+
+	// End of a statement
+	const uIndex lhs = *p++;
+	const uIndex root = work[0];
+	value[lhs] = node_value[root];
+	if (opcode == REPLAY_ASSIGN) {
+	  for (uIndex i = 0; i < nd; ++i) {
+	    tangent[lhs*nd+i] = node_tangent[root*nd+i];
+	  }
+	  // Propagate the multipliers and their tangents from the root
+	  // of the tree to the variables
+	  n_work = 0;
+	  if (node_is_active[root]) {
+	    work[0] = root;
+	    work_multiplier[0] = 1.0;
+	    for (uIndex i = 0; i < nd; ++i) {
+	      work_dmultiplier[i] = 0.0;
+	    }
+	    n_work = 1;
+	  }
+	  while (n_work > 0) {
+	    --n_work;
+	    const uIndex j = work[n_work];
+	    const Real m = work_multiplier[n_work];
+	    const uIndex op = node_opcode[j];
+	    if (op == REPLAY_VARIABLE) {
+	      op_index.push_back(node_arg[2*j]);
+	      op_multiplier.push_back(m);
+	      op_dmultiplier.insert(op_dmultiplier.end(),
+				    work_dmultiplier.begin() + n_work*nd,
+				    work_dmultiplier.begin() + (n_work+1)*nd);
+	      continue;
+	    }
+	    // The multiplier of each argument is the product of m and
+	    // the partial derivative, whose tangent follows from the
+	    // product rule. The arguments replace node j on the work
+	    // stack with the first on top, so that it is visited first;
+	    // if there are two, the tangents of m are first copied to
+	    // the upper slot since they are updated in place.
+	    const uIndex n_arg = (op < REPLAY_Add) ? 1 : 2;
+	    const uIndex n_push = (node_use_arg[2*j] ? 1 : 0)
+	      + (n_arg == 2 && node_use_arg[2*j+1] ? 1 : 0);
+	    uIndex slot[2] = { n_work, n_work };
+	    if (n_push == 2) {
+	      slot[0] = n_work+1;
+	      for (uIndex i = 0; i < nd; ++i) {
+		work_dmultiplier[(n_work+1)*nd+i] = work_dmultiplier[n_work*nd+i];
+	      }
+	    }
+	    for (uIndex iarg = 0; iarg < n_arg; ++iarg) {
+	      if (!node_use_arg[2*j+iarg]) {
+		continue;
+	      }
+	      const Real partial = node_partial[2*j+iarg];
+	      const Real* dpartial = &node_dpartial[(2*j+iarg)*nd];
+	      const uIndex s = slot[iarg];
+	      Real* dm = &work_dmultiplier[s*nd];
+	      for (uIndex i = 0; i < nd; ++i) {
+		dm[i] = dm[i]*partial + m*dpartial[i];
+	      }
+	      work[s] = node_arg[2*j+iarg];
+	      work_multiplier[s] = m*partial;
+	    }
+	    n_work += n_push;
+	  }
+	  st_lhs.push_back(lhs);
+	  st_end.push_back(op_index.size());
+	}
+	n_node = 0;
+	n_work = 0;
+      }
+
+      // Reverse pass computing the adjoints and their tangents
+      std::vector<Real> adjoint(max_gradient, 0.0);
+      std::vector<Real> dadjoint(static_cast<std::size_t>(max_gradient)*nd, 0.0);
+      std::vector<Real> da(nd);
+      for (std::size_t i = 0; i < dependent_index.size(); ++i) {
+	adjoint[dependent_index[i]] += dependent_weight ? dependent_weight[i] : 1.0;
+      }
+      for (std::size_t ist = st_lhs.size(); ist > 0; --ist) {
+	const uIndex lhs = st_lhs[ist-1];
+	const Real a = adjoint[lhs];
+	adjoint[lhs] = 0.0;
+	bool is_zero = (a == 0.0);
+	for (uIndex i = 0; i < nd; ++i) {
+	  da[i] = dadjoint[lhs*nd+i];
+	  dadjoint[lhs*nd+i] = 0.0;
+	  if (da[i] != 0.0) {
+	    is_zero = false;
+	  }
+	}
+	if (is_zero) {
+	  continue;
+	}
+	for (uIndex iop = ist > 1 ? st_end[ist-2] : 0; iop < st_end[ist-1]; ++iop) {
+	  const uIndex index = op_index[iop];
+	  const Real m = op_multiplier[iop];
+	  const Real* dm = &op_dmultiplier[static_cast<std::size_t>(iop)*nd];
+	  adjoint[index] += m*a;
+	  for (uIndex i = 0; i < nd; ++i) {
+	    dadjoint[index*nd+i] += m*da[i] + dm[i]*a;
+	  }
+	}
+      }
+      for (std::size_t j = 0; j < independent_index.size(); ++j) {
+	for (uIndex i = 0; i < nd; ++i) {
+	  product[j*nd+i] = dadjoint[independent_index[j]*nd+i];
+	}
+      }
+    }
+
+  } // End namespace internal
+} // End namespace adept
@@ -0,0 +1,140 @@
+/* SinglePrecisionStack.cpp -- Reduced-precision copy of the operation stack
+
+    Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   The storage is described in SinglePrecisionStack.h.
+
+*/
+
+#include <limits>
+
+#include <adept/SinglePrecisionStack.h>
+
+namespace adept {
+  namespace internal {
+
+    // Remove any existing copy, retaining the memory for the next one
+    void
+    SinglePrecisionStack::clear(uIndex max_gradient)
+    {
+      statement_.clear();
+      multiplier_.clear();
+      short_index_.clear();
+      index_.clear();
+      n_statements_ = 0;
+      n_operations_ = 0;
+      is_short_index_ = sizeof(uIndex) <= sizeof(unsigned int)
+	|| max_gradient <= static_cast<uIndex>(std::numeric_limits<unsigned int>::max());
+    }
+
+    // Copy the statements and operations of one block of a recording
+    void
+    SinglePrecisionStack::push_block(const StackBlock& block)
+    {
+      if (statement_.empty()) {
+	// Insert a null statement
+	statement_.push_back(Statement(-1, 0));
+      }
+      const uIndex offset = multiplier_.size();
+      const uIndex n_operations = block.statement[block.n_statements-1].end_plus_one;
+      for (uIndex i = block.statement[0].end_plus_one; i < n_operations; i++) {
+	multiplier_.push_back(static_cast<float>(block.multiplier[i]));
+	if (is_short_index_) {
+	  short_index_.push_back(static_cast<unsigned int>(block.index[i]));
+	}
+	else {
+	  index_.push_back(block.index[i]);
+	}
+      }
+      const uIndex start = offset - block.statement[0].end_plus_one;
+      for (uIndex ist = 1; ist < block.n_statements; ist++) {
+	statement_.push_back(Statement(block.statement[ist].index,
+				       start + block.statement[ist].end_plus_one));
+      }
+    }
+
+    // Perform adjoint computation (reverse mode)
+    void
+    SinglePrecisionStack::reverse(Real* __restrict gradient) const
+    {
+      if (statement_.empty() || multiplier_.empty()) {
+	// Without operations the adjoint simply zeros the gradients
+	// of the left-hand sides
+	for (std::size_t ist = statement_.size(); ist > 1; ist--) {
+	  gradient[statement_[ist-1].index] = 0.0;
+	}
+      }
+      else if (is_short_index_) {
+	reverse_(&short_index_[0], gradient);
+      }
+      else {
+	reverse_(&index_[0], gradient);
+      }
+    }
+
+    // Perform tangent-linear computation (forward mode)
+    void
+    SinglePrecisionStack::forward(Real* __restrict gradient) const
+    {
+      if (statement_.empty() || multiplier_.empty()) {
+	for (std::size_t ist = 1; ist < statement_.size(); ist++) {
+	  gradient[statement_[ist].index] = 0.0;
+	}
+      }
+      else if (is_short_index_) {
+	forward_(&short_index_[0], gradient);
+      }
+      else {
+	forward_(&index_[0], gradient);
+      }
+    }
+
+    // The kernels are as in Stack::compute_adjoint and
+    // Stack::compute_tangent_linear, except that each multiplier is
+    // converted from single precision as it is read
+    template <typename IndexType>
+    void
+    SinglePrecisionStack::reverse_(const IndexType* __restrict index,
+				   Real* __restrict gradient) const
+    {
+      const Statement* __restrict statement_list = &statement_[0];
+      const float* __restrict multiplier = &multiplier_[0];
+      for (uIndex ist = static_cast<uIndex>(statement_.size())-1; ist > 0;
+	   ist--) {
+	const Statement& statement = statement_list[ist];
+	Real a = gradient[statement.index];
+	gradient[statement.index] = 0.0;
+	if (a != 0.0) {
+	  for (uIndex i = statement_list[ist-1].end_plus_one;
+	       i < statement.end_plus_one; i++) {
+	    gradient[index[i]] += static_cast<Real>(multiplier[i])*a;
+	  }
+	}
+      }
+    }
+
+    template <typename IndexType>
+    void
+    SinglePrecisionStack::forward_(const IndexType* __restrict index,
+				   Real* __restrict gradient) const
+    {
+      const Statement* __restrict statement_list = &statement_[0];
+      const float* __restrict multiplier = &multiplier_[0];
+      for (uIndex ist = 1; ist < static_cast<uIndex>(statement_.size());
+	   ist++) {
+	const Statement& statement = statement_list[ist];
+	Real a = 0.0;
+	for (uIndex i = statement_list[ist-1].end_plus_one;
+	     i < statement.end_plus_one; i++) {
+	  a += static_cast<Real>(multiplier[i])*gradient[index[i]];
+	}
+	gradient[statement.index] = a;
+      }
+    }
+
+  }
+}
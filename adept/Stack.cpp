@@ -12,6 +12,7 @@
 
 #include <iostream>
 #include <cstring> // For memcpy
+#include <algorithm>
 
 
 #ifdef _OPENMP
@@ -19,6 +20,7 @@
 #endif
 
 #include <adept/Stack.h>
+#include <adept/Packet.h>
 
 
 namespace adept {
@@ -46,10 +48,11 @@ namespace adept {
       _stack_current_thread = 0; 
     }
 #ifndef ADEPT_STACK_STORAGE_STL
-    if (gradient_) {
-      delete[] gradient_;
-    }
+    free_with_policy(gradient_);
 #endif
+    if (gradient_directions_) {
+      free_aligned(gradient_directions_);
+    }
   }
   
   // Make this stack "active" by copying its "this" pointer to a
@@ -114,6 +117,29 @@ namespace adept {
   }
 
 
+  // Set the allocation policy and reallocate the recording and
+  // gradient list accordingly
+  void
+  Stack::set_allocation_policy(int policy)
+  {
+    check_allocation_policy(policy);
+    allocation_policy_ = policy;
+    reallocate_stack();
+#ifndef ADEPT_STACK_STORAGE_STL
+    if (gradient_) {
+      Real* new_gradient = allocate_array<Real>(n_allocated_gradients_,
+						allocation_policy_);
+      if (gradients_initialized_) {
+	std::memcpy(new_gradient, gradient_,
+		    n_allocated_gradients_*sizeof(Real));
+      }
+      free_with_policy(gradient_);
+      gradient_ = new_gradient;
+    }
+#endif
+  }
+
+
   // Return maximum number of OpenMP threads to be used in Jacobian
   // calculation
   int 
@@ -140,22 +166,54 @@ namespace adept {
   Stack::compute_adjoint()
   {
     if (gradients_are_initialized()) {
-      // Loop backwards through the derivative statements
-      for (uIndex ist = n_statements_-1; ist > 0; ist--) {
-	const Statement& statement = statement_[ist];
-	// We copy the RHS gradient (LHS in the original derivative
-	// statement but swapped in the adjoint equivalent) to "a" in
-	// case it appears on the LHS in any of the following statements
-	Real a = gradient_[statement.index];
-	gradient_[statement.index] = 0.0;
-	// By only looping if a is non-zero we gain a significant speed-up
-	if (a != 0.0) {
-	  // Loop over operations
-	  for (uIndex i = statement_[ist-1].end_plus_one;
-	       i < statement.end_plus_one; i++) {
-	    gradient_[index_[i]] += multiplier_[i]*a;
+      if (!matrix_node_.empty()) {
+	// Interleave the statements with the matrix nodes
+	compute_adjoint(StackPosition(), get_position());
+	return;
+      }
+      if (adjoint_is_parallelized() && max_jacobian_threads() > 1) {
+	parallel_adjoint_.reverse(gradient_);
+	return;
+      }
+      if (recording_is_single_precision()) {
+	single_precision_stack_.reverse(gradient_);
+	return;
+      }
+      if (recording_is_compressed()) {
+	compressed_stack_.reverse(gradient_);
+	return;
+      }
+      // Loop backwards through the blocks of the stack (of which
+      // there is only one unless ADEPT_STACK_STORAGE_BLOCKS is
+      // defined)
+      for (uIndex iblock = n_stack_blocks(); iblock > 0; iblock--) {
+	// If the block to be processed next has been spilled to disk
+	// then start reading it now
+	if (iblock > 1) {
+	  prefetch_stack_block(iblock-2);
+	}
+	const StackBlock block = stack_block(iblock-1);
+	const Statement* __restrict statement_list = block.statement;
+	const Real*      __restrict multiplier = block.multiplier;
+	const uIndex*    __restrict index = block.index;
+	// Loop backwards through the derivative statements
+	for (uIndex ist = block.n_statements-1; ist > 0; ist--) {
+	  const Statement& statement = statement_list[ist];
+	  // We copy the RHS gradient (LHS in the original derivative
+	  // statement but swapped in the adjoint equivalent) to "a" in
+	  // case it appears on the LHS in any of the following statements
+	  Real a = gradient_[statement.index];
+	  gradient_[statement.index] = 0.0;
+	  // By only looping if a is non-zero we gain a significant speed-up
+	  if (a != 0.0) {
+	    // Loop over operations
+	    for (uIndex i = statement_list[ist-1].end_plus_one;
+		 i < statement.end_plus_one; i++) {
+	      gradient_[index[i]] += multiplier[i]*a;
+	    }
 	  }
 	}
+	release_stack_block(iblock-1);
       }
     }  
     else {
@@ -171,17 +229,40 @@ namespace adept {
   Stack::compute_tangent_linear()
   {
     if (gradients_are_initialized()) {
-      // Loop forward through the statements
-      for (uIndex ist = 1; ist < n_statements_; ist++) {
-	const Statement& statement = statement_[ist];
-	// We copy the LHS to "a" in case it appears on the RHS in any
-	// of the following statements
-	Real a = 0.0;
-	for (uIndex i = statement_[ist-1].end_plus_one;
-	     i < statement.end_plus_one; i++) {
-	  a += multiplier_[i]*gradient_[index_[i]];
+      if (!matrix_node_.empty()) {
+	compute_tangent_linear(StackPosition(), get_position());
+	return;
+      }
+      if (recording_is_single_precision()) {
+	single_precision_stack_.forward(gradient_);
+	return;
+      }
+      if (recording_is_compressed()) {
+	compressed_stack_.forward(gradient_);
+	return;
+      }
+      // Loop forward through the blocks of the stack
+      for (uIndex iblock = 0; iblock < n_stack_blocks(); iblock++) {
+	if (iblock+1 < n_stack_blocks()) {
+	  prefetch_stack_block(iblock+1);
 	}
-	gradient_[statement.index] = a;
+	const StackBlock block = stack_block(iblock);
+	const Statement* __restrict statement_list = block.statement;
+	const Real*      __restrict multiplier = block.multiplier;
+	const uIndex*    __restrict index = block.index;
+	// Loop forward through the statements
+	for (uIndex ist = 1; ist < block.n_statements; ist++) {
+	  const Statement& statement = statement_list[ist];
+	  // We copy the LHS to "a" in case it appears on the RHS in any
+	  // of the following statements
+	  Real a = 0.0;
+	  for (uIndex i = statement_list[ist-1].end_plus_one;
+	       i < statement.end_plus_one; i++) {
+	    a += multiplier[i]*gradient_[index[i]];
+	  }
+	  gradient_[statement.index] = a;
+	}
+	release_stack_block(iblock);
       }
     }
     else {
@@ -190,35 +271,699 @@ namespace adept {
   }
 
 
+  // Check that "start" and "end" describe a range of the current
+  // recording
+  void
+  Stack::check_position_range(const StackPosition& start,
+			      const StackPosition& end) const
+  {
+    if (start.n_statements < 1 || start.n_statements > end.n_statements
+	|| start.n_operations > end.n_operations
+	|| start.n_matrix_nodes > end.n_matrix_nodes) {
+      throw invalid_operation("Start position is after end position in tangent-linear or adjoint of part of a recording"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+    if (end.n_statements > n_statements()
+	|| end.n_operations > n_operations()
+	|| end.n_matrix_nodes > n_matrix_nodes()) {
+      throw invalid_operation("End position is beyond the end of the recording in tangent-linear or adjoint of part of a recording"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+  }
+
+
+  // Perform tangent linear computation between two positions in the
+  // recording, processing each matrix node after the statements
+  // recorded before it
+  void
+  Stack::compute_tangent_linear(const StackPosition& start,
+				const StackPosition& end)
+  {
+    check_position_range(start, end);
+    if (!gradients_are_initialized()) {
+      throw(gradients_not_initialized());
+    }
+    uIndex first_statement = start.n_statements;
+    for (uIndex inode = start.n_matrix_nodes; inode < end.n_matrix_nodes;
+	 inode++) {
+      const MatrixNode& node = matrix_node_[inode];
+      forward_statements(first_statement, node.position());
+      node.forward(gradient_, 1);
+      first_statement = node.position();
+    }
+    forward_statements(first_statement, end.n_statements);
+  }
+
+
+  // Perform adjoint computation between two positions in the
+  // recording, processing the matrix nodes in reverse order
+  void
+  Stack::compute_adjoint(const StackPosition& start,
+			 const StackPosition& end)
+  {
+    check_position_range(start, end);
+    if (!gradients_are_initialized()) {
+      throw(gradients_not_initialized());
+    }
+    uIndex end_statement = end.n_statements;
+    for (uIndex inode = end.n_matrix_nodes; inode > start.n_matrix_nodes;
+	 inode--) {
+      const MatrixNode& node = matrix_node_[inode-1];
+      reverse_statements(node.position(), end_statement);
+      node.reverse(gradient_, 1);
+      end_statement = node.position();
+    }
+    reverse_statements(start.n_statements, end_statement);
+  }
+
+
+  // Perform tangent linear computation on a range of statements.
+  // Statement ist of a block is statement first+ist of the
+  // recording, where first is the number of statements in the
+  // previous blocks excluding their null statements.
+  void
+  Stack::forward_statements(uIndex first_statement, uIndex end_statement)
+  {
+    uIndex first = 0;
+    for (uIndex iblock = 0; iblock < n_stack_blocks()
+	   && first+1 < end_statement; iblock++) {
+      const StackBlock block = stack_block(iblock);
+      if (first + block.n_statements > first_statement) {
+	if (iblock+1 < n_stack_blocks()
+	    && first + block.n_statements < end_statement) {
+	  prefetch_stack_block(iblock+1);
+	}
+	const Statement* __restrict statement_list = block.statement;
+	const Real*      __restrict multiplier = block.multiplier;
+	const uIndex*    __restrict index = block.index;
+	uIndex ist_begin = first_statement > first+1
+	  ? first_statement - first : 1;
+	uIndex ist_end = std::min(end_statement - first, block.n_statements);
+	for (uIndex ist = ist_begin; ist < ist_end; ist++) {
+	  const Statement& statement = statement_list[ist];
+	  Real a = 0.0;
+	  for (uIndex i = statement_list[ist-1].end_plus_one;
+	       i < statement.end_plus_one; i++) {
+	    a += multiplier[i]*gradient_[index[i]];
+	  }
+	  gradient_[statement.index] = a;
+	}
+	release_stack_block(iblock);
+      }
+      first += block.n_statements - 1;
+    }
+  }
+
+
+  // Perform adjoint computation on a range of statements, looping
+  // backwards through the blocks and numbering the statements as in
+  // forward_statements above
+  void
+  Stack::reverse_statements(uIndex first_statement, uIndex end_statement)
+  {
+    uIndex first = n_statements();
+    for (uIndex iblock = n_stack_blocks(); iblock > 0
+	   && first > first_statement; iblock--) {
+      const StackBlock block = stack_block(iblock-1);
+      first -= block.n_statements - 1;
+      if (first < end_statement) {
+	if (iblock > 1 && first > first_statement) {
+	  prefetch_stack_block(iblock-2);
+	}
+	const Statement* __restrict statement_list = block.statement;
+	const Real*      __restrict multiplier = block.multiplier;
+	const uIndex*    __restrict index = block.index;
+	// Global statement number of local statement ist is first-1+ist
+	uIndex ist_end = first_statement > first
+	  ? first_statement - first + 1 : 1;
+	uIndex ist = std::min(end_statement - first + 1, block.n_statements);
+	for (ist--; ist >= ist_end; ist--) {
+	  const Statement& statement = statement_list[ist];
+	  Real a = gradient_[statement.index];
+	  gradient_[statement.index] = 0.0;
+	  if (a != 0.0) {
+	    for (uIndex i = statement_list[ist-1].end_plus_one;
+		 i < statement.end_plus_one; i++) {
+	      gradient_[index[i]] += multiplier[i]*a;
+	    }
+	  }
+	}
+	release_stack_block(iblock-1);
+      }
+    }
+  }
+
+
+  // Discard the statements and matrix nodes recorded after a position
+  void
+  Stack::rewind(const StackPosition& position)
+  {
+    if (position.n_statements < 1 || position.n_statements > n_statements()
+	|| position.n_operations > n_operations()
+	|| position.n_matrix_nodes > n_matrix_nodes()) {
+      throw invalid_operation("Stack::rewind() called with a position beyond the end of the recording"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+    if (is_preaccumulating_ && position.n_statements < preaccumulation_statement_) {
+      throw invalid_operation("Stack::rewind() cannot rewind to before the start of a preaccumulation region"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+    if (!gradient_index_map_.empty()) {
+      throw invalid_operation("Stack::rewind() cannot be applied to a recording renumbered by Stack::renumber_gradients()"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+    if (position.n_statements == n_statements()
+	&& position.n_matrix_nodes == n_matrix_nodes()) {
+      return;
+    }
+    rewind_stack(position.n_statements, position.n_operations);
+    matrix_node_.resize(position.n_matrix_nodes);
+    // Active variables created after "position" that still exist
+    // need their gradients to be stored
+    max_gradient_ = std::max(position.max_gradient, i_gradient_);
+
+    // The recording now differs from the one that enable_replay()
+    // stored, and from any compressed, single-precision or sorted
+    // copy
+    if (is_replay_enabled()) {
+      replay_stack_.push_unsupported();
+    }
+    compressed_stack_.clear();
+    single_precision_stack_.clear();
+    parallel_adjoint_.clear();
+  }
+
+
+  // Add a matrix node to the end of the recording
+  void
+  Stack::push_matrix_node(MatrixNode* node)
+  {
+    matrix_node_.push_back(node, n_statements());
+    // The statements alone no longer describe the recording, so it
+    // cannot be replayed, and any compressed or other copy of it is
+    // out of date
+    if (is_replay_enabled()) {
+      replay_stack_.push_unsupported();
+    }
+    compressed_stack_.clear();
+    single_precision_stack_.clear();
+    parallel_adjoint_.clear();
+  }
+
+
+  // Throw an exception if the recording contains matrix nodes
+  void
+  Stack::check_no_matrix_nodes(const char* function) const
+  {
+    if (!matrix_node_.empty()) {
+      throw feature_not_available(std::string(function)
+	  + " cannot process a recording containing matrix nodes: call Stack::disable_matrix_nodes() before recording"
+	  ADEPT_EXCEPTION_LOCATION);
+    }
+  }
+
+
+
+  // Perform adjoint computation (reverse mode) on the gradients in
+  // n_directions directions, which must have been loaded with
+  // set_gradient_directions
+  void
+  Stack::compute_adjoint(uIndex n_directions)
+  {
+    if (n_gradient_directions_ == 0) {
+      throw(gradients_not_initialized());
+    }
+    if (n_directions != n_gradient_directions_) {
+      throw invalid_operation("Number of directions passed to compute_adjoint differs from that of existing gradients"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+    reverse_kernel_directions(gradient_directions_, gradient_direction_stride_);
+  }
+
+
+  // Perform tangent linear computation (forward mode) on the
+  // gradients in n_directions directions, which must have been
+  // loaded with set_gradient_directions
+  void
+  Stack::compute_tangent_linear(uIndex n_directions)
+  {
+    if (n_gradient_directions_ == 0) {
+      throw(gradients_not_initialized());
+    }
+    if (n_directions != n_gradient_directions_) {
+      throw invalid_operation("Number of directions passed to compute_tangent_linear differs from that of existing gradients"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+    forward_kernel_directions(gradient_directions_, gradient_direction_stride_);
+  }
+
+
+  // Adjoint computation on a gradient list in which the gradients
+  // of each variable occupy "stride" contiguous elements, where
+  // stride is a multiple of the packet size and the list is
+  // suitably aligned, so that each operation is applied to all
+  // directions using vector instructions
+  void
+  Stack::reverse_kernel_directions(Real* gradient, uIndex stride) const
+  {
+    uIndex end_statement = n_statements();
+    for (uIndex inode = matrix_node_.size(); inode > 0; inode--) {
+      const MatrixNode& node = matrix_node_[inode-1];
+      reverse_statements_directions(gradient, stride,
+				    node.position(), end_statement);
+      node.reverse(gradient, stride);
+      end_statement = node.position();
+    }
+    reverse_statements_directions(gradient, stride, 1, end_statement);
+  }
+
+
+  // Tangent-linear computation on a gradient list with the same
+  // layout as for reverse_kernel_directions
+  void
+  Stack::forward_kernel_directions(Real* gradient, uIndex stride) const
+  {
+    uIndex first_statement = 1;
+    for (std::size_t inode = 0; inode < matrix_node_.size(); inode++) {
+      const MatrixNode& node = matrix_node_[inode];
+      forward_statements_directions(gradient, stride,
+				    first_statement, node.position());
+      node.forward(gradient, stride);
+      first_statement = node.position();
+    }
+    forward_statements_directions(gradient, stride,
+				  first_statement, n_statements());
+  }
+
+
+  // Adjoint computation on a range of statements of a gradient list
+  // with the layout described above, numbering the statements as in
+  // reverse_statements
+  void
+  Stack::reverse_statements_directions(Real* gradient, uIndex stride,
+				       uIndex first_statement,
+				       uIndex end_statement) const
+  {
+    // Gradients of the left-hand side of the current statement
+    Real* __restrict a = alloc_aligned<Real>(stride);
+    uIndex first = n_statements();
+    for (uIndex iblock = n_stack_blocks(); iblock > 0
+	   && first > first_statement; iblock--) {
+      const StackBlock block = stack_block(iblock-1);
+      first -= block.n_statements - 1;
+      if (first >= end_statement) {
+	continue;
+      }
+      if (iblock > 1 && first > first_statement) {
+	prefetch_stack_block(iblock-2);
+      }
+      const Statement* __restrict statement_list = block.statement;
+      const Real*      __restrict multiplier = block.multiplier;
+      const uIndex*    __restrict index = block.index;
+      uIndex ist_end = first_statement > first
+	? first_statement - first + 1 : 1;
+      uIndex ist = std::min(end_statement - first + 1, block.n_statements);
+      for (ist--; ist >= ist_end; ist--) {
+	const Statement& statement = statement_list[ist];
+	Real* lhs = gradient
+	  + static_cast<std::size_t>(statement.index)*stride;
+	bool is_zero = true;
+	for (uIndex j = 0; j < stride; j++) {
+	  a[j] = lhs[j];
+	  lhs[j] = 0.0;
+	  if (a[j] != 0.0) {
+	    is_zero = false;
+	  }
+	}
+	// As in the single-direction case, only loop over the
+	// operations if any of the directions is non-zero
+	if (!is_zero) {
+	  for (uIndex i = statement_list[ist-1].end_plus_one;
+	       i < statement.end_plus_one; i++) {
+	    Real* rhs = gradient
+	      + static_cast<std::size_t>(index[i])*stride;
+#if ADEPT_REAL_PACKET_SIZE > 1
+	    Packet<Real> m(multiplier[i]);
+	    for (uIndex j = 0; j < stride; j += Packet<Real>::size) {
+	      Packet<Real> g(rhs+j);
+	      g += m * Packet<Real>(a+j);
+	      g.put(rhs+j);
+	    }
+#else
+	    for (uIndex j = 0; j < stride; j++) {
+	      rhs[j] += multiplier[i]*a[j];
+	    }
+#endif
+	  }
+	}
+      }
+      release_stack_block(iblock-1);
+    }
+    free_aligned(a);
+  }
+
+
+  // Tangent-linear computation on a range of statements of a
+  // gradient list with the layout described above, numbering the
+  // statements as in forward_statements
+  void
+  Stack::forward_statements_directions(Real* gradient, uIndex stride,
+				       uIndex first_statement,
+				       uIndex end_statement) const
+  {
+    // We accumulate the left-hand side in "a" in case it appears on
+    // the right-hand side
+    Real* __restrict a = alloc_aligned<Real>(stride);
+    uIndex first = 0;
+    for (uIndex iblock = 0; iblock < n_stack_blocks()
+	   && first+1 < end_statement; iblock++) {
+      const StackBlock block = stack_block(iblock);
+      uIndex block_first = first;
+      first += block.n_statements - 1;
+      if (block_first + block.n_statements <= first_statement) {
+	continue;
+      }
+      if (iblock+1 < n_stack_blocks()
+	  && block_first + block.n_statements < end_statement) {
+	prefetch_stack_block(iblock+1);
+      }
+      const Statement* __restrict statement_list = block.statement;
+      const Real*      __restrict multiplier = block.multiplier;
+      const uIndex*    __restrict index = block.index;
+      uIndex ist_begin = first_statement > block_first+1
+	? first_statement - block_first : 1;
+      uIndex ist_end = std::min(end_statement - block_first,
+				block.n_statements);
+      for (uIndex ist = ist_begin; ist < ist_end; ist++) {
+	const Statement& statement = statement_list[ist];
+	for (uIndex j = 0; j < stride; j++) {
+	  a[j] = 0.0;
+	}
+	for (uIndex i = statement_list[ist-1].end_plus_one;
+	     i < statement.end_plus_one; i++) {
+	  const Real* rhs = gradient
+	    + static_cast<std::size_t>(index[i])*stride;
+#if ADEPT_REAL_PACKET_SIZE > 1
+	  Packet<Real> m(multiplier[i]);
+	  for (uIndex j = 0; j < stride; j += Packet<Real>::size) {
+	    Packet<Real> g(a+j);
+	    g += m * Packet<Real>(rhs+j);
+	    g.put(a+j);
+	  }
+#else
+	  for (uIndex j = 0; j < stride; j++) {
+	    a[j] += multiplier[i]*rhs[j];
+	  }
+#endif
+	}
+	Real* lhs = gradient
+	  + static_cast<std::size_t>(statement.index)*stride;
+	for (uIndex j = 0; j < stride; j++) {
+	  lhs[j] = a[j];
+	}
+      }
+      release_stack_block(iblock);
+    }
+    free_aligned(a);
+  }
+
+
+  // Encode the current recording in compressed form for use by
+  // subsequent calls to compute_adjoint and compute_tangent_linear
+  void
+  Stack::compress_recording()
+  {
+    check_no_matrix_nodes("Stack::compress_recording()");
+    compressed_stack_.clear();
+    for (uIndex iblock = 0; iblock < n_stack_blocks(); iblock++) {
+      compressed_stack_.push_block(stack_block(iblock));
+    }
+    compressed_stack_.finish(n_statements(), n_operations());
+    single_precision_stack_.clear();
+  }
+
+
+  // Copy the current recording with multipliers in single precision
+  // for use by subsequent calls to compute_adjoint and
+  // compute_tangent_linear
+  void
+  Stack::store_single_precision_recording()
+  {
+    check_no_matrix_nodes("Stack::store_single_precision_recording()");
+    single_precision_stack_.clear(max_gradient_);
+    for (uIndex iblock = 0; iblock < n_stack_blocks(); iblock++) {
+      single_precision_stack_.push_block(stack_block(iblock));
+    }
+    single_precision_stack_.finish(n_statements(), n_operations());
+    compressed_stack_.clear();
+  }
+
+
+  // Compare adjoints computed from the single-precision and
+  // full-precision recordings
+  Real
+  Stack::single_precision_error() const
+  {
+    if (!recording_is_single_precision()) {
+      throw invalid_operation("Stack::single_precision_error() called without a current single-precision recording"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+    if (independent_index_.empty() || dependent_index_.empty()) {
+      throw dependents_or_independents_not_identified("Independent and dependent variables must be identified before Stack::single_precision_error()"
+						      ADEPT_EXCEPTION_LOCATION);
+    }
+    std::vector<Real> gradient(max_gradient_, 0.0);
+    std::vector<Real> gradient_single(max_gradient_, 0.0);
+    for (std::size_t i = 0; i < dependent_index_.size(); ++i) {
+      gradient[dependent_index_[i]] = 1.0;
+      gradient_single[dependent_index_[i]] = 1.0;
+    }
+    single_precision_stack_.reverse(&gradient_single[0]);
+    // Full-precision adjoint, as in compute_adjoint()
+    for (uIndex iblock = n_stack_blocks(); iblock > 0; iblock--) {
+      const StackBlock block = stack_block(iblock-1);
+      for (uIndex ist = block.n_statements-1; ist > 0; ist--) {
+	const Statement& statement = block.statement[ist];
+	Real a = gradient[statement.index];
+	gradient[statement.index] = 0.0;
+	if (a != 0.0) {
+	  for (uIndex i = block.statement[ist-1].end_plus_one;
+	       i < statement.end_plus_one; i++) {
+	    gradient[block.index[i]] += block.multiplier[i]*a;
+	  }
+	}
+      }
+    }
+    Real max_error = 0.0;
+    Real max_gradient = 0.0;
+    for (std::size_t i = 0; i < independent_index_.size(); ++i) {
+      const uIndex index = independent_index_[i];
+      max_error = std::max(max_error,
+			   std::fabs(gradient_single[index] - gradient[index]));
+      max_gradient = std::max(max_gradient, std::fabs(gradient[index]));
+    }
+    if (max_gradient > 0.0) {
+      return max_error / max_gradient;
+    }
+    else {
+      return max_error;
+    }
+  }
+
+
+  // Sort the statements of the current recording into levels for
+  // use by compute_adjoint(), in two passes through the recording
+  void
+  Stack::parallelize_adjoint()
+  {
+    check_no_matrix_nodes("Stack::parallelize_adjoint()");
+    parallel_adjoint_.start_levels(max_gradient_);
+    for (uIndex iblock = 0; iblock < n_stack_blocks(); iblock++) {
+      parallel_adjoint_.compute_levels(stack_block(iblock));
+    }
+    parallel_adjoint_.start_sort();
+    for (uIndex iblock = 0; iblock < n_stack_blocks(); iblock++) {
+      parallel_adjoint_.push_block(stack_block(iblock));
+    }
+    parallel_adjoint_.finish(n_statements(), n_operations(),
+			     max_jacobian_threads());
+  }
+
+
+  // Make a new recording at new values of the independent variables
+  // by interpreting the operations stored following enable_replay()
+  void
+  Stack::replay(const Real* x, Real* y)
+  {
+    if (!recording_is_replayable()) {
+      throw recording_not_replayable("Stack::replay() called for a recording that was not made after calling Stack::enable_replay(), or that contains statements that cannot be replayed"
+				     ADEPT_EXCEPTION_LOCATION);
+    }
+    std::vector<Real> value(max_gradient_);
+    // Start a new recording, retaining the independent and dependent
+    // variables and the stored operations
+    clear_stack();
+    compressed_stack_.clear();
+    single_precision_stack_.clear();
+    parallel_adjoint_.clear();
+    clear_gradients();
+    push_lhs(-1);
+    replay_stack_.replay(*this, independent_index_, x, &value[0]);
+    if (y) {
+      for (std::size_t i = 0; i < dependent_index_.size(); ++i) {
+	y[i] = value[dependent_index_[i]];
+      }
+    }
+  }
+
+  // Compute a Hessian-vector product by forward-over-reverse
+  // differentiation of the operations stored following
+  // enable_replay()
+  void
+  Stack::hessian_vector_product(const Real* direction, Real* product,
+				const Real* dependent_weight)
+  {
+    if (independent_index_.empty() || dependent_index_.empty()) {
+      throw(dependents_or_independents_not_identified());
+    }
+    if (!recording_is_replayable()) {
+      throw recording_not_replayable("Stack::hessian_vector_product() called for a recording that was not made after calling Stack::enable_replay(), or that contains statements that cannot be replayed"
+				     ADEPT_EXCEPTION_LOCATION);
+    }
+    replay_stack_.hessian_product(max_gradient_, independent_index_,
+				  dependent_index_, dependent_weight,
+				  1, direction, product);
+  }
+
+
+  // Compute the Hessian matrix, processing HESSIAN_BLOCK_SIZE
+  // columns at a time
+  void
+  Stack::hessian(Real* hessian_out, const Real* dependent_weight)
+  {
+    if (independent_index_.empty() || dependent_index_.empty()) {
+      throw(dependents_or_independents_not_identified());
+    }
+    if (!recording_is_replayable()) {
+      throw recording_not_replayable("Stack::hessian() called for a recording that was not made after calling Stack::enable_replay(), or that contains statements that cannot be replayed"
+				     ADEPT_EXCEPTION_LOCATION);
+    }
+    static const uIndex HESSIAN_BLOCK_SIZE = 16;
+    const uIndex n = n_independent();
+    const uIndex block_size = std::min(n, HESSIAN_BLOCK_SIZE);
+    std::vector<Real> direction(n*block_size), product(n*block_size);
+    for (uIndex first = 0; first < n; first += block_size) {
+      const uIndex n_block = std::min(block_size, n - first);
+      // Each direction has one non-zero entry of 1.0
+      direction.assign(n*n_block, 0.0);
+      for (uIndex i = 0; i < n_block; i++) {
+	direction[(first+i)*n_block+i] = 1.0;
+      }
+      product.resize(n*n_block);
+      replay_stack_.hessian_product(max_gradient_, independent_index_,
+				    dependent_index_, dependent_weight,
+				    n_block, &direction[0], &product[0]);
+      for (uIndex j = 0; j < n; j++) {
+	for (uIndex i = 0; i < n_block; i++) {
+	  hessian_out[(first+i)*n+j] = product[j*n_block+i];
+	}
+      }
+    }
+  }
+
+
+
+  // Start recording the work of one thread of a parallel region,
+  // giving the active objects created in this thread the gradient
+  // indices from first_gradient to first_gradient+n_gradients-1,
+  // which should have been reserved by the parent stack
+  void
+  Stack::begin_substack(uIndex first_gradient, uIndex n_gradients)
+  {
+    if (is_thread_unsafe_) {
+      throw feature_not_available("Sub-stacks cannot be used when Adept is compiled with ADEPT_STACK_THREAD_UNSAFE"
+				  ADEPT_EXCEPTION_LOCATION);
+    }
+    if (n_gradients_registered_ > 0) {
+      throw invalid_operation("Stack::begin_substack() called for a stack with registered gradients"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+    // Make this the active stack in this thread, even if another
+    // stack (typically the parent) is active
+    substack_previous_stack_ = ADEPT_ACTIVE_STACK;
+    ADEPT_ACTIVE_STACK = this;
+    gap_list_.clear();
+    i_gradient_ = first_gradient;
+    substack_end_gradient_ = first_gradient + n_gradients;
+    is_substack_overflowed_ = false;
+    new_recording();
+    max_gradient_ = first_gradient;
+  }
+
+  // Finish recording the work of one thread, reactivating the stack
+  // that was previously active. This is called inside the parallel
+  // region, where an exception could not be caught, so if more
+  // gradients were registered than reserved, this is only recorded
+  // here and reported by append_substack().
+  void
+  Stack::end_substack()
+  {
+    if (is_active()) {
+      ADEPT_ACTIVE_STACK = substack_previous_stack_;
+    }
+    substack_previous_stack_ = 0;
+    if (max_gradient_ > substack_end_gradient_) {
+      is_substack_overflowed_ = true;
+    }
+  }
+
+  // Append the statements of a sub-stack to the current recording
+  void
+  Stack::append_substack(const Stack& substack)
+  {
+    substack.check_no_matrix_nodes("Stack::append_substack()");
+    if (substack.is_substack_overflowed_) {
+      throw gradient_out_of_range("More active objects created in a sub-stack than the number of gradients passed to Stack::begin_substack()"
+				  ADEPT_EXCEPTION_LOCATION);
+    }
+    for (uIndex iblock = 0; iblock < substack.n_stack_blocks(); iblock++) {
+      const StackBlock block = substack.stack_block(iblock);
+      for (uIndex ist = 1; ist < block.n_statements; ist++) {
+	uIndex start = block.statement[ist-1].end_plus_one;
+	uIndex end_plus_one = block.statement[ist].end_plus_one;
+	check_space(end_plus_one - start);
+	for (uIndex i = start; i < end_plus_one; i++) {
+	  push_rhs(block.multiplier[i], block.index[i]);
+	}
+	push_lhs(block.statement[ist].index);
+      }
+    }
+    if (substack.max_gradient_ > max_gradient_) {
+      max_gradient_ = substack.max_gradient_;
+    }
+  }
+
 
   // Register n gradients
   uIndex
   Stack::do_register_gradients(const uIndex& n) {
     n_gradients_registered_ += n;
-    if (!gap_list_.empty()) {
-      uIndex return_val;
-      // Insert in a gap, if there is one big enough
-      for (GapListIterator it = gap_list_.begin();
-	   it != gap_list_.end(); it++) {
-	uIndex len = it->end + 1 - it->start;
+    // Insert in the lowest gap that is big enough, if there is one;
+    // since the gap list is in descending order, search from the back
+    for (std::size_t igap = gap_list_.size(); igap > 0; igap--) {
+      Gap& gap = gap_list_[igap-1];
+      uIndex len = gap.end + 1 - gap.start;
+      if (len >= n) {
+	uIndex return_val = gap.start;
 	if (len > n) {
 	  // Gap a bit larger than needed: reduce its size
-	  return_val = it->start;
-	  it->start += n;
-	  return return_val;
+	  gap.start += n;
 	}
-	else if (len == n) {
+	else {
 	  // Gap exactly the size needed: fill it and remove from list
-	  return_val = it->start;
-	  if (most_recent_gap_ == it) {
-	    gap_list_.erase(it);
-	    most_recent_gap_ = gap_list_.end();
-	  }
-	  else {
-	    gap_list_.erase(it);
-	  }
-	  return return_val;
+	  gap_list_.erase(gap_list_.begin() + (igap-1));
 	}
+	return return_val;
       }
     }
     // No suitable gap found; instead add to end of gradient vector
@@ -226,9 +971,56 @@ namespace adept {
     if (i_gradient_ > max_gradient_) {
       max_gradient_ = i_gradient_;
     }
+    // In a sub-stack (the only case in which substack_end_gradient_
+    // is non-zero) the gradients may have run into the range of
+    // another thread; single gradients are checked by end_substack()
+    if (substack_end_gradient_ > 0 && i_gradient_ > substack_end_gradient_) {
+      is_substack_overflowed_ = true;
+    }
     return i_gradient_ - n;
   }
-  
+
+
+  // Comparison used to find the first gap, in the descending order of
+  // the gap list, that starts no more than one element after the
+  // gradients ending at "gradient_end"
+  namespace {
+    struct gap_starts_after {
+      bool operator()(const Gap& gap, uIndex gradient_end) const {
+	return gap.start > gradient_end + 1;
+      }
+    };
+  }
+
+  // Add gradients to the gap list, merging them with the gaps either
+  // side if they are adjacent. Since the gap list is a vector sorted
+  // in descending order, the location is found with a binary search.
+  void
+  Stack::add_gap(uIndex gradient_index, uIndex n)
+  {
+    GapListIterator it = std::lower_bound(gap_list_.begin(), gap_list_.end(),
+					  gradient_index+n-1, gap_starts_after());
+    if (it != gap_list_.end() && it->start == gradient_index + n) {
+      // Added at the base of an existing gap: check whether it has
+      // merged with the next (lower) one
+      it->start = gradient_index;
+      GapListIterator next = it+1;
+      if (next != gap_list_.end() && next->end + 1 == it->start) {
+	it->start = next->start;
+	gap_list_.erase(next);
+      }
+    }
+    else if (it != gap_list_.end() && it->end + 1 == gradient_index) {
+      // Added at the top of an existing gap; the previous (higher)
+      // gap cannot be adjacent or it would have been found above
+      it->end += n;
+    }
+    else {
+      // Insert a new gap before "it"
+      gap_list_.insert(it, Gap(gradient_index, gradient_index+n-1));
+    }
+  }
+
 
   // If an aReal object is deleted, its gradient_index is
   // unregistered from the stack.  If this is at the top of the stack
@@ -240,84 +1032,7 @@ namespace adept {
   void
   Stack::unregister_gradient_not_top(const uIndex& gradient_index)
   {
-    enum {
-      ADDED_AT_BASE,
-      ADDED_AT_TOP,
-      NEW_GAP,
-      NOT_FOUND
-    } status = NOT_FOUND;
-    // First try to find if the unregistered element is at the
-    // start or end of an existing gap
-    if (!gap_list_.empty() && most_recent_gap_ != gap_list_.end()) {
-      // We have a "most recent" gap - check whether the gradient
-      // to be unregistered is here
-      Gap& current_gap = *most_recent_gap_;
-      if (gradient_index == current_gap.start - 1) {
-	current_gap.start--;
-	status = ADDED_AT_BASE;
-      }
-      else if (gradient_index == current_gap.end + 1) {
-	current_gap.end++;
-	status = ADDED_AT_TOP;
-      }
-      // Should we check for erroneous removal from middle of gap?
-    }
-    if (status == NOT_FOUND) {
-      // Search other gaps
-      for (GapListIterator it = gap_list_.begin();
-	   it != gap_list_.end(); it++) {
-	if (gradient_index <= it->end + 1) {
-	  // Gradient to unregister is either within the gap
-	  // referenced by iterator "it", or it is between "it"
-	  // and the previous gap in the list
-	  if (gradient_index == it->start - 1) {
-	    status = ADDED_AT_BASE;
-	    it->start--;
-	    most_recent_gap_ = it;
-	  }
-	  else if (gradient_index == it->end + 1) {
-	    status = ADDED_AT_TOP;
-	    it->end++;
-	    most_recent_gap_ = it;
-	  }
-	  else {
-	    // Insert a new gap of width 1; note that list::insert
-	    // inserts *before* the specified location
-	    most_recent_gap_
-	      = gap_list_.insert(it, Gap(gradient_index));
-	    status = NEW_GAP;
-	  }
-	  break;
-	}
-      }
-      if (status == NOT_FOUND) {
-	gap_list_.push_back(Gap(gradient_index));
-	most_recent_gap_ = gap_list_.end();
-	most_recent_gap_--;
-      }
-    }
-    // Finally check if gaps have merged
-    if (status == ADDED_AT_BASE
-	&& most_recent_gap_ != gap_list_.begin()) {
-      // Check whether the gap has merged with the next one
-      GapListIterator it = most_recent_gap_;
-      it--;
-      if (it->end == most_recent_gap_->start - 1) {
-	// Merge two gaps
-	most_recent_gap_->start = it->start;
-	gap_list_.erase(it);
-      }
-    }
-    else if (status == ADDED_AT_TOP) {
-      GapListIterator it = most_recent_gap_;
-      it++;
-      if (it != gap_list_.end()
-	  && it->start == most_recent_gap_->end + 1) {
-	// Merge two gaps
-	most_recent_gap_->end = it->end;
-	gap_list_.erase(it);
-      }
-    }
+    add_gap(gradient_index, 1);
   }	
 
 
@@ -331,120 +1046,19 @@ namespace adept {
       // Gradient to be unregistered is at the top of the stack
       i_gradient_ -= n;
       if (!gap_list_.empty()) {
-	Gap& last_gap = gap_list_.back();
+	// The highest gap is at the front of the list
+	Gap& last_gap = gap_list_.front();
 	if (i_gradient_ == last_gap.end+1) {
 	  // We have unregistered the elements between the "gap" of
 	  // unregistered element and the top of the stack, so can set
 	  // the variables indicating the presence of the gap to zero
 	  i_gradient_ = last_gap.start;
-	  GapListIterator it = gap_list_.end();
-	  it--;
-	  if (most_recent_gap_ == it) {
-	    most_recent_gap_ = gap_list_.end();
-	  }
-	  gap_list_.pop_back();
+	  gap_list_.erase(gap_list_.begin());
 	}
       }
     }
     else { // Gradients to be unregistered not at top of stack.
-      enum {
-	ADDED_AT_BASE,
-	ADDED_AT_TOP,
-	NEW_GAP,
-	NOT_FOUND
-      } status = NOT_FOUND;
-      // First try to find if the unregistered element is at the start
-      // or end of an existing gap
-      if (!gap_list_.empty() && most_recent_gap_ != gap_list_.end()) {
-	// We have a "most recent" gap - check whether the gradient
-	// to be unregistered is here
-	Gap& current_gap = *most_recent_gap_;
-	if (gradient_index == current_gap.start - n) {
-	  current_gap.start -= n;
-	  status = ADDED_AT_BASE;
-	}
-	else if (gradient_index == current_gap.end + 1) {
-	  current_gap.end += n;
-	  status = ADDED_AT_TOP;
-	}
-	/*
-	else if (gradient_index > current_gap.start - n
-		 && gradient_index < current_gap.end + 1) {
-	  std::cout << "** Attempt to find " << gradient_index << " in gaps ";
-	  print_gaps();
-	  std::cout << "\n";
-	  throw invalid_operation("Gap list corruption");
-	}
-	*/
-	// Should we check for erroneous removal from middle of gap?
-      }
-      if (status == NOT_FOUND) {
-	// Search other gaps
-	for (GapListIterator it = gap_list_.begin();
-	     it != gap_list_.end(); it++) {
-	  if (gradient_index <= it->end + 1) {
-	    // Gradient to unregister is either within the gap
-	    // referenced by iterator "it", or it is between "it" and
-	    // the previous gap in the list
-	    if (gradient_index == it->start - n) {
-	      status = ADDED_AT_BASE;
-	      it->start -= n;
-	      most_recent_gap_ = it;
-	    }
-	    else if (gradient_index == it->end + 1) {
-	      status = ADDED_AT_TOP;
-	      it->end += n;
-	      most_recent_gap_ = it;
-	    }
-	    /*
-	    else if (gradient_index > it->start - n) {
-	      std::cout << "*** Attempt to find " << gradient_index << " in gaps ";
-	      print_gaps();
-	      std::cout << "\n";
-	      throw invalid_operation("Gap list corruption");
-	    }
-	    */
-	    else {
-	      // Insert a new gap; note that list::insert inserts
-	      // *before* the specified location
-	      most_recent_gap_
-		= gap_list_.insert(it, Gap(gradient_index,
-					   gradient_index+n-1));
-	      status = NEW_GAP;
-	    }
-	    break;
-	  }
-	}
-	if (status == NOT_FOUND) {
-	  gap_list_.push_back(Gap(gradient_index,
-				  gradient_index+n-1));
-	  most_recent_gap_ = gap_list_.end();
-	  most_recent_gap_--;
-	}
-      }
-      // Finally check if gaps have merged
-      if (status == ADDED_AT_BASE
-	  && most_recent_gap_ != gap_list_.begin()) {
-	// Check whether the gap has merged with the next one
-	GapListIterator it = most_recent_gap_;
-	it--;
-	if (it->end == most_recent_gap_->start - 1) {
-	  // Merge two gaps
-	  most_recent_gap_->start = it->start;
-	  gap_list_.erase(it);
-	}
-      }
-      else if (status == ADDED_AT_TOP) {
-	GapListIterator it = most_recent_gap_;
-
-	it++;
-	if (it != gap_list_.end()
-	    && it->start == most_recent_gap_->end + 1) {
-	  // Merge two gaps
-	  most_recent_gap_->end = it->end;
-	  gap_list_.erase(it);
-	}
-      }
+      add_gap(gradient_index, n);
     }
   }
   
@@ -454,21 +1068,26 @@ namespace adept {
   void
   Stack::print_statements(std::ostream& os) const
   {
-    for (uIndex ist = 1; ist < n_statements_; ist++) {
-      const Statement& statement = statement_[ist];
-      os << ist
-		<< ": d[" << statement.index
-		<< "] = ";
+    // Statements are numbered consecutively across blocks
+    uIndex ist_global = 1;
+    for (uIndex iblock = 0; iblock < n_stack_blocks(); iblock++) {
+      const StackBlock block = stack_block(iblock);
+      for (uIndex ist = 1; ist < block.n_statements; ist++, ist_global++) {
+	const Statement& statement = block.statement[ist];
+	os << ist_global
+		  << ": d[" << statement.index
+		  << "] = ";
       
-      if (statement_[ist-1].end_plus_one == statement_[ist].end_plus_one) {
-	os << "0\n";
-      }
-      else {    
-	for (uIndex i = statement_[ist-1].end_plus_one;
-	     i < statement.end_plus_one; i++) {
-	  os << " + " << multiplier_[i] << "*d[" << index_[i] << "]";
+	if (block.statement[ist-1].end_plus_one == statement.end_plus_one) {
+	  os << "0\n";
+	}
+	else {    
+	  for (uIndex i = block.statement[ist-1].end_plus_one;
+	       i < statement.end_plus_one; i++) {
+	    os << " + " << block.multiplier[i] << "*d[" << block.index[i] << "]";
+	  }
+	  os << "\n";
 	}
-	os << "\n";
       }
     }
   }
@@ -502,8 +1121,9 @@ namespace adept {
   void
   Stack::print_gaps(std::ostream& os) const
   {
-    for (std::list<Gap>::const_iterator it = gap_list_.begin();
-	 it != gap_list_.end(); it++) {
+    // Print in ascending order of gradient index
+    for (GapList::const_reverse_iterator it = gap_list_.rbegin();
+	 it != gap_list_.rend(); it++) {
       os << it->start << "-" << it->end << " ";
     }
   }
@@ -517,10 +1137,8 @@ namespace adept {
   {
     if (max_gradient_ > 0) {
       if (n_allocated_gradients_ < max_gradient_) {
-	if (gradient_) {
-	  delete[] gradient_;
-	}
-	gradient_ = new Real[max_gradient_];
+	free_with_policy(gradient_);
+	gradient_ = allocate_array<Real>(max_gradient_, allocation_policy_);
 	n_allocated_gradients_ = max_gradient_;
       }
       for (uIndex i = 0; i < max_gradient_; i++) {
@@ -538,6 +1156,31 @@ namespace adept {
   }
 #endif
 
+  // Initialize the gradients in n_directions directions, padding the
+  // gradients of each variable to a multiple of the packet size so
+  // that they are suitably aligned for vector instructions
+  void
+  Stack::initialize_gradient_directions(uIndex n_directions)
+  {
+    gradient_direction_stride_ = ((n_directions + Packet<Real>::size - 1)
+				  / Packet<Real>::size) * Packet<Real>::size;
+    std::size_t n = static_cast<std::size_t>(max_gradient_)
+      * gradient_direction_stride_;
+    if (n_allocated_gradient_directions_ < n) {
+      if (gradient_directions_) {
+	free_aligned(gradient_directions_);
+	gradient_directions_ = 0;
+	n_allocated_gradient_directions_ = 0;
+      }
+      gradient_directions_ = alloc_aligned<Real>(n);
+      n_allocated_gradient_directions_ = n;
+    }
+    for (std::size_t i = 0; i < n; i++) {
+      gradient_directions_[i] = 0.0;
+    }
+    n_gradient_directions_ = n_directions;
+  }
+
   // Report information about the stack to the specified stream, or
   // standard output if omitted; note that this is synonymous with
   // sending the Stack object to a stream using the "<<" operator.
@@ -565,7 +1208,34 @@ namespace adept {
     os << "      " << n_statements()-1 << " statements (" 
        << n_allocated_statements() << " allocated)";
     os << " and " << n_operations() << " operations (" 
-       << n_allocated_operations() << " allocated)\n";
+       << n_allocated_operations() << " allocated)";
+#ifdef ADEPT_STACK_STORAGE_BLOCKS
+    os << " in " << n_stack_blocks() << " blocks";
+    if (n_spilled_blocks() > 0) {
+      os << " (" << n_spilled_blocks() << " spilled to disk)";
+    }
+#endif
+    os << "\n";
+    if (!matrix_node_.empty()) {
+      os << "      " << n_matrix_nodes() << " matrix nodes using "
+	 << matrix_node_memory() << " bytes\n";
+    }
+    if (recording_is_compressed()) {
+      os << "      Recording compressed to " << compressed_memory()
+	 << " bytes\n";
+    }
+    if (recording_is_single_precision()) {
+      os << "      Recording stored in single precision using "
+	 << single_precision_memory() << " bytes\n";
+    }
+    if (recording_is_replayable()) {
+      os << "      Recording replayable using " << replay_stack_.memory()
+	 << " bytes\n";
+    }
+    if (adjoint_is_parallelized()) {
+      os << "      Adjoint parallelized in " << n_adjoint_levels()
+	 << " levels using " << parallel_adjoint_memory() << " bytes\n";
+    }
     os << "      " << n_gradients_registered() << " gradients currently registered ";
     os << "and a total of " << max_gradients() << " needed (current index "
        << i_gradient() << ")\n";
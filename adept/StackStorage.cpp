@@ -0,0 +1,504 @@
+/* StackStorage.cpp -- Storage of stacks in blocks
+
+    Copyright (C) 2012-2014 University of Reading
+    Copyright (C) 2015 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   The Stack class inherits from a class providing the storage (and
+   interface to the storage) for the derivative statements that are
+   accumulated during the execution of an algorithm.  The derivative
+   statements are held in two stacks described by Hogan (2014): the
+   "statement stack" and the "operation stack".
+
+   This file provides the non-inline functions of the storage engine
+   selected by ADEPT_STACK_STORAGE_BLOCKS, in which the two stacks
+   are held in a list of fixed-size blocks so that growing them
+   never involves copying the existing recording, and in which blocks
+   may be spilled to disk if a memory budget is set.
+
+*/
+
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef __unix__
+#include <unistd.h>  // Defines _POSIX_VERSION and _POSIX_MAPPED_FILES
+#endif
+
+// Spilling blocks to disk requires memory-mapped files
+#if defined(_POSIX_MAPPED_FILES) && _POSIX_MAPPED_FILES > 0
+#define ADEPT_HAVE_STACK_SPILL 1
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <cerrno>
+#endif
+
+#include <adept/StackStorage.h>
+
+namespace adept {
+  namespace internal {
+
+    StackStorage::~StackStorage() {
+      for (std::size_t iblock = 0; iblock < block_.size(); ++iblock) {
+	free_block(iblock);
+      }
+#ifdef ADEPT_HAVE_STACK_SPILL
+      if (spill_file_descriptor_ >= 0) {
+	close(spill_file_descriptor_);
+      }
+#endif
+    }
+
+    // Allocate the arrays of a block
+    void
+    StackStorage::allocate_block(uIndex iblock,
+				 uIndex n_statements, uIndex n_operations)
+    {
+      StackBlock& block = block_[iblock];
+      block.statement  = allocate_array<Statement>(n_statements,
+						   allocation_policy_);
+      block.multiplier = allocate_array<Real>(n_operations, allocation_policy_);
+      block.index      = allocate_array<uIndex>(n_operations,
+						allocation_policy_);
+      block.n_statements = 0;
+      block.n_operations = 0;
+      block.n_allocated_statements = n_statements;
+      block.n_allocated_operations = n_operations;
+    }
+
+    // Free the arrays of a block, or unmap them if the block has
+    // been spilled to disk
+    void
+    StackStorage::free_block(uIndex iblock)
+    {
+      StackBlock& block = block_[iblock];
+      SpilledBlock& spilled = spilled_block_[iblock];
+      if (spilled.mapping) {
+#ifdef ADEPT_HAVE_STACK_SPILL
+	munmap(spilled.mapping, spilled.length);
+#endif
+	spilled = SpilledBlock();
+      }
+      else {
+	free_with_policy(block.statement);
+	free_with_policy(block.multiplier);
+	free_with_policy(block.index);
+      }
+      block = StackBlock();
+    }
+
+    // Allocate the first block
+    void
+    StackStorage::initialize(uIndex n)
+    {
+      block_.push_back(StackBlock());
+      spilled_block_.push_back(SpilledBlock());
+      allocate_block(0, n, n);
+      i_block_ = 0;
+      use_block(0);
+    }
+
+    // Copy the contents of each block held in memory into new arrays
+    // of the same size; spilled blocks are left in the scratch file
+    void
+    StackStorage::reallocate_stack()
+    {
+      for (uIndex iblock = 0; iblock < static_cast<uIndex>(block_.size()); ++iblock) {
+	StackBlock& block = block_[iblock];
+	if (spilled_block_[iblock].mapping || !block.statement) {
+	  continue;
+	}
+	uIndex n_statements = block.n_statements;
+	uIndex n_operations = block.n_operations;
+	if (iblock == i_block_) {
+	  n_statements = n_statements_;
+	  n_operations = n_operations_;
+	}
+	StackBlock old_block = block;
+	allocate_block(iblock, old_block.n_allocated_statements,
+		       old_block.n_allocated_operations);
+	std::memcpy(block.statement, old_block.statement,
+		    n_statements*sizeof(Statement));
+	std::memcpy(block.multiplier, old_block.multiplier,
+		    n_operations*sizeof(Real));
+	std::memcpy(block.index, old_block.index,
+		    n_operations*sizeof(uIndex));
+	block.n_statements = old_block.n_statements;
+	block.n_operations = old_block.n_operations;
+	free_with_policy(old_block.statement);
+	free_with_policy(old_block.multiplier);
+	free_with_policy(old_block.index);
+      }
+      if (!block_.empty()) {
+	use_block(i_block_);
+      }
+    }
+
+    // Start a new block rather than copying the current one into a
+    // larger array
+    void
+    StackStorage::grow_operation_stack(uIndex min)
+    {
+      new_block(0, min, true);
+    }
+
+    // ... likewise for the statement stack
+    void
+    StackStorage::grow_statement_stack(uIndex min)
+    {
+      new_block(min > 0 ? min : 1, 0, false);
+    }
+
+    // Finish the current block and start a new one, reusing a block
+    // from a previous recording if one is available and large
+    // enough.  The operations of an unfinished statement (those
+    // after the end of the last statement) are moved to the new
+    // block so that every statement has all its operations in one
+    // block.  If move_last_statement is true then the last complete
+    // statement is moved as well, since check_space() may be called
+    // from append_derivative_dependence just before the last
+    // statement is extended with update_lhs().
+    void
+    StackStorage::new_block(uIndex min_statements, uIndex min_operations,
+			    bool move_last_statement)
+    {
+      // Work out what needs to be moved to the new block
+      uIndex n_move_statements = 0;
+      uIndex first_move_operation = n_operations_;
+      if (n_statements_ > 0) {
+	first_move_operation = statement_[n_statements_-1].end_plus_one;
+	if (move_last_statement && n_statements_ > 1) {
+	  n_move_statements = 1;
+	  first_move_operation = statement_[n_statements_-2].end_plus_one;
+	}
+      }
+      uIndex n_move_operations = n_operations_ - first_move_operation;
+
+      // Space required in the new block, including its null
+      // statement. An array assignment calls check_space() once for
+      // all its operations and then pushes the statements one by one,
+      // so a block started for n operations is given space for n
+      // statements as well, and a new block never has less free space
+      // than the one it replaces in case some of that space has
+      // already been reserved with check_space()
+      uIndex n_need_statements = n_move_statements + 2
+	+ std::max(min_statements, min_operations);
+      uIndex n_need_operations = n_move_operations + min_operations + 1;
+      n_need_statements = std::max(n_need_statements, n_move_statements + 1
+				   + n_allocated_statements_ - n_statements_);
+      n_need_operations = std::max(n_need_operations, n_move_operations
+				   + n_allocated_operations_ - n_operations_);
+      if (n_need_statements < ADEPT_STACK_BLOCK_LENGTH) {
+	n_need_statements = ADEPT_STACK_BLOCK_LENGTH;
+      }
+      if (n_need_operations < ADEPT_STACK_BLOCK_LENGTH) {
+	n_need_operations = ADEPT_STACK_BLOCK_LENGTH;
+      }
+
+      // Finish the current block
+      StackBlock& old_block = block_[i_block_];
+      old_block.n_statements = n_statements_ - n_move_statements;
+      old_block.n_operations = first_move_operation;
+      n_statements_previous_ += old_block.n_statements - 1;
+      n_operations_previous_ += old_block.n_operations;
+
+      // Find space for the next block
+      ++i_block_;
+      if (static_cast<std::size_t>(i_block_) == block_.size()) {
+	block_.push_back(StackBlock());
+	spilled_block_.push_back(SpilledBlock());
+	allocate_block(i_block_, n_need_statements, n_need_operations);
+      }
+      else if (block_[i_block_].n_allocated_statements < n_need_statements
+	       || block_[i_block_].n_allocated_operations < n_need_operations
+	       || spilled_block_[i_block_].mapping) {
+	free_block(i_block_);
+	allocate_block(i_block_, n_need_statements, n_need_operations);
+      }
+      // Note that push_back may have invalidated old_block
+      StackBlock& prev_block = block_[i_block_-1];
+      StackBlock& block = block_[i_block_];
+
+      // The new block starts with a null statement
+      block.statement[0] = Statement(-1, 0);
+      for (uIndex ist = 0; ist < n_move_statements; ++ist) {
+	const Statement& statement = prev_block.statement[prev_block.n_statements+ist];
+	block.statement[ist+1] = Statement(statement.index,
+			   statement.end_plus_one - first_move_operation);
+      }
+      std::memcpy(block.multiplier, prev_block.multiplier+first_move_operation,
+		  n_move_operations*sizeof(Real));
+      std::memcpy(block.index, prev_block.index+first_move_operation,
+		  n_move_operations*sizeof(uIndex));
+
+      use_block(i_block_);
+      n_statements_ = n_move_statements + 1;
+      n_operations_ = n_move_operations;
+
+      if (memory_budget_ > 0) {
+	apply_memory_budget();
+      }
+    }
+
+    // Return to the point in the recording after the first
+    // n_statements statements and n_operations operations, stepping
+    // back through the blocks until the one containing the point is
+    // found; a point at the start of a block is treated as the end of
+    // the previous block
+    void
+    StackStorage::rewind_stack(uIndex n_statements, uIndex n_operations)
+    {
+      while (i_block_ > 0 && n_statements <= n_statements_previous_) {
+	--i_block_;
+	n_statements_previous_ -= block_[i_block_].n_statements - 1;
+	n_operations_previous_ -= block_[i_block_].n_operations;
+      }
+      use_block(i_block_);
+      n_statements_ = n_statements - n_statements_previous_;
+      n_operations_ = n_operations - n_operations_previous_;
+    }
+
+    // Shrink a block whose contents have been compacted in place,
+    // keeping the totals of the previous blocks consistent
+    void
+    StackStorage::resize_stack_block(uIndex iblock, uIndex n_statements,
+				     uIndex n_operations)
+    {
+      if (iblock == i_block_) {
+	n_statements_ = n_statements;
+	n_operations_ = n_operations;
+      }
+      else {
+	StackBlock& block = block_[iblock];
+	n_statements_previous_ -= block.n_statements - n_statements;
+	n_operations_previous_ -= block.n_operations - n_operations;
+	block.n_statements = n_statements;
+	block.n_operations = n_operations;
+      }
+    }
+
+    // Return the total amount of memory allocated for statements and
+    // operations, excluding blocks that have been spilled to disk
+    uIndex
+    StackStorage::n_allocated_statements() const
+    {
+      uIndex n = 0;
+      for (std::size_t iblock = 0; iblock < block_.size(); ++iblock) {
+	if (!spilled_block_[iblock].mapping) {
+	  n += block_[iblock].n_allocated_statements;
+	}
+      }
+      return n;
+    }
+
+    uIndex
+    StackStorage::n_allocated_operations() const
+    {
+      uIndex n = 0;
+      for (std::size_t iblock = 0; iblock < block_.size(); ++iblock) {
+	if (!spilled_block_[iblock].mapping) {
+	  n += block_[iblock].n_allocated_operations;
+	}
+      }
+      return n;
+    }
+
+    uIndex
+    StackStorage::n_spilled_blocks() const
+    {
+      uIndex n = 0;
+      for (uIndex iblock = 0; iblock < i_block_; ++iblock) {
+	if (spilled_block_[iblock].mapping) {
+	  ++n;
+	}
+      }
+      return n;
+    }
+
+    void
+    StackStorage::set_memory_budget(std::size_t bytes)
+    {
+#ifdef ADEPT_HAVE_STACK_SPILL
+      memory_budget_ = bytes;
+#else
+      if (bytes > 0) {
+	throw feature_not_available("Cannot spill stack to disk: memory-mapped files not available on this platform"
+				    ADEPT_EXCEPTION_LOCATION);
+      }
+#endif
+    }
+
+    // Spill the oldest finished blocks of the current recording until
+    // the memory they occupy is within budget; the current block is
+    // never spilled
+    void
+    StackStorage::apply_memory_budget()
+    {
+      std::size_t bytes = 0;
+      for (uIndex iblock = 0; iblock <= i_block_; ++iblock) {
+	if (!spilled_block_[iblock].mapping) {
+	  bytes += block_[iblock].n_allocated_statements*sizeof(Statement)
+	    + block_[iblock].n_allocated_operations*(sizeof(Real)+sizeof(uIndex));
+	}
+      }
+      for (uIndex iblock = 0; iblock < i_block_ && bytes > memory_budget_;
+	   ++iblock) {
+	if (!spilled_block_[iblock].mapping) {
+	  bytes -= block_[iblock].n_allocated_statements*sizeof(Statement)
+	    + block_[iblock].n_allocated_operations*(sizeof(Real)+sizeof(uIndex));
+	  spill_block(iblock);
+	}
+      }
+    }
+
+#ifdef ADEPT_HAVE_STACK_SPILL
+
+    // Round up to a multiple of "align"
+    static inline std::size_t
+    round_up(std::size_t n, std::size_t align) {
+      return ((n + align - 1) / align) * align;
+    }
+
+    // Write "n" bytes to the scratch file starting at "offset"
+    static void
+    write_spill_file(int fd, const void* data, std::size_t n,
+		     std::size_t offset)
+    {
+      const char* ptr = static_cast<const char*>(data);
+      while (n > 0) {
+	ssize_t n_written = pwrite(fd, ptr, n, offset);
+	if (n_written < 0) {
+	  if (errno == EINTR) {
+	    continue;
+	  }
+	  throw stack_file_error("Error writing stack to scratch file"
+				 ADEPT_EXCEPTION_LOCATION);
+	}
+	ptr += n_written;
+	offset += n_written;
+	n -= n_written;
+      }
+    }
+
+    void
+    StackStorage::spill_block(uIndex iblock)
+    {
+      if (spill_file_descriptor_ < 0) {
+	// Create the scratch file and delete it immediately, so that
+	// it disappears when closed or when the program exits
+	std::string directory = spill_directory_;
+	if (directory.empty()) {
+	  const char* tmpdir = std::getenv("TMPDIR");
+	  directory = tmpdir ? tmpdir : "/tmp";
+	}
+	std::string name = directory + "/adept_stack_XXXXXX";
+	std::vector<char> name_buffer(name.begin(), name.end());
+	name_buffer.push_back('\0');
+	spill_file_descriptor_ = mkstemp(&name_buffer[0]);
+	if (spill_file_descriptor_ < 0) {
+	  throw stack_file_error("Cannot create scratch file for stack in directory \""
+				 + directory + "\"" ADEPT_EXCEPTION_LOCATION);
+	}
+	unlink(&name_buffer[0]);
+      }
+
+      // Each block starts on a page boundary so that it can be mapped
+      // separately, and each array on a 64-byte boundary
+      StackBlock& block = block_[iblock];
+      static const std::size_t page_size = sysconf(_SC_PAGESIZE);
+      std::size_t statement_bytes = block.n_statements*sizeof(Statement);
+      std::size_t multiplier_offset = round_up(statement_bytes, 64);
+      std::size_t index_offset = multiplier_offset
+	+ round_up(block.n_operations*sizeof(Real), 64);
+      std::size_t length = index_offset + block.n_operations*sizeof(uIndex);
+      std::size_t offset = spill_file_size_;
+
+      write_spill_file(spill_file_descriptor_, block.statement,
+		       statement_bytes, offset);
+      write_spill_file(spill_file_descriptor_, block.multiplier,
+		       block.n_operations*sizeof(Real),
+		       offset+multiplier_offset);
+      write_spill_file(spill_file_descriptor_, block.index,
+		       block.n_operations*sizeof(uIndex),
+		       offset+index_offset);
+      spill_file_size_ = round_up(offset+length, page_size);
+      // Ensure the file extends to the end of the mapping
+      if (ftruncate(spill_file_descriptor_, spill_file_size_) != 0) {
+	throw stack_file_error("Error extending stack scratch file"
+			       ADEPT_EXCEPTION_LOCATION);
+      }
+
+      // The mapping is writable so that passes that modify a block in
+      // place work on spilled blocks too
+      void* mapping = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   spill_file_descriptor_, offset);
+      if (mapping == MAP_FAILED) {
+	throw stack_file_error("Error mapping stack scratch file into memory"
+			       ADEPT_EXCEPTION_LOCATION);
+      }
+
+      // Replace the arrays of the block with the mapping
+      uIndex n_statements = block.n_statements;
+      uIndex n_operations = block.n_operations;
+      free_block(iblock);
+      char* base = static_cast<char*>(mapping);
+      block.statement  = reinterpret_cast<Statement*>(base);
+      block.multiplier = reinterpret_cast<Real*>(base+multiplier_offset);
+      block.index      = reinterpret_cast<uIndex*>(base+index_offset);
+      block.n_statements = block.n_allocated_statements = n_statements;
+      block.n_operations = block.n_allocated_operations = n_operations;
+      spilled_block_[iblock].mapping = mapping;
+      spilled_block_[iblock].length  = length;
+    }
+
+    // Unmap the spilled blocks and truncate the scratch file; the
+    // blocks will be allocated afresh if needed by the next recording
+    void
+    StackStorage::clear_spilled_blocks()
+    {
+      for (std::size_t iblock = 0; iblock < block_.size(); ++iblock) {
+	if (spilled_block_[iblock].mapping) {
+	  free_block(iblock);
+	}
+      }
+      // The first block must be in memory since clear_stack() makes
+      // it the current block
+      if (!block_[0].statement) {
+	allocate_block(0, ADEPT_STACK_BLOCK_LENGTH, ADEPT_STACK_BLOCK_LENGTH);
+      }
+      if (ftruncate(spill_file_descriptor_, 0) != 0) {
+	throw stack_file_error("Error truncating stack scratch file"
+			       ADEPT_EXCEPTION_LOCATION);
+      }
+      spill_file_size_ = 0;
+    }
+
+    // Tell the operating system that a spilled block will be needed
+    // soon, in which case it starts reading it asynchronously, or that
+    // it is no longer needed, in which case its pages may be discarded
+    // (they remain in the file)
+    void
+    StackStorage::advise_spilled_block(uIndex iblock, bool will_need) const
+    {
+      const SpilledBlock& spilled = spilled_block_[iblock];
+      madvise(spilled.mapping, spilled.length,
+	      will_need ? MADV_WILLNEED : MADV_DONTNEED);
+    }
+
+#else
+
+    // Blocks are never spilled if memory-mapped files are not
+    // available
+    void StackStorage::spill_block(uIndex) { }
+    void StackStorage::clear_spilled_blocks() { spill_file_size_ = 0; }
+    void StackStorage::advise_spilled_block(uIndex, bool) const { }
+
+#endif
+
+  }
+}
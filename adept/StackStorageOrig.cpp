@@ -26,15 +26,9 @@ namespace adept {
   namespace internal {
 
     StackStorageOrig::~StackStorageOrig() {
-      if (statement_) {
-	delete[] statement_;
-      }
-      if (multiplier_) {
-	delete[] multiplier_;
-      }
-      if (index_) {
-	delete[] index_;
-      }
+      free_with_policy(statement_);
+      free_with_policy(multiplier_);
+      free_with_policy(index_);
     }
 
 
@@ -48,14 +42,14 @@ namespace adept {
       if (min > 0 && new_size < n_allocated_operations_+min) {
 	new_size += min;
       }
-      Real* new_multiplier = new Real[new_size];
-      uIndex* new_index = new uIndex[new_size];
+      Real* new_multiplier = allocate_array<Real>(new_size, allocation_policy_);
+      uIndex* new_index = allocate_array<uIndex>(new_size, allocation_policy_);
       
       std::memcpy(new_multiplier, multiplier_, n_operations_*sizeof(Real));
       std::memcpy(new_index, index_, n_operations_*sizeof(uIndex));
       
-      delete[] multiplier_;
-      delete[] index_;
+      free_with_policy(multiplier_);
+      free_with_policy(index_);
       
       multiplier_ = new_multiplier;
       index_ = new_index;
@@ -71,15 +65,39 @@ namespace adept {
       if (min > 0 && new_size < n_allocated_statements_+min) {
 	new_size += min;
       }
-      Statement* new_statement = new Statement[new_size];
+      Statement* new_statement
+	= allocate_array<Statement>(new_size, allocation_policy_);
       std::memcpy(new_statement, statement_,
 		  n_statements_*sizeof(Statement));
-      delete[] statement_;
+      free_with_policy(statement_);
       
       statement_ = new_statement;
       
       n_allocated_statements_ = new_size;
     }
 
+    // Copy the stacks into new arrays of the same size, allocated
+    // according to the current policy
+    void
+    StackStorageOrig::reallocate_stack()
+    {
+      Statement* new_statement
+	= allocate_array<Statement>(n_allocated_statements_, allocation_policy_);
+      Real* new_multiplier
+	= allocate_array<Real>(n_allocated_operations_, allocation_policy_);
+      uIndex* new_index
+	= allocate_array<uIndex>(n_allocated_operations_, allocation_policy_);
+      std::memcpy(new_statement, statement_,
+		  n_statements_*sizeof(Statement));
+      std::memcpy(new_multiplier, multiplier_, n_operations_*sizeof(Real));
+      std::memcpy(new_index, index_, n_operations_*sizeof(uIndex));
+      free_with_policy(statement_);
+      free_with_policy(multiplier_);
+      free_with_policy(index_);
+      statement_ = new_statement;
+      multiplier_ = new_multiplier;
+      index_ = new_index;
+    }
+
   }
 }
@@ -0,0 +1,212 @@
+/* allocation_policy.cpp -- Allocation of the recording and gradient list
+
+    Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   The allocation policies are described in allocation_policy.h.
+   Arrays to which a policy applies are mapped directly with mmap;
+   the others, and any for which mapping fails, come from malloc.
+   Either way the array is preceded by a header of HEADER_BYTES
+   (which preserves 64-byte alignment of mapped arrays) holding the
+   length of the mapping, or zero if the array came from malloc.
+
+*/
+
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+
+#ifdef __unix__
+#include <unistd.h>  // Defines _POSIX_VERSION and _POSIX_MAPPED_FILES
+#endif
+
+#if defined(_POSIX_MAPPED_FILES) && _POSIX_MAPPED_FILES > 0
+#define ADEPT_HAVE_MMAP 1
+#include <sys/types.h>
+#include <sys/mman.h>
+#endif
+
+#include <adept/allocation_policy.h>
+#include <adept/exception.h>
+
+namespace adept {
+  namespace internal {
+
+    // Bytes preceding each array, of which the first holds the length
+    // of the mapping
+    enum { HEADER_BYTES = 64 };
+
+#ifdef ADEPT_HAVE_MMAP
+
+    static std::size_t
+    round_up_to(std::size_t n, std::size_t multiple)
+    {
+      return ((n + multiple - 1) / multiple) * multiple;
+    }
+
+    // Return the default huge page size from /proc/meminfo, or 2 MiB
+    // if it cannot be read
+    static std::size_t
+    huge_page_size()
+    {
+      static std::size_t size = 0;
+      if (size == 0) {
+	std::size_t kb = 2048;
+	std::FILE* file = std::fopen("/proc/meminfo", "r");
+	if (file) {
+	  char line[256];
+	  while (std::fgets(line, sizeof(line), file)) {
+	    unsigned long value;
+	    if (std::sscanf(line, "Hugepagesize: %lu kB", &value) == 1) {
+	      kb = value;
+	      break;
+	    }
+	  }
+	  std::fclose(file);
+	}
+	size = kb * 1024;
+      }
+      return size;
+    }
+
+    // Map "length" bytes of anonymous memory aligned to "alignment",
+    // returning 0 on failure
+    static char*
+    map_aligned(std::size_t length, std::size_t alignment)
+    {
+      void* mapping = mmap(0, length + alignment, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (mapping == MAP_FAILED) {
+	return 0;
+      }
+      // Unmap the parts before and after the aligned region
+      char* start = static_cast<char*>(mapping);
+      char* aligned = reinterpret_cast<char*>
+	(round_up_to(reinterpret_cast<std::size_t>(start), alignment));
+      if (aligned > start) {
+	munmap(start, aligned - start);
+      }
+      if (start + alignment > aligned) {
+	munmap(aligned + length, start + alignment - aligned);
+      }
+      return aligned;
+    }
+
+    // Map memory for an array according to the policy, storing the
+    // length of the mapping in "length" and returning 0 on failure
+    static char*
+    map_with_policy(std::size_t bytes, int policy, std::size_t& length)
+    {
+      static const std::size_t page_size = sysconf(_SC_PAGESIZE);
+      char* data = 0;
+#ifdef MAP_HUGETLB
+      if (policy & ALLOCATE_EXPLICIT_HUGE_PAGES) {
+	length = round_up_to(bytes, huge_page_size());
+	void* mapping = mmap(0, length, PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (mapping != MAP_FAILED) {
+	  data = static_cast<char*>(mapping);
+	}
+      }
+#endif
+      if (!data && (policy & (ALLOCATE_TRANSPARENT_HUGE_PAGES
+			      | ALLOCATE_EXPLICIT_HUGE_PAGES))) {
+	length = round_up_to(bytes, huge_page_size());
+	data = map_aligned(length, huge_page_size());
+#ifdef MADV_HUGEPAGE
+	if (data) {
+	  madvise(data, length, MADV_HUGEPAGE);
+	}
+#endif
+      }
+      if (!data && !(policy & (ALLOCATE_TRANSPARENT_HUGE_PAGES
+			       | ALLOCATE_EXPLICIT_HUGE_PAGES))) {
+	length = round_up_to(bytes, page_size);
+	void* mapping = mmap(0, length, PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping != MAP_FAILED) {
+	  data = static_cast<char*>(mapping);
+	}
+      }
+      if (data && (policy & ALLOCATE_PREFAULT)) {
+	// Fresh anonymous pages are zero, so writing zero to each one
+	// faults it in without changing its contents
+	volatile char* page = data;
+	for (std::size_t i = 0; i < length; i += page_size) {
+	  page[i] = 0;
+	}
+      }
+      return data;
+    }
+
+#endif
+
+    // Check that the policy can be honoured on this platform
+    void
+    check_allocation_policy(int policy)
+    {
+      if (policy & ~ALLOCATE_ALL_FLAGS) {
+	throw feature_not_available("Unknown flag in allocation policy"
+				    ADEPT_EXCEPTION_LOCATION);
+      }
+#ifdef ADEPT_HAVE_MMAP
+#if !defined(MADV_HUGEPAGE) && !defined(MAP_HUGETLB)
+      if (policy & (ALLOCATE_TRANSPARENT_HUGE_PAGES
+		    | ALLOCATE_EXPLICIT_HUGE_PAGES)) {
+	throw feature_not_available("Huge pages not supported on this platform"
+				    ADEPT_EXCEPTION_LOCATION);
+      }
+#endif
+#else
+      if (policy != ALLOCATE_DEFAULT) {
+	throw feature_not_available("Allocation policies require mmap, which is not available on this platform"
+				    ADEPT_EXCEPTION_LOCATION);
+      }
+#endif
+    }
+
+    // Allocate memory according to the policy
+    void*
+    allocate_with_policy(std::size_t bytes, int policy)
+    {
+      char* data = 0;
+      std::size_t length = 0;
+#ifdef ADEPT_HAVE_MMAP
+      if (policy != ALLOCATE_DEFAULT && bytes >= MIN_MAPPED_BYTES) {
+	data = map_with_policy(bytes + HEADER_BYTES, policy, length);
+      }
+#endif
+      if (!data) {
+	data = static_cast<char*>(std::malloc(bytes + HEADER_BYTES));
+	if (!data) {
+	  throw std::bad_alloc();
+	}
+	length = 0;
+      }
+      *reinterpret_cast<std::size_t*>(data) = length;
+      return data + HEADER_BYTES;
+    }
+
+    // Free memory allocated by allocate_with_policy
+    void
+    free_with_policy(void* data)
+    {
+      if (data) {
+	char* start = static_cast<char*>(data) - HEADER_BYTES;
+	std::size_t length = *reinterpret_cast<std::size_t*>(start);
+	if (length == 0) {
+	  std::free(start);
+	}
+#ifdef ADEPT_HAVE_MMAP
+	else {
+	  munmap(start, length);
+	}
+#endif
+      }
+    }
+
+  } // End namespace internal
+} // End namespace adept
@@ -0,0 +1,421 @@
+/* builtin_blas.cpp -- Built-in replacements for selected BLAS functions
+
+    Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   Matrix-matrix multiplication follows the usual design of optimized
+   BLAS libraries: op(B) is copied in panels of KC rows and NC
+   columns into slivers of NR columns, op(A) is copied in blocks of
+   MC rows and KC columns into slivers of MR rows (scaled by alpha),
+   and each MR-by-NR tile of C is then accumulated by a "micro-kernel"
+   that holds the tile in registers as packets (see Packet.h).  The
+   block sizes are chosen so that a sliver of B stays in the level-1
+   cache and a block of A in the level-2 cache.  If Adept is compiled
+   with OpenMP then the blocks of A are shared between threads for
+   large matrices.
+
+   The matrix-vector functions copy strided vectors to contiguous
+   arrays and arrange their loops so that the innermost loop is over
+   contiguous elements of the matrix, which the compiler can
+   vectorize.  Symmetric matrix-matrix multiplication expands the
+   symmetric matrix to a dense one and calls the matrix-matrix
+   multiplication.
+
+*/
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include <adept/Packet.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// If ADEPT_SOURCE_H is defined then we are in a header file generated
+// from all the source files, so builtin_blas.h will already have been
+// included
+#ifndef AdeptSource_H
+#include "builtin_blas.h"
+#endif
+
+namespace adept {
+  namespace internal {
+
+#ifdef HAVE_BLAS
+    bool use_builtin_blas_ = false;
+#else
+    bool use_builtin_blas_ = true;
+#endif
+
+    // Block sizes for matrix-matrix multiplication: the micro-kernel
+    // computes an MR-by-NR tile of C, where NR is two packets
+    template <typename T>
+    struct GemmBlocking {
+      static const int MR = 4;
+      static const int NR = 2*Packet<T>::size;
+      static const int KC = 256;
+      static const int MC = 128;
+      static const int NC = 2048;
+    };
+
+    // Work per block of A above which OpenMP threads are used
+    static const double builtin_blas_min_parallel_work = 4.0e6;
+
+    static inline bool
+    is_no_trans(char trans) {
+      return trans == 'N' || trans == 'n';
+    }
+
+    static inline bool
+    is_upper(char uplo) {
+      return uplo == 'U' || uplo == 'u';
+    }
+
+    // Index of element i of a vector of length n with increment inc,
+    // following the BLAS convention for negative increments
+    static inline int
+    blas_vector_index(int i, int n, int inc) {
+      return inc > 0 ? i*inc : (i+1-n)*inc;
+    }
+
+    // Copy a strided vector to a contiguous one
+    template <typename T>
+    static void
+    builtin_blas_gather(int n, const T* x, int incx, T* out) {
+      for (int i = 0; i < n; ++i) {
+	out[i] = x[blas_vector_index(i, n, incx)];
+      }
+    }
+
+    // y = beta*y + alpha*work, where y is strided and work is
+    // contiguous
+    template <typename T>
+    static void
+    builtin_blas_update(int n, T alpha, const T* work, T beta,
+			T* y, int incy) {
+      for (int i = 0; i < n; ++i) {
+	T& yi = y[blas_vector_index(i, n, incy)];
+	if (beta == 0.0) {
+	  yi = alpha*work[i];
+	}
+	else {
+	  yi = beta*yi + alpha*work[i];
+	}
+      }
+    }
+
+    // Compute the MR-by-NR tile "c" (row-major) from a sliver of A
+    // holding MR values per k and a sliver of B holding NR values
+    // per k, both aligned to packet boundaries
+    template <typename T>
+    static inline void
+    gemm_micro_kernel(int kc, const T* __restrict a, const T* __restrict b,
+		      T* __restrict c) {
+      typedef Packet<T> P;
+      static const int NR = GemmBlocking<T>::NR;
+      P c00, c01, c10, c11, c20, c21, c30, c31;
+      for (int p = 0; p < kc; ++p, a += GemmBlocking<T>::MR, b += NR) {
+	P b0(b), b1(b+P::size);
+	P a0(a[0]);
+	c00 += a0*b0;
+	c01 += a0*b1;
+	P a1(a[1]);
+	c10 += a1*b0;
+	c11 += a1*b1;
+	P a2(a[2]);
+	c20 += a2*b0;
+	c21 += a2*b1;
+	P a3(a[3]);
+	c30 += a3*b0;
+	c31 += a3*b1;
+      }
+      c00.put(c);      c01.put(c+P::size);
+      c10.put(c+NR);   c11.put(c+NR+P::size);
+      c20.put(c+2*NR); c21.put(c+2*NR+P::size);
+      c30.put(c+3*NR); c31.put(c+3*NR+P::size);
+    }
+
+    // C = alpha*op(A)*op(B) + beta*C for column-major matrices, where
+    // op(A) is m-by-k and op(B) is k-by-n
+    template <typename T>
+    static void
+    builtin_gemm(char transa, char transb, int m, int n, int k,
+		 T alpha, const T* a, int lda, const T* b, int ldb,
+		 T beta, T* c, int ldc) {
+      typedef GemmBlocking<T> B;
+      if (beta != 1.0) {
+	for (int j = 0; j < n; ++j) {
+	  for (int i = 0; i < m; ++i) {
+	    c[i+j*ldc] = beta == 0.0 ? 0.0 : beta*c[i+j*ldc];
+	  }
+	}
+      }
+      if (m == 0 || n == 0 || k == 0 || alpha == 0.0) {
+	return;
+      }
+      // Element op(A)(i,p) is at a[i*a_row+p*a_col], element
+      // op(B)(p,j) at b[p*b_row+j*b_col]
+      const int a_row = is_no_trans(transa) ? 1 : lda;
+      const int a_col = is_no_trans(transa) ? lda : 1;
+      const int b_row = is_no_trans(transb) ? 1 : ldb;
+      const int b_col = is_no_trans(transb) ? ldb : 1;
+
+      T* b_pack = alloc_aligned<T>(B::KC*B::NC);
+      for (int jc = 0; jc < n; jc += B::NC) {
+	const int nc = std::min(n-jc, B::NC);
+	for (int pc = 0; pc < k; pc += B::KC) {
+	  const int kc = std::min(k-pc, B::KC);
+	  // Pack a KC-by-NC panel of op(B), padding the last sliver
+	  // with zeros
+	  for (int jr = 0; jr < nc; jr += B::NR) {
+	    T* bp = b_pack + jr*kc;
+	    const int nr = std::min(nc-jr, B::NR);
+	    for (int p = 0; p < kc; ++p, bp += B::NR) {
+	      const T* bb = b + (pc+p)*b_row + (jc+jr)*b_col;
+	      for (int j = 0; j < nr; ++j) {
+		bp[j] = bb[j*b_col];
+	      }
+	      for (int j = nr; j < B::NR; ++j) {
+		bp[j] = 0.0;
+	      }
+	    }
+	  }
+	  const int n_blocks = (m + B::MC - 1) / B::MC;
+#ifdef _OPENMP
+#pragma omp parallel if (n_blocks > 1 && !omp_in_parallel()			\
+			 && static_cast<double>(B::MC)*nc*kc > builtin_blas_min_parallel_work)
+#endif
+	  {
+	    T* a_pack = alloc_aligned<T>(B::MC*B::KC);
+	    T* tile   = alloc_aligned<T>(B::MR*B::NR);
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+	    for (int iblock = 0; iblock < n_blocks; ++iblock) {
+	      const int ic = iblock*B::MC;
+	      const int mc = std::min(m-ic, B::MC);
+	      // Pack an MC-by-KC block of alpha*op(A), padding the
+	      // last sliver with zeros
+	      for (int ir = 0; ir < mc; ir += B::MR) {
+		T* ap = a_pack + ir*kc;
+		const int mr = std::min(mc-ir, B::MR);
+		for (int p = 0; p < kc; ++p, ap += B::MR) {
+		  const T* aa = a + (ic+ir)*a_row + (pc+p)*a_col;
+		  for (int i = 0; i < mr; ++i) {
+		    ap[i] = alpha*aa[i*a_row];
+		  }
+		  for (int i = mr; i < B::MR; ++i) {
+		    ap[i] = 0.0;
+		  }
+		}
+	      }
+	      // Accumulate each tile of C
+	      for (int jr = 0; jr < nc; jr += B::NR) {
+		const int nr = std::min(nc-jr, B::NR);
+		for (int ir = 0; ir < mc; ir += B::MR) {
+		  const int mr = std::min(mc-ir, B::MR);
+		  gemm_micro_kernel(kc, a_pack + ir*kc, b_pack + jr*kc, tile);
+		  T* cc = c + (ic+ir) + (jc+jr)*ldc;
+		  for (int j = 0; j < nr; ++j) {
+		    for (int i = 0; i < mr; ++i) {
+		      cc[i+j*ldc] += tile[i*B::NR+j];
+		    }
+		  }
+		}
+	      }
+	    }
+	    free_aligned(tile);
+	    free_aligned(a_pack);
+	  }
+	}
+      }
+      free_aligned(b_pack);
+    }
+
+    // y = alpha*op(A)*x + beta*y for a column-major m-by-n matrix A
+    template <typename T>
+    static void
+    builtin_gemv(char trans, int m, int n, T alpha, const T* a, int lda,
+		 const T* x, int incx, T beta, T* y, int incy) {
+      const int nx = is_no_trans(trans) ? n : m;
+      const int ny = is_no_trans(trans) ? m : n;
+      std::vector<T> xc(nx), work(ny, 0.0);
+      builtin_blas_gather(nx, x, incx, &xc[0]);
+      if (is_no_trans(trans)) {
+	// Add columns of A to the result four at a time
+	T* __restrict w = &work[0];
+	int j = 0;
+	for ( ; j+3 < n; j += 4) {
+	  const T* __restrict a0 = a + j*lda;
+	  const T* __restrict a1 = a0 + lda;
+	  const T* __restrict a2 = a1 + lda;
+	  const T* __restrict a3 = a2 + lda;
+	  const T x0 = xc[j], x1 = xc[j+1], x2 = xc[j+2], x3 = xc[j+3];
+	  for (int i = 0; i < m; ++i) {
+	    w[i] += a0[i]*x0 + a1[i]*x1 + a2[i]*x2 + a3[i]*x3;
+	  }
+	}
+	for ( ; j < n; ++j) {
+	  const T* __restrict a0 = a + j*lda;
+	  const T x0 = xc[j];
+	  for (int i = 0; i < m; ++i) {
+	    w[i] += a0[i]*x0;
+	  }
+	}
+      }
+      else {
+	// Dot product of each column of A with x
+	const T* __restrict xx = &xc[0];
+	for (int j = 0; j < n; ++j) {
+	  const T* __restrict a0 = a + j*lda;
+	  T sum = 0.0;
+	  for (int i = 0; i < m; ++i) {
+	    sum += a0[i]*xx[i];
+	  }
+	  work[j] = sum;
+	}
+      }
+      builtin_blas_update(ny, alpha, &work[0], beta, y, incy);
+    }
+
+    // C = alpha*A*B + beta*C (side "L") or C = alpha*B*A + beta*C
+    // (side "R") where A is symmetric with only the "uplo" triangle
+    // referenced and C is m-by-n
+    template <typename T>
+    static void
+    builtin_symm(char side, char uplo, int m, int n, T alpha,
+		 const T* a, int lda, const T* b, int ldb, T beta,
+		 T* c, int ldc) {
+      const bool is_left = (side == 'L' || side == 'l');
+      const int na = is_left ? m : n;
+      std::vector<T> full(na*na);
+      for (int j = 0; j < na; ++j) {
+	for (int i = 0; i < na; ++i) {
+	  bool is_stored = is_upper(uplo) ? (i <= j) : (i >= j);
+	  full[i+j*na] = is_stored ? a[i+j*lda] : a[j+i*lda];
+	}
+      }
+      if (is_left) {
+	builtin_gemm('N', 'N', m, n, m, alpha, &full[0], na, b, ldb,
+		     beta, c, ldc);
+      }
+      else {
+	builtin_gemm('N', 'N', m, n, n, alpha, b, ldb, &full[0], na,
+		     beta, c, ldc);
+      }
+    }
+
+    // y = alpha*A*x + beta*y where A is an n-by-n symmetric matrix
+    // with only the "uplo" triangle referenced
+    template <typename T>
+    static void
+    builtin_symv(char uplo, int n, T alpha, const T* a, int lda,
+		 const T* x, int incx, T beta, T* y, int incy) {
+      std::vector<T> xc(n), work(n, 0.0);
+      builtin_blas_gather(n, x, incx, &xc[0]);
+      T* __restrict w = &work[0];
+      const T* __restrict xx = &xc[0];
+      for (int j = 0; j < n; ++j) {
+	// Each stored element in column j contributes to element i
+	// of the result via A(i,j) and to element j via A(j,i)
+	const T* __restrict aj = a + j*lda;
+	const int i_start = is_upper(uplo) ? 0 : j+1;
+	const int i_end   = is_upper(uplo) ? j : n;
+	const T xj = xx[j];
+	T sum = 0.0;
+	for (int i = i_start; i < i_end; ++i) {
+	  w[i] += aj[i]*xj;
+	  sum  += aj[i]*xx[i];
+	}
+	w[j] += aj[j]*xj + sum;
+      }
+      builtin_blas_update(n, alpha, w, beta, y, incy);
+    }
+
+    // y = alpha*op(A)*x + beta*y where A is an m-by-n band matrix
+    // with kl sub-diagonals and ku super-diagonals, element (i,j)
+    // being stored in a[ku+i-j+j*lda]
+    template <typename T>
+    static void
+    builtin_gbmv(char trans, int m, int n, int kl, int ku, T alpha,
+		 const T* a, int lda, const T* x, int incx, T beta,
+		 T* y, int incy) {
+      const int nx = is_no_trans(trans) ? n : m;
+      const int ny = is_no_trans(trans) ? m : n;
+      std::vector<T> xc(nx), work(ny, 0.0);
+      builtin_blas_gather(nx, x, incx, &xc[0]);
+      T* __restrict w = &work[0];
+      const T* __restrict xx = &xc[0];
+      for (int j = 0; j < n; ++j) {
+	const T* __restrict aj = a + ku - j + j*lda;
+	const int i_start = std::max(0, j-ku);
+	const int i_end   = std::min(m, j+kl+1);
+	if (is_no_trans(trans)) {
+	  const T xj = xx[j];
+	  for (int i = i_start; i < i_end; ++i) {
+	    w[i] += aj[i]*xj;
+	  }
+	}
+	else {
+	  T sum = 0.0;
+	  for (int i = i_start; i < i_end; ++i) {
+	    sum += aj[i]*xx[i];
+	  }
+	  w[j] = sum;
+	}
+      }
+      builtin_blas_update(ny, alpha, w, beta, y, incy);
+    }
+
+    // Versions with the same interface as the Fortran BLAS functions
+#define ADEPT_DEFINE_BUILTIN_BLAS(T, GEMM, GEMV, SYMM, SYMV, GBMV)	\
+    void GEMM(const char* TransA, const char* TransB, const int* M,	\
+	      const int* N, const int* K, const T* alpha,		\
+	      const T* A, const int* lda, const T* B, const int* ldb,	\
+	      const T* beta, T* C, const int* ldc) {			\
+      builtin_gemm(*TransA, *TransB, *M, *N, *K, *alpha, A, *lda,	\
+		   B, *ldb, *beta, C, *ldc);				\
+    }									\
+    void GEMV(const char* TransA, const int* M, const int* N,		\
+	      const T* alpha, const T* A, const int* lda, const T* X,	\
+	      const int* incX, const T* beta, T* Y, const int* incY) {	\
+      builtin_gemv(*TransA, *M, *N, *alpha, A, *lda, X, *incX,		\
+		   *beta, Y, *incY);					\
+    }									\
+    void SYMM(const char* side, const char* uplo, const int* M,	\
+	      const int* N, const T* alpha, const T* A, const int* lda,	\
+	      const T* B, const int* ldb, const T* beta, T* C,		\
+	      const int* ldc) {						\
+      builtin_symm(*side, *uplo, *M, *N, *alpha, A, *lda, B, *ldb,	\
+		   *beta, C, *ldc);					\
+    }									\
+    void SYMV(const char* uplo, const int* N, const T* alpha,		\
+	      const T* A, const int* lda, const T* X, const int* incX,	\
+	      const T* beta, T* Y, const int* incY) {			\
+      builtin_symv(*uplo, *N, *alpha, A, *lda, X, *incX, *beta,	\
+		   Y, *incY);						\
+    }									\
+    void GBMV(const char* TransA, const int* M, const int* N,		\
+	      const int* kl, const int* ku, const T* alpha, const T* A,	\
+	      const int* lda, const T* X, const int* incX,		\
+	      const T* beta, T* Y, const int* incY) {			\
+      builtin_gbmv(*TransA, *M, *N, *kl, *ku, *alpha, A, *lda,		\
+		   X, *incX, *beta, Y, *incY);				\
+    }
+    ADEPT_DEFINE_BUILTIN_BLAS(float,  builtin_sgemm, builtin_sgemv,
+			      builtin_ssymm, builtin_ssymv, builtin_sgbmv)
+    ADEPT_DEFINE_BUILTIN_BLAS(double, builtin_dgemm, builtin_dgemv,
+			      builtin_dsymm, builtin_dsymv, builtin_dgbmv)
+#undef ADEPT_DEFINE_BUILTIN_BLAS
+
+  } // End namespace internal
+} // End namespace adept
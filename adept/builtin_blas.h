@@ -0,0 +1,56 @@
+/* builtin_blas.h -- Built-in replacements for selected BLAS functions
+
+    Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   The functions declared here have the same arguments and
+   column-major behaviour as the Fortran BLAS functions of the same
+   name without the "builtin_" prefix and trailing underscore, so
+   that the C++ interface in cppblas.cpp can call either.  They are
+   used if Adept is compiled without BLAS, or if
+   adept::set_use_builtin_blas(true) has been called.
+
+*/
+
+#ifndef AdeptBuiltinBlas_H
+#define AdeptBuiltinBlas_H 1
+
+namespace adept {
+  namespace internal {
+
+    // True if the functions below are used in place of an external
+    // BLAS library
+    extern bool use_builtin_blas_;
+
+#define ADEPT_DECLARE_BUILTIN_BLAS(T, GEMM, GEMV, SYMM, SYMV, GBMV)	\
+    void GEMM(const char* TransA, const char* TransB, const int* M,	\
+	      const int* N, const int* K, const T* alpha,		\
+	      const T* A, const int* lda, const T* B, const int* ldb,	\
+	      const T* beta, T* C, const int* ldc);			\
+    void GEMV(const char* TransA, const int* M, const int* N,		\
+	      const T* alpha, const T* A, const int* lda, const T* X,	\
+	      const int* incX, const T* beta, T* Y, const int* incY);	\
+    void SYMM(const char* side, const char* uplo, const int* M,	\
+	      const int* N, const T* alpha, const T* A, const int* lda,	\
+	      const T* B, const int* ldb, const T* beta, T* C,		\
+	      const int* ldc);						\
+    void SYMV(const char* uplo, const int* N, const T* alpha,		\
+	      const T* A, const int* lda, const T* X, const int* incX,	\
+	      const T* beta, T* Y, const int* incY);			\
+    void GBMV(const char* TransA, const int* M, const int* N,		\
+	      const int* kl, const int* ku, const T* alpha, const T* A,	\
+	      const int* lda, const T* X, const int* incX,		\
+	      const T* beta, T* Y, const int* incY);
+    ADEPT_DECLARE_BUILTIN_BLAS(float,  builtin_sgemm, builtin_sgemv,
+			       builtin_ssymm, builtin_ssymv, builtin_sgbmv)
+    ADEPT_DECLARE_BUILTIN_BLAS(double, builtin_dgemm, builtin_dgemv,
+			       builtin_dsymm, builtin_dsymv, builtin_dgbmv)
+#undef ADEPT_DECLARE_BUILTIN_BLAS
+
+  } // End namespace internal
+} // End namespace adept
+
+#endif
@@ -8,7 +8,10 @@
 
    This file provides a C++ interface to selected Level-2 and -3 BLAS
    functions in which the precision of the arguments (float versus
-   double) is inferred via overloading
+   double) is inferred via overloading.  The functions of an external
+   BLAS library are called if Adept was compiled with one, unless
+   adept::set_use_builtin_blas(true) has been called, otherwise the
+   built-in functions in builtin_blas.cpp are called.
 
 */
 
@@ -19,23 +22,30 @@
 #include "config.h"
 #endif
 
+// If ADEPT_SOURCE_H is defined then we are in a header file generated
+// from all the source files, so builtin_blas.h will already have been
+// included
+#ifndef AdeptSource_H
+#include "builtin_blas.h"
+#endif
+
 #ifdef HAVE_BLAS
 
 extern "C" {
   void sgemm_(const char* TransA, const char* TransB, const int* M,
 	      const int* N, const int* K, const float* alpha,
 	      const float* A, const int* lda, const float* B, const int* ldb,
-	      const float* beta, const float* C, const int* ldc);
+	      const float* beta, float* C, const int* ldc);
   void dgemm_(const char* TransA, const char* TransB, const int* M,
 	      const int* N, const int* K, const double* alpha,
 	      const double* A, const int* lda, const double* B, const int* ldb,
-	      const double* beta, const double* C, const int* ldc);
+	      const double* beta, double* C, const int* ldc);
   void sgemv_(const char* TransA, const int* M, const int* N, const float* alpha,
 	      const float* A, const int* lda, const float* X, const int* incX,
-	      const float* beta, const float* Y, const int* incY);
+	      const float* beta, float* Y, const int* incY);
   void dgemv_(const char* TransA, const int* M, const int* N, const double* alpha,
 	      const double* A, const int* lda, const double* X, const int* incX,
-	      const double* beta, const double* Y, const int* incY);
+	      const double* beta, double* Y, const int* incY);
   void ssymm_(const char* side, const char* uplo, const int* M, const int* N,
 	      const float* alpha, const float* A, const int* lda, const float* B,
 	      const int* ldb, const float* beta, float* C, const int* ldc);
@@ -44,20 +54,30 @@ extern "C" {
 	      const int* ldb, const double* beta, double* C, const int* ldc);
   void ssymv_(const char* uplo, const int* N, const float* alpha, const float* A, 
 	      const int* lda, const float* X, const int* incX, const float* beta, 
-	      const float* Y, const int* incY);
+	      float* Y, const int* incY);
   void dsymv_(const char* uplo, const int* N, const double* alpha, const double* A, 
 	      const int* lda, const double* X, const int* incX, const double* beta, 
-	      const double* Y, const int* incY);
+	      double* Y, const int* incY);
   void sgbmv_(const char* TransA, const int* M, const int* N, const int* kl, 
 	      const int* ku, const float* alpha, const float* A, const int* lda,
 	      const float* X, const int* incX, const float* beta, 
-	      const float* Y, const int* incY);
+	      float* Y, const int* incY);
   void dgbmv_(const char* TransA, const int* M, const int* N, const int* kl, 
 	      const int* ku, const double* alpha, const double* A, const int* lda,
 	      const double* X, const int* incX, const double* beta, 
-	      const double* Y, const int* incY);
+	      double* Y, const int* incY);
 }
 
+// Call the external BLAS function FUNC unless the built-in
+// replacement BUILTIN has been requested
+#define ADEPT_BLAS_FUNC(FUNC, BUILTIN) (use_builtin_blas_ ? BUILTIN : FUNC)
+
+#else
+
+#define ADEPT_BLAS_FUNC(FUNC, BUILTIN) BUILTIN
+
+#endif
+
 namespace adept {
 
   namespace internal {
@@ -80,8 +100,8 @@ namespace adept {
 	     A, &lda, &beta, C, &ldc);				\
       }								\
     }
-    ADEPT_DEFINE_GEMM(double, dgemm_, zgemm_)
-    ADEPT_DEFINE_GEMM(float,  sgemm_, cgemm_)
+    ADEPT_DEFINE_GEMM(double, ADEPT_BLAS_FUNC(dgemm_, builtin_dgemm), zgemm_)
+    ADEPT_DEFINE_GEMM(float,  ADEPT_BLAS_FUNC(sgemm_, builtin_sgemm), cgemm_)
 #undef ADEPT_DEFINE_GEMM
     
     // Matrix-vector multiplication for a general dense matrix
@@ -103,8 +123,8 @@ namespace adept {
 	     &beta, Y, &incY);					\
       }								\
     }
-    ADEPT_DEFINE_GEMV(double, dgemv_, zgemv_)
-    ADEPT_DEFINE_GEMV(float,  sgemv_, cgemv_)
+    ADEPT_DEFINE_GEMV(double, ADEPT_BLAS_FUNC(dgemv_, builtin_dgemv), zgemv_)
+    ADEPT_DEFINE_GEMV(float,  ADEPT_BLAS_FUNC(sgemv_, builtin_sgemv), cgemv_)
 #undef ADEPT_DEFINE_GEMV
     
     // Matrix-matrix multiplication where matrix A is symmetric
@@ -128,8 +148,8 @@ namespace adept {
 	     B, &ldb, &beta, C, &ldc);					\
       }									\
     }
-    ADEPT_DEFINE_SYMM(double, dsymm_, zsymm_)
-    ADEPT_DEFINE_SYMM(float,  ssymm_, csymm_)
+    ADEPT_DEFINE_SYMM(double, ADEPT_BLAS_FUNC(dsymm_, builtin_dsymm), zsymm_)
+    ADEPT_DEFINE_SYMM(float,  ADEPT_BLAS_FUNC(ssymm_, builtin_ssymm), csymm_)
 #undef ADEPT_DEFINE_SYMM
     
     // Matrix-vector multiplication where the matrix is symmetric
@@ -147,8 +167,8 @@ namespace adept {
         FUNC(&UploNew, &N, &alpha, A, &lda, X, &incX, &beta, Y, &incY);	\
       }									\
     }
-    ADEPT_DEFINE_SYMV(double, dsymv_, zsymv_)
-    ADEPT_DEFINE_SYMV(float,  ssymv_, csymv_)
+    ADEPT_DEFINE_SYMV(double, ADEPT_BLAS_FUNC(dsymv_, builtin_dsymv), zsymv_)
+    ADEPT_DEFINE_SYMV(float,  ADEPT_BLAS_FUNC(ssymv_, builtin_ssymv), csymv_)
 #undef ADEPT_DEFINE_SYMV
     
     // Matrix-vector multiplication for a general band matrix
@@ -171,96 +191,11 @@ namespace adept {
 	     X, &incX, &beta, Y, &incY);			\
       }								\
     }
-    ADEPT_DEFINE_GBMV(double, dgbmv_, zgbmv_)
-    ADEPT_DEFINE_GBMV(float,  sgbmv_, cgbmv_)
+    ADEPT_DEFINE_GBMV(double, ADEPT_BLAS_FUNC(dgbmv_, builtin_dgbmv), zgbmv_)
+    ADEPT_DEFINE_GBMV(float,  ADEPT_BLAS_FUNC(sgbmv_, builtin_sgbmv), cgbmv_)
 #undef ADEPT_DEFINE_GBMV
+#undef ADEPT_BLAS_FUNC
   
   } // End namespace internal
   
 } // End namespace adept
-  
-
-#else // Don't have BLAS
-
-
-namespace adept {
-
-  namespace internal {
-    
-    // Matrix-matrix multiplication for general dense matrices
-#define ADEPT_DEFINE_GEMM(T, FUNC, FUNC_COMPLEX)		\
-    void cppblas_gemm(BLAS_ORDER Order,				\
-		      BLAS_TRANSPOSE TransA,			\
-		      BLAS_TRANSPOSE TransB,			\
-		      int M, int N,				\
-		      int K, T alpha, const T *A,		\
-		      int lda, const T *B, int ldb,		\
-		      T beta, T *C, int ldc) {			\
-      throw feature_not_available("Cannot perform matrix-matrix multiplication because compiled without BLAS"); \
-    }
-    ADEPT_DEFINE_GEMM(double, dgemm_, zgemm_)
-    ADEPT_DEFINE_GEMM(float,  sgemm_, cgemm_)
-#undef ADEPT_DEFINE_GEMM
-    
-    // Matrix-vector multiplication for a general dense matrix
-#define ADEPT_DEFINE_GEMV(T, FUNC, FUNC_COMPLEX)		\
-    void cppblas_gemv(const BLAS_ORDER Order,			\
-		      const BLAS_TRANSPOSE TransA,		\
-		      const int M, const int N,			\
-		      const T alpha, const T *A, const int lda,	\
-		      const T *X, const int incX, const T beta,	\
-		      T *Y, const int incY) {			\
-      throw feature_not_available("Cannot perform matrix-vector multiplication because compiled without BLAS"); \
-    }
-    ADEPT_DEFINE_GEMV(double, dgemv_, zgemv_)
-    ADEPT_DEFINE_GEMV(float,  sgemv_, cgemv_)
-#undef ADEPT_DEFINE_GEMV
-    
-    // Matrix-matrix multiplication where matrix A is symmetric
-    // FIX! CHECK ROW MAJOR VERSION IS RIGHT			
-#define ADEPT_DEFINE_SYMM(T, FUNC, FUNC_COMPLEX)			\
-    void cppblas_symm(const BLAS_ORDER Order,				\
-		      const BLAS_SIDE Side,				\
-		      const BLAS_UPLO Uplo,				\
-		      const int M, const int N,				\
-		      const T alpha, const T *A, const int lda,		\
-		      const T *B, const int ldb, const T beta,		\
-		      T *C, const int ldc) {				\
-      throw feature_not_available("Cannot perform symmetric matrix-matrix multiplication because compiled without BLAS"); \
-    }
-    ADEPT_DEFINE_SYMM(double, dsymm_, zsymm_)
-    ADEPT_DEFINE_SYMM(float,  ssymm_, csymm_)
-#undef ADEPT_DEFINE_SYMM
-    
-    // Matrix-vector multiplication where the matrix is symmetric
-#define ADEPT_DEFINE_SYMV(T, FUNC, FUNC_COMPLEX)			\
-    void cppblas_symv(const BLAS_ORDER Order,				\
-		      const BLAS_UPLO Uplo,				\
-		      const int N, const T alpha, const T *A,		\
-		      const int lda, const T *X, const int incX,	\
-		      const T beta, T *Y, const int incY) {		\
-      throw feature_not_available("Cannot perform symmetric matrix-vector multiplication because compiled without BLAS"); \
-    }
-    ADEPT_DEFINE_SYMV(double, dsymv_, zsymv_)
-    ADEPT_DEFINE_SYMV(float,  ssymv_, csymv_)
-#undef ADEPT_DEFINE_SYMV
-    
-    // Matrix-vector multiplication for a general band matrix
-#define ADEPT_DEFINE_GBMV(T, FUNC, FUNC_COMPLEX)		\
-    void cppblas_gbmv(const BLAS_ORDER Order,			\
-		      const BLAS_TRANSPOSE TransA,		\
-		      const int M, const int N,			\
-		      const int KL, const int KU, const T alpha,\
-		      const T *A, const int lda, const T *X,	\
-		      const int incX, const T beta, T *Y,	\
-		      const int incY) {				\
-      throw feature_not_available("Cannot perform band matrix-vector multiplication because compiled without BLAS"); \
-    }
-    ADEPT_DEFINE_GBMV(double, dgbmv_, zgbmv_)
-    ADEPT_DEFINE_GBMV(float,  sgbmv_, cgbmv_)
-#undef ADEPT_DEFINE_GBMV
-
-  }
-}
-
-#endif
@@ -42,6 +42,10 @@ extern "C" {
 	      int* ipiv, float* b, const int* ldb, int* info);
   void dgesv_(const int* n, const int* nrhs, double* a, const int* lda, 
 	      int* ipiv, double* b, const int* ldb, int* info);
+  void sgetrs_(const char* trans, const int* n, const int* nrhs, const float* a,
+	       const int* lda, const int* ipiv, float* b, const int* ldb, int* info);
+  void dgetrs_(const char* trans, const int* n, const int* nrhs, const double* a,
+	       const int* lda, const int* ipiv, double* b, const int* ldb, int* info);
 }
 
 namespace adept {
@@ -153,6 +157,23 @@ namespace adept {
       return info;
     }
 
+    // Solve system of linear equations, or the transposed system if
+    // trans is 'T', using the factorization from cpplapack_getrf
+    inline
+    int cpplapack_getrs(char trans, int n, int nrhs, const float* a, int lda,
+			const int* ipiv, float* b, int ldb) {
+      int info;
+      sgetrs_(&trans, &n, &nrhs, a, &lda, ipiv, b, &ldb, &info);
+      return info;
+    }
+    inline
+    int cpplapack_getrs(char trans, int n, int nrhs, const double* a, int lda,
+			const int* ipiv, double* b, int ldb) {
+      int info;
+      dgetrs_(&trans, &n, &nrhs, a, &lda, ipiv, b, &ldb, &info);
+      return info;
+    }
+
     // Solve system of linear equations with symmetric matrix
     inline
     int cpplapack_sysv(char uplo, int n, int nrhs, float* a, int lda, int* ipiv,
@@ -11,6 +11,7 @@
 
 #include <adept/Array.h>
 #include <adept/SpecialMatrix.h>
+#include <adept/solve.h>
 
 #ifndef AdeptSource_H
 #include "cpplapack.h"
@@ -144,12 +145,35 @@ namespace adept {
 #endif
 
 namespace adept {
+
+  // -------------------------------------------------------------------
+  // Invert active general square matrix A by solving AX = I, so that
+  // the inverse is recorded as a single node that stores the LU
+  // factorization of A
+  // -------------------------------------------------------------------
+  template <typename Type>
+  Array<2,Type,true> 
+  inv(const Array<2,Type,true>& A) {
+    if (A.dimension(0) != A.dimension(1)) {
+      throw invalid_operation("Only square matrices can be inverted"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+    Array<2,Type,false> identity(A.dimensions());
+    identity = 0.0;
+    for (Index i = 0; i < A.dimension(0); ++i) {
+      identity(i,i) = 1.0;
+    }
+    return solve(A, identity);
+  }
+
   // -------------------------------------------------------------------
   // Explicit instantiations
   // -------------------------------------------------------------------
 #define ADEPT_EXPLICIT_INV(TYPE)					\
   template Array<2,TYPE,false>						\
   inv(const Array<2,TYPE,false>& A);					\
+  template Array<2,TYPE,true>						\
+  inv(const Array<2,TYPE,true>& A);					\
   template SpecialMatrix<TYPE,SymmEngine<ROW_LOWER_COL_UPPER>,false>	\
   inv(const SpecialMatrix<TYPE,SymmEngine<ROW_LOWER_COL_UPPER>,false>&); \
   template SpecialMatrix<TYPE,SymmEngine<ROW_UPPER_COL_LOWER>,false>	\
@@ -88,46 +88,54 @@ namespace adept {
   Stack::jacobian_forward_kernel(Real* __restrict gradient_multipass_b) const
   {
 
-    // Loop forward through the derivative statements
-    for (uIndex ist = 1; ist < n_statements_; ist++) {
-      const Statement& statement = statement_[ist];
-      // We copy the LHS to "a" in case it appears on the RHS in any
-      // of the following statements
-      Packet<Real> a; // Zeroed automatically
-      // Loop through operations
-      for (uIndex iop = statement_[ist-1].end_plus_one;
-	   iop < statement.end_plus_one; iop++) {
-	Packet<Real> g(gradient_multipass_b+index_[iop]*MULTIPASS_SIZE);
-	Packet<Real> m(multiplier_[iop]);
-	a += m * g;
-      }
-      // Copy the results
-      a.put(gradient_multipass_b+statement.index*MULTIPASS_SIZE);
-    } // End of loop over statements
+    // Loop forward through the derivative statements, one
+    // block of the stack at a time
+    for (uIndex iblock = 0; iblock < n_stack_blocks(); iblock++) {
+      const StackBlock block = stack_block(iblock);
+      for (uIndex ist = 1; ist < block.n_statements; ist++) {
+	const Statement& statement = block.statement[ist];
+	// We copy the LHS to "a" in case it appears on the RHS in any
+	// of the following statements
+	Packet<Real> a; // Zeroed automatically
+	// Loop through operations
+	for (uIndex iop = block.statement[ist-1].end_plus_one;
+	     iop < statement.end_plus_one; iop++) {
+	  Packet<Real> g(gradient_multipass_b+block.index[iop]*MULTIPASS_SIZE);
+	  Packet<Real> m(block.multiplier[iop]);
+	  a += m * g;
+	}
+	// Copy the results
+	a.put(gradient_multipass_b+statement.index*MULTIPASS_SIZE);
+      } // End of loop over statements
+    } // End of loop over blocks
   }    
 #else
   void
   Stack::jacobian_forward_kernel(Real* __restrict gradient_multipass_b) const
   {
 
-    // Loop forward through the derivative statements
-    for (uIndex ist = 1; ist < n_statements_; ist++) {
-      const Statement& statement = statement_[ist];
-      // We copy the LHS to "a" in case it appears on the RHS in any
-      // of the following statements
-      Block<MULTIPASS_SIZE,Real> a; // Zeroed automatically
-      // Loop through operations
-      for (uIndex iop = statement_[ist-1].end_plus_one;
-	   iop < statement.end_plus_one; iop++) {
+    // Loop forward through the derivative statements, one
+    // block of the stack at a time
+    for (uIndex iblock = 0; iblock < n_stack_blocks(); iblock++) {
+      const StackBlock block = stack_block(iblock);
+      for (uIndex ist = 1; ist < block.n_statements; ist++) {
+	const Statement& statement = block.statement[ist];
+	// We copy the LHS to "a" in case it appears on the RHS in any
+	// of the following statements
+	Block<MULTIPASS_SIZE,Real> a; // Zeroed automatically
+	// Loop through operations
+	for (uIndex iop = block.statement[ist-1].end_plus_one;
+	     iop < statement.end_plus_one; iop++) {
+	  for (uIndex i = 0; i < MULTIPASS_SIZE; i++) {
+	    a[i] += block.multiplier[iop]*gradient_multipass_b[block.index[iop]*MULTIPASS_SIZE+i];
+	  }
+	}
+	// Copy the results
 	for (uIndex i = 0; i < MULTIPASS_SIZE; i++) {
-	  a[i] += multiplier_[iop]*gradient_multipass_b[index_[iop]*MULTIPASS_SIZE+i];
+	  gradient_multipass_b[statement.index*MULTIPASS_SIZE+i] = a[i];
 	}
-      }
-      // Copy the results
-      for (uIndex i = 0; i < MULTIPASS_SIZE; i++) {
-	gradient_multipass_b[statement.index*MULTIPASS_SIZE+i] = a[i];
-      }
-    } // End of loop over statements
+      } // End of loop over statements
+    } // End of loop over blocks
   }    
 #endif
 
@@ -136,24 +144,28 @@ namespace adept {
 				       uIndex n_extra) const
   {
 
-    // Loop forward through the derivative statements
-    for (uIndex ist = 1; ist < n_statements_; ist++) {
-      const Statement& statement = statement_[ist];
-      // We copy the LHS to "a" in case it appears on the RHS in any
-      // of the following statements
-      Block<MULTIPASS_SIZE,Real> a; // Zeroed automatically
-      // Loop through operations
-      for (uIndex iop = statement_[ist-1].end_plus_one;
-	   iop < statement.end_plus_one; iop++) {
+    // Loop forward through the derivative statements, one
+    // block of the stack at a time
+    for (uIndex iblock = 0; iblock < n_stack_blocks(); iblock++) {
+      const StackBlock block = stack_block(iblock);
+      for (uIndex ist = 1; ist < block.n_statements; ist++) {
+	const Statement& statement = block.statement[ist];
+	// We copy the LHS to "a" in case it appears on the RHS in any
+	// of the following statements
+	Block<MULTIPASS_SIZE,Real> a; // Zeroed automatically
+	// Loop through operations
+	for (uIndex iop = block.statement[ist-1].end_plus_one;
+	     iop < statement.end_plus_one; iop++) {
+	  for (uIndex i = 0; i < n_extra; i++) {
+	    a[i] += block.multiplier[iop]*gradient_multipass_b[block.index[iop]*MULTIPASS_SIZE+i];
+	  }
+	}
+	// Copy the results
 	for (uIndex i = 0; i < n_extra; i++) {
-	  a[i] += multiplier_[iop]*gradient_multipass_b[index_[iop]*MULTIPASS_SIZE+i];
+	  gradient_multipass_b[statement.index*MULTIPASS_SIZE+i] = a[i];
 	}
-      }
-      // Copy the results
-      for (uIndex i = 0; i < n_extra; i++) {
-	gradient_multipass_b[statement.index*MULTIPASS_SIZE+i] = a[i];
-      }
-    } // End of loop over statements
+      } // End of loop over statements
+    } // End of loop over blocks
   }    
 
 
@@ -247,6 +259,10 @@ namespace adept {
     if (independent_index_.empty() || dependent_index_.empty()) {
       throw(dependents_or_independents_not_identified());
     }
+    if (!matrix_node_.empty()) {
+      jacobian_matrix_nodes(jacobian_out, true);
+      return;
+    }
 #ifdef _OPENMP
     if (have_openmp_ 
 	&& !openmp_manually_disabled_
@@ -388,66 +404,70 @@ namespace adept {
 	  gradient_multipass_b[dependent_index_[i_dependent+i]][i] = 1.0;
 	}
 
-	// Loop backward through the derivative statements
-	for (uIndex ist = n_statements_-1; ist > 0; ist--) {
-	  const Statement& statement = statement_[ist];
-	  // We copy the RHS to "a" in case it appears on the LHS in any
-	  // of the following statements
-	  Real a[MULTIPASS_SIZE];
+	// Loop backward through the derivative statements, one
+	// block of the stack at a time
+	for (uIndex iblock = n_stack_blocks(); iblock > 0; iblock--) {
+	  const StackBlock block = stack_block(iblock-1);
+	  for (uIndex ist = block.n_statements-1; ist > 0; ist--) {
+	    const Statement& statement = block.statement[ist];
+	    // We copy the RHS to "a" in case it appears on the LHS in any
+	    // of the following statements
+	    Real a[MULTIPASS_SIZE];
 #if MULTIPASS_SIZE > MULTIPASS_SIZE_ZERO_CHECK
-	  // For large blocks, we only process the ones where a[i] is
-	  // non-zero
-	  uIndex i_non_zero[MULTIPASS_SIZE];
+	    // For large blocks, we only process the ones where a[i] is
+	    // non-zero
+	    uIndex i_non_zero[MULTIPASS_SIZE];
 #endif
-	  uIndex n_non_zero = 0;
-	  for (uIndex i = 0; i < block_size; i++) {
-	    a[i] = gradient_multipass_b[statement.index][i];
-	    gradient_multipass_b[statement.index][i] = 0.0;
-	    if (a[i] != 0.0) {
+	    uIndex n_non_zero = 0;
+	    for (uIndex i = 0; i < block_size; i++) {
+	      a[i] = gradient_multipass_b[statement.index][i];
+	      gradient_multipass_b[statement.index][i] = 0.0;
+	      if (a[i] != 0.0) {
 #if MULTIPASS_SIZE > MULTIPASS_SIZE_ZERO_CHECK
-	      i_non_zero[n_non_zero++] = i;
+		i_non_zero[n_non_zero++] = i;
 #else
-	      n_non_zero = 1;
+		n_non_zero = 1;
 #endif
+	      }
 	    }
-	  }
 
-	  // Only do anything for this statement if any of the a values
-	  // are non-zero
-	  if (n_non_zero) {
-	    // Loop through the operations
-	    for (uIndex iop = statement_[ist-1].end_plus_one;
-		 iop < statement.end_plus_one; iop++) {
-	      // Try to minimize pointer dereferencing by making local
-	      // copies
-	      Real multiplier = multiplier_[iop];
-	      Real* __restrict gradient_multipass 
-		= &(gradient_multipass_b[index_[iop]][0]);
+	    // Only do anything for this statement if any of the a values
+	    // are non-zero
+	    if (n_non_zero) {
+	      // Loop through the operations
+	      for (uIndex iop = block.statement[ist-1].end_plus_one;
+		   iop < statement.end_plus_one; iop++) {
+		// Try to minimize pointer dereferencing by making local
+		// copies
+		Real multiplier = block.multiplier[iop];
+		Real* __restrict gradient_multipass 
+		  = &(gradient_multipass_b[block.index[iop]][0]);
 #if MULTIPASS_SIZE > MULTIPASS_SIZE_ZERO_CHECK
-	      // For large blocks, loop over only the indices
-	      // corresponding to non-zero a
-	      for (uIndex i = 0; i < n_non_zero; i++) {
-		gradient_multipass[i_non_zero[i]] += multiplier*a[i_non_zero[i]];
-	      }
+		// For large blocks, loop over only the indices
+		// corresponding to non-zero a
+		for (uIndex i = 0; i < n_non_zero; i++) {
+		  gradient_multipass[i_non_zero[i]] += multiplier*a[i_non_zero[i]];
+		}
 #else
-	      // For small blocks, do all indices
-	      for (uIndex i = 0; i < block_size; i++) {
-	      //	      for (uIndex i = 0; i < MULTIPASS_SIZE; i++) {
-		gradient_multipass[i] += multiplier*a[i];
-	      }
+		// For small blocks, do all indices
+		for (uIndex i = 0; i < block_size; i++) {
+		//	      for (uIndex i = 0; i < MULTIPASS_SIZE; i++) {
+		  gradient_multipass[i] += multiplier*a[i];
+		}
 #endif
+	      }
+	    }
+	  } // End of loop over statement
+	  // Copy the gradients corresponding to the independent
+	  // variables into the Jacobian matrix
+	  for (uIndex iindep = 0; iindep < n_independent(); iindep++) {
+	    for (uIndex i = 0; i < block_size; i++) {
+	      jacobian_out[iindep*n_dependent()+i_dependent+i] 
+		= gradient_multipass_b[independent_index_[iindep]][i];
 	    }
 	  }
-	} // End of loop over statement
-	// Copy the gradients corresponding to the independent
-	// variables into the Jacobian matrix
-	for (uIndex iindep = 0; iindep < n_independent(); iindep++) {
-	  for (uIndex i = 0; i < block_size; i++) {
-	    jacobian_out[iindep*n_dependent()+i_dependent+i] 
-	      = gradient_multipass_b[independent_index_[iindep]][i];
-	  }
-	}
-      } // End of loop over blocks
+	} // End of loop over blocks
+	} // End of loop over blocks
     } // end #pragma omp parallel
   } // end jacobian_reverse_openmp
 
@@ -467,6 +487,10 @@ namespace adept {
     if (independent_index_.empty() || dependent_index_.empty()) {
       throw(dependents_or_independents_not_identified());
     }
+    if (!matrix_node_.empty()) {
+      jacobian_matrix_nodes(jacobian_out, false);
+      return;
+    }
 #ifdef _OPENMP
     if (have_openmp_ 
 	&& !openmp_manually_disabled_
@@ -501,55 +525,59 @@ namespace adept {
       for (uIndex i = 0; i < MULTIPASS_SIZE; i++) {
 	gradient_multipass_b[dependent_index_[i_dependent+i]][i] = 1.0;
       }
-      // Loop backward through the derivative statements
-      for (uIndex ist = n_statements_-1; ist > 0; ist--) {
-	const Statement& statement = statement_[ist];
-	// We copy the RHS to "a" in case it appears on the LHS in any
-	// of the following statements
-	Real a[MULTIPASS_SIZE];
+      // Loop backward through the derivative statements, one
+      // block of the stack at a time
+      for (uIndex iblock = n_stack_blocks(); iblock > 0; iblock--) {
+	const StackBlock block = stack_block(iblock-1);
+	for (uIndex ist = block.n_statements-1; ist > 0; ist--) {
+	  const Statement& statement = block.statement[ist];
+	  // We copy the RHS to "a" in case it appears on the LHS in any
+	  // of the following statements
+	  Real a[MULTIPASS_SIZE];
 #if MULTIPASS_SIZE > MULTIPASS_SIZE_ZERO_CHECK
-	// For large blocks, we only process the ones where a[i] is
-	// non-zero
-	uIndex i_non_zero[MULTIPASS_SIZE];
+	  // For large blocks, we only process the ones where a[i] is
+	  // non-zero
+	  uIndex i_non_zero[MULTIPASS_SIZE];
 #endif
-	uIndex n_non_zero = 0;
-	for (uIndex i = 0; i < MULTIPASS_SIZE; i++) {
-	  a[i] = gradient_multipass_b[statement.index][i];
-	  gradient_multipass_b[statement.index][i] = 0.0;
-	  if (a[i] != 0.0) {
+	  uIndex n_non_zero = 0;
+	  for (uIndex i = 0; i < MULTIPASS_SIZE; i++) {
+	    a[i] = gradient_multipass_b[statement.index][i];
+	    gradient_multipass_b[statement.index][i] = 0.0;
+	    if (a[i] != 0.0) {
 #if MULTIPASS_SIZE > MULTIPASS_SIZE_ZERO_CHECK
-	    i_non_zero[n_non_zero++] = i;
+	      i_non_zero[n_non_zero++] = i;
 #else
-	    n_non_zero = 1;
+	      n_non_zero = 1;
 #endif
+	    }
 	  }
-	}
-	// Only do anything for this statement if any of the a values
-	// are non-zero
-	if (n_non_zero) {
-	  // Loop through the operations
-	  for (uIndex iop = statement_[ist-1].end_plus_one;
-	       iop < statement.end_plus_one; iop++) {
-	    // Try to minimize pointer dereferencing by making local
-	    // copies
-	    Real multiplier = multiplier_[iop];
-	    Real* __restrict gradient_multipass 
-	      = &(gradient_multipass_b[index_[iop]][0]);
+	  // Only do anything for this statement if any of the a values
+	  // are non-zero
+	  if (n_non_zero) {
+	    // Loop through the operations
+	    for (uIndex iop = block.statement[ist-1].end_plus_one;
+		 iop < statement.end_plus_one; iop++) {
+	      // Try to minimize pointer dereferencing by making local
+	      // copies
+	      Real multiplier = block.multiplier[iop];
+	      Real* __restrict gradient_multipass 
+		= &(gradient_multipass_b[block.index[iop]][0]);
 #if MULTIPASS_SIZE > MULTIPASS_SIZE_ZERO_CHECK
-	    // For large blocks, loop over only the indices
-	    // corresponding to non-zero a
-	    for (uIndex i = 0; i < n_non_zero; i++) {
-	      gradient_multipass[i_non_zero[i]] += multiplier*a[i_non_zero[i]];
-	    }
+	      // For large blocks, loop over only the indices
+	      // corresponding to non-zero a
+	      for (uIndex i = 0; i < n_non_zero; i++) {
+		gradient_multipass[i_non_zero[i]] += multiplier*a[i_non_zero[i]];
+	      }
 #else
-	    // For small blocks, do all indices
-	    for (uIndex i = 0; i < MULTIPASS_SIZE; i++) {
-	      gradient_multipass[i] += multiplier*a[i];
-	    }
+	      // For small blocks, do all indices
+	      for (uIndex i = 0; i < MULTIPASS_SIZE; i++) {
+		gradient_multipass[i] += multiplier*a[i];
+	      }
 #endif
+	    }
 	  }
-	}
-      } // End of loop over statement
+	} // End of loop over statement
+      } // End of loop over blocks
       // Copy the gradients corresponding to the independent variables
       // into the Jacobian matrix
       for (uIndex iindep = 0; iindep < n_independent(); iindep++) {
@@ -570,47 +598,51 @@ namespace adept {
       for (uIndex i = 0; i < n_extra; i++) {
 	gradient_multipass_b[dependent_index_[i_dependent+i]][i] = 1.0;
       }
-      for (uIndex ist = n_statements_-1; ist > 0; ist--) {
-	const Statement& statement = statement_[ist];
-	Real a[MULTIPASS_SIZE];
+      // Loop backward through the blocks of the stack
+      for (uIndex iblock = n_stack_blocks(); iblock > 0; iblock--) {
+	const StackBlock block = stack_block(iblock-1);
+	for (uIndex ist = block.n_statements-1; ist > 0; ist--) {
+	  const Statement& statement = block.statement[ist];
+	  Real a[MULTIPASS_SIZE];
 #if MULTIPASS_SIZE > MULTIPASS_SIZE_ZERO_CHECK
-	uIndex i_non_zero[MULTIPASS_SIZE];
+	  uIndex i_non_zero[MULTIPASS_SIZE];
 #endif
-	uIndex n_non_zero = 0;
-	for (uIndex i = 0; i < n_extra; i++) {
-	  a[i] = gradient_multipass_b[statement.index][i];
-	  gradient_multipass_b[statement.index][i] = 0.0;
-	  if (a[i] != 0.0) {
+	  uIndex n_non_zero = 0;
+	  for (uIndex i = 0; i < n_extra; i++) {
+	    a[i] = gradient_multipass_b[statement.index][i];
+	    gradient_multipass_b[statement.index][i] = 0.0;
+	    if (a[i] != 0.0) {
 #if MULTIPASS_SIZE > MULTIPASS_SIZE_ZERO_CHECK
-	    i_non_zero[n_non_zero++] = i;
+	      i_non_zero[n_non_zero++] = i;
 #else
-	    n_non_zero = 1;
+	      n_non_zero = 1;
 #endif
+	    }
 	  }
-	}
-	if (n_non_zero) {
-	  for (uIndex iop = statement_[ist-1].end_plus_one;
-	       iop < statement.end_plus_one; iop++) {
-	    Real multiplier = multiplier_[iop];
-	    Real* __restrict gradient_multipass 
-	      = &(gradient_multipass_b[index_[iop]][0]);
+	  if (n_non_zero) {
+	    for (uIndex iop = block.statement[ist-1].end_plus_one;
+		 iop < statement.end_plus_one; iop++) {
+	      Real multiplier = block.multiplier[iop];
+	      Real* __restrict gradient_multipass 
+		= &(gradient_multipass_b[block.index[iop]][0]);
 	    //	    if (index_[iop] > max_gradient_-1
 	    //		|| index_[iop] < 0) {
 	    //	    std::cerr << "AAAAAA: iop=" << iop << " index_[iop]=" << index_[iop] << " max_gradient_=" << max_gradient_ << " ist=" << ist << "\n";
 	      //	    }
 #if MULTIPASS_SIZE > MULTIPASS_SIZE_ZERO_CHECK
-	    for (uIndex i = 0; i < n_non_zero; i++) {
-	      gradient_multipass[i_non_zero[i]] += multiplier*a[i_non_zero[i]];
-	    }
+	      for (uIndex i = 0; i < n_non_zero; i++) {
+		gradient_multipass[i_non_zero[i]] += multiplier*a[i_non_zero[i]];
+	      }
 #else
-	    for (uIndex i = 0; i < n_extra; i++) {
-	      //	      std::cerr << "BBBBB: i=" << i << " gradient_multipass[i]=" << gradient_multipass[i] << " multiplier=" << multiplier << " a[i]=" << a[i] << "\n";
-	      gradient_multipass[i] += multiplier*a[i];
-	    }
+	      for (uIndex i = 0; i < n_extra; i++) {
+		//	      std::cerr << "BBBBB: i=" << i << " gradient_multipass[i]=" << gradient_multipass[i] << " multiplier=" << multiplier << " a[i]=" << a[i] << "\n";
+		gradient_multipass[i] += multiplier*a[i];
+	      }
 #endif
+	    }
 	  }
 	}
-      }
+      } // End of loop over blocks
       for (uIndex iindep = 0; iindep < n_independent(); iindep++) {
 	for (uIndex i = 0; i < n_extra; i++) {
 	  jacobian_out[iindep*n_dependent()+i_dependent+i] 
@@ -620,6 +652,54 @@ namespace adept {
     }
   }
 
+  // Compute the Jacobian matrix of a recording containing matrix
+  // nodes, which the kernels above cannot process, by forward (if
+  // is_forward is true) or reverse passes in MULTIPASS_SIZE
+  // directions at once; the layout of jacobian_out is as above
+  void
+  Stack::jacobian_matrix_nodes(Real* jacobian_out, bool is_forward) const
+  {
+    const uIndex stride = MULTIPASS_SIZE;
+    const uIndex n_seed = is_forward ? n_independent() : n_dependent();
+    const std::vector<uIndex>& seed_index
+      = is_forward ? independent_index_ : dependent_index_;
+    const std::vector<uIndex>& out_index
+      = is_forward ? dependent_index_ : independent_index_;
+    const std::size_t gradient_size
+      = static_cast<std::size_t>(max_gradient_)*stride;
+    Real* __restrict gradient = alloc_aligned<Real>(gradient_size);
+    for (uIndex i_seed = 0; i_seed < n_seed; i_seed += stride) {
+      const uIndex n_block = std::min(stride, n_seed - i_seed);
+      for (std::size_t i = 0; i < gradient_size; i++) {
+	gradient[i] = 0.0;
+      }
+      // Each seed vector has one non-zero entry of 1.0
+      for (uIndex i = 0; i < n_block; i++) {
+	gradient[static_cast<std::size_t>(seed_index[i_seed+i])*stride+i]
+	  = 1.0;
+      }
+      if (is_forward) {
+	forward_kernel_directions(gradient, stride);
+      }
+      else {
+	reverse_kernel_directions(gradient, stride);
+      }
+      for (std::size_t iout = 0; iout < out_index.size(); iout++) {
+	for (uIndex i = 0; i < n_block; i++) {
+	  Real value
+	    = gradient[static_cast<std::size_t>(out_index[iout])*stride+i];
+	  if (is_forward) {
+	    jacobian_out[(i_seed+i)*n_dependent()+iout] = value;
+	  }
+	  else {
+	    jacobian_out[iout*n_dependent()+i_seed+i] = value;
+	  }
+	}
+      }
+    }
+    free_aligned(gradient);
+  }
+
   // Compute the Jacobian matrix; note that jacobian_out must be
   // allocated to be of size m*n, where m is the number of dependent
   // variables and n is the number of independents. In the resulting
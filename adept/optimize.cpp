@@ -0,0 +1,173 @@
+/* optimize.cpp -- Remove statements that cannot affect the dependent variables
+
+    Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   A forward pass through the recording finds the statements that
+   depend on the independent variables ("reachable" statements),
+   keeping track of which gradient indices currently hold such a
+   variable.  A backward pass then finds the statements whose
+   left-hand side is needed by a later statement or is a dependent
+   variable ("live" statements), starting from the set of dependent
+   gradient indices: a statement kills its left-hand side and then,
+   if it is live and reachable, makes the gradient indices on its
+   right-hand side live.
+
+   Dead statements are removed.  Live statements that are not
+   reachable lose their operations but are retained, since in the
+   adjoint pass they set the gradient of their left-hand side to zero
+   before the gradient index is used by an earlier variable.
+   Operations with a multiplier of zero are removed from all
+   statements.  Each block of the recording is compacted in place.
+
+*/
+
+#include <vector>
+
+#include "adept/Stack.h"
+
+namespace adept {
+
+  namespace internal {
+
+    // Fate of each statement of the recording
+    enum OptimizeStatus {
+      OPTIMIZE_REMOVE = 0,   // Cannot affect the dependent variables
+      OPTIMIZE_KEEP,         // Retain, removing zero multipliers
+      OPTIMIZE_KEEP_LHS_ONLY // Retain without any operations
+    };
+
+  }
+
+  using namespace internal;
+
+  void
+  Stack::optimize()
+  {
+    check_no_matrix_nodes("Stack::optimize()");
+    if (dependent_index_.empty()) {
+      throw dependents_or_independents_not_identified("Dependent variables not identified before Stack::optimize()"
+						      ADEPT_EXCEPTION_LOCATION);
+    }
+    if (is_preaccumulating_) {
+      throw invalid_operation("Stack::optimize() called within a preaccumulation region"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+
+    const uIndex n_blocks = n_stack_blocks();
+    std::vector<uIndex> first_statement(n_blocks); // Of element 0 of each block
+    uIndex ist_global = 0;
+    for (uIndex iblock = 0; iblock < n_blocks; ++iblock) {
+      first_statement[iblock] = ist_global;
+      ist_global += stack_block(iblock).n_statements - 1;
+    }
+
+    // Forward pass to find the statements that depend on the
+    // independent variables
+    std::vector<bool> is_reachable_statement;
+    if (!independent_index_.empty()) {
+      is_reachable_statement.resize(n_statements(), false);
+      std::vector<bool> is_reachable(max_gradient_, false);
+      for (std::size_t i = 0; i < independent_index_.size(); ++i) {
+	if (static_cast<std::size_t>(independent_index_[i]) < is_reachable.size()) {
+	  is_reachable[independent_index_[i]] = true;
+	}
+      }
+      for (uIndex iblock = 0; iblock < n_blocks; ++iblock) {
+	const StackBlock block = stack_block(iblock);
+	for (uIndex ist = 1; ist < block.n_statements; ++ist) {
+	  bool reachable = false;
+	  for (uIndex iop = block.statement[ist-1].end_plus_one;
+	       iop < block.statement[ist].end_plus_one; ++iop) {
+	    if (block.multiplier[iop] != 0.0 && is_reachable[block.index[iop]]) {
+	      reachable = true;
+	      break;
+	    }
+	  }
+	  is_reachable[block.statement[ist].index] = reachable;
+	  is_reachable_statement[first_statement[iblock]+ist] = reachable;
+	}
+      }
+    }
+
+    // Backward pass to find the statements that affect the dependent
+    // variables
+    std::vector<char> status(n_statements(), OPTIMIZE_REMOVE);
+    {
+      std::vector<bool> is_live(max_gradient_, false);
+      for (std::size_t i = 0; i < dependent_index_.size(); ++i) {
+	if (static_cast<std::size_t>(dependent_index_[i]) < is_live.size()) {
+	  is_live[dependent_index_[i]] = true;
+	}
+      }
+      for (uIndex iblock = n_blocks; iblock > 0; --iblock) {
+	const StackBlock block = stack_block(iblock-1);
+	const uIndex offset = first_statement[iblock-1];
+	for (uIndex ist = block.n_statements-1; ist > 0; --ist) {
+	  const uIndex lhs = block.statement[ist].index;
+	  if (!is_live[lhs]) {
+	    continue;
+	  }
+	  is_live[lhs] = false;
+	  if (!is_reachable_statement.empty()
+	      && !is_reachable_statement[offset+ist]) {
+	    status[offset+ist] = OPTIMIZE_KEEP_LHS_ONLY;
+	    continue;
+	  }
+	  status[offset+ist] = OPTIMIZE_KEEP;
+	  for (uIndex iop = block.statement[ist-1].end_plus_one;
+	       iop < block.statement[ist].end_plus_one; ++iop) {
+	    if (block.multiplier[iop] != 0.0) {
+	      is_live[block.index[iop]] = true;
+	    }
+	  }
+	}
+      }
+    }
+
+    // Compact each block in place: statements and operations only
+    // move towards the start of their block
+    bool is_statement_removed = false;
+    for (uIndex iblock = 0; iblock < n_blocks; ++iblock) {
+      const StackBlock block = stack_block(iblock);
+      const uIndex offset = first_statement[iblock];
+      uIndex begin_operation = block.statement[0].end_plus_one;
+      uIndex jst = 1;
+      uIndex jop = begin_operation;
+      for (uIndex ist = 1; ist < block.n_statements; ++ist) {
+	const uIndex end_operation = block.statement[ist].end_plus_one;
+	if (status[offset+ist] != OPTIMIZE_REMOVE) {
+	  if (status[offset+ist] == OPTIMIZE_KEEP) {
+	    for (uIndex iop = begin_operation; iop < end_operation; ++iop) {
+	      if (block.multiplier[iop] != 0.0) {
+		block.multiplier[jop] = block.multiplier[iop];
+		block.index[jop++] = block.index[iop];
+	      }
+	    }
+	  }
+	  block.statement[jst].index = block.statement[ist].index;
+	  block.statement[jst++].end_plus_one = jop;
+	}
+	begin_operation = end_operation;
+      }
+      if (jst < block.n_statements) {
+	is_statement_removed = true;
+      }
+      resize_stack_block(iblock, jst, jop);
+    }
+
+    // The recording now differs from the one that enable_replay()
+    // stored, and from any compressed, single-precision or
+    // sorted copy
+    if (is_statement_removed && is_replay_enabled()) {
+      replay_stack_.push_unsupported();
+    }
+    compressed_stack_.clear();
+    single_precision_stack_.clear();
+    parallel_adjoint_.clear();
+  }
+
+} // End namespace adept
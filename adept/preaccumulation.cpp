@@ -0,0 +1,284 @@
+/* preaccumulation.cpp -- Local Jacobian preaccumulation of regions of a recording
+
+    Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   The statements of a region of the recording are copied and the
+   variables they refer to are numbered consecutively as "slots".
+   The inputs of the region are the variables that are read before
+   being written.  The Jacobian of the outputs with respect to the
+   inputs is computed by propagating min(n_inputs, n_outputs)
+   directions at once forward or backward through the copy, after
+   which the region is removed from the recording and replaced by one
+   statement per output whose operations are the non-zero elements of
+   the corresponding row of the Jacobian.
+
+   If an output is also an input (for example x in "x = f(x,y)"),
+   writing it would alter the value seen by later outputs.  The
+   statements of such outputs are therefore written last, all but the
+   final one via a temporary gradient index that is copied to the
+   output afterwards.  The temporaries are placed above every
+   gradient index that is registered or that the region refers to,
+   since an input destroyed within the region may have left a gap
+   that register_gradient() would fill while the input is still read
+   by the new statements.
+
+*/
+
+#include <vector>
+#include <algorithm>
+
+#include "adept/Stack.h"
+
+namespace adept {
+
+  namespace internal {
+
+    // Marker for a gradient index not yet assigned a slot
+    static const uIndex NO_PREACCUMULATION_SLOT = -1;
+
+    // Return the slot of a gradient index, assigning a new one if
+    // needed
+    static inline
+    uIndex
+    preaccumulation_slot(uIndex gradient_index, std::vector<uIndex>& slot,
+			 std::vector<uIndex>& slot_index)
+    {
+      if (static_cast<std::size_t>(gradient_index) >= slot.size()) {
+	slot.resize(2*gradient_index+1, NO_PREACCUMULATION_SLOT);
+      }
+      if (slot[gradient_index] == NO_PREACCUMULATION_SLOT) {
+	slot[gradient_index] = slot_index.size();
+	slot_index.push_back(gradient_index);
+      }
+      return slot[gradient_index];
+    }
+
+  }
+
+  using namespace internal;
+
+  // Start a preaccumulation region at the current end of the
+  // recording
+  void
+  Stack::begin_preaccumulation()
+  {
+    if (is_preaccumulating_) {
+      throw invalid_operation("Stack::begin_preaccumulation() called when a preaccumulation region has already begun"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+    is_preaccumulating_ = true;
+    preaccumulation_statement_ = n_statements();
+    preaccumulation_operation_ = n_operations();
+    preaccumulation_matrix_node_ = n_matrix_nodes();
+    preaccumulation_output_.clear();
+  }
+
+  // Replace the statements of the region by those of its local
+  // Jacobian
+  void
+  Stack::end_preaccumulation()
+  {
+    if (!is_preaccumulating_) {
+      throw invalid_operation("Stack::end_preaccumulation() called without a matching begin_preaccumulation()"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+    is_preaccumulating_ = false;
+
+    // A region containing matrix nodes is left as it was recorded,
+    // since only its statements could be replaced
+    if (n_matrix_nodes() > preaccumulation_matrix_node_) {
+      preaccumulation_output_.clear();
+      return;
+    }
+
+    // Copy the region, numbering the variables it refers to
+    std::vector<uIndex>& slot = preaccumulation_slot_;
+    std::vector<uIndex> slot_index;    // Gradient index of each slot
+    std::vector<uIndex> lhs_slot;      // Slot written by each statement
+    std::vector<uIndex> end_operation; // End of operations of each statement
+    std::vector<uIndex> op_slot;
+    std::vector<Real> op_multiplier;
+    std::vector<bool> is_written, is_input;
+    uIndex first_statement_in_block = 0; // Statement number of element 0
+    for (uIndex iblock = 0; iblock < n_stack_blocks(); ++iblock) {
+      const StackBlock block = stack_block(iblock);
+      uIndex ist = 1;
+      if (preaccumulation_statement_ > first_statement_in_block + ist) {
+	ist = preaccumulation_statement_ - first_statement_in_block;
+      }
+      for ( ; ist < block.n_statements; ++ist) {
+	for (uIndex iop = block.statement[ist-1].end_plus_one;
+	     iop < block.statement[ist].end_plus_one; ++iop) {
+	  uIndex islot = preaccumulation_slot(block.index[iop], slot,
+					      slot_index);
+	  if (static_cast<std::size_t>(islot) == is_written.size()) {
+	    is_written.push_back(false);
+	    is_input.push_back(true);
+	  }
+	  op_slot.push_back(islot);
+	  op_multiplier.push_back(block.multiplier[iop]);
+	}
+	uIndex islot = preaccumulation_slot(block.statement[ist].index,
+					    slot, slot_index);
+	if (static_cast<std::size_t>(islot) == is_written.size()) {
+	  is_written.push_back(true);
+	  is_input.push_back(false);
+	}
+	is_written[islot] = true;
+	lhs_slot.push_back(islot);
+	end_operation.push_back(op_slot.size());
+      }
+      first_statement_in_block += block.n_statements - 1;
+    }
+    const uIndex n_slots = slot_index.size();
+
+    // The outputs are the distinct output variables written in the
+    // region; others are unaffected by it
+    std::vector<uIndex> output_slot;
+    std::vector<bool> is_output(n_slots, false);
+    for (std::size_t i = 0; i < preaccumulation_output_.size(); ++i) {
+      uIndex index = preaccumulation_output_[i];
+      if (static_cast<std::size_t>(index) < slot.size()
+	  && slot[index] != NO_PREACCUMULATION_SLOT
+	  && is_written[slot[index]] && !is_output[slot[index]]) {
+	is_output[slot[index]] = true;
+	output_slot.push_back(slot[index]);
+      }
+    }
+    std::vector<uIndex> input_slot;
+    for (uIndex islot = 0; islot < n_slots; ++islot) {
+      if (is_input[islot]) {
+	input_slot.push_back(islot);
+      }
+    }
+    // Reset the map for the next region
+    for (uIndex islot = 0; islot < n_slots; ++islot) {
+      slot[slot_index[islot]] = NO_PREACCUMULATION_SLOT;
+    }
+    preaccumulation_output_.clear();
+
+    // Compute the Jacobian, in forward mode with one direction per
+    // input or in reverse mode with one direction per output
+    const uIndex n_in = input_slot.size();
+    const uIndex n_out = output_slot.size();
+    const uIndex n_region_statements = lhs_slot.size();
+    std::vector<Real> jacobian(n_out*n_in); // Row-major
+    if (n_in > 0 && n_out > 0) {
+      const uIndex n_dir = std::min(n_in, n_out);
+      std::vector<Real> work(n_slots*n_dir, 0.0);
+      std::vector<Real> tmp(n_dir);
+      if (n_in <= n_out) {
+	for (uIndex j = 0; j < n_in; ++j) {
+	  work[input_slot[j]*n_dir+j] = 1.0;
+	}
+	uIndex iop = 0;
+	for (uIndex ist = 0; ist < n_region_statements; ++ist) {
+	  tmp.assign(n_dir, 0.0);
+	  for ( ; iop < end_operation[ist]; ++iop) {
+	    const Real* w = &work[op_slot[iop]*n_dir];
+	    for (uIndex j = 0; j < n_dir; ++j) {
+	      tmp[j] += op_multiplier[iop]*w[j];
+	    }
+	  }
+	  std::copy(tmp.begin(), tmp.end(), work.begin()+lhs_slot[ist]*n_dir);
+	}
+	for (uIndex i = 0; i < n_out; ++i) {
+	  for (uIndex j = 0; j < n_in; ++j) {
+	    jacobian[i*n_in+j] = work[output_slot[i]*n_dir+j];
+	  }
+	}
+      }
+      else {
+	for (uIndex i = 0; i < n_out; ++i) {
+	  work[output_slot[i]*n_dir+i] = 1.0;
+	}
+	for (uIndex ist = n_region_statements; ist > 0; --ist) {
+	  Real* a = &work[lhs_slot[ist-1]*n_dir];
+	  std::copy(a, a+n_dir, tmp.begin());
+	  std::fill(a, a+n_dir, 0.0);
+	  uIndex begin_operation = ist > 1 ? end_operation[ist-2] : 0;
+	  for (uIndex iop = begin_operation; iop < end_operation[ist-1]; ++iop) {
+	    Real* w = &work[op_slot[iop]*n_dir];
+	    for (uIndex i = 0; i < n_dir; ++i) {
+	      w[i] += op_multiplier[iop]*tmp[i];
+	    }
+	  }
+	}
+	for (uIndex i = 0; i < n_out; ++i) {
+	  for (uIndex j = 0; j < n_in; ++j) {
+	    jacobian[i*n_in+j] = work[input_slot[j]*n_dir+i];
+	  }
+	}
+      }
+    }
+
+    // Outputs that are also inputs are written last, all but one via
+    // a temporary
+    std::vector<uIndex> output_order;
+    std::vector<uIndex> in_place;
+    uIndex n_new_operations = 0;
+    for (uIndex i = 0; i < n_out; ++i) {
+      if (is_input[output_slot[i]]) {
+	in_place.push_back(i);
+      }
+      else {
+	output_order.push_back(i);
+      }
+      for (uIndex j = 0; j < n_in; ++j) {
+	if (jacobian[i*n_in+j] != 0.0) {
+	  ++n_new_operations;
+	}
+      }
+    }
+    output_order.insert(output_order.end(), in_place.begin(), in_place.end());
+    const uIndex n_in_place = in_place.size();
+    const uIndex n_not_in_place = n_out - n_in_place;
+    const uIndex n_temporaries = n_in_place > 0 ? n_in_place-1 : 0;
+    n_new_operations += n_temporaries;
+
+    // Leave the region alone unless this reduces its size
+    if (n_new_operations + n_out + n_temporaries
+	>= n_operations() - preaccumulation_operation_ + n_region_statements) {
+      return;
+    }
+
+    rewind_stack(preaccumulation_statement_, preaccumulation_operation_);
+    if (is_replay_enabled()) {
+      replay_stack_.push_unsupported();
+    }
+    uIndex first_temporary = i_gradient_;
+    for (uIndex islot = 0; islot < n_slots; ++islot) {
+      if (slot_index[islot] >= first_temporary) {
+	first_temporary = slot_index[islot]+1;
+      }
+    }
+    if (first_temporary + n_temporaries > max_gradient_) {
+      max_gradient_ = first_temporary + n_temporaries;
+    }
+    for (uIndex iorder = 0; iorder < n_out; ++iorder) {
+      uIndex i = output_order[iorder];
+      uIndex lhs = slot_index[output_slot[i]];
+      if (iorder >= n_not_in_place
+	  && iorder - n_not_in_place < n_temporaries) {
+	lhs = first_temporary + iorder - n_not_in_place;
+      }
+      check_space(n_in);
+      for (uIndex j = 0; j < n_in; ++j) {
+	if (jacobian[i*n_in+j] != 0.0) {
+	  push_rhs(jacobian[i*n_in+j], slot_index[input_slot[j]]);
+	}
+      }
+      push_lhs(lhs);
+    }
+    for (uIndex itemp = 0; itemp < n_temporaries; ++itemp) {
+      check_space(1);
+      push_rhs(1.0, first_temporary + itemp);
+      push_lhs(slot_index[output_slot[in_place[itemp]]]);
+    }
+  }
+
+} // End namespace adept
@@ -0,0 +1,506 @@
+/* recording_file.cpp -- Save a recording to a file and load it again
+
+    Copyright (C) 2012-2014 University of Reading
+    Copyright (C) 2015 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   A recording can be written to a binary file with
+   Stack::save_recording() and read back, possibly by a different
+   process, with Stack::load_recording(), after which adjoint,
+   tangent-linear and Jacobian calculations can be performed without
+   re-running the algorithm.  The file has the following layout, in
+   which all numbers are little-endian and each array starts at a
+   multiple of 64 bytes from the start of the file so that the file
+   may be memory mapped:
+
+     Header: the 8 characters "ADEPTREC", then ten 8-byte unsigned
+       integers: format version, flags (1 if compressed), sizeof(Real),
+       sizeof(uIndex), number of statements (including the initial
+       null statement), number of operations, number of gradients
+       required, number of independent variables, number of dependent
+       variables and number of compressed code words
+
+     Statement stack: pairs of uIndex (gradient index, one plus the
+       position of the last operation)
+
+     If not compressed: the multipliers (Real) and then the gradient
+       indices (uIndex) of the operation stack
+
+     If compressed: the code words in the form described in
+       CompressedStack.h, to which the positions in the statement
+       stack refer
+
+     The gradient indices (uIndex) of the independent and then the
+       dependent variables
+
+*/
+
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <limits>
+
+#include <adept/Stack.h>
+
+namespace adept {
+
+  using namespace internal;
+
+  namespace internal {
+
+    // Version of the file format written by save_recording
+    static const std::size_t RECORDING_FILE_VERSION = 1;
+    static const std::size_t RECORDING_FILE_COMPRESSED = 1;
+    static const std::size_t RECORDING_FILE_ALIGNMENT = 64;
+    static const std::size_t RECORDING_FILE_HEADER_WORDS = 10;
+
+    static bool
+    recording_file_host_is_little_endian()
+    {
+      const unsigned int one = 1;
+      return *reinterpret_cast<const unsigned char*>(&one) == 1;
+    }
+
+    // Reverse the byte order of n elements of the specified size
+    static void
+    recording_file_swap_bytes(char* data, std::size_t element_size,
+			      std::size_t n)
+    {
+      for (std::size_t i = 0; i < n; ++i, data += element_size) {
+	for (std::size_t j = 0; j < element_size/2; ++j) {
+	  char tmp = data[j];
+	  data[j] = data[element_size-1-j];
+	  data[element_size-1-j] = tmp;
+	}
+      }
+    }
+
+    // Write an unsigned integer as 8 little-endian bytes
+    static void
+    recording_file_write_word(std::ostream& os, std::size_t value)
+    {
+      unsigned char bytes[8];
+      for (int i = 0; i < 8; ++i) {
+	bytes[i] = static_cast<unsigned char>(value & 0xff);
+	value >>= 8;
+      }
+      os.write(reinterpret_cast<const char*>(bytes), 8);
+    }
+
+    static std::size_t
+    recording_file_read_word(std::istream& is)
+    {
+      unsigned char bytes[8];
+      is.read(reinterpret_cast<char*>(bytes), 8);
+      std::size_t value = 0;
+      for (int i = 7; i >= 0; --i) {
+	value = (value << 8) | bytes[i];
+      }
+      return value;
+    }
+
+    // Write zeros up to the next multiple of RECORDING_FILE_ALIGNMENT
+    // bytes
+    static void
+    recording_file_pad(std::ostream& os, std::size_t& pos)
+    {
+      static const char zeros[RECORDING_FILE_ALIGNMENT] = { 0 };
+      std::size_t n = (RECORDING_FILE_ALIGNMENT
+		       - pos % RECORDING_FILE_ALIGNMENT)
+	% RECORDING_FILE_ALIGNMENT;
+      os.write(zeros, n);
+      pos += n;
+    }
+
+    static void
+    recording_file_skip_pad(std::istream& is, std::size_t& pos)
+    {
+      std::size_t n = (RECORDING_FILE_ALIGNMENT
+		       - pos % RECORDING_FILE_ALIGNMENT)
+	% RECORDING_FILE_ALIGNMENT;
+      is.seekg(n, std::ios::cur);
+      pos += n;
+    }
+
+    // Write an array of n elements, each made up of elements of size
+    // element_size that need to be byte swapped on big-endian hosts
+    static void
+    recording_file_write(std::ostream& os, std::size_t& pos,
+			 const void* data, std::size_t element_size,
+			 std::size_t n)
+    {
+      std::size_t n_bytes = element_size*n;
+      if (n_bytes == 0) {
+	return;
+      }
+      if (recording_file_host_is_little_endian()) {
+	os.write(static_cast<const char*>(data), n_bytes);
+      }
+      else {
+	std::vector<char> buffer(static_cast<const char*>(data),
+				 static_cast<const char*>(data)+n_bytes);
+	recording_file_swap_bytes(&buffer[0], element_size, n);
+	os.write(&buffer[0], n_bytes);
+      }
+      pos += n_bytes;
+    }
+
+    static void
+    recording_file_read(std::istream& is, std::size_t& pos,
+			void* data, std::size_t element_size, std::size_t n)
+    {
+      std::size_t n_bytes = element_size*n;
+      if (n_bytes == 0) {
+	return;
+      }
+      is.read(static_cast<char*>(data), n_bytes);
+      if (!recording_file_host_is_little_endian()) {
+	recording_file_swap_bytes(static_cast<char*>(data), element_size, n);
+      }
+      pos += n_bytes;
+    }
+
+    // Return true if n elements of the specified size starting at
+    // position pos lie within a file of file_size bytes
+    static bool
+    recording_file_fits(std::size_t pos, std::size_t file_size,
+			std::size_t element_size, std::size_t n)
+    {
+      return pos <= file_size && n <= (file_size - pos) / element_size;
+    }
+
+    // Return true if all the gradient indices are less than
+    // n_gradients; they are compared as std::size_t so that negative
+    // values of a signed uIndex are also rejected
+    static bool
+    recording_file_indices_valid(const std::vector<uIndex>& index,
+				 uIndex n_gradients)
+    {
+      for (std::size_t i = 0; i < index.size(); ++i) {
+	if (static_cast<std::size_t>(index[i])
+	    >= static_cast<std::size_t>(n_gradients)) {
+	  return false;
+	}
+      }
+      return true;
+    }
+
+  } // End namespace internal
+
+
+  // Write the current recording, and the lists of independent and
+  // dependent variables, to a binary file
+  void
+  Stack::save_recording(const std::string& filename, bool compress) const
+  {
+    check_no_matrix_nodes("Stack::save_recording()");
+    // Compress the recording if requested and if it has not already
+    // been compressed
+    CompressedStack local_compressed_stack;
+    const CompressedStack* compressed = 0;
+    if (compress) {
+      if (!recording_file_host_is_little_endian()) {
+	throw feature_not_available("Compressed recording files can only be written on little-endian platforms"
+				    ADEPT_EXCEPTION_LOCATION);
+      }
+      if (recording_is_compressed()) {
+	compressed = &compressed_stack_;
+      }
+      else {
+	for (uIndex iblock = 0; iblock < n_stack_blocks(); iblock++) {
+	  local_compressed_stack.push_block(stack_block(iblock));
+	}
+	compressed = &local_compressed_stack;
+      }
+    }
+
+    std::ofstream file(filename.c_str(), std::ios::out | std::ios::binary);
+    if (!file) {
+      throw stack_file_error("Cannot open \"" + filename + "\" to save recording"
+			     ADEPT_EXCEPTION_LOCATION);
+    }
+
+    // Header
+    std::size_t pos = 8;
+    file.write("ADEPTREC", 8);
+    recording_file_write_word(file, RECORDING_FILE_VERSION);
+    recording_file_write_word(file, compress ? RECORDING_FILE_COMPRESSED : 0);
+    recording_file_write_word(file, sizeof(Real));
+    recording_file_write_word(file, sizeof(uIndex));
+    recording_file_write_word(file, n_statements());
+    recording_file_write_word(file, n_operations());
+    recording_file_write_word(file, max_gradient_);
+    recording_file_write_word(file, independent_index_.size());
+    recording_file_write_word(file, dependent_index_.size());
+    recording_file_write_word(file, compress ? compressed->code().size() : 0);
+    pos += 8*RECORDING_FILE_HEADER_WORDS;
+    recording_file_pad(file, pos);
+
+    if (compress) {
+      recording_file_write(file, pos, &compressed->statements()[0],
+			   sizeof(uIndex), 2*compressed->statements().size());
+      recording_file_pad(file, pos);
+      if (!compressed->code().empty()) {
+	recording_file_write(file, pos, &compressed->code()[0],
+			     sizeof(uIndex), compressed->code().size());
+      }
+      recording_file_pad(file, pos);
+    }
+    else {
+      // The statements of each block are written with their
+      // positions in the operation stack offset by the number of
+      // operations in earlier blocks, and without the null statement
+      // at the start of each block except the first
+      uIndex n_previous_operations = 0;
+      for (uIndex iblock = 0; iblock < n_stack_blocks(); iblock++) {
+	const StackBlock block = stack_block(iblock);
+	uIndex first = iblock == 0 ? 0 : 1;
+	if (n_previous_operations == 0) {
+	  recording_file_write(file, pos, block.statement+first, sizeof(uIndex),
+			       2*(block.n_statements-first));
+	}
+	else {
+	  std::vector<Statement> statements(block.statement+first,
+					    block.statement+block.n_statements);
+	  for (std::size_t ist = 0; ist < statements.size(); ++ist) {
+	    statements[ist].end_plus_one += n_previous_operations;
+	  }
+	  if (!statements.empty()) {
+	    recording_file_write(file, pos, &statements[0], sizeof(uIndex),
+				 2*statements.size());
+	  }
+	}
+	n_previous_operations += block.n_operations;
+      }
+      recording_file_pad(file, pos);
+      for (uIndex iblock = 0; iblock < n_stack_blocks(); iblock++) {
+	const StackBlock block = stack_block(iblock);
+	recording_file_write(file, pos, block.multiplier, sizeof(Real),
+			     block.n_operations);
+      }
+      recording_file_pad(file, pos);
+      for (uIndex iblock = 0; iblock < n_stack_blocks(); iblock++) {
+	const StackBlock block = stack_block(iblock);
+	recording_file_write(file, pos, block.index, sizeof(uIndex),
+			     block.n_operations);
+      }
+      recording_file_pad(file, pos);
+    }
+
+    if (!independent_index_.empty()) {
+      recording_file_write(file, pos, &independent_index_[0], sizeof(uIndex),
+			   independent_index_.size());
+    }
+    recording_file_pad(file, pos);
+    if (!dependent_index_.empty()) {
+      recording_file_write(file, pos, &dependent_index_[0], sizeof(uIndex),
+			   dependent_index_.size());
+    }
+
+    if (!file) {
+      throw stack_file_error("Error writing recording to \"" + filename + "\""
+			     ADEPT_EXCEPTION_LOCATION);
+    }
+  }
+
+
+  // Replace the current recording with one read from a file written
+  // by save_recording. The whole file is read and checked before the
+  // current recording is cleared, so that a truncated or corrupt file
+  // results in a stack_file_error exception rather than a corrupt
+  // recording.
+  void
+  Stack::load_recording(const std::string& filename)
+  {
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!file) {
+      throw stack_file_error("Cannot open \"" + filename + "\" to load recording"
+			     ADEPT_EXCEPTION_LOCATION);
+    }
+    file.seekg(0, std::ios::end);
+    const std::size_t file_size
+      = static_cast<std::streamoff>(file.tellg());
+    file.seekg(0, std::ios::beg);
+
+    // Read and check the header
+    char magic[8];
+    file.read(magic, 8);
+    std::size_t header[RECORDING_FILE_HEADER_WORDS];
+    for (std::size_t i = 0; i < RECORDING_FILE_HEADER_WORDS; ++i) {
+      header[i] = recording_file_read_word(file);
+    }
+    if (!file || std::strncmp(magic, "ADEPTREC", 8) != 0) {
+      throw stack_file_error("\"" + filename + "\" is not an Adept recording file"
+			     ADEPT_EXCEPTION_LOCATION);
+    }
+    if (header[0] != RECORDING_FILE_VERSION) {
+      throw stack_file_error("\"" + filename + "\" was written by an incompatible version of Adept"
+			     ADEPT_EXCEPTION_LOCATION);
+    }
+    if (header[2] != sizeof(Real) || header[3] != sizeof(uIndex)) {
+      throw stack_file_error("\"" + filename + "\" was written by Adept compiled with different sizes of Real or uIndex"
+			     ADEPT_EXCEPTION_LOCATION);
+    }
+    bool compressed = (header[1] & RECORDING_FILE_COMPRESSED);
+    if (compressed && !recording_file_host_is_little_endian()) {
+      throw feature_not_available("Compressed recording files can only be read on little-endian platforms"
+				  ADEPT_EXCEPTION_LOCATION);
+    }
+    const std::string corrupt_message
+      = "\"" + filename + "\" is truncated or corrupt";
+    // Every count must be representable as a uIndex, and there must
+    // be at least the initial null statement
+    for (std::size_t i = 4; i < RECORDING_FILE_HEADER_WORDS; ++i) {
+      if (header[i] > static_cast<std::size_t>(std::numeric_limits<uIndex>::max())) {
+	throw stack_file_error(corrupt_message ADEPT_EXCEPTION_LOCATION);
+      }
+    }
+    uIndex n_file_statements = header[4];
+    uIndex n_file_operations = header[5];
+    uIndex n_file_gradients  = header[6];
+    uIndex n_file_independents = header[7];
+    uIndex n_file_dependents = header[8];
+    std::size_t n_code = header[9];
+    if (n_file_statements < 1 || (!compressed && n_code != 0)) {
+      throw stack_file_error(corrupt_message ADEPT_EXCEPTION_LOCATION);
+    }
+    std::size_t pos = 8 + 8*RECORDING_FILE_HEADER_WORDS;
+    recording_file_skip_pad(file, pos);
+
+    // Read the statements and operations, checking before each array
+    // is allocated that the file is large enough to contain it
+    std::vector<Statement> statements;
+    std::vector<uIndex> code;
+    std::vector<Real> multiplier;
+    std::vector<uIndex> index;
+    if (!recording_file_fits(pos, file_size, 2*sizeof(uIndex),
+			     n_file_statements)) {
+      throw stack_file_error(corrupt_message ADEPT_EXCEPTION_LOCATION);
+    }
+    statements.resize(n_file_statements);
+    recording_file_read(file, pos, &statements[0], sizeof(uIndex),
+			2*n_file_statements);
+    recording_file_skip_pad(file, pos);
+    if (compressed) {
+      if (!recording_file_fits(pos, file_size, sizeof(uIndex), n_code)) {
+	throw stack_file_error(corrupt_message ADEPT_EXCEPTION_LOCATION);
+      }
+      code.resize(n_code);
+      if (n_code > 0) {
+	recording_file_read(file, pos, &code[0], sizeof(uIndex), n_code);
+      }
+      recording_file_skip_pad(file, pos);
+    }
+    else if (n_file_operations > 0) {
+      if (!recording_file_fits(pos, file_size, sizeof(Real)+sizeof(uIndex),
+			       n_file_operations)) {
+	throw stack_file_error(corrupt_message ADEPT_EXCEPTION_LOCATION);
+      }
+      multiplier.resize(n_file_operations);
+      index.resize(n_file_operations);
+      recording_file_read(file, pos, &multiplier[0], sizeof(Real),
+			  n_file_operations);
+      recording_file_skip_pad(file, pos);
+      recording_file_read(file, pos, &index[0], sizeof(uIndex),
+			  n_file_operations);
+      recording_file_skip_pad(file, pos);
+    }
+    if (!file) {
+      throw stack_file_error(corrupt_message ADEPT_EXCEPTION_LOCATION);
+    }
+
+    // Read the independent and dependent variables
+    std::vector<uIndex> independent_index, dependent_index;
+    if (!recording_file_fits(pos, file_size, sizeof(uIndex),
+			     n_file_independents)) {
+      throw stack_file_error(corrupt_message ADEPT_EXCEPTION_LOCATION);
+    }
+    independent_index.resize(n_file_independents);
+    if (n_file_independents > 0) {
+      recording_file_read(file, pos, &independent_index[0], sizeof(uIndex),
+			  n_file_independents);
+    }
+    recording_file_skip_pad(file, pos);
+    if (!recording_file_fits(pos, file_size, sizeof(uIndex),
+			     n_file_dependents)) {
+      throw stack_file_error(corrupt_message ADEPT_EXCEPTION_LOCATION);
+    }
+    dependent_index.resize(n_file_dependents);
+    if (n_file_dependents > 0) {
+      recording_file_read(file, pos, &dependent_index[0], sizeof(uIndex),
+			  n_file_dependents);
+    }
+    if (!file) {
+      throw stack_file_error(corrupt_message ADEPT_EXCEPTION_LOCATION);
+    }
+
+    // Check that the statements refer to operations within the file
+    // in order, and that all gradient indices are within the number
+    // of gradients stated in the header
+    if (compressed) {
+      std::size_t n_operations_encoded;
+      if (!CompressedStack::is_valid(statements, code, n_file_gradients,
+				     n_operations_encoded)
+	  || n_operations_encoded != static_cast<std::size_t>(n_file_operations)) {
+	throw stack_file_error(corrupt_message ADEPT_EXCEPTION_LOCATION);
+      }
+    }
+    else {
+      if (statements[0].end_plus_one != 0
+	  || statements[n_file_statements-1].end_plus_one != n_file_operations
+	  || !recording_file_indices_valid(index, n_file_gradients)) {
+	throw stack_file_error(corrupt_message ADEPT_EXCEPTION_LOCATION);
+      }
+      for (uIndex ist = 1; ist < n_file_statements; ist++) {
+	if (static_cast<std::size_t>(statements[ist].index)
+	    >= static_cast<std::size_t>(n_file_gradients)
+	    || statements[ist].end_plus_one < statements[ist-1].end_plus_one) {
+	  throw stack_file_error(corrupt_message ADEPT_EXCEPTION_LOCATION);
+	}
+      }
+    }
+    if (!recording_file_indices_valid(independent_index, n_file_gradients)
+	|| !recording_file_indices_valid(dependent_index, n_file_gradients)) {
+      throw stack_file_error(corrupt_message ADEPT_EXCEPTION_LOCATION);
+    }
+
+    // Only now replace the current recording
+    new_recording();
+    if (compressed) {
+      // Decode the statements on to the stack, then keep the
+      // compressed version for use in forward and reverse passes
+      compressed_stack_.swap(statements, code);
+      for (uIndex ist = 1; ist < n_file_statements; ist++) {
+	compressed_stack_.decode(ist, multiplier, index);
+	check_space(multiplier.size());
+	for (std::size_t i = 0; i < multiplier.size(); i++) {
+	  push_rhs(multiplier[i], index[i]);
+	}
+	push_lhs(compressed_stack_.statements()[ist].index);
+      }
+      compressed_stack_.finish(n_statements(), n_operations());
+    }
+    else {
+      for (uIndex ist = 1; ist < n_file_statements; ist++) {
+	uIndex start = statements[ist-1].end_plus_one;
+	check_space(statements[ist].end_plus_one - start);
+	for (uIndex i = start; i < statements[ist].end_plus_one; i++) {
+	  push_rhs(multiplier[i], index[i]);
+	}
+	push_lhs(statements[ist].index);
+      }
+    }
+    independent_index_.swap(independent_index);
+    dependent_index_.swap(dependent_index);
+
+    // Ensure enough gradients will be allocated for the forward and
+    // reverse passes
+    if (n_file_gradients > max_gradient_) {
+      max_gradient_ = n_file_gradients;
+    }
+  }
+
+} // End namespace adept
@@ -0,0 +1,212 @@
+/* renumber_gradients.cpp -- Renumber gradient indices for locality
+
+    Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   Gradient indices are allocated to active objects as they are
+   created, filling gaps left by destroyed objects, so the indices
+   referred to by consecutive statements of a large recording can be
+   scattered across the gradient list.  Here the recording is passed
+   through once and each variable is given the next unused index when
+   it is first encountered, with the independent variables first.
+
+   If indices are to be reused, a variable is given a new index each
+   time it is assigned, which is released for use by a later
+   assignment after the last statement that reads the assigned value.
+   A backward pass first marks the operation that is the last read of
+   each value and the statements whose left-hand side is never read.
+   A variable read before it is assigned in the recording (an input)
+   is always given a fresh index, since in the adjoint pass its
+   gradient must not be mixed with that of an earlier variable
+   sharing the index.  The independent and dependent variables keep
+   one index throughout, which is never shared.
+
+*/
+
+#include <vector>
+
+#include "adept/Stack.h"
+
+namespace adept {
+
+  using namespace internal;
+
+  void
+  Stack::renumber_gradients(bool reuse_indices)
+  {
+    check_no_matrix_nodes("Stack::renumber_gradients()");
+    if (reuse_indices
+	&& (independent_index_.empty() || dependent_index_.empty())) {
+      throw dependents_or_independents_not_identified("Independent and dependent variables must be identified before Stack::renumber_gradients(true)"
+						      ADEPT_EXCEPTION_LOCATION);
+    }
+    if (is_preaccumulating_) {
+      throw invalid_operation("Stack::renumber_gradients() called within a preaccumulation region"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+    if (!gradient_index_map_.empty()) {
+      throw invalid_operation("Stack::renumber_gradients() called twice for the same recording"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+
+    const uIndex n_blocks = n_stack_blocks();
+    const uIndex n_original = max_gradient_;
+
+    // Variables that keep the same index throughout
+    std::vector<bool> is_fixed(n_original, !reuse_indices);
+    if (reuse_indices) {
+      for (std::size_t i = 0; i < independent_index_.size(); ++i) {
+	is_fixed[independent_index_[i]] = true;
+      }
+      for (std::size_t i = 0; i < dependent_index_.size(); ++i) {
+	is_fixed[dependent_index_[i]] = true;
+      }
+    }
+
+    // Backward pass to find the last read of each assigned value
+    std::vector<bool> is_last_read, is_lhs_read;
+    if (reuse_indices) {
+      is_last_read.resize(n_operations(), false);
+      is_lhs_read.resize(n_statements(), false);
+      std::vector<bool> is_read_later(n_original, false);
+      uIndex first_statement = n_statements()-1; // Excluding null statement
+      uIndex first_operation = n_operations();
+      for (uIndex iblock = n_blocks; iblock > 0; --iblock) {
+	const StackBlock block = stack_block(iblock-1);
+	first_statement -= block.n_statements - 1;
+	first_operation -= block.n_operations;
+	for (uIndex ist = block.n_statements-1; ist > 0; --ist) {
+	  const uIndex lhs = block.statement[ist].index;
+	  is_lhs_read[first_statement+ist] = is_read_later[lhs];
+	  is_read_later[lhs] = false;
+	  for (uIndex iop = block.statement[ist].end_plus_one;
+	       iop > block.statement[ist-1].end_plus_one; --iop) {
+	    const uIndex index = block.index[iop-1];
+	    if (!is_read_later[index]) {
+	      is_last_read[first_operation+iop-1] = true;
+	      is_read_later[index] = true;
+	    }
+	  }
+	}
+      }
+    }
+
+    // Forward pass to assign the new indices
+    std::vector<uIndex> new_index(n_original, -1); // Of current value
+    std::vector<uIndex> free_index;
+    std::vector<uIndex> released_index;
+    uIndex n_new = 0;
+    for (std::size_t i = 0; i < independent_index_.size(); ++i) {
+      if (new_index[independent_index_[i]] < 0) {
+	new_index[independent_index_[i]] = n_new++;
+      }
+    }
+    uIndex first_statement = 0;
+    uIndex first_operation = 0;
+    for (uIndex iblock = 0; iblock < n_blocks; ++iblock) {
+      const StackBlock block = stack_block(iblock);
+      for (uIndex ist = 1; ist < block.n_statements; ++ist) {
+	released_index.clear();
+	for (uIndex iop = block.statement[ist-1].end_plus_one;
+	     iop < block.statement[ist].end_plus_one; ++iop) {
+	  const uIndex index = block.index[iop];
+	  if (new_index[index] < 0) {
+	    // Input to the recording
+	    new_index[index] = n_new++;
+	  }
+	  block.index[iop] = new_index[index];
+	  if (reuse_indices && !is_fixed[index]
+	      && is_last_read[first_operation+iop]) {
+	    released_index.push_back(new_index[index]);
+	    new_index[index] = -1;
+	  }
+	}
+	free_index.insert(free_index.end(),
+			  released_index.begin(), released_index.end());
+	const uIndex lhs = block.statement[ist].index;
+	if (is_fixed[lhs]) {
+	  if (new_index[lhs] < 0) {
+	    new_index[lhs] = n_new++;
+	  }
+	  block.statement[ist].index = new_index[lhs];
+	}
+	else {
+	  uIndex index;
+	  if (free_index.empty()) {
+	    index = n_new++;
+	  }
+	  else {
+	    index = free_index.back();
+	    free_index.pop_back();
+	  }
+	  block.statement[ist].index = index;
+	  if (is_lhs_read[first_statement+ist]) {
+	    new_index[lhs] = index;
+	  }
+	  else {
+	    free_index.push_back(index);
+	  }
+	}
+      }
+      first_statement += block.n_statements - 1;
+      first_operation += block.n_operations;
+    }
+
+    // Map the original indices of the variables that remain
+    // accessible to their new ones
+    gradient_index_map_.assign(n_original, -1);
+    for (uIndex i = 0; i < n_original; ++i) {
+      if (is_fixed[i]) {
+	if (new_index[i] < 0) {
+	  new_index[i] = n_new++;
+	}
+	gradient_index_map_[i] = new_index[i];
+      }
+    }
+    renumbered_n_statements_ = n_statements();
+    renumber_gradient_indices(independent_index_, 0);
+    renumber_gradient_indices(dependent_index_, 0);
+    max_gradient_ = n_new;
+    clear_gradients();
+
+    // The indices no longer match those of the operations stored for
+    // replay, or of any compressed, single-precision or sorted copy of
+    // the recording
+    if (is_replay_enabled()) {
+      replay_stack_.push_unsupported();
+    }
+    compressed_stack_.clear();
+    single_precision_stack_.clear();
+    parallel_adjoint_.clear();
+  }
+
+  // Return the new index of a variable after renumber_gradients()
+  uIndex
+  Stack::renumbered_gradient_index(uIndex gradient_index) const
+  {
+    if (n_statements() != renumbered_n_statements_) {
+      throw invalid_operation("Statements added to the recording after Stack::renumber_gradients()"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+    if (static_cast<std::size_t>(gradient_index) >= gradient_index_map_.size()
+	|| gradient_index_map_[gradient_index] < 0) {
+      throw gradient_out_of_range("Gradient of a variable that is neither independent nor dependent requested after Stack::renumber_gradients(true)"
+				  ADEPT_EXCEPTION_LOCATION);
+    }
+    return gradient_index_map_[gradient_index];
+  }
+
+  // Convert original gradient indices to new ones
+  void
+  Stack::renumber_gradient_indices(std::vector<uIndex>& index,
+				   std::size_t first) const
+  {
+    for (std::size_t i = first; i < index.size(); ++i) {
+      index[i] = renumbered_gradient_index(index[i]);
+    }
+  }
+
+} // End namespace adept
@@ -22,6 +22,13 @@
 #include <cblas.h>
 #endif
 
+// If ADEPT_SOURCE_H is defined then we are in a header file generated
+// from all the source files, so builtin_blas.h will already have been
+// included
+#ifndef AdeptSource_H
+#include "builtin_blas.h"
+#endif
+
 namespace adept {
 
   // -------------------------------------------------------------------
@@ -90,13 +97,15 @@ namespace adept {
     s << "  Compiled with " << adept::compiler_version() << "\n";
     s << "  Compiler flags \"" << adept::compiler_flags() << "\"\n";
 #ifdef BLAS_LIBS
-    if (std::strlen(BLAS_LIBS) > 2) {
+    if (std::strlen(BLAS_LIBS) > 2 && !internal::use_builtin_blas_) {
       const char* blas_libs = BLAS_LIBS + 2;
       s << "  BLAS support from " << blas_libs << " library\n";
     }
     else {
       s << "  BLAS support from built-in library\n";
     }
+#else
+    s << "  BLAS support from built-in library\n";
 #endif
 #ifdef HAVE_OPENBLAS_CBLAS_HEADER
     s << "  Number of BLAS threads may be specified up to maximum of "
@@ -141,15 +150,32 @@ namespace adept {
 #endif
   }
 
-  // Was the library compiled with matrix multiplication support (from
-  // BLAS)?
+  // Is matrix multiplication available?  This is always true since
+  // Adept provides built-in replacements for the BLAS functions it
+  // uses if compiled without BLAS
   bool
   have_matrix_multiplication() {
-#ifdef HAVE_BLAS
     return true;
-#else
-    return false;
+  }
+
+  // Are matrix operations performed by Adept's built-in replacements
+  // for the BLAS functions rather than by an external BLAS library?
+  bool
+  is_using_builtin_blas() {
+    return internal::use_builtin_blas_;
+  }
+
+  // Choose whether to use Adept's built-in replacements for the BLAS
+  // functions rather than an external BLAS library, e.g. to compare
+  // their speed, and return whether they are now used; if Adept was
+  // compiled without BLAS then the built-in functions are always
+  // used
+  bool
+  set_use_builtin_blas(bool use_builtin) {
+#ifdef HAVE_BLAS
+    internal::use_builtin_blas_ = use_builtin;
 #endif
+    return internal::use_builtin_blas_;
   }
 
   // Was the library compiled with linear algebra support (e.g. inv
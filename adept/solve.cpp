@@ -210,6 +210,153 @@ namespace adept {
     return B_;
   }
 
+
+  namespace internal {
+
+    // Factorize the n-by-n matrix "a" into the column-major LU
+    // factors "lu", then solve for the n-by-nrhs right-hand side
+    // "b", returning the column-major solution in "x"
+    template <typename T>
+    static void
+    lu_factorize_and_solve(Index n, Index nrhs, const MatrixOperand<T>& a,
+			   const MatrixOperand<T>& b, std::vector<T>& lu,
+			   std::vector<lapack_int>& ipiv, std::vector<T>& x)
+    {
+      lu.resize(n*n);
+      ipiv.resize(n);
+      x.resize(n*nrhs);
+      for (Index j = 0; j < n; ++j) {
+	for (Index i = 0; i < n; ++i) {
+	  lu[i+j*n] = a.data[i*a.offset[0] + j*a.offset[1]];
+	}
+      }
+      for (Index j = 0; j < nrhs; ++j) {
+	for (Index i = 0; i < n; ++i) {
+	  x[i+j*n] = b.data[i*b.offset[0] + j*b.offset[1]];
+	}
+      }
+      lapack_int status = cpplapack_getrf(n, &lu[0], n, &ipiv[0]);
+      if (status != 0) {
+	std::stringstream s;
+	s << "Failed to factorize matrix: LAPACK ?getrf returned code " << status;
+	throw(matrix_ill_conditioned(s.str() ADEPT_EXCEPTION_LOCATION));
+      }
+      cpplapack_getrs('N', n, nrhs, &lu[0], n, &ipiv[0], &x[0], n);
+    }
+
+    // Record the solution "x" of the system with matrix "a" and
+    // right-hand side "b", either as a single node holding the LU
+    // factors of "a" or, if matrix nodes are disabled, as one
+    // statement per element of x: dx = A^-1*(db - dA*x)
+    template <typename T>
+    static void
+    record_solve(Index n, Index nrhs, const std::vector<T>& lu,
+		 const std::vector<lapack_int>& ipiv, const MatrixOperand<T>& a,
+		 const MatrixOperand<T>& b, const MatrixOperand<T>& x)
+    {
+#ifdef ADEPT_RECORDING_PAUSABLE
+      if (!ADEPT_ACTIVE_STACK->is_recording()) {
+	return;
+      }
+#endif
+      if (ADEPT_ACTIVE_STACK->are_matrix_nodes_enabled()) {
+	active_stack()->push_matrix_node(new SolveNode(n, nrhs, &lu[0], &ipiv[0],
+						       a, b, x));
+	return;
+      }
+      std::vector<T> a_inv(lu);
+      lapack_int status = cpplapack_getri(n, &a_inv[0], n, &ipiv[0]);
+      if (status != 0) {
+	std::stringstream s;
+	s << "Failed to invert matrix: LAPACK ?getri returned code " << status;
+	throw(matrix_ill_conditioned(s.str() ADEPT_EXCEPTION_LOCATION));
+      }
+      std::vector<T> multiplier(n);
+      for (Index j = 0; j < nrhs; ++j) {
+	for (Index i = 0; i < n; ++i) {
+	  if (b.is_active) {
+	    active_stack()->push_derivative_dependence(b.gradient_index + j*b.offset[1],
+						       &a_inv[i], n, b.offset[0], n);
+	  }
+	  if (a.is_active) {
+	    for (Index k = 0; k < n; ++k) {
+	      for (Index l = 0; l < n; ++l) {
+		multiplier[l] = -a_inv[i+k*n] * x.data[l*x.offset[0] + j*x.offset[1]];
+	      }
+	      active_stack()->push_derivative_dependence(a.gradient_index + k*a.offset[0],
+							 &multiplier[0], n, a.offset[1]);
+	    }
+	  }
+	  active_stack()->push_lhs(x.gradient_index + i*x.offset[0] + j*x.offset[1]);
+	}
+      }
+    }
+
+  }
+
+  // -------------------------------------------------------------------
+  // Solve Ax = b for general square matrix A where A and/or b are
+  // active
+  // -------------------------------------------------------------------
+  template <typename T, bool AIsActive, bool BIsActive>
+  typename internal::enable_if<AIsActive || BIsActive, Array<1,T,true> >::type
+  solve(const Array<2,T,AIsActive>& A, const Array<1,T,BIsActive>& b) {
+    using internal::MatrixOperand;
+    if (A.dimension(0) != A.dimension(1) || A.dimension(1) != b.dimension(0)) {
+      throw size_mismatch("Matrix must be square and match the length of the vector in solve"
+			  ADEPT_EXCEPTION_LOCATION);
+    }
+    const Index n = b.dimension(0);
+    MatrixOperand<T> a_op(A.const_data(), A.offset(0), A.offset(1),
+			  A.gradient_index(), AIsActive);
+    MatrixOperand<T> b_op(b.const_data(), b.offset(0), 0,
+			  b.gradient_index(), BIsActive);
+    std::vector<T> lu, x_;
+    std::vector<lapack_int> ipiv;
+    internal::lu_factorize_and_solve(n, 1, a_op, b_op, lu, ipiv, x_);
+    Array<1,T,true> x(n);
+    for (Index i = 0; i < n; ++i) {
+      x.data()[i*x.offset(0)] = x_[i];
+    }
+    internal::record_solve(n, 1, lu, ipiv, a_op, b_op,
+			   MatrixOperand<T>(x.const_data(), x.offset(0), 0,
+					    x.gradient_index(), true));
+    return x;
+  }
+
+  // -------------------------------------------------------------------
+  // Solve AX = B for general square matrix A where A and/or B are
+  // active
+  // -------------------------------------------------------------------
+  template <typename T, bool AIsActive, bool BIsActive>
+  typename internal::enable_if<AIsActive || BIsActive, Array<2,T,true> >::type
+  solve(const Array<2,T,AIsActive>& A, const Array<2,T,BIsActive>& B) {
+    using internal::MatrixOperand;
+    if (A.dimension(0) != A.dimension(1) || A.dimension(1) != B.dimension(0)) {
+      throw size_mismatch("Matrix must be square and match the number of rows of the right-hand side in solve"
+			  ADEPT_EXCEPTION_LOCATION);
+    }
+    const Index n = B.dimension(0);
+    const Index nrhs = B.dimension(1);
+    MatrixOperand<T> a_op(A.const_data(), A.offset(0), A.offset(1),
+			  A.gradient_index(), AIsActive);
+    MatrixOperand<T> b_op(B.const_data(), B.offset(0), B.offset(1),
+			  B.gradient_index(), BIsActive);
+    std::vector<T> lu, x_;
+    std::vector<lapack_int> ipiv;
+    internal::lu_factorize_and_solve(n, nrhs, a_op, b_op, lu, ipiv, x_);
+    Array<2,T,true> X(n, nrhs);
+    for (Index i = 0; i < n; ++i) {
+      for (Index j = 0; j < nrhs; ++j) {
+	X.data()[i*X.offset(0) + j*X.offset(1)] = x_[i+j*n];
+      }
+    }
+    internal::record_solve(n, nrhs, lu, ipiv, a_op, b_op,
+			   MatrixOperand<T>(X.const_data(), X.offset(0), X.offset(1),
+					    X.gradient_index(), true));
+    return X;
+  }
+
 }
 
 #else
@@ -254,6 +401,26 @@ namespace adept {
     throw feature_not_available("Cannot solve linear equations because compiled without LAPACK");
   }
 
+  // -------------------------------------------------------------------
+  // Solve Ax = b for general square matrix A where A and/or b are
+  // active
+  // -------------------------------------------------------------------
+  template <typename T, bool AIsActive, bool BIsActive>
+  typename internal::enable_if<AIsActive || BIsActive, Array<1,T,true> >::type
+  solve(const Array<2,T,AIsActive>& A, const Array<1,T,BIsActive>& b) {
+    throw feature_not_available("Cannot solve linear equations because compiled without LAPACK");
+  }
+
+  // -------------------------------------------------------------------
+  // Solve AX = B for general square matrix A where A and/or B are
+  // active
+  // -------------------------------------------------------------------
+  template <typename T, bool AIsActive, bool BIsActive>
+  typename internal::enable_if<AIsActive || BIsActive, Array<2,T,true> >::type
+  solve(const Array<2,T,AIsActive>& A, const Array<2,T,BIsActive>& B) {
+    throw feature_not_available("Cannot solve linear equations because compiled without LAPACK");
+  }
+
 }
 
 #endif
@@ -280,5 +447,23 @@ namespace adept {
   ADEPT_EXPLICIT_SOLVE(double,2)
 #undef ADEPT_EXPLICIT_SOLVE
 
+#define ADEPT_EXPLICIT_ACTIVE_SOLVE(TYPE,RRANK,AACTIVE,BACTIVE)		\
+  template Array<RRANK,TYPE,true>					\
+  solve(const Array<2,TYPE,AACTIVE>& A, const Array<RRANK,TYPE,BACTIVE>& b);
+
+  ADEPT_EXPLICIT_ACTIVE_SOLVE(float,1,true,false)
+  ADEPT_EXPLICIT_ACTIVE_SOLVE(float,1,false,true)
+  ADEPT_EXPLICIT_ACTIVE_SOLVE(float,1,true,true)
+  ADEPT_EXPLICIT_ACTIVE_SOLVE(float,2,true,false)
+  ADEPT_EXPLICIT_ACTIVE_SOLVE(float,2,false,true)
+  ADEPT_EXPLICIT_ACTIVE_SOLVE(float,2,true,true)
+  ADEPT_EXPLICIT_ACTIVE_SOLVE(double,1,true,false)
+  ADEPT_EXPLICIT_ACTIVE_SOLVE(double,1,false,true)
+  ADEPT_EXPLICIT_ACTIVE_SOLVE(double,1,true,true)
+  ADEPT_EXPLICIT_ACTIVE_SOLVE(double,2,true,false)
+  ADEPT_EXPLICIT_ACTIVE_SOLVE(double,2,false,true)
+  ADEPT_EXPLICIT_ACTIVE_SOLVE(double,2,true,true)
+#undef ADEPT_EXPLICIT_ACTIVE_SOLVE
+
 }
 
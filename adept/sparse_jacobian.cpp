@@ -0,0 +1,359 @@
+/* sparse_jacobian.cpp -- Computation of sparse Jacobian matrices
+
+    Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   The sparsity pattern of the Jacobian is found by propagating bit
+   vectors through the recording, with each bit indicating dependence
+   on one independent variable (forward) or influence on one
+   dependent variable (reverse), in the same way as tangent-linear and
+   adjoint directions but combined with bitwise "or" in place of
+   multiplication and addition. One machine word holds 64
+   directions, and several words per variable are processed in each
+   pass.
+
+   The columns of the Jacobian are then coloured greedily such that
+   no two columns of the same colour have a non-zero element in the
+   same row, and likewise for the rows. If there are fewer column
+   colours than row colours, a forward pass is seeded with one
+   direction per colour, each direction being the sum of the unit
+   vectors of the independent variables of that colour, and each
+   non-zero element of the Jacobian can be read from the direction
+   of its column's colour.  Otherwise the same is done with a
+   reverse pass seeded by the colours of the rows. A banded Jacobian
+   of bandwidth b needs only b directions regardless of its size.
+
+*/
+
+#include <vector>
+#include <algorithm>
+
+#include "adept/Stack.h"
+#include "adept/Packet.h"
+
+namespace adept {
+
+  namespace internal {
+
+    // Maximum number of colours processed in one pass, which limits
+    // the memory used to this number of gradients per variable
+    static const uIndex MAX_SPARSE_JACOBIAN_DIRECTIONS = 64;
+
+    // Words of bits used to propagate the sparsity pattern, and the
+    // maximum number of words per variable processed in one pass
+    typedef std::size_t SparsityWord;
+    static const uIndex SPARSITY_WORD_BITS = sizeof(SparsityWord)*8;
+    static const uIndex MAX_SPARSITY_WORDS = 8;
+
+    // Convert a sparsity pattern with n_row rows in compressed sparse
+    // row form into compressed sparse column form
+    static
+    void
+    transpose_sparsity(uIndex n_row, uIndex n_column,
+		       const std::vector<uIndex>& row_start,
+		       const std::vector<uIndex>& column,
+		       std::vector<uIndex>& column_start,
+		       std::vector<uIndex>& row)
+    {
+      column_start.assign(n_column+1, 0);
+      for (std::size_t k = 0; k < column.size(); k++) {
+	++column_start[column[k]+1];
+      }
+      for (uIndex j = 0; j < n_column; j++) {
+	column_start[j+1] += column_start[j];
+      }
+      std::vector<uIndex> next(column_start.begin(), column_start.end()-1);
+      row.resize(column.size());
+      for (uIndex i = 0; i < n_row; i++) {
+	for (uIndex k = row_start[i]; k < row_start[i+1]; k++) {
+	  row[next[column[k]]++] = i;
+	}
+      }
+    }
+
+    // Assign each of the n_column columns of a sparsity pattern,
+    // supplied in both compressed sparse row and compressed sparse
+    // column forms, the lowest colour not already used by a column
+    // sharing a row with it, returning the number of colours
+    static
+    uIndex
+    colour_sparse_columns(uIndex n_column,
+			  const std::vector<uIndex>& row_start,
+			  const std::vector<uIndex>& column,
+			  const std::vector<uIndex>& column_start,
+			  const std::vector<uIndex>& row,
+			  std::vector<uIndex>& colour)
+    {
+      uIndex n_colour = 0;
+      colour.resize(n_column);
+      // forbidden[c] == j+1 if colour c is used by a neighbour of
+      // column j
+      std::vector<uIndex> forbidden(n_column+1, 0);
+      for (uIndex j = 0; j < n_column; j++) {
+	for (uIndex k = column_start[j]; k < column_start[j+1]; k++) {
+	  const uIndex i = row[k];
+	  for (uIndex l = row_start[i]; l < row_start[i+1]; l++) {
+	    if (column[l] < j) {
+	      forbidden[colour[column[l]]] = j+1;
+	    }
+	  }
+	}
+	uIndex c = 0;
+	while (c < n_colour && forbidden[c] == j+1) {
+	  ++c;
+	}
+	colour[j] = c;
+	if (c == n_colour) {
+	  ++n_colour;
+	}
+      }
+      return n_colour;
+    }
+
+  } // End namespace internal
+
+  using namespace internal;
+
+  // Compute the sparsity pattern of the Jacobian matrix by
+  // propagating bit vectors forward through the recording if there
+  // are no more independents than dependents, or backward otherwise
+  void
+  Stack::jacobian_sparsity(std::vector<uIndex>& row_start,
+			   std::vector<uIndex>& column) const
+  {
+    check_no_matrix_nodes("Stack::jacobian_sparsity()");
+    if (independent_index_.empty() || dependent_index_.empty()) {
+      throw(dependents_or_independents_not_identified());
+    }
+    const bool is_forward = (n_independent() <= n_dependent());
+    // Number of directions: independents in forward mode, dependents
+    // in reverse mode
+    const uIndex n_directions = is_forward ? n_independent() : n_dependent();
+    const uIndex n_words = std::min((n_directions + SPARSITY_WORD_BITS - 1)
+				    / SPARSITY_WORD_BITS,
+				    MAX_SPARSITY_WORDS);
+    const uIndex n_pass_directions = n_words * SPARSITY_WORD_BITS;
+    std::vector<SparsityWord> bits(static_cast<std::size_t>(max_gradient_)
+				   * n_words);
+    std::vector<SparsityWord> a(n_words);
+    // Columns of the non-zero elements of each row
+    std::vector<std::vector<uIndex> > row_column(n_dependent());
+
+    for (uIndex first = 0; first < n_directions; first += n_pass_directions) {
+      const uIndex end = std::min(first + n_pass_directions, n_directions);
+      std::fill(bits.begin(), bits.end(), SparsityWord(0));
+      const std::vector<uIndex>& seed_index
+	= is_forward ? independent_index_ : dependent_index_;
+      for (uIndex j = first; j < end; j++) {
+	bits[seed_index[j]*n_words + (j-first)/SPARSITY_WORD_BITS]
+	  |= SparsityWord(1) << ((j-first) % SPARSITY_WORD_BITS);
+      }
+      if (is_forward) {
+	for (uIndex iblock = 0; iblock < n_stack_blocks(); iblock++) {
+	  if (iblock+1 < n_stack_blocks()) {
+	    prefetch_stack_block(iblock+1);
+	  }
+	  const StackBlock block = stack_block(iblock);
+	  for (uIndex ist = 1; ist < block.n_statements; ist++) {
+	    std::fill(a.begin(), a.end(), SparsityWord(0));
+	    for (uIndex i = block.statement[ist-1].end_plus_one;
+		 i < block.statement[ist].end_plus_one; i++) {
+	      const SparsityWord* rhs = &bits[block.index[i]*n_words];
+	      for (uIndex w = 0; w < n_words; w++) {
+		a[w] |= rhs[w];
+	      }
+	    }
+	    std::copy(a.begin(), a.end(),
+		      bits.begin() + block.statement[ist].index*n_words);
+	  }
+	  release_stack_block(iblock);
+	}
+	// Bit j of dependent i indicates a non-zero element in column
+	// first+j of row i
+	for (uIndex i = 0; i < n_dependent(); i++) {
+	  const SparsityWord* dep = &bits[dependent_index_[i]*n_words];
+	  for (uIndex w = 0; w < n_words; w++) {
+	    SparsityWord word = dep[w];
+	    for (uIndex b = 0; word; b++, word >>= 1) {
+	      if (word & 1) {
+		row_column[i].push_back(first + w*SPARSITY_WORD_BITS + b);
+	      }
+	    }
+	  }
+	}
+      }
+      else {
+	for (uIndex iblock = n_stack_blocks(); iblock > 0; iblock--) {
+	  if (iblock > 1) {
+	    prefetch_stack_block(iblock-2);
+	  }
+	  const StackBlock block = stack_block(iblock-1);
+	  for (uIndex ist = block.n_statements-1; ist > 0; ist--) {
+	    // As in the adjoint, the left-hand side is cleared since
+	    // the statement overwrites it
+	    SparsityWord* lhs = &bits[block.statement[ist].index*n_words];
+	    SparsityWord any = 0;
+	    for (uIndex w = 0; w < n_words; w++) {
+	      a[w] = lhs[w];
+	      lhs[w] = 0;
+	      any |= a[w];
+	    }
+	    if (any) {
+	      for (uIndex i = block.statement[ist-1].end_plus_one;
+		   i < block.statement[ist].end_plus_one; i++) {
+		SparsityWord* rhs = &bits[block.index[i]*n_words];
+		for (uIndex w = 0; w < n_words; w++) {
+		  rhs[w] |= a[w];
+		}
+	      }
+	    }
+	  }
+	  release_stack_block(iblock-1);
+	}
+	// Bit i of independent j indicates a non-zero element in
+	// column j of row first+i; looping over the columns in order
+	// keeps each row sorted
+	for (uIndex j = 0; j < n_independent(); j++) {
+	  const SparsityWord* indep = &bits[independent_index_[j]*n_words];
+	  for (uIndex w = 0; w < n_words; w++) {
+	    SparsityWord word = indep[w];
+	    for (uIndex b = 0; word; b++, word >>= 1) {
+	      if (word & 1) {
+		row_column[first + w*SPARSITY_WORD_BITS + b].push_back(j);
+	      }
+	    }
+	  }
+	}
+      }
+    }
+
+    row_start.resize(n_dependent()+1);
+    column.clear();
+    for (uIndex i = 0; i < n_dependent(); i++) {
+      row_start[i] = column.size();
+      column.insert(column.end(), row_column[i].begin(), row_column[i].end());
+    }
+    row_start[n_dependent()] = column.size();
+  }
+
+
+  // Compute the Jacobian matrix in compressed sparse row form, using
+  // forward or reverse passes with one direction per colour of the
+  // columns or rows, respectively
+  uIndex
+  Stack::sparse_jacobian(std::vector<uIndex>& row_start,
+			 std::vector<uIndex>& column,
+			 std::vector<Real>& value,
+			 bool reuse_sparsity) const
+  {
+    const uIndex n_row = n_dependent();
+    const uIndex n_column = n_independent();
+    if (!reuse_sparsity) {
+      jacobian_sparsity(row_start, column);
+    }
+    else if (independent_index_.empty() || dependent_index_.empty()) {
+      throw(dependents_or_independents_not_identified());
+    }
+    else if (row_start.size() != static_cast<std::size_t>(n_row)+1
+	     || column.size() != static_cast<std::size_t>(row_start[n_row])) {
+      throw invalid_operation("Sparsity pattern passed to sparse_jacobian does not match the number of dependent variables"
+			      ADEPT_EXCEPTION_LOCATION);
+    }
+    std::vector<uIndex> column_start, row;
+    transpose_sparsity(n_row, n_column, row_start, column, column_start, row);
+    std::vector<uIndex> column_colour, row_colour;
+    uIndex n_column_colour = colour_sparse_columns(n_column, row_start, column,
+						   column_start, row,
+						   column_colour);
+    uIndex n_row_colour = colour_sparse_columns(n_row, column_start, row,
+						row_start, column, row_colour);
+    const bool is_forward = (n_column_colour <= n_row_colour);
+    const uIndex n_colour = is_forward ? n_column_colour : n_row_colour;
+
+    value.resize(column.size());
+    if (n_colour == 0) {
+      return 0;
+    }
+
+    // Gradients of each variable are padded to a multiple of the
+    // packet size, as required by the kernels
+    uIndex max_directions = std::min(n_colour, MAX_SPARSE_JACOBIAN_DIRECTIONS);
+    uIndex stride = ((max_directions + Packet<Real>::size - 1)
+		     / Packet<Real>::size) * Packet<Real>::size;
+    std::size_t gradient_size = static_cast<std::size_t>(max_gradient_)*stride;
+    Real* gradient = alloc_aligned<Real>(gradient_size);
+
+    for (uIndex first_colour = 0; first_colour < n_colour;
+	 first_colour += max_directions) {
+      const uIndex end_colour = std::min(first_colour + max_directions,
+					 n_colour);
+      for (std::size_t i = 0; i < gradient_size; i++) {
+	gradient[i] = 0.0;
+      }
+      if (is_forward) {
+	for (uIndex j = 0; j < n_column; j++) {
+	  const uIndex c = column_colour[j];
+	  if (c >= first_colour && c < end_colour) {
+	    gradient[static_cast<std::size_t>(independent_index_[j])*stride
+		     + c - first_colour] = 1.0;
+	  }
+	}
+	forward_kernel_directions(gradient, stride);
+	for (uIndex i = 0; i < n_row; i++) {
+	  const Real* dep = gradient
+	    + static_cast<std::size_t>(dependent_index_[i])*stride;
+	  for (uIndex k = row_start[i]; k < row_start[i+1]; k++) {
+	    const uIndex c = column_colour[column[k]];
+	    if (c >= first_colour && c < end_colour) {
+	      value[k] = dep[c - first_colour];
+	    }
+	  }
+	}
+      }
+      else {
+	for (uIndex i = 0; i < n_row; i++) {
+	  const uIndex c = row_colour[i];
+	  if (c >= first_colour && c < end_colour) {
+	    gradient[static_cast<std::size_t>(dependent_index_[i])*stride
+		     + c - first_colour] = 1.0;
+	  }
+	}
+	reverse_kernel_directions(gradient, stride);
+	for (uIndex i = 0; i < n_row; i++) {
+	  const uIndex c = row_colour[i];
+	  if (c >= first_colour && c < end_colour) {
+	    for (uIndex k = row_start[i]; k < row_start[i+1]; k++) {
+	      value[k] = gradient[static_cast<std::size_t>(
+				    independent_index_[column[k]])*stride
+				  + c - first_colour];
+	    }
+	  }
+	}
+      }
+    }
+    free_aligned(gradient);
+    return n_colour;
+  }
+
+
+  // Compute the Jacobian matrix in coordinate form
+  uIndex
+  Stack::sparse_jacobian_coordinate(std::vector<uIndex>& row,
+				    std::vector<uIndex>& column,
+				    std::vector<Real>& value) const
+  {
+    std::vector<uIndex> row_start;
+    uIndex n_colour = sparse_jacobian(row_start, column, value, false);
+    row.resize(column.size());
+    for (uIndex i = 0; i < n_dependent(); i++) {
+      for (uIndex k = row_start[i]; k < row_start[i+1]; k++) {
+	row[k] = i;
+      }
+    }
+    return n_colour;
+  }
+
+} // End namespace adept
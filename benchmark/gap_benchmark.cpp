@@ -0,0 +1,224 @@
+/* gap_benchmark.cpp - Benchmark registering and unregistering gradients
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+
+  When active objects are destroyed out of last-in-first-out order,
+  such as when functions return active arrays, the Stack keeps a list
+  of the "gaps" in the gradient list. This program times interleaved
+  registering and unregistering of gradients by the Stack, whose gap
+  list is a sorted vector, against ListGapAllocator below, which
+  reproduces the std::list-based gap list used by earlier versions of
+  Adept. Both use the first gap that is large enough, so they should
+  return the same sequence of gradient indices.
+*/
+
+#include <iostream>
+#include <vector>
+#include <list>
+
+#include <adept.h>
+
+#include "Timer.h"
+
+using adept::uIndex;
+
+// Gap list from earlier versions of Adept, stored in a std::list
+// with a pointer to the most recently grown gap
+class ListGapAllocator {
+public:
+  typedef std::list<adept::Gap> GapList;
+  typedef GapList::iterator GapListIterator;
+
+  ListGapAllocator() : most_recent_gap_(gap_list_.end()), i_gradient_(0) { }
+
+  uIndex register_gradients(uIndex n) {
+    for (GapListIterator it = gap_list_.begin();
+	 it != gap_list_.end(); it++) {
+      uIndex len = it->end + 1 - it->start;
+      if (len > n) {
+	uIndex return_val = it->start;
+	it->start += n;
+	return return_val;
+      }
+      else if (len == n) {
+	uIndex return_val = it->start;
+	if (most_recent_gap_ == it) {
+	  most_recent_gap_ = gap_list_.end();
+	}
+	gap_list_.erase(it);
+	return return_val;
+      }
+    }
+    i_gradient_ += n;
+    return i_gradient_ - n;
+  }
+
+  void unregister_gradients(uIndex gradient_index, uIndex n) {
+    if (gradient_index+n == i_gradient_) {
+      i_gradient_ -= n;
+      if (!gap_list_.empty() && i_gradient_ == gap_list_.back().end+1) {
+	i_gradient_ = gap_list_.back().start;
+	GapListIterator it = gap_list_.end();
+	it--;
+	if (most_recent_gap_ == it) {
+	  most_recent_gap_ = gap_list_.end();
+	}
+	gap_list_.pop_back();
+      }
+      return;
+    }
+    enum { ADDED_AT_BASE, ADDED_AT_TOP, NEW_GAP, NOT_FOUND } status
+      = NOT_FOUND;
+    if (!gap_list_.empty() && most_recent_gap_ != gap_list_.end()) {
+      if (gradient_index == most_recent_gap_->start - n) {
+	most_recent_gap_->start -= n;
+	status = ADDED_AT_BASE;
+      }
+      else if (gradient_index == most_recent_gap_->end + 1) {
+	most_recent_gap_->end += n;
+	status = ADDED_AT_TOP;
+      }
+    }
+    if (status == NOT_FOUND) {
+      for (GapListIterator it = gap_list_.begin();
+	   it != gap_list_.end(); it++) {
+	if (gradient_index <= it->end + 1) {
+	  if (gradient_index == it->start - n) {
+	    status = ADDED_AT_BASE;
+	    it->start -= n;
+	  }
+	  else if (gradient_index == it->end + 1) {
+	    status = ADDED_AT_TOP;
+	    it->end += n;
+	  }
+	  else {
+	    it = gap_list_.insert(it, adept::Gap(gradient_index,
+						 gradient_index+n-1));
+	    status = NEW_GAP;
+	  }
+	  most_recent_gap_ = it;
+	  break;
+	}
+      }
+      if (status == NOT_FOUND) {
+	gap_list_.push_back(adept::Gap(gradient_index, gradient_index+n-1));
+	most_recent_gap_ = gap_list_.end();
+	most_recent_gap_--;
+      }
+    }
+    if (status == ADDED_AT_BASE && most_recent_gap_ != gap_list_.begin()) {
+      GapListIterator it = most_recent_gap_;
+      it--;
+      if (it->end == most_recent_gap_->start - 1) {
+	most_recent_gap_->start = it->start;
+	gap_list_.erase(it);
+      }
+    }
+    else if (status == ADDED_AT_TOP) {
+      GapListIterator it = most_recent_gap_;
+      it++;
+      if (it != gap_list_.end() && it->start == most_recent_gap_->end + 1) {
+	most_recent_gap_->end = it->end;
+	gap_list_.erase(it);
+      }
+    }
+  }
+
+private:
+  GapList gap_list_;
+  GapListIterator most_recent_gap_;
+  uIndex i_gradient_;
+};
+
+// Simple linear congruential generator so that both allocators see
+// exactly the same sequence of requests
+class Random {
+public:
+  Random() : state_(12345u) { }
+  unsigned int operator()(unsigned int n) {
+    state_ = state_ * 1103515245u + 12345u;
+    return (state_ >> 8) % n;
+  }
+private:
+  unsigned int state_;
+};
+
+// Keep n_live objects of up to max_size gradients alive, repeatedly
+// destroying a randomly chosen one and creating a replacement, and
+// return a checksum of the gradient indices returned
+template <class Allocator>
+uIndex
+run_pattern(Allocator& allocator, int n_live, uIndex max_size, int n_steps)
+{
+  Random random;
+  std::vector<uIndex> start(n_live), size(n_live);
+  uIndex checksum = 0;
+  for (int i = 0; i < n_live; i++) {
+    size[i] = 1 + random(max_size);
+    start[i] = allocator.register_gradients(size[i]);
+  }
+  for (int istep = 0; istep < n_steps; istep++) {
+    int i = random(n_live);
+    allocator.unregister_gradients(start[i], size[i]);
+    size[i] = 1 + random(max_size);
+    start[i] = allocator.register_gradients(size[i]);
+    checksum = checksum*31 + start[i];
+  }
+  // Destroy in reverse order of creation
+  for (int i = n_live-1; i >= 0; i--) {
+    allocator.unregister_gradients(start[i], size[i]);
+  }
+  return checksum;
+}
+
+int
+main(int argc, char** argv)
+{
+  const int n_steps = 200000;
+  const int n_live[] = {10, 100, 1000, 10000};
+  const uIndex max_size[] = {1, 16};
+  bool error = false;
+
+  adept::Stack stack;
+  Timer timer;
+  int list_id = timer.new_activity("std::list gap list");
+  int stack_id = timer.new_activity("adept::Stack gap list");
+
+  std::cout << "Interleaved register/unregister of " << n_steps
+	    << " objects (times in ns per step)\n";
+  std::cout << " live objects  max size   std::list    adept::Stack   speed-up\n";
+  for (int isize = 0; isize < 2; isize++) {
+    for (int ilive = 0; ilive < 4; ilive++) {
+      ListGapAllocator list_allocator;
+      timer.start(list_id);
+      uIndex list_checksum = run_pattern(list_allocator, n_live[ilive],
+					 max_size[isize], n_steps);
+      timer.stop();
+      timer.start(stack_id);
+      uIndex stack_checksum = run_pattern(stack, n_live[ilive],
+					  max_size[isize], n_steps);
+      timer.stop();
+      double t_list  = timer.timing(list_id) * 1.0e9 / n_steps;
+      double t_stack = timer.timing(stack_id) * 1.0e9 / n_steps;
+      std::cout << "  " << n_live[ilive] << "\t\t" << max_size[isize]
+		<< "\t" << t_list << "\t" << t_stack
+		<< "\t" << t_list / t_stack << "\n";
+      if (list_checksum != stack_checksum) {
+	std::cout << "*** Gradient indices differ between allocators\n";
+	error = true;
+      }
+      timer.reset(list_id);
+      timer.reset(stack_id);
+    }
+  }
+  if (stack.n_gradients_registered() != 0 || !stack.gap_list().empty()) {
+    std::cout << "*** Stack gap list not empty after all gradients unregistered\n";
+    error = true;
+  }
+  return error ? 1 : 0;
+}
@@ -54,8 +54,15 @@ main(int argc, char* argv[])
 
   adept::Stack stack;
   int n = 2;
+  // If Adept was compiled with BLAS then the inactive multiplication
+  // is also timed using Adept's built-in replacements for BLAS
+  bool compare_builtin = !adept::set_use_builtin_blas(false);
   std::cout << "Dense N-by-N matrix-matrix multiplication\n";
-  std::cout << " N        inactive time (us)   inactive flops    active time (us)    active flops\n";
+  std::cout << " N        inactive time (us)   inactive flops    active time (us)    active flops";
+  if (compare_builtin) {
+    std::cout << "    built-in time (us)    built-in flops";
+  }
+  std::cout << "\n";
   for (int i = ibegin; i <= iend; ++i) {
     std::cout << n << "  ";
 
@@ -65,6 +72,13 @@ main(int argc, char* argv[])
     t = time_operation<true>(n, nrepeat, is_col_major);
     std::cout << t*1.0e6 << "  " << (n*n*n) / t;
 
+    if (compare_builtin) {
+      adept::set_use_builtin_blas(true);
+      t = time_operation<false>(n, nrepeat, is_col_major);
+      std::cout << "  " << t*1.0e6 << "  " << (n*n*n) / t;
+      adept::set_use_builtin_blas(false);
+    }
+
     std::cout << "\n";
 
     n *= 2;
@@ -16,5 +16,6 @@
 #include <adept/BinaryOperation.h>
 #include <adept/Active.h>
 #include <adept/scalar_shortcuts.h>
+#include <adept/Checkpointer.h>
 
 #endif
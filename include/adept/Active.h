@@ -90,6 +90,7 @@ namespace adept {
       if (ADEPT_ACTIVE_STACK->is_recording()) {
 #endif
 	ADEPT_ACTIVE_STACK->push_lhs(gradient_index_);
+	record_replay_constant_();
 #ifdef ADEPT_RECORDING_PAUSABLE
       }
 #endif
@@ -106,6 +107,10 @@ namespace adept {
 #endif
 	ADEPT_ACTIVE_STACK->push_rhs(1.0,gradient_index);
 	ADEPT_ACTIVE_STACK->push_lhs(gradient_index_);
+	if (ADEPT_ACTIVE_STACK->is_replay_enabled()) {
+	  ADEPT_ACTIVE_STACK->replay_stack().push_variable(gradient_index, rhs);
+	  ADEPT_ACTIVE_STACK->replay_stack().push_lhs(gradient_index_);
+	}
 #ifdef ADEPT_RECORDING_PAUSABLE
       }
 #endif
@@ -152,6 +157,7 @@ namespace adept {
 	// Push the gradient offet of this object on to the statement
 	// stack, thereby storing the left-hand-side of the statement
 	ADEPT_ACTIVE_STACK->push_lhs(gradient_index_);
+	rhs.record_replay(*ADEPT_ACTIVE_STACK, gradient_index_);
 #ifdef ADEPT_RECORDING_PAUSABLE
       }
       else {
@@ -192,6 +198,7 @@ namespace adept {
       if (ADEPT_ACTIVE_STACK->is_recording()) {
 #endif
 	ADEPT_ACTIVE_STACK->push_lhs(gradient_index_);
+	record_replay_constant_();
 #ifdef ADEPT_RECORDING_PAUSABLE
       }
 #endif
@@ -213,6 +220,7 @@ namespace adept {
 	// Same as construction with an expression (defined above)
 	val_ = rhs.scalar_value_and_gradient(*ADEPT_ACTIVE_STACK);
 	ADEPT_ACTIVE_STACK->push_lhs(gradient_index_);
+	rhs.record_replay(*ADEPT_ACTIVE_STACK, gradient_index_);
 #ifdef ADEPT_RECORDING_PAUSABLE
       }
       else {
@@ -236,6 +244,7 @@ namespace adept {
 	// Same as construction with an expression (defined above)
 	val_ = rhs.scalar_value_and_gradient(*ADEPT_ACTIVE_STACK);
 	ADEPT_ACTIVE_STACK->push_lhs(gradient_index_);
+	rhs.record_replay(*ADEPT_ACTIVE_STACK, gradient_index_);
 #ifdef ADEPT_RECORDING_PAUSABLE
       }
       else {
@@ -258,6 +267,7 @@ namespace adept {
 #endif
 	val_ = rhs.scalar_value_and_gradient(*ADEPT_ACTIVE_STACK);
 	ADEPT_ACTIVE_STACK->push_lhs(gradient_index_);
+	rhs.record_replay(*ADEPT_ACTIVE_STACK, gradient_index_);
 #ifdef ADEPT_RECORDING_PAUSABLE
       }
       else {
@@ -294,12 +304,14 @@ namespace adept {
     template <typename PType>
     typename enable_if<is_not_expression<PType>::value, Active&>::type
     operator+=(const PType& rhs) {
+      record_replay_value_(REPLAY_Add, rhs);
       val_ += rhs;
       return *this;
     }
     template <typename PType>
     typename enable_if<is_not_expression<PType>::value, Active&>::type
     operator-=(const PType& rhs) {
+      record_replay_value_(REPLAY_Subtract, rhs);
       val_ -= rhs;
       return *this;
     }
@@ -364,7 +376,24 @@ namespace adept {
 					gradient_index_+1, &gradient);
       return gradient;
     }
- 
+
+    // Set and get the gradients in n_directions directions, for use
+    // with the multi-direction versions of forward() and reverse()
+    template <typename MyType>
+    void set_gradient_directions(uIndex n_directions,
+				 const MyType* gradient) const {
+      return ADEPT_ACTIVE_STACK->set_gradient_directions(gradient_index_,
+							 n_directions,
+							 gradient);
+    }
+    template <typename MyType>
+    void get_gradient_directions(uIndex n_directions,
+				 MyType* gradient) const {
+      return ADEPT_ACTIVE_STACK->get_gradient_directions(gradient_index_,
+							 n_directions,
+							 gradient);
+    }
+
 
     // For modular codes, some modules may have an existing
     // Jacobian code and possibly be unsuitable for automatic
@@ -520,6 +549,10 @@ namespace adept {
     void set_location_(const ExpressionSize<Rank>& i, 
 		       ExpressionSize<NArrays>& index) const {}
 
+    void record_replay_(ReplayStack& replay) const {
+      replay.push_variable(gradient_index_, val_);
+    }
+
 
     // The Stack::independent(x) and Stack::dependent(y) functions add
     // the gradient_index of objects x and y to std::vector<uIndex>
@@ -547,6 +580,26 @@ namespace adept {
     // 6. Protected member functions
     // -------------------------------------------------------------------
   protected:
+
+    // If the stack is storing operations for replay, store the
+    // assignment of the current (passive) value to this object, or
+    // the modification of the value by a passive scalar that does
+    // not change the gradient
+    void record_replay_constant_() const {
+      if (ADEPT_ACTIVE_STACK->is_replay_enabled()) {
+	ADEPT_ACTIVE_STACK->replay_stack().push_assign_constant(gradient_index_, val_);
+      }
+    }
+    template <typename PType>
+    void record_replay_value_(uIndex opcode, const PType& rhs) const {
+      if (ADEPT_ACTIVE_STACK->is_replay_enabled()) {
+	ReplayStack& replay = ADEPT_ACTIVE_STACK->replay_stack();
+	replay.push_variable(gradient_index_, val_);
+	replay.push_constant(rhs);
+	replay.push_operation(opcode);
+	replay.push_lhs_value(gradient_index_);
+      }
+    }
     
     // -------------------------------------------------------------------
     // 7. Data
@@ -294,6 +294,10 @@ namespace adept {
     void set_location_(const ExpressionSize<Rank>& i, 
 		       ExpressionSize<NArrays>& index) const {}
 
+    void record_replay_(ReplayStack& replay) const {
+      replay.push_variable(gradient_index_, val_);
+    }
+
 
     // The Stack::independent(x) and Stack::dependent(y) functions add
     // the gradient_index of objects x and y to std::vector<uIndex>
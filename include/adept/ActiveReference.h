@@ -101,6 +101,7 @@ namespace adept {
       if (ADEPT_ACTIVE_STACK->is_recording()) {
 #endif
 	ADEPT_ACTIVE_STACK->push_lhs(gradient_index_);
+	record_replay_constant_();
 #ifdef ADEPT_RECORDING_PAUSABLE
       }
 #endif
@@ -121,6 +122,7 @@ namespace adept {
 #endif
 	val_ = rhs.scalar_value_and_gradient(*ADEPT_ACTIVE_STACK);
 	ADEPT_ACTIVE_STACK->push_lhs(gradient_index_);
+	rhs.record_replay(*ADEPT_ACTIVE_STACK, gradient_index_);
 #ifdef ADEPT_RECORDING_PAUSABLE
       }
       else {
@@ -144,6 +146,7 @@ namespace adept {
 	// Same as construction with an expression (defined above)
 	val_ = rhs.scalar_value_and_gradient(*ADEPT_ACTIVE_STACK);
 	ADEPT_ACTIVE_STACK->push_lhs(gradient_index_);
+	rhs.record_replay(*ADEPT_ACTIVE_STACK, gradient_index_);
 #ifdef ADEPT_RECORDING_PAUSABLE
       }
       else {
@@ -165,6 +168,7 @@ namespace adept {
 #endif
 	val_ = rhs.scalar_value_and_gradient(*ADEPT_ACTIVE_STACK);
 	ADEPT_ACTIVE_STACK->push_lhs(gradient_index_);
+	rhs.record_replay(*ADEPT_ACTIVE_STACK, gradient_index_);
 #ifdef ADEPT_RECORDING_PAUSABLE
       }
       else {
@@ -201,12 +205,14 @@ namespace adept {
     template <typename PType>
     typename enable_if<is_not_expression<PType>::value, ActiveReference&>::type
     operator+=(const PType& rhs) {
+      record_replay_value_(REPLAY_Add, rhs);
       val_ += rhs;
       return *this;
     }
     template <typename PType>
     typename enable_if<is_not_expression<PType>::value, ActiveReference&>::type
     operator-=(const PType& rhs) {
+      record_replay_value_(REPLAY_Subtract, rhs);
       val_ -= rhs;
       return *this;
     }
@@ -423,6 +429,10 @@ namespace adept {
     void set_location_(const ExpressionSize<Rank>& i, 
 		       ExpressionSize<NArrays>& index) const {}
 
+    void record_replay_(ReplayStack& replay) const {
+      replay.push_variable(gradient_index_, val_);
+    }
+
 
     // The Stack::independent(x) and Stack::dependent(y) functions add
     // the gradient_index of objects x and y to std::vector<uIndex>
@@ -450,6 +460,23 @@ namespace adept {
     // reference to the underlying passive data
     Type& lvalue() { return val_; }
 
+    // Store assignments of passive values for replay, as in Active
+    void record_replay_constant_() const {
+      if (ADEPT_ACTIVE_STACK->is_replay_enabled()) {
+	ADEPT_ACTIVE_STACK->replay_stack().push_assign_constant(gradient_index_, val_);
+      }
+    }
+    template <typename PType>
+    void record_replay_value_(uIndex opcode, const PType& rhs) const {
+      if (ADEPT_ACTIVE_STACK->is_replay_enabled()) {
+	ReplayStack& replay = ADEPT_ACTIVE_STACK->replay_stack();
+	replay.push_variable(gradient_index_, val_);
+	replay.push_constant(rhs);
+	replay.push_operation(opcode);
+	replay.push_lhs_value(gradient_index_);
+      }
+    }
+
     // -------------------------------------------------------------------
     // 7. Data
     // -------------------------------------------------------------------
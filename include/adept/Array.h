@@ -60,6 +60,11 @@ namespace adept {
     template <MatrixStorageOrder, Index, Index> struct BandEngine;
   }
 
+  // Forward declaration to enable assignment of matrix products
+  namespace internal {
+    template <typename, int, bool> class MatmulChain;
+  }
+
   // Forward declaration to enable linking at construction and via
   // link to FixedArray
   template <typename, bool, Index, Index, Index, Index, Index, Index, Index>
@@ -634,6 +639,24 @@ namespace adept {
   //    ADEPT_DEFINE_OPERATOR(operator|=, |);
 #undef ADEPT_DEFINE_OPERATOR
 
+    // A matrix product A**B**... (see matmul.h) is evaluated directly
+    // into the present array, or accumulated into it with += and -=
+    template <bool EIsActive>
+    Array& operator=(const internal::MatmulChain<Type,Rank,EIsActive>& rhs) {
+      rhs.assign_to_(*this, 0);
+      return *this;
+    }
+    template <bool EIsActive>
+    Array& operator+=(const internal::MatmulChain<Type,Rank,EIsActive>& rhs) {
+      rhs.assign_to_(*this, 1);
+      return *this;
+    }
+    template <bool EIsActive>
+    Array& operator-=(const internal::MatmulChain<Type,Rank,EIsActive>& rhs) {
+      rhs.assign_to_(*this, -1);
+      return *this;
+    }
+
     // Enable the A.where(B) = C construct.
 
     // Firstly implement the A.where(B) to return a "Where<A,B>" object
@@ -313,6 +313,12 @@ namespace adept {
 	right.template set_location_<MyArrayNum+L::n_arrays>(i, index);
       }
 
+      void record_replay_(ReplayStack& replay) const {
+	record_replay_argument(replay, left);
+	record_replay_argument(replay, right);
+	replay.push_operation(Op::replay_opcode);
+      }
+
 
       template <int MyArrayNum, int MyScratchNum, int NArrays, int NScratch>
       void calc_gradient_(Stack& stack, const ExpressionSize<NArrays>& loc,
@@ -534,6 +540,12 @@ namespace adept {
 	right.template set_location_<MyArrayNum>(i, index);
       }
 
+      void record_replay_(ReplayStack& replay) const {
+	replay.push_constant(left.value());
+	record_replay_argument(replay, right);
+	replay.push_operation(Op::replay_opcode);
+      }
+
 
       template <int MyArrayNum, int MyScratchNum, int NArrays, int NScratch>
       void calc_gradient_(Stack& stack, const ExpressionSize<NArrays>& loc,
@@ -718,6 +730,12 @@ namespace adept {
 	left.template set_location_<MyArrayNum>(i, index);
       }
 
+      void record_replay_(ReplayStack& replay) const {
+	record_replay_argument(replay, left);
+	replay.push_constant(right.value());
+	replay.push_operation(Op::replay_opcode);
+      }
+
 
       template <int MyArrayNum, int MyScratchNum, int NArrays, int NScratch>
       void calc_gradient_(Stack& stack, const ExpressionSize<NArrays>& loc,
@@ -776,6 +794,7 @@ namespace adept {
       static const bool is_operator  = true;  // Operator or function for expression_string()
       static const int  store_result = 0;     // Do we need any scratch space?
       static const bool is_vectorized = true;
+      static const int  replay_opcode = REPLAY_Add;
 
       const char* operation_string() const { return "+"; } // For expression_string()
       
@@ -818,6 +837,7 @@ namespace adept {
       static const bool is_operator  = true;  // Operator or function for expression_string()
       static const int  store_result = 1;     // Do we need any scratch space?
       static const bool is_vectorized = true;
+      static const int  replay_opcode = REPLAY_Subtract;
 
       const char* operation_string() const { return "-"; } // For expression_string()
       
@@ -861,6 +881,7 @@ namespace adept {
       static const bool is_operator  = true; // Operator or function for expression_string()
       static const int  store_result = 1;    // Do we need any scratch space? (this can be 0 or 1)
       static const bool is_vectorized = true;
+      static const int  replay_opcode = REPLAY_Multiply;
 
       const char* operation_string() const { return "*"; } // For expression_string()
       
@@ -907,6 +928,7 @@ namespace adept {
       static const bool is_operator  = true; // Operator or function for expression_string()
       static const int  store_result = 2;    // Do we need any scratch space? (this can be 1 or 2)
       static const bool is_vectorized = true;
+      static const int  replay_opcode = REPLAY_Divide;
 
       const char* operation_string() const { return "/"; } // For expression_string()
       
@@ -981,6 +1003,7 @@ namespace adept {
       static const bool is_operator  = false; // Operator or function for expression_string()
       static const int  store_result = 1;     // Do we need any scratch space? (this CANNOT be changed)
       static const bool is_vectorized = false;
+      static const int  replay_opcode = REPLAY_Pow;
 
       const char* operation_string() const { return "pow"; } // For expression_string()
       
@@ -1040,6 +1063,7 @@ namespace adept {
       static const bool is_operator  = false; // Operator or function for expression_string()
       static const int  store_result = 2;     // Do we need any scratch space? Yes: for left^2+right^2
       static const bool is_vectorized = false;
+      static const int  replay_opcode = REPLAY_Atan2;
 
       const char* operation_string() const { return "atan2"; } // For expression_string()
       
@@ -1100,6 +1124,7 @@ namespace adept {
       static const bool is_operator  = false; // Operator or function for expression_string()
       static const int  store_result = 0;    // Do we need any scratch space? (this can be 0 or 1)
       static const bool is_vectorized = true;
+      static const int  replay_opcode = REPLAY_Max;
 
       const char* operation_string() const { return "max"; } // For expression_string()
       
@@ -1181,6 +1206,7 @@ namespace adept {
       static const bool is_operator  = false; // Operator or function for expression_string()
       static const int  store_result = 0;    // Do we need any scratch space? (this can be 0 or 1)
       static const bool is_vectorized = true;
+      static const int  replay_opcode = REPLAY_Min;
 
       const char* operation_string() const { return "min"; } // For expression_string()
       
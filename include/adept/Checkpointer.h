@@ -0,0 +1,230 @@
+/* Checkpointer.h -- Binomial checkpointing of time-stepping adjoints
+
+    Copyright (C) 2012-2014 University of Reading
+    Copyright (C) 2015 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   Recording every step of a long time-stepping simulation can require
+   more memory than is available. The alternative is to store the
+   state at a small number of "checkpoints" during the simulation and
+   then, when computing the adjoint, to rerun the simulation from the
+   checkpoints so that only one step is recorded at a time. The
+   Checkpointer class automates this: the user supplies a "step"
+   functor and a "copy_state" functor, and the Checkpointer calls them
+   according to a binomial schedule that, for a given number of
+   checkpoints, minimizes the number of steps that must be recomputed.
+
+   The step functor is called as step(i) to advance the state from
+   step i to step i+1, where the state consists of user variables that
+   include the active variables passed to Checkpointer::reverse; the
+   step should overwrite these variables in place. The copy_state
+   functor is called as copy_state(slot, true) to copy the state into
+   checkpoint "slot" and copy_state(slot, false) to copy it back,
+   where slot is between 0 and the number of checkpoints minus one.
+   Usage is as follows:
+
+     Checkpointer<MyStep,MyCopy> checkpointer(n_steps, n_checkpoints,
+                                              step, copy_state);
+     checkpointer.forward();   // State now at step n_steps
+     // ...record the cost function of the final state and compute
+     // its adjoint, placing the gradients of the state in "adjoint"
+     checkpointer.reverse(state, n_state, adjoint);
+     // "adjoint" now contains the gradients of the initial state
+
+   The schedule is computed by the non-template CheckpointSchedule
+   class as a list of actions, which can also be used to predict the
+   cost of a given number of checkpoints without running anything.
+
+*/
+
+#ifndef AdeptCheckpointer_H
+#define AdeptCheckpointer_H 1
+
+#include <vector>
+
+#include <adept/base.h>
+#include <adept/Active.h>
+
+namespace adept {
+
+  // Schedule of actions to compute the adjoint of n_steps steps
+  // storing no more than n_checkpoints copies of the state at once
+  class CheckpointSchedule {
+  public:
+    enum ActionType {
+      CHECKPOINT_STORE,   // Copy the state into checkpoint "slot"
+      CHECKPOINT_RESTORE, // Copy checkpoint "slot" back to the state
+      CHECKPOINT_ADVANCE, // Run "n_steps" steps from "step" without recording
+      CHECKPOINT_ADJOINT  // Record step "step" and compute its adjoint
+    };
+
+    struct Action {
+      ActionType type;
+      uIndex slot;
+      uIndex step;
+      uIndex n_steps;
+    };
+
+    CheckpointSchedule(uIndex n_steps, uIndex n_checkpoints);
+
+    // The actions of the forward pass, which runs the whole
+    // simulation storing the initial state and some intermediate
+    // ones, and the actions of the reverse pass that follows
+    const std::vector<Action>& forward_actions() const
+    { return forward_actions_; }
+    const std::vector<Action>& reverse_actions() const
+    { return reverse_actions_; }
+
+    uIndex n_steps() const { return n_steps_; }
+    uIndex n_checkpoints() const { return n_checkpoints_; }
+
+    // Number of steps that are run without recording in the reverse
+    // pass, in addition to the n_steps of the forward pass and the
+    // n_steps that are recorded
+    uIndex n_recomputed_steps() const { return n_recomputed_steps_; }
+
+  protected:
+    // Add the actions to reverse steps "first" to "last"-1, where the
+    // state at "first" is stored in "slot" and "n_free" further
+    // checkpoints are available
+    void reverse_segment(uIndex first, uIndex last, uIndex slot,
+			 uIndex n_free);
+    // Add an action and update current_step_
+    void add_action(std::vector<Action>& actions, ActionType type,
+		    uIndex slot, uIndex step, uIndex n_steps = 1);
+
+    // Data
+    std::vector<Action> forward_actions_;
+    std::vector<Action> reverse_actions_;
+    uIndex n_steps_;
+    uIndex n_checkpoints_;
+    uIndex n_recomputed_steps_;
+    uIndex current_step_; // Step of the state at this point in the schedule
+  };
+
+
+  // Drive the forward and reverse passes of a checkpointed
+  // simulation on the currently active stack
+  template <class Step, class CopyState>
+  class Checkpointer {
+  public:
+    Checkpointer(uIndex n_steps, uIndex n_checkpoints,
+		 Step& step, CopyState& copy_state)
+      : schedule_(n_steps, n_checkpoints), step_(step),
+	copy_state_(copy_state), n_recomputed_steps_(0),
+	max_statements_(0), max_operations_(0) { }
+
+    // Run the simulation from step 0 to n_steps without recording,
+    // storing checkpoints along the way; any existing recording is
+    // left unchanged
+    void forward() {
+      run(schedule_.forward_actions(), 0, 0, 0);
+    }
+
+    // Given the gradients of the final state in "adjoint", compute
+    // the gradients of the initial state, replacing the contents of
+    // "adjoint". The "state" variables must be the active variables
+    // updated in place by the step functor. Each step is recorded
+    // after any existing recording, which is rewound to its original
+    // end before the next, so that the checkpointed simulation may be
+    // part of a larger recording; that of the last step is left on
+    // the stack.
+    void reverse(Active<Real>* state, uIndex n_state, Real* adjoint) {
+      n_recomputed_steps_ = 0;
+      max_statements_ = 0;
+      max_operations_ = 0;
+      run(schedule_.reverse_actions(), state, n_state, adjoint);
+    }
+
+    const CheckpointSchedule& schedule() const { return schedule_; }
+
+    // Number of steps run without recording in the last reverse pass
+    uIndex n_recomputed_steps() const { return n_recomputed_steps_; }
+    // Largest recording of a single step in the last reverse pass
+    uIndex max_statements() const { return max_statements_; }
+    uIndex max_operations() const { return max_operations_; }
+
+  protected:
+    // Steps run without recording are run with recording paused if
+    // ADEPT_RECORDING_PAUSABLE is defined; otherwise the recording
+    // is rewound after each step so that it does not grow
+    void advance(uIndex first, uIndex n) {
+      bool is_paused = ADEPT_ACTIVE_STACK->pause_recording();
+      for (uIndex i = first; i < first+n; i++) {
+	step_(i);
+	if (!is_paused) {
+	  ADEPT_ACTIVE_STACK->rewind(start_);
+	}
+      }
+      ADEPT_ACTIVE_STACK->continue_recording();
+    }
+
+    // Copy the state to or from a checkpoint without recording
+    void copy_state(uIndex slot, bool store) {
+      bool is_paused = ADEPT_ACTIVE_STACK->pause_recording();
+      copy_state_(slot, store);
+      if (is_paused) {
+	ADEPT_ACTIVE_STACK->continue_recording();
+      }
+      else {
+	ADEPT_ACTIVE_STACK->rewind(start_);
+      }
+    }
+
+    // Carry out a list of actions; "state" is only used by the
+    // CHECKPOINT_ADJOINT actions of the reverse pass, in which the
+    // adjoint of each recorded step is computed from its own part of
+    // the recording
+    void run(const std::vector<CheckpointSchedule::Action>& actions,
+	     Active<Real>* state, uIndex n_state, Real* adjoint) {
+      Stack& stack = *ADEPT_ACTIVE_STACK;
+      start_ = stack.get_position();
+      for (std::size_t iaction = 0; iaction < actions.size(); iaction++) {
+	const CheckpointSchedule::Action& action = actions[iaction];
+	switch (action.type) {
+	case CheckpointSchedule::CHECKPOINT_STORE:
+	  copy_state(action.slot, true);
+	  break;
+	case CheckpointSchedule::CHECKPOINT_RESTORE:
+	  copy_state(action.slot, false);
+	  break;
+	case CheckpointSchedule::CHECKPOINT_ADVANCE:
+	  advance(action.step, action.n_steps);
+	  if (adjoint) {
+	    n_recomputed_steps_ += action.n_steps;
+	  }
+	  break;
+	case CheckpointSchedule::CHECKPOINT_ADJOINT:
+	  stack.rewind(start_);
+	  stack.clear_gradients();
+	  step_(action.step);
+	  if (stack.n_statements() - start_.n_statements > max_statements_) {
+	    max_statements_ = stack.n_statements() - start_.n_statements;
+	  }
+	  if (stack.n_operations() - start_.n_operations > max_operations_) {
+	    max_operations_ = stack.n_operations() - start_.n_operations;
+	  }
+	  set_gradients(state, n_state, adjoint);
+	  stack.compute_adjoint(start_, stack.get_position());
+	  get_gradients(state, n_state, adjoint);
+	  break;
+	}
+      }
+    }
+
+    // Data
+    CheckpointSchedule schedule_;
+    Step& step_;
+    CopyState& copy_state_;
+    uIndex n_recomputed_steps_;
+    uIndex max_statements_;
+    uIndex max_operations_;
+    StackPosition start_; // End of the recording when run() was called
+  };
+
+} // End namespace adept
+
+#endif
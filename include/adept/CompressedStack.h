@@ -0,0 +1,163 @@
+/* CompressedStack.h -- Compressed copy of the statement & operation stacks
+
+    Copyright (C) 2012-2014 University of Reading
+    Copyright (C) 2015 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   Most operations in a typical recording have a multiplier of
+   exactly +1 or -1 (from additions, subtractions and copies), and
+   array statements generate long runs of consecutive gradient
+   indices, yet each operation on the stack takes a full Real and a
+   full uIndex. Stack::compress_recording() encodes the recording
+   into the more compact form held by the CompressedStack class,
+   which is then used by Stack::compute_adjoint() and
+   Stack::compute_tangent_linear() as long as the recording is not
+   subsequently modified.
+
+   The statements are stored as in the original stacks, except that
+   "end_plus_one" refers to a single array of uIndex "code words"
+   rather than to the operation stack. The operations of each
+   statement are stored as a sequence of groups of operations of the
+   same kind, each introduced by a header word containing the number
+   of operations in the group shifted left by GROUP_SHIFT bits,
+   combined with one of GROUP_GENERAL, GROUP_PLUS_ONE or
+   GROUP_MINUS_ONE, and optionally with GROUP_RUN.  The header is
+   followed by:
+
+     GROUP_GENERAL             n x (index, multiplier)
+     GROUP_GENERAL|GROUP_RUN   first index, n x multiplier
+     GROUP_PLUS/MINUS_ONE      n x index
+     GROUP_PLUS/MINUS_ONE|RUN  first index
+
+   where each multiplier occupies REAL_WORDS code words.  The order
+   of the operations is preserved, so the results of the adjoint and
+   tangent-linear computations are identical to those using the
+   uncompressed recording.
+
+*/
+
+#ifndef AdeptCompressedStack_H
+#define AdeptCompressedStack_H 1
+
+#include <vector>
+#include <cstddef>
+
+#include <adept/base.h>
+#include <adept/Statement.h>
+
+namespace adept {
+  namespace internal {
+
+    class CompressedStack {
+    public:
+      // Flags stored in the header word of each group of operations
+      enum {
+	GROUP_GENERAL   = 0, // Multipliers stored explicitly
+	GROUP_PLUS_ONE  = 1, // All multipliers equal to +1
+	GROUP_MINUS_ONE = 2, // All multipliers equal to -1
+	GROUP_KIND_MASK = 3,
+	GROUP_RUN       = 4, // Gradient indices are consecutive
+	GROUP_SHIFT     = 3
+      };
+
+      // Shortest run of consecutive gradient indices worth storing as
+      // a run: shorter runs are stored as part of a list, since
+      // splitting a list around a run costs up to two header words
+      enum { MIN_RUN_LENGTH = 4 };
+
+      // Number of code words occupied by a multiplier
+      enum { REAL_WORDS = (sizeof(Real)+sizeof(uIndex)-1)/sizeof(uIndex) };
+
+      CompressedStack() : n_statements_(0), n_operations_(0) { }
+
+      // Remove any existing compressed recording
+      void clear();
+
+      // Encode the statements and operations of one block of a
+      // recording, appending them to those already encoded; the
+      // blocks must be supplied in order
+      void push_block(const StackBlock& block);
+
+      // Record the number of statements and operations in the
+      // original recording once all its blocks have been encoded
+      void finish(uIndex n_statements, uIndex n_operations) {
+	n_statements_ = n_statements;
+	n_operations_ = n_operations;
+      }
+
+      // Return true if this is a compressed version of a recording
+      // with the specified number of statements and operations; since
+      // statements and operations can only be added to a recording,
+      // this indicates whether it has been modified since compression
+      bool matches(uIndex n_statements, uIndex n_operations) const {
+	return n_statements_ > 0
+	  && n_statements_ == n_statements && n_operations_ == n_operations;
+      }
+
+      // Adjoint and tangent-linear computations on the gradient list
+      void reverse(Real* __restrict gradient) const;
+      void forward(Real* __restrict gradient) const;
+
+      // Extract the multipliers and gradient indices of the
+      // operations of statement "ist" (where the first real statement
+      // is 1) into the vectors provided, which are first cleared
+      void decode(uIndex ist, std::vector<Real>& multiplier,
+		  std::vector<uIndex>& index) const;
+
+      // Return true if "statements" and "code", read from a file, are
+      // a valid encoding whose operations refer only to gradient
+      // indices less than n_gradients, in which case n_operations is
+      // set to the number of operations encoded
+      static bool is_valid(const std::vector<Statement>& statements,
+			   const std::vector<uIndex>& code,
+			   uIndex n_gradients, std::size_t& n_operations);
+
+      // Direct access to the encoded statements and operations, used
+      // to write them to a file, and to replace them with those read
+      // from a file
+      const std::vector<Statement>& statements() const { return statement_; }
+      const std::vector<uIndex>& code() const { return code_; }
+      void swap(std::vector<Statement>& statements, std::vector<uIndex>& code) {
+	statement_.swap(statements);
+	code_.swap(code);
+      }
+
+      // Number of statements and operations that were compressed, and
+      // the number of bytes now used to store them
+      uIndex n_statements() const { return n_statements_; }
+      uIndex n_operations() const { return n_operations_; }
+      std::size_t memory() const {
+	return statement_.size()*sizeof(Statement)
+	  + code_.size()*sizeof(uIndex);
+      }
+
+    protected:
+      // Encode n operations of one statement
+      void push_operations(const Real* multiplier, const uIndex* index,
+			   uIndex n);
+      // Encode n operations of the same kind, splitting them into
+      // runs and lists of gradient indices
+      void push_group(uIndex kind, const Real* multiplier,
+		      const uIndex* index, uIndex n);
+      // Encode n operations as one run or one list, splitting into
+      // more than one group if n is too large to store in a header
+      void push_run(uIndex kind, const Real* multiplier,
+		    const uIndex* index, uIndex n);
+      void push_list(uIndex kind, const Real* multiplier,
+		     const uIndex* index, uIndex n);
+      void push_multiplier(Real multiplier);
+
+      // Data
+      std::vector<Statement> statement_; // First is a null statement
+      std::vector<uIndex> code_;         // Encoded operations
+      uIndex n_statements_;              // Statements in original
+      uIndex n_operations_;              // Operations in original
+    };
+
+  } // End namespace internal
+} // End namespace adept
+
+#endif
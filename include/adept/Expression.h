@@ -160,6 +160,23 @@ namespace adept {
       return val;
     }
  
+    // If the stack is storing operations for replay, store this
+    // expression as the right-hand-side of a statement whose
+    // left-hand-side has the gradient index provided; this is called
+    // just after the statement has been pushed on to the stack
+    void record_replay(Stack& stack, uIndex lhs_index) const {
+      if (stack.is_replay_enabled()) {
+	cast().record_replay_(stack.replay_stack());
+	stack.replay_stack().push_lhs(lhs_index);
+      }
+    }
+
+    // Expressions that do not provide their own version of this
+    // function cannot be replayed
+    void record_replay_(internal::ReplayStack& replay) const {
+      replay.push_unsupported();
+    }
+
     // For each array in the expression use location "i" to return the
     // memory index
     template <int Rank, int NArrays>
@@ -345,6 +362,10 @@ namespace adept {
       void set_location_(const ExpressionSize<Rank>& i, 
 			 ExpressionSize<NArrays>& index) const {}
 
+      void record_replay_(ReplayStack& replay) const {
+	replay.push_constant(val_);
+      }
+
     protected:
       Type val_;
       
@@ -352,6 +373,22 @@ namespace adept {
 
 
 
+    // Store an argument of an operation for replay: inactive
+    // arguments are stored as constants
+    template <class E>
+    inline
+    typename enable_if<E::is_active>::type
+    record_replay_argument(ReplayStack& replay, const E& arg) {
+      arg.record_replay_(replay);
+    }
+    template <class E>
+    inline
+    typename enable_if<!E::is_active>::type
+    record_replay_argument(ReplayStack& replay, const E& arg) {
+      replay.push_constant(arg.scalar_value());
+    }
+
+
     // ---------------------------------------------------------------------
     // SECTION 3. "expr_cast" helper 
     // ---------------------------------------------------------------------
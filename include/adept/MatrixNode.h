@@ -0,0 +1,334 @@
+/* MatrixNode.h -- Matrix operations stored as single entries of a recording
+
+    Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   Recording a matrix multiplication C=A*B one statement per element
+   of C puts 2*m*n*k operations on the stack for an m-by-k matrix A
+   and a k-by-n matrix B.  Instead, a MatrixNode holds a copy of the
+   values of the operands and the gradient indices of the operands
+   and result, and its tangent-linear and adjoint are computed at the
+   matrix level with BLAS, e.g. A_ad += C_ad*B^T and B_ad += A^T*C_ad
+   in the adjoint of a multiplication.
+
+   The nodes are held by the Stack in the MatrixNodeList class in the
+   order they were recorded, each with the number of statements
+   recorded before it, so that the tangent-linear and adjoint passes
+   can process the statements between one node and the next and then
+   the node itself.  A node with gradient layout "stride" applies its
+   operation to each of the "stride" directions of the gradient list
+   used by the multi-direction and Jacobian kernels, in which the
+   gradients of variable i occupy elements i*stride to
+   i*stride+stride-1.
+
+*/
+
+#ifndef AdeptMatrixNode_H
+#define AdeptMatrixNode_H 1
+
+#include <vector>
+#include <cstddef>
+
+#include <adept/base.h>
+
+namespace adept {
+  namespace internal {
+
+    // Description of a matrix operand: element (i,j) has value
+    // data[i*offset[0]+j*offset[1]] and, if the matrix is active,
+    // gradient index gradient_index+i*offset[0]+j*offset[1]; a vector
+    // is a matrix with one column
+    template <typename T>
+    struct MatrixOperand {
+      MatrixOperand(const T* data_, Index offset0, Index offset1,
+		    uIndex gradient_index_, bool is_active_)
+	: data(data_), gradient_index(gradient_index_), is_active(is_active_) {
+	offset[0] = offset0;
+	offset[1] = offset1;
+      }
+      const T* data;
+      Index offset[2];
+      uIndex gradient_index;
+      bool is_active;
+    };
+
+
+    // Base class for matrix operations stored in a recording
+    class MatrixNode {
+    public:
+      MatrixNode() : position_(0) { }
+      virtual ~MatrixNode() { }
+
+      // Tangent-linear and adjoint of the operation on a gradient
+      // list with the layout described above
+      virtual void forward(Real* gradient, uIndex stride) const = 0;
+      virtual void reverse(Real* gradient, uIndex stride) const = 0;
+
+      // Number of bytes used to store the node
+      virtual std::size_t memory() const = 0;
+
+      // Number of statements (including the null statement) recorded
+      // before the node
+      uIndex position() const { return position_; }
+      void set_position(uIndex position) { position_ = position; }
+
+    protected:
+      // Copy the values of an operand into a contiguous row-major
+      // array
+      template <typename T>
+      static void copy_values(const MatrixOperand<T>& x, Index rows,
+			      Index cols, std::vector<Real>& values) {
+	values.resize(rows*cols);
+	for (Index i = 0; i < rows; ++i) {
+	  for (Index j = 0; j < cols; ++j) {
+	    values[i*cols+j] = x.data[i*x.offset[0] + j*x.offset[1]];
+	  }
+	}
+      }
+
+      uIndex position_;
+    };
+
+
+    // Matrix multiplication C=alpha*A*B where A is m-by-k and B is
+    // k-by-n, or C+=alpha*A*B if is_accumulated is true; the values
+    // of A are only stored if B is active and vice versa
+    class MatmulNode : public MatrixNode {
+    public:
+      template <typename T>
+      MatmulNode(Index m, Index n, Index k,
+		 const MatrixOperand<T>& left, const MatrixOperand<T>& right,
+		 uIndex ans_index, Index ans_offset0, Index ans_offset1,
+		 Real alpha = 1.0, bool is_accumulated = false)
+	: m_(m), n_(n), k_(k), left_index_(left.gradient_index),
+	  right_index_(right.gradient_index), ans_index_(ans_index),
+	  alpha_(alpha), left_is_active_(left.is_active),
+	  right_is_active_(right.is_active), is_accumulated_(is_accumulated) {
+	left_offset_[0]  = left.offset[0];
+	left_offset_[1]  = left.offset[1];
+	right_offset_[0] = right.offset[0];
+	right_offset_[1] = right.offset[1];
+	ans_offset_[0]   = ans_offset0;
+	ans_offset_[1]   = ans_offset1;
+	if (right_is_active_) {
+	  copy_values(left, m, k, left_);
+	}
+	if (left_is_active_) {
+	  copy_values(right, k, n, right_);
+	}
+      }
+
+      virtual void forward(Real* gradient, uIndex stride) const;
+      virtual void reverse(Real* gradient, uIndex stride) const;
+      virtual std::size_t memory() const {
+	return sizeof(*this) + (left_.size() + right_.size())*sizeof(Real);
+      }
+
+    protected:
+      // Data
+      Index m_, n_, k_;
+      uIndex left_index_, right_index_, ans_index_;
+      Index left_offset_[2], right_offset_[2], ans_offset_[2];
+      Real alpha_;
+      bool left_is_active_, right_is_active_, is_accumulated_;
+      std::vector<Real> left_, right_; // Row-major copies of the values
+    };
+
+
+    // Matrix multiplication C=S*B where S is an n-by-n symmetric
+    // matrix and B is n-by-m.  Only the lower triangle of S is read,
+    // so element (i,j) of the operand must be valid for i>=j (an
+    // upper-triangle matrix is passed in transposed), and each of its
+    // elements receives the adjoint of both S(i,j) and S(j,i).
+    class SymmMatmulNode : public MatrixNode {
+    public:
+      template <typename T>
+      SymmMatmulNode(Index n, Index m,
+		     const MatrixOperand<T>& left, const MatrixOperand<T>& right,
+		     uIndex ans_index, Index ans_offset0, Index ans_offset1)
+	: n_(n), m_(m), left_index_(left.gradient_index),
+	  right_index_(right.gradient_index), ans_index_(ans_index),
+	  left_is_active_(left.is_active), right_is_active_(right.is_active) {
+	left_offset_[0]  = left.offset[0];
+	left_offset_[1]  = left.offset[1];
+	right_offset_[0] = right.offset[0];
+	right_offset_[1] = right.offset[1];
+	ans_offset_[0]   = ans_offset0;
+	ans_offset_[1]   = ans_offset1;
+	if (right_is_active_) {
+	  left_.assign(n*n, 0.0);
+	  for (Index i = 0; i < n; ++i) {
+	    for (Index j = 0; j <= i; ++j) {
+	      left_[i*n+j] = left.data[i*left.offset[0] + j*left.offset[1]];
+	    }
+	  }
+	}
+	if (left_is_active_) {
+	  copy_values(right, n, m, right_);
+	}
+      }
+
+      virtual void forward(Real* gradient, uIndex stride) const;
+      virtual void reverse(Real* gradient, uIndex stride) const;
+      virtual std::size_t memory() const {
+	return sizeof(*this) + (left_.size() + right_.size())*sizeof(Real);
+      }
+
+    protected:
+      // Data
+      Index n_, m_;
+      uIndex left_index_, right_index_, ans_index_;
+      Index left_offset_[2], right_offset_[2], ans_offset_[2];
+      bool left_is_active_, right_is_active_;
+      std::vector<Real> left_;  // Row-major lower triangle of S
+      std::vector<Real> right_; // Row-major copy of B
+    };
+
+
+    // Matrix multiplication C=A*B where A is an n-by-n band matrix
+    // with kl sub-diagonals and ku super-diagonals and B is n-by-m.
+    // Only elements of A within the band are read, and A is stored
+    // in the packed column-major format of LAPACK (element (i,j) in
+    // band[ku+i-j+j*(kl+ku+1)]) so that its tangent linear and
+    // adjoint can be computed with ?gbmv, while the adjoint of A is
+    // computed only on the band.
+    class BandMatmulNode : public MatrixNode {
+    public:
+      template <typename T>
+      BandMatmulNode(Index n, Index m, Index kl, Index ku,
+		     const MatrixOperand<T>& left, const MatrixOperand<T>& right,
+		     uIndex ans_index, Index ans_offset0, Index ans_offset1)
+	: n_(n), m_(m), kl_(kl), ku_(ku), left_index_(left.gradient_index),
+	  right_index_(right.gradient_index), ans_index_(ans_index),
+	  left_is_active_(left.is_active), right_is_active_(right.is_active) {
+	left_offset_[0]  = left.offset[0];
+	left_offset_[1]  = left.offset[1];
+	right_offset_[0] = right.offset[0];
+	right_offset_[1] = right.offset[1];
+	ans_offset_[0]   = ans_offset0;
+	ans_offset_[1]   = ans_offset1;
+	if (right_is_active_) {
+	  const Index ldab = kl+ku+1;
+	  left_.assign(ldab*n, 0.0);
+	  for (Index j = 0; j < n; ++j) {
+	    Index i_end_plus_1 = j+kl+1 > n ? n : j+kl+1;
+	    for (Index i = j < ku ? 0 : j-ku; i < i_end_plus_1; ++i) {
+	      left_[ku+i-j+j*ldab] = left.data[i*left.offset[0] + j*left.offset[1]];
+	    }
+	  }
+	}
+	if (left_is_active_) {
+	  copy_values(right, n, m, right_);
+	}
+      }
+
+      virtual void forward(Real* gradient, uIndex stride) const;
+      virtual void reverse(Real* gradient, uIndex stride) const;
+      virtual std::size_t memory() const {
+	return sizeof(*this) + (left_.size() + right_.size())*sizeof(Real);
+      }
+
+    protected:
+      // Data
+      Index n_, m_, kl_, ku_;
+      uIndex left_index_, right_index_, ans_index_;
+      Index left_offset_[2], right_offset_[2], ans_offset_[2];
+      bool left_is_active_, right_is_active_;
+      std::vector<Real> left_;  // Packed band storage of A
+      std::vector<Real> right_; // Row-major copy of B
+    };
+
+
+    // Solution X of the linear system A*X=B, where A is n-by-n and B
+    // and X are n-by-nrhs.  The LU factorization of A from ?getrf is
+    // stored, so the tangent linear, X_tl = A^-1*(B_tl - A_tl*X), and
+    // the adjoint, B_ad += A^-T*X_ad and A_ad -= A^-T*X_ad*X^T, need
+    // only triangular solves rather than a new factorization.  The
+    // values of X are only stored if A is active.
+    class SolveNode : public MatrixNode {
+    public:
+      template <typename T>
+      SolveNode(Index n, Index nrhs, const T* lu, const int* ipiv,
+		const MatrixOperand<T>& a, const MatrixOperand<T>& b,
+		const MatrixOperand<T>& x)
+	: n_(n), nrhs_(nrhs), a_index_(a.gradient_index),
+	  b_index_(b.gradient_index), x_index_(x.gradient_index),
+	  a_is_active_(a.is_active), b_is_active_(b.is_active),
+	  lu_(lu, lu+n*n), ipiv_(ipiv, ipiv+n) {
+	// The offsets are stored transposed so that gathering the
+	// gradients of an operand yields a column-major matrix, as
+	// required by LAPACK
+	a_offset_[0] = a.offset[1];
+	a_offset_[1] = a.offset[0];
+	b_offset_[0] = b.offset[1];
+	b_offset_[1] = b.offset[0];
+	x_offset_[0] = x.offset[1];
+	x_offset_[1] = x.offset[0];
+	if (a_is_active_) {
+	  x_.resize(n*nrhs);
+	  for (Index j = 0; j < nrhs; ++j) {
+	    for (Index i = 0; i < n; ++i) {
+	      x_[i+j*n] = x.data[i*x.offset[0] + j*x.offset[1]];
+	    }
+	  }
+	}
+      }
+
+      virtual void forward(Real* gradient, uIndex stride) const;
+      virtual void reverse(Real* gradient, uIndex stride) const;
+      virtual std::size_t memory() const {
+	return sizeof(*this) + (lu_.size() + x_.size())*sizeof(Real)
+	  + ipiv_.size()*sizeof(int);
+      }
+
+    protected:
+      // Data
+      Index n_, nrhs_;
+      uIndex a_index_, b_index_, x_index_;
+      Index a_offset_[2], b_offset_[2], x_offset_[2];
+      bool a_is_active_, b_is_active_;
+      std::vector<Real> lu_;  // Column-major LU factors of A
+      std::vector<int> ipiv_; // Pivot indices from ?getrf
+      std::vector<Real> x_;   // Column-major copy of X
+    };
+
+
+    // List of the nodes of a recording, which owns the nodes
+    class MatrixNodeList {
+    public:
+      MatrixNodeList() { }
+      ~MatrixNodeList() { clear(); }
+
+      // Add a node recorded after the first "position" statements,
+      // taking ownership of it
+      void push_back(MatrixNode* node, uIndex position) {
+	node->set_position(position);
+	node_.push_back(node);
+      }
+
+      // Delete all nodes, or all but the first n
+      void clear() { resize(0); }
+      void resize(std::size_t n);
+
+      bool empty() const { return node_.empty(); }
+      std::size_t size() const { return node_.size(); }
+      const MatrixNode& operator[](std::size_t i) const { return *node_[i]; }
+
+      // Number of bytes used to store the nodes
+      std::size_t memory() const;
+
+    private:
+      // The nodes are owned by the list so it cannot be copied
+      MatrixNodeList(const MatrixNodeList&) { }
+      MatrixNodeList& operator=(const MatrixNodeList&) { return *this; }
+
+      std::vector<MatrixNode*> node_;
+    };
+
+  } // End namespace internal
+} // End namespace adept
+
+#endif
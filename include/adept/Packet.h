@@ -123,10 +123,29 @@ namespace adept {
       void operator-=(T d) { data-=d; }
       void operator*=(T d) { data*=d; }
       void operator/=(T d) { data/=d; }
+      void operator+=(const Packet& d) { data+=d.data; }
+      void operator-=(const Packet& d) { data-=d.data; }
+      void operator*=(const Packet& d) { data*=d.data; }
+      void operator/=(const Packet& d) { data/=d.data; }
       T value() const { return data; }
       T data;
     };
 
+    // Default arithmetic operators, so that code written in terms of
+    // packets also works when they contain only one value
+    template <typename T>
+    inline Packet<T> operator+(const Packet<T>& x, const Packet<T>& y)
+    { return Packet<T>(x.data+y.data); }
+    template <typename T>
+    inline Packet<T> operator-(const Packet<T>& x, const Packet<T>& y)
+    { return Packet<T>(x.data-y.data); }
+    template <typename T>
+    inline Packet<T> operator*(const Packet<T>& x, const Packet<T>& y)
+    { return Packet<T>(x.data*y.data); }
+    template <typename T>
+    inline Packet<T> operator/(const Packet<T>& x, const Packet<T>& y)
+    { return Packet<T>(x.data/y.data); }
+
     // Default functions
 #ifdef ADEPT_CXX11_FEATURES
     template <typename T>
@@ -0,0 +1,131 @@
+/* ParallelAdjoint.h -- Level-scheduled copy of the recording for parallel adjoints
+
+    Copyright (C) 2012-2014 University of Reading
+    Copyright (C) 2015 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   The adjoint of a recording is normally computed by a single loop
+   backwards through the statements, but a large recording typically
+   contains many statements that do not depend on each other.
+   Stack::parallelize_adjoint() assigns each statement to a "level"
+   such that a statement depends only on statements in lower levels,
+   where statement t depends on an earlier statement s if t reads the
+   variable written by s, writes a variable read by s, or writes the
+   same variable as s. The adjoints of the statements within a level
+   can then be computed concurrently, processing the levels from the
+   highest to the lowest. The only conflicting accesses to the
+   gradient list within a level are from two statements that read the
+   same variable, whose contributions to its gradient are accumulated
+   atomically, so the results are identical to those of the serial
+   adjoint except for the order in which such contributions are
+   summed.
+
+   Each level is divided equally between the threads, and typically
+   the statements that read the same variable are neighbours (such as
+   the statements of a finite-difference stencil), so they fall to the
+   same thread. The schedule is therefore computed for a particular
+   number of threads, and only the operations on variables that are
+   also read by another thread in the same level are accumulated
+   atomically.
+
+   The ParallelAdjoint class holds a copy of the recording in which
+   the statements are sorted by level, stored as in the original
+   stacks with a null first statement, and with level_start_[ilevel]
+   being the first statement of each level.  The operations of each
+   statement are sorted so that those requiring atomic accumulation
+   come last, starting at atomic_start_[ist].
+
+*/
+
+#ifndef AdeptParallelAdjoint_H
+#define AdeptParallelAdjoint_H 1
+
+#include <vector>
+#include <cstddef>
+
+#include <adept/base.h>
+#include <adept/Statement.h>
+
+namespace adept {
+  namespace internal {
+
+    class ParallelAdjoint {
+    public:
+      // Levels containing fewer statements than this are processed by
+      // a single thread, since they do not have enough work to
+      // outweigh the cost of synchronizing the threads
+      enum { MIN_PARALLEL_STATEMENTS = 256 };
+
+      ParallelAdjoint()
+	: n_statements_(0), n_operations_(0), n_threads_(1),
+	  i_statement_(0) { }
+
+      // Remove any existing schedule
+      void clear();
+
+      // The schedule is computed in two passes through the blocks of
+      // the recording, which must be supplied in order each time.
+      // First, compute the level of each statement of a recording
+      // whose gradient indices are all less than max_gradient
+      void start_levels(uIndex max_gradient);
+      void compute_levels(const StackBlock& block);
+      // Second, copy the statements into their positions sorted by
+      // level
+      void start_sort();
+      void push_block(const StackBlock& block);
+      // Finally find the operations that must be accumulated
+      // atomically when "n_threads" threads are used, record the
+      // number of statements and operations in the original
+      // recording, and free the memory used in scheduling
+      void finish(uIndex n_statements, uIndex n_operations, int n_threads);
+
+      // Return true if this schedule was computed from a recording
+      // with the specified number of statements and operations, as
+      // for CompressedStack::matches
+      bool matches(uIndex n_statements, uIndex n_operations) const {
+	return n_statements_ > 0
+	  && n_statements_ == n_statements && n_operations_ == n_operations;
+      }
+
+      // Adjoint computation on the gradient list using the number of
+      // OpenMP threads passed to finish(); if fewer are available,
+      // all operations of parallel levels are accumulated atomically
+      void reverse(Real* __restrict gradient) const;
+
+      // Number of levels and the number of bytes used
+      uIndex n_levels() const {
+	return level_start_.empty() ? 0 : level_start_.size()-1;
+      }
+      std::size_t memory() const {
+	return statement_.size()*sizeof(Statement)
+	  + multiplier_.size()*sizeof(Real)
+	  + (index_.size()+level_start_.size()+atomic_start_.size())
+	  *sizeof(uIndex);
+      }
+
+    protected:
+      // Data
+      std::vector<Statement> statement_; // Sorted statements
+      std::vector<Real> multiplier_;     // Operations of sorted statements
+      std::vector<uIndex> index_;
+      std::vector<uIndex> level_start_;  // First statement of each level
+      std::vector<uIndex> atomic_start_; // First atomic operation
+      uIndex n_statements_;              // Statements in original
+      uIndex n_operations_;              // Operations in original
+      int n_threads_;                    // Threads scheduled for
+      // Used while computing the schedule
+      std::vector<uIndex> statement_level_; // Level of each statement
+      std::vector<uIndex> last_write_;   // Level that last wrote each variable
+      std::vector<uIndex> last_read_;    // Highest level to read each variable
+      std::vector<uIndex> level_end_operation_; // Next free operation
+      std::vector<uIndex> next_statement_;      // Next free statement
+      uIndex i_statement_;               // Statements treated so far
+    };
+
+  } // End namespace internal
+} // End namespace adept
+
+#endif
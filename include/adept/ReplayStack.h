@@ -0,0 +1,240 @@
+/* ReplayStack.h -- Record of operations enabling a recording to be replayed
+
+    Copyright (C) 2012-2014 University of Reading
+    Copyright (C) 2015 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   The statement and operation stacks store only the partial
+   derivatives of each statement, so obtaining derivatives at a new
+   point normally requires the algorithm to be run again.  If
+   Stack::enable_replay() has been called, each scalar statement is
+   also stored in the ReplayStack class as a short program of
+   "opcodes" in postfix (reverse Polish) order, together with the
+   values of its constants. Provided that the flow of control of the
+   algorithm does not depend on the values of its inputs,
+   Stack::replay() can then interpret these programs to compute the
+   values of all the variables at new values of the independent
+   variables, pushing the corresponding partial derivatives on to a
+   new recording as it goes.
+
+   The code array contains, for each statement, a sequence of
+
+     REPLAY_VARIABLE  gradient index   Push value of a variable
+     REPLAY_CONSTANT                   Push the next constant
+     REPLAY_<Unary operation>          Apply to the top value
+     REPLAY_<Binary operation>         Apply to the top two values
+
+   terminated by REPLAY_ASSIGN (or REPLAY_ASSIGN_VALUE for an
+   assignment that has no differential statement, such as "x += 1.0")
+   and the gradient index of the left-hand-side. The opcodes of the
+   operations are named after the policy classes that implement them
+   in UnaryOperation.h and BinaryOperation.h, each of which provides
+   its opcode as "replay_opcode".
+
+*/
+
+#ifndef AdeptReplayStack_H
+#define AdeptReplayStack_H 1
+
+#include <vector>
+#include <cstddef>
+
+#include <adept/base.h>
+
+namespace adept {
+
+  class Stack;
+
+  namespace internal {
+
+    // Opcodes of the programs held by ReplayStack
+    enum ReplayOpcode {
+      // Operands and assignment
+      REPLAY_VARIABLE = 0,
+      REPLAY_CONSTANT,
+      REPLAY_ASSIGN,
+      REPLAY_ASSIGN_VALUE,
+      // Unary operations
+      REPLAY_Log,
+      REPLAY_Log10,
+      REPLAY_Sin,
+      REPLAY_Cos,
+      REPLAY_Tan,
+      REPLAY_Asin,
+      REPLAY_Acos,
+      REPLAY_Atan,
+      REPLAY_Sinh,
+      REPLAY_Cosh,
+      REPLAY_Abs,
+      REPLAY_Fabs,
+      REPLAY_Exp,
+      REPLAY_Sqrt,
+      REPLAY_Tanh,
+      REPLAY_Ceil,
+      REPLAY_Floor,
+      REPLAY_Log2,
+      REPLAY_Expm1,
+      REPLAY_Exp2,
+      REPLAY_Log1p,
+      REPLAY_Asinh,
+      REPLAY_Acosh,
+      REPLAY_Atanh,
+      REPLAY_Erf,
+      REPLAY_Erfc,
+      REPLAY_Cbrt,
+      REPLAY_Round,
+      REPLAY_Trunc,
+      REPLAY_Rint,
+      REPLAY_Nearbyint,
+      REPLAY_UnaryPlus,
+      REPLAY_UnaryMinus,
+      REPLAY_Not,
+      // Binary operations
+      REPLAY_Add,
+      REPLAY_Subtract,
+      REPLAY_Multiply,
+      REPLAY_Divide,
+      REPLAY_Pow,
+      REPLAY_Atan2,
+      REPLAY_Max,
+      REPLAY_Min
+    };
+
+    class ReplayStack {
+    public:
+      ReplayStack() : is_enabled_(false), is_supported_(true),
+		      n_statements_(0) { }
+
+      // Start or stop storing statements
+      void enable() { is_enabled_ = true; }
+      void disable() { is_enabled_ = false; }
+      bool is_enabled() const { return is_enabled_; }
+
+      // Remove the statements of the previous recording, retaining
+      // the memory for the next one
+      void clear();
+
+      // Functions used by the expression classes to store the
+      // right-hand-side of a statement in postfix order; a variable
+      // read before it has been assigned in the current recording is
+      // an input, and its current value is stored
+      void push_variable(uIndex gradient_index, Real value) {
+	if (!is_known(gradient_index)) {
+	  set_known(gradient_index);
+	  input_index_.push_back(gradient_index);
+	  input_value_.push_back(value);
+	}
+	code_.push_back(REPLAY_VARIABLE);
+	code_.push_back(gradient_index);
+      }
+      void push_constant(Real value) {
+	code_.push_back(REPLAY_CONSTANT);
+	constant_.push_back(value);
+      }
+      void push_operation(uIndex opcode) {
+	code_.push_back(opcode);
+      }
+      // Store the statement "lhs = value" for a passive value
+      void push_assign_constant(uIndex gradient_index, Real value) {
+	push_constant(value);
+	push_lhs(gradient_index);
+      }
+      // Called for expressions that cannot be replayed
+      void push_unsupported() {
+	is_supported_ = false;
+      }
+
+      // Complete a statement whose differential statement has just
+      // been pushed on to the main stack with Stack::push_lhs
+      void push_lhs(uIndex gradient_index) {
+	set_known(gradient_index);
+	code_.push_back(REPLAY_ASSIGN);
+	code_.push_back(gradient_index);
+	++n_statements_;
+      }
+      // Complete a statement that changes only the value of a
+      // variable, not its derivatives
+      void push_lhs_value(uIndex gradient_index) {
+	set_known(gradient_index);
+	code_.push_back(REPLAY_ASSIGN_VALUE);
+	code_.push_back(gradient_index);
+      }
+
+      // Return true if the stored statements describe the whole of a
+      // recording containing the specified number of statements
+      // (excluding the initial null statement)
+      bool matches(uIndex n_statements) const {
+	return is_supported_ && n_statements_ > 0
+	  && n_statements_ == n_statements;
+      }
+
+      // Compute the values of all the variables in the recording
+      // given the values of the independent variables, and make a new
+      // recording on "stack" of the differential statements at these
+      // values. "value" must have space for all the gradient indices
+      // of the recording; on exit it contains the values of the
+      // variables at the end of the algorithm.
+      void replay(Stack& stack, const std::vector<uIndex>& independent_index,
+		  const Real* x, Real* __restrict value);
+
+      // Compute the products of the Hessian matrix of the sum of the
+      // dependent variables, weighted by dependent_weight (or by one
+      // if it is NULL), with n_directions directions, by
+      // differentiating the stored statements in forward mode at the
+      // point of the current recording and then in reverse mode.
+      // "direction" and "product" hold the n_directions values for
+      // each independent variable contiguously.
+      void hessian_product(uIndex max_gradient,
+			   const std::vector<uIndex>& independent_index,
+			   const std::vector<uIndex>& dependent_index,
+			   const Real* dependent_weight,
+			   uIndex n_directions, const Real* direction,
+			   Real* product) const;
+
+      // Number of statements stored and the number of bytes used
+      uIndex n_statements() const { return n_statements_; }
+      std::size_t memory() const {
+	return code_.size()*sizeof(uIndex)
+	  + (constant_.size()+input_value_.size())*sizeof(Real)
+	  + input_index_.size()*sizeof(uIndex);
+      }
+
+    protected:
+      bool is_known(uIndex gradient_index) const {
+	return static_cast<std::size_t>(gradient_index) < is_known_.size()
+	  && is_known_[gradient_index];
+      }
+      void set_known(uIndex gradient_index) {
+	if (static_cast<std::size_t>(gradient_index) >= is_known_.size()) {
+	  is_known_.resize(2*gradient_index+1, false);
+	}
+	is_known_[gradient_index] = true;
+      }
+
+      // Data
+      std::vector<uIndex> code_;        // Opcodes and gradient indices
+      std::vector<Real> constant_;      // Constants in order of use
+      std::vector<uIndex> input_index_; // Variables read before written
+      std::vector<Real> input_value_;   // ...and their values
+      std::vector<bool> is_known_;      // Variables read or written
+      // Scratch space for replay(), describing each node of the
+      // statement being evaluated
+      std::vector<Real> node_value_;
+      std::vector<Real> node_extra_;
+      std::vector<uIndex> node_arg_;
+      std::vector<uIndex> node_opcode_;
+      std::vector<char> node_is_active_;
+      std::vector<uIndex> work_;
+      std::vector<Real> work_multiplier_;
+      bool is_enabled_;                 // Store statements?
+      bool is_supported_;               // Could all be stored?
+      uIndex n_statements_;             // Number of differential statements
+    };
+
+  } // End namespace internal
+} // End namespace adept
+
+#endif
@@ -0,0 +1,113 @@
+/* SinglePrecisionStack.h -- Reduced-precision copy of the operation stack
+
+    Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   For many purposes, such as the sensitivities computed from an
+   ensemble, multipliers accurate to single precision are sufficient
+   even when the algorithm itself must be run in double precision.
+   Stack::store_single_precision_recording() copies the recording into
+   the SinglePrecisionStack class, in which each multiplier is stored
+   as a float.  If ADEPT_SUPPORT_HUGE_ARRAYS is defined, so that
+   uIndex is std::size_t, each gradient index is also stored as an
+   unsigned int if the largest gradient index allows it; otherwise
+   uIndex is already 32 bits and the indices are copied unchanged.
+   Until the recording is modified, Stack::compute_adjoint() and
+   Stack::compute_tangent_linear() then read this copy, converting the
+   multipliers back to Real as they go, so the gradients themselves
+   are still accumulated in full precision.
+
+   The copy is held in addition to the full-precision recording, so
+   it reduces the memory bandwidth of the adjoint and tangent-linear
+   computations but increases the total memory used, by around 8
+   bytes per operation in the default configuration.
+
+   The statements are stored as in the original stacks but in a single
+   array, with "end_plus_one" referring to the concatenated multiplier
+   and index arrays.
+
+*/
+
+#ifndef AdeptSinglePrecisionStack_H
+#define AdeptSinglePrecisionStack_H 1
+
+#include <vector>
+#include <cstddef>
+
+#include <adept/base.h>
+#include <adept/Statement.h>
+
+namespace adept {
+  namespace internal {
+
+    class SinglePrecisionStack {
+    public:
+      SinglePrecisionStack()
+	: n_statements_(0), n_operations_(0), is_short_index_(true) { }
+
+      // Remove any existing copy of a recording, and prepare for the
+      // blocks of a recording whose gradient indices are less than
+      // max_gradient
+      void clear(uIndex max_gradient = 0);
+
+      // Copy the statements and operations of one block of a
+      // recording, appending them to those already copied; the blocks
+      // must be supplied in order
+      void push_block(const StackBlock& block);
+
+      // Record the number of statements and operations in the
+      // original recording once all its blocks have been copied
+      void finish(uIndex n_statements, uIndex n_operations) {
+	n_statements_ = n_statements;
+	n_operations_ = n_operations;
+      }
+
+      // Return true if this is a copy of a recording with the
+      // specified number of statements and operations, as for
+      // CompressedStack::matches
+      bool matches(uIndex n_statements, uIndex n_operations) const {
+	return n_statements_ > 0
+	  && n_statements_ == n_statements && n_operations_ == n_operations;
+      }
+
+      // Adjoint and tangent-linear computations on the gradient list
+      void reverse(Real* __restrict gradient) const;
+      void forward(Real* __restrict gradient) const;
+
+      // Return true if the gradient indices are stored as unsigned
+      // int rather than uIndex
+      bool is_short_index() const { return is_short_index_; }
+
+      // Number of bytes used to store the copy
+      std::size_t memory() const {
+	return statement_.size()*sizeof(Statement)
+	  + multiplier_.size()*sizeof(float)
+	  + short_index_.size()*sizeof(unsigned int)
+	  + index_.size()*sizeof(uIndex);
+      }
+
+    protected:
+      template <typename IndexType>
+      void reverse_(const IndexType* __restrict index,
+		    Real* __restrict gradient) const;
+      template <typename IndexType>
+      void forward_(const IndexType* __restrict index,
+		    Real* __restrict gradient) const;
+
+      // Data
+      std::vector<Statement> statement_;    // First is a null statement
+      std::vector<float> multiplier_;
+      std::vector<unsigned int> short_index_; // Used if is_short_index_
+      std::vector<uIndex> index_;             // Used otherwise
+      uIndex n_statements_;                 // Statements in original
+      uIndex n_operations_;                 // Operations in original
+      bool is_short_index_;
+    };
+
+  } // End namespace internal
+} // End namespace adept
+
+#endif
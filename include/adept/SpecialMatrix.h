@@ -442,7 +442,7 @@ namespace adept {
 	}
       }
       template <bool IsActive, typename Type>
-      typename enable_if<!IsActive,ActiveReference<Type> >::type
+      typename enable_if<!IsActive,Type&>::type
       get_reference(Index i, Index j, Index dim, Index offset, 
 		    Index gradient_index, Type* data) {
 	Index off = j-i;
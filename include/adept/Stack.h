@@ -26,7 +26,7 @@
 #include <utility>
 #include <string>
 #include <vector>
-#include <list>
+#include <algorithm>
 #include <cstddef>
 #include <limits>
 
@@ -36,6 +36,12 @@
 
 #include <adept/base.h>
 #include <adept/exception.h>
+#include <adept/CompressedStack.h>
+#include <adept/SinglePrecisionStack.h>
+#include <adept/ReplayStack.h>
+#include <adept/ParallelAdjoint.h>
+#include <adept/MatrixNode.h>
+#include <adept/StackStorage.h>
 #include <adept/StackStorageOrig.h>
 #include <adept/StackStorageOrigStl.h>
 #include <adept/traits.h>
@@ -75,7 +81,9 @@ namespace adept {
     Type data[Size] ADEPT_SSE2_ALIGNED;
   };
 
-  // Structure for describing a gap in the current list of gradients
+  // Structure for describing a gap in the current list of gradients;
+  // the gap list is a vector of non-overlapping, non-adjacent gaps
+  // sorted in order of increasing gradient index
   struct Gap {
     Gap(uIndex value) : start(value), end(value) {}
     Gap(uIndex start_, uIndex end_) : start(start_), end(end_) {}
@@ -83,6 +91,21 @@ namespace adept {
     uIndex end;
   };
 
+  // Structure for describing a point in a recording, returned by
+  // Stack::get_position(); the default is the start of a recording
+  struct StackPosition {
+    StackPosition() : n_statements(1), n_operations(0), max_gradient(0),
+		      n_matrix_nodes(0) {}
+    StackPosition(uIndex n_statements_, uIndex n_operations_,
+		  uIndex max_gradient_, uIndex n_matrix_nodes_ = 0)
+      : n_statements(n_statements_), n_operations(n_operations_),
+	max_gradient(max_gradient_), n_matrix_nodes(n_matrix_nodes_) {}
+    uIndex n_statements; // Including the null statement
+    uIndex n_operations;
+    uIndex max_gradient; // Max number of gradients at this point
+    uIndex n_matrix_nodes;
+  };
+
 
   // ---------------------------------------------------------------------
   // Definition of Stack class
@@ -92,8 +115,10 @@ namespace adept {
   // information, which is controlled by preprocessor
   // variables. Member functions not defined here are in Stack.cpp.
   class Stack 
-#ifdef ADEPT_STACK_STORAGE_STL
+#if defined(ADEPT_STACK_STORAGE_STL)
     : public internal::StackStorageOrigStl
+#elif defined(ADEPT_STACK_STORAGE_BLOCKS)
+    : public internal::StackStorage
 #else
     : public internal::StackStorageOrig
 #endif
@@ -102,8 +127,8 @@ namespace adept {
     // -------------------------------------------------------------------
     // Stack: 1. Static Definitions
     // -------------------------------------------------------------------
-    typedef std::list<Gap> GapList;
-    typedef std::list<Gap>::iterator GapListIterator;
+    typedef std::vector<Gap> GapList;
+    typedef std::vector<Gap>::iterator GapListIterator;
 
     // -------------------------------------------------------------------
     // Stack: 2. Constructor and destructor
@@ -116,7 +141,6 @@ namespace adept {
 #ifndef ADEPT_STACK_STORAGE_STL
       gradient_(0),
 #endif
-      most_recent_gap_(gap_list_.end()),
       i_gradient_(0), n_allocated_gradients_(0), max_gradient_(0),
       n_gradients_registered_(0),
       gradients_initialized_(false), 
@@ -134,7 +158,14 @@ namespace adept {
 #else
       have_openmp_(false),
 #endif
-      openmp_manually_disabled_(false)
+      openmp_manually_disabled_(false),
+      substack_previous_stack_(0), substack_end_gradient_(0),
+      is_substack_overflowed_(false),
+      gradient_directions_(0), n_gradient_directions_(0),
+      gradient_direction_stride_(0), n_allocated_gradient_directions_(0),
+      is_preaccumulating_(false), preaccumulation_statement_(0),
+      preaccumulation_operation_(0), renumbered_n_statements_(0),
+      is_matrix_node_enabled_(true), preaccumulation_matrix_node_(0)
     { 
       initialize(ADEPT_INITIAL_STACK_LENGTH);
       new_recording();
@@ -190,18 +221,13 @@ namespace adept {
 	  return_val = i_gradient_-1;
 	}
 	else {
-	  // Insert in a gap
-	  Gap& first_gap = gap_list_.front();
+	  // Insert in the lowest gap, which is at the back of the list
+	  Gap& first_gap = gap_list_.back();
 	  return_val = first_gap.start;
 	  first_gap.start++;
 	  if (first_gap.start > first_gap.end) {
-	    // Gap has closed: remove it from the list, after checking
-	    // if it had been stored as the gap that had most recently
-	    // grown
-	    if (most_recent_gap_ == gap_list_.begin()) {
-	      most_recent_gap_ = gap_list_.end();
-	    }
-	    gap_list_.pop_front();
+	    // Gap has closed: remove it from the list
+	    gap_list_.pop_back();
 	  }
 	}
 #ifdef ADEPT_RECORDING_PAUSABLE
@@ -245,19 +271,15 @@ namespace adept {
         // Gradient to be unregistered is at the top of the stack
         i_gradient_--;
 	if (!gap_list_.empty()) {
-	  Gap& last_gap = gap_list_.back();
+	  // The highest gap is at the front of the list
+	  Gap& last_gap = gap_list_.front();
 	  if (i_gradient_ == last_gap.end+1) {
 	    // We have unregistered the elements between the "gap" of
 	    // unregistered element and the top of the stack, so can
 	    // set the variables indicating the presence of the gap to
 	    // zero
 	    i_gradient_ = last_gap.start;
-	    GapListIterator it = gap_list_.end();
-	    it--;
-	    if (most_recent_gap_ == it) {
-	      most_recent_gap_ = gap_list_.end();
-	    }
-	    gap_list_.pop_back();
+	    gap_list_.erase(gap_list_.begin());
 	  }
 	}
       }
@@ -280,6 +302,10 @@ namespace adept {
 
     // Unregister a gradient that is not at the top of the stack
     void unregister_gradient_not_top(const uIndex& gradient_index);
+
+    // Add the n gradients starting at gradient_index, which are not
+    // at the top of the stack, to the gap list
+    void add_gap(uIndex gradient_index, uIndex n);
   public:
 
     // Set the gradients in the list with indices between start and
@@ -293,6 +319,12 @@ namespace adept {
       if (!gradients_are_initialized()) {
 	initialize_gradients();
       }
+      if (!gradient_index_map_.empty()) {
+	for (uIndex i = start, j = 0; i < end_plus_one; i++, j++) {
+	  gradient_[renumbered_gradient_index(i)] = gradient[j];
+	}
+	return;
+      }
       if (end_plus_one > max_gradient_) {
 	throw gradient_out_of_range();
       }
@@ -312,6 +344,12 @@ namespace adept {
       if (!gradients_are_initialized()) {
 	throw gradients_not_initialized();
       }
+      if (!gradient_index_map_.empty()) {
+	for (uIndex i = start, j = 0; i < end_plus_one; i++, j++) {
+	  gradient[j] = gradient_[renumbered_gradient_index(i)];
+	}
+	return;
+      }
       if (end_plus_one > max_gradient_) {
 	throw gradient_out_of_range();
       }
@@ -327,6 +365,12 @@ namespace adept {
       if (!gradients_are_initialized()) {
 	throw gradients_not_initialized();
       }
+      if (!gradient_index_map_.empty()) {
+	for (uIndex i = start, j = 0; i < end_plus_one; i+=src_stride, j+=target_stride) {
+	  gradient[j] = gradient_[renumbered_gradient_index(i)];
+	}
+	return;
+      }
       if (end_plus_one > max_gradient_) {
 	throw gradient_out_of_range();
       }
@@ -348,6 +392,316 @@ namespace adept {
     void compute_adjoint();
     void reverse() { return compute_adjoint(); }
 
+    // Return the current end of the recording, which may be passed
+    // to the following functions provided that the recording has not
+    // since been rewound to an earlier point or cleared
+    StackPosition get_position() const {
+      return StackPosition(n_statements(), n_operations(), max_gradient_,
+			   matrix_node_.size());
+    }
+
+    // Run the tangent-linear or adjoint algorithm on only the
+    // statements recorded between positions "start" and "end"; any
+    // compressed or other copy of the recording is not used
+    void compute_tangent_linear(const StackPosition& start,
+				const StackPosition& end);
+    void forward(const StackPosition& start, const StackPosition& end) {
+      return compute_tangent_linear(start, end);
+    }
+    void compute_adjoint(const StackPosition& start,
+			 const StackPosition& end);
+    void reverse(const StackPosition& start, const StackPosition& end) {
+      return compute_adjoint(start, end);
+    }
+
+    // Discard the statements recorded after "position", retaining
+    // the memory for those recorded next. Active variables that
+    // still exist keep their gradient indices, so the gap list is
+    // unchanged, but max_gradients() returns to its value at
+    // "position" unless these variables need more. The gradients are
+    // not cleared, so the adjoint of the earlier part of the
+    // recording may continue from those already computed.
+    void rewind(const StackPosition& position);
+
+    // Set the gradients in "n_directions" directions of the variable
+    // with index gradient_index to the values pointed to by
+    // "gradient". The first call after clear_gradients() creates a
+    // second gradient list holding n_directions gradients per
+    // variable, all initialized to zero, which is used by
+    // compute_tangent_linear(n_directions) and
+    // compute_adjoint(n_directions).
+    template <typename MyReal>
+    typename internal::enable_if<internal::is_floating_point<MyReal>::value,
+		       void>::type
+    set_gradient_directions(uIndex gradient_index, uIndex n_directions,
+			    const MyReal* gradient) {
+      if (n_gradient_directions_ != n_directions) {
+	if (n_gradient_directions_ > 0 || n_directions == 0) {
+	  throw invalid_operation("Number of gradient directions differs from that of existing gradients: call clear_gradients() first"
+				  ADEPT_EXCEPTION_LOCATION);
+	}
+	initialize_gradient_directions(n_directions);
+      }
+      if (!gradient_index_map_.empty()) {
+	gradient_index = renumbered_gradient_index(gradient_index);
+      }
+      if (gradient_index >= max_gradient_) {
+	throw gradient_out_of_range();
+      }
+      Real* __restrict dest
+	= gradient_directions_
+	+ static_cast<std::size_t>(gradient_index)*gradient_direction_stride_;
+      for (uIndex i = 0; i < n_directions; i++) {
+	dest[i] = gradient[i];
+      }
+    }
+
+    // Get the gradients in "n_directions" directions of the variable
+    // with index gradient_index and put them in the location pointed
+    // to by "gradient"
+    template <typename MyReal>
+    typename internal::enable_if<internal::is_floating_point<MyReal>::value,
+		       void>::type
+    get_gradient_directions(uIndex gradient_index, uIndex n_directions,
+			    MyReal* gradient) const {
+      if (n_gradient_directions_ == 0) {
+	throw gradients_not_initialized();
+      }
+      if (n_directions != n_gradient_directions_) {
+	throw invalid_operation("Number of gradient directions requested differs from that of existing gradients"
+				ADEPT_EXCEPTION_LOCATION);
+      }
+      if (!gradient_index_map_.empty()) {
+	gradient_index = renumbered_gradient_index(gradient_index);
+      }
+      if (gradient_index >= max_gradient_) {
+	throw gradient_out_of_range();
+      }
+      const Real* __restrict src
+	= gradient_directions_
+	+ static_cast<std::size_t>(gradient_index)*gradient_direction_stride_;
+      for (uIndex i = 0; i < n_directions; i++) {
+	gradient[i] = src[i];
+      }
+    }
+
+    // Return the number of directions of the gradients set by
+    // set_gradient_directions, or zero if there are none
+    uIndex n_gradient_directions() const { return n_gradient_directions_; }
+
+    // Run the tangent-linear and adjoint algorithms on the gradients
+    // in n_directions directions loaded by set_gradient_directions,
+    // equivalent to n_directions calls to the single-direction
+    // versions but reading the recording only once
+    void compute_tangent_linear(uIndex n_directions);
+    void forward(uIndex n_directions) {
+      return compute_tangent_linear(n_directions);
+    }
+    void compute_adjoint(uIndex n_directions);
+    void reverse(uIndex n_directions) { return compute_adjoint(n_directions); }
+
+    // Remove from the current recording the statements that cannot
+    // affect the dependent variables, and the operations with a
+    // multiplier of zero (as ADEPT_REMOVE_NULL_STATEMENTS does while
+    // recording, but without slowing the recording down), compacting
+    // the recording in place.  If independent variables have been
+    // identified then the operations of statements that do not
+    // depend on them are removed too. Afterwards the adjoint and
+    // tangent-linear passes only give correct derivatives of the
+    // dependent variables with respect to the independent variables
+    // (or all inputs if no independents were identified), so this is
+    // intended for recordings used for many Jacobian or adjoint
+    // calculations.
+    void optimize();
+
+    // Renumber the gradient indices of the current recording in the
+    // order in which the variables are first used, so that
+    // compute_adjoint() and compute_tangent_linear() access the
+    // gradient list almost sequentially. If reuse_indices is true,
+    // variables whose lifetimes within the recording do not overlap
+    // share an index, which also shortens the gradient list, but then
+    // only the gradients of the independent and dependent variables
+    // (which must have been identified) can be set and retrieved.
+    // Active objects and set_gradients/get_gradients continue to use
+    // the original indices, which are mapped to the new ones. No
+    // further statements may be added to the recording;
+    // new_recording() restores the original numbering.
+    void renumber_gradients(bool reuse_indices = false);
+
+    // Return true if renumber_gradients() has been called since the
+    // last new_recording()
+    bool gradients_are_renumbered() const {
+      return !gradient_index_map_.empty();
+    }
+
+    // Encode the current recording in a compressed form in which
+    // operations with multipliers of +1 or -1 and runs of consecutive
+    // gradient indices take less memory; until the recording is
+    // modified, compute_tangent_linear() and compute_adjoint() then
+    // read the compressed recording, reducing the memory bandwidth
+    // they require. The uncompressed recording is retained for other
+    // purposes such as computing Jacobian matrices.
+    void compress_recording();
+
+    // Return true if compress_recording() has been called and the
+    // recording has not been modified since
+    bool recording_is_compressed() const {
+      return compressed_stack_.matches(n_statements(), n_operations());
+    }
+
+    // Return the number of bytes used to store the compressed
+    // recording
+    std::size_t compressed_memory() const {
+      return compressed_stack_.memory();
+    }
+
+    // Store a copy of the current recording in which the multipliers
+    // are held in single precision (and, with huge-array support, the
+    // gradient indices in 32 bits if max_gradients() allows); until
+    // the recording is modified, compute_tangent_linear() and
+    // compute_adjoint() then read this copy in place of any
+    // compressed recording, reducing the memory bandwidth they
+    // require. The gradients are still accumulated in Real precision
+    // but inherit a relative error of order 1.0e-7 from the
+    // multipliers. The full-precision recording is retained for other
+    // purposes such as computing Jacobian matrices, so the copy
+    // increases rather than reduces the total memory used.
+    void store_single_precision_recording();
+
+    // Return true if store_single_precision_recording() has been
+    // called and the recording has not been modified since
+    bool recording_is_single_precision() const {
+      return single_precision_stack_.matches(n_statements(), n_operations());
+    }
+
+    // Return the number of bytes used to store the single-precision
+    // recording
+    std::size_t single_precision_memory() const {
+      return single_precision_stack_.memory();
+    }
+
+    // Report the accuracy of the single-precision recording: the
+    // adjoint is computed from both the single-precision and the
+    // full-precision recordings for unit gradients of the dependent
+    // variables, and the largest absolute difference in the gradients
+    // of the independent variables is returned divided by the largest
+    // absolute gradient. The gradient list is not affected.
+    Real single_precision_error() const;
+
+    // Active matrix multiplications are recorded as single "matrix
+    // nodes" holding copies of their operands, whose tangent-linear
+    // and adjoint are computed with BLAS, rather than as one
+    // statement per element of the result; see MatrixNode.h.  The
+    // tangent-linear, adjoint and Jacobian functions process the
+    // nodes, but functions that analyse or copy the statements of a
+    // recording throw feature_not_available if it contains any, in
+    // which case disable_matrix_nodes() may be called before
+    // recording to restore the element-by-element form.
+    void enable_matrix_nodes() { is_matrix_node_enabled_ = true; }
+    void disable_matrix_nodes() { is_matrix_node_enabled_ = false; }
+    bool are_matrix_nodes_enabled() const { return is_matrix_node_enabled_; }
+
+    // Add a node to the end of the recording, taking ownership of it
+    void push_matrix_node(internal::MatrixNode* node);
+
+    // Return the number of matrix nodes in the recording and the
+    // number of bytes used to store them
+    uIndex n_matrix_nodes() const { return matrix_node_.size(); }
+    std::size_t matrix_node_memory() const { return matrix_node_.memory(); }
+
+    // Analyze the dependencies between the statements of the current
+    // recording and store a copy of it sorted into "levels" of
+    // statements that are independent of each other; until the
+    // recording is modified, compute_adjoint() then processes the
+    // statements of each level in parallel, using the number of
+    // OpenMP threads given by max_jacobian_threads() when this
+    // function was called. The gradients are identical to those of
+    // the serial adjoint except for rounding.
+    void parallelize_adjoint();
+
+    // Return true if parallelize_adjoint() has been called and the
+    // recording has not been modified since
+    bool adjoint_is_parallelized() const {
+      return parallel_adjoint_.matches(n_statements(), n_operations());
+    }
+
+    // Return the number of levels found by parallelize_adjoint(), and
+    // the number of bytes used to store the sorted recording
+    uIndex n_adjoint_levels() const {
+      return parallel_adjoint_.n_levels();
+    }
+    std::size_t parallel_adjoint_memory() const {
+      return parallel_adjoint_.memory();
+    }
+
+    // Also store each scalar statement of subsequent recordings as a
+    // sequence of operations, so that the recording can be replayed
+    // at new values of the independent variables
+    void enable_replay() { replay_stack_.enable(); }
+    void disable_replay() { replay_stack_.disable(); }
+    bool is_replay_enabled() const { return replay_stack_.is_enabled(); }
+
+    // Return true if every statement of the current recording has
+    // been stored by enable_replay(), so that replay() can be called
+    bool recording_is_replayable() const {
+      return replay_stack_.matches(n_statements()-1);
+    }
+
+    // Replace the recording with that which would have been obtained
+    // by running the algorithm again with the values of the
+    // independent variables set to the n_independent() values
+    // pointed to by "x", without running the algorithm.  If "y" is
+    // provided it is filled with the values of the n_dependent()
+    // dependent variables. The flow of control of the algorithm must
+    // not depend on the values of the independent variables.
+    void replay(const Real* x, Real* y = 0);
+
+    // Compute the product of the Hessian matrix of the dependent
+    // variable with respect to the independent variables and the
+    // n_independent() values pointed to by "direction", putting the
+    // result in "product". If there is more than one dependent
+    // variable, the Hessian is that of their sum weighted by the
+    // n_dependent() values of "dependent_weight", or their plain sum
+    // if it is omitted. The operations stored following
+    // enable_replay() are differentiated in forward mode and then in
+    // reverse mode (forward-over-reverse) at the point of the current
+    // recording, so the recording must be replayable.
+    void hessian_vector_product(const Real* direction, Real* product,
+				const Real* dependent_weight = 0);
+
+    // Compute the Hessian matrix of size n*n, where n is the number
+    // of independent variables, with the dependent variables
+    // weighted as in hessian_vector_product; the columns are
+    // computed in blocks, each block requiring one forward and one
+    // reverse pass through the stored operations.
+    void hessian(Real* hessian_out, const Real* dependent_weight = 0);
+
+    // Access the stored operations, used by active objects and
+    // expressions to add statements to them
+    internal::ReplayStack& replay_stack() { return replay_stack_; }
+
+    // Threads inside a parallel region may each record into their
+    // own "sub-stack". The parent stack first reserves a range of
+    // gradient indices with register_gradients(n), and each thread
+    // calls begin_substack() on a separate Stack object with its own
+    // part of that range, which makes the sub-stack active in that
+    // thread and gives the active objects it creates gradient indices
+    // within the range. Active objects created outside the region may
+    // be read and (if only by one thread) assigned to in the usual
+    // way. Each thread must destroy the active objects it created
+    // before calling end_substack(), which reactivates the stack that
+    // was previously active in that thread.  After the region, the
+    // parent calls append_substack() for each sub-stack in a fixed
+    // order so that one compute_adjoint() call covers the whole
+    // computation, and then unregisters the reserved range. If a
+    // thread registered more gradients than its part of the range,
+    // append_substack() throws gradient_out_of_range, since an
+    // exception could not be caught from end_substack() inside the
+    // parallel region.
+    void begin_substack(uIndex first_gradient, uIndex n_gradients);
+    void end_substack();
+    void append_substack(const Stack& substack);
+
     // Return the number of independent and dependent variables that
     // have been identified
     uIndex n_independent() const { return independent_index_.size(); }
@@ -370,6 +724,40 @@ namespace adept {
     void jacobian_forward(Real* jacobian_out);
     void jacobian_reverse(Real* jacobian_out);
 
+    // Compute the sparsity pattern of the Jacobian matrix from the
+    // recording, in compressed sparse row form: the non-zero elements
+    // of row i (corresponding to dependent variable i) are in the
+    // columns (independent variables) column[row_start[i]] to
+    // column[row_start[i+1]-1], sorted in increasing order. Elements
+    // that are structurally non-zero are included even if their value
+    // at the current point is zero. Bit vectors holding 64
+    // independent (or dependent) variables per word are propagated
+    // forward (or backward) through the recording, so the cost is
+    // that of one pass for every 512 variables.
+    void jacobian_sparsity(std::vector<uIndex>& row_start,
+			   std::vector<uIndex>& column) const;
+
+    // Compute the Jacobian matrix in compressed sparse row form, as
+    // for jacobian_sparsity but with the values of the elements in
+    // "value". Structurally orthogonal columns (or rows) are grouped
+    // and computed together as one direction of a forward (or
+    // reverse) pass, choosing whichever needs fewer directions; the
+    // number of directions is returned. This is much faster than
+    // jacobian() for sparse and banded Jacobians. If reuse_sparsity
+    // is true, row_start and column are assumed to already contain
+    // the sparsity pattern, for example from a previous call for a
+    // recording with the same structure, and it is not recomputed.
+    uIndex sparse_jacobian(std::vector<uIndex>& row_start,
+			   std::vector<uIndex>& column,
+			   std::vector<Real>& value,
+			   bool reuse_sparsity = false) const;
+
+    // As sparse_jacobian, but returning the Jacobian in coordinate
+    // form with the row and column of each element
+    uIndex sparse_jacobian_coordinate(std::vector<uIndex>& row,
+				      std::vector<uIndex>& column,
+				      std::vector<Real>& value) const;
+
     // Return maximum number of OpenMP threads to be used in Jacobian
     // calculation
     int max_jacobian_threads() const;
@@ -389,6 +777,16 @@ namespace adept {
     // function.
     int set_max_jacobian_threads(int n);
 
+    // Set the policy for allocating the arrays that hold the
+    // recording and the gradient list, a combination of the ALLOCATE_*
+    // flags described in allocation_policy.h that can request huge
+    // pages, placement of pages by first touch and prefaulting of
+    // pages. The existing arrays are copied into memory allocated
+    // according to the new policy. ALLOCATE_DEFAULT (the default)
+    // allocates from the heap. Throws feature_not_available if the
+    // policy is not supported on this platform.
+    void set_allocation_policy(int policy);
+
     // In order to compute the jacobian we need to first declare which
     // active variables are independent (x) and which are dependent
     // (y). First, the following two functions declare an individual
@@ -398,28 +796,44 @@ namespace adept {
     template <class A>
     void independent(const A& x) {
       //      independent_index_.push_back(x.gradient_index());
+      std::size_t n_previous = independent_index_.size();
       x.push_gradient_indices(independent_index_);
+      if (!gradient_index_map_.empty()) {
+	renumber_gradient_indices(independent_index_, n_previous);
+      }
     }
     template <class A>
     void independent(const A* x, uIndex n) {
+      std::size_t n_previous = independent_index_.size();
       for (uIndex i = 0; i < n; i++) {
 	//	independent_index_.push_back(x[i].gradient_index());
 	x[i].push_gradient_indices(independent_index_);
       }
+      if (!gradient_index_map_.empty()) {
+	renumber_gradient_indices(independent_index_, n_previous);
+      }
     }
 
     // Likewise, delcare the dependent variables
     template <class A>
     void dependent(const A& x) {
       //      dependent_index_.push_back(x.gradient_index());
+      std::size_t n_previous = dependent_index_.size();
       x.push_gradient_indices(dependent_index_);
+      if (!gradient_index_map_.empty()) {
+	renumber_gradient_indices(dependent_index_, n_previous);
+      }
     }
     template <class A>
     void dependent(const A* x, uIndex n) {
+      std::size_t n_previous = dependent_index_.size();
       for (uIndex i = 0; i < n; i++) {
 	//	dependent_index_.push_back(x[i].gradient_index());
 	x[i].push_gradient_indices(dependent_index_);
       }
+      if (!gradient_index_map_.empty()) {
+	renumber_gradient_indices(dependent_index_, n_previous);
+      }
     }
 
     // Print various bits of information about the Stack to the
@@ -440,11 +854,31 @@ namespace adept {
     // Print a list of the gaps in the gradient list
     void print_gaps(std::ostream& os = std::cout) const;
 
+    // Write the current recording, together with the lists of
+    // independent and dependent variables, to a binary file, using
+    // the compressed encoding of compress_recording() if "compress"
+    // is true
+    void save_recording(const std::string& filename,
+			bool compress = false) const;
+
+    // Replace the current recording with one read from a file written
+    // by save_recording, possibly by another process, so that
+    // adjoint, tangent-linear and Jacobian calculations can be
+    // performed without running the original algorithm. Gradients
+    // are then set and retrieved using their indices, with
+    // set_gradients and get_gradients. Any active objects that exist
+    // when the recording is loaded must not be used afterwards, since
+    // their gradient indices may coincide with those in the file. A
+    // truncated or corrupt file causes stack_file_error to be thrown
+    // and leaves the current recording unchanged.
+    void load_recording(const std::string& filename);
+
     // Clear the gradient list enabling a new adjoint or
     // tangent-linear computation to be performed with the same
     // recording
     void clear_gradients() {
       gradients_initialized_ = false;
+      n_gradient_directions_ = 0;
     }
 
     // Clear the list of independent variables, in order that a
@@ -494,9 +928,16 @@ namespace adept {
     // recording
     void new_recording() {
       clear_stack(); // Defined in the storage class
+      compressed_stack_.clear();
+      single_precision_stack_.clear();
+      replay_stack_.clear();
+      parallel_adjoint_.clear();
+      matrix_node_.clear();
       clear_independents();
       clear_dependents();
       clear_gradients();
+      is_preaccumulating_ = false;
+      gradient_index_map_.clear();
 
       // i_gradient_ is the maximum index of all currently constructed
       // aReal objects and max_gradient_ is the maximum index of all
@@ -543,6 +984,43 @@ namespace adept {
 #endif
     }
 
+    // A region of the recording that maps a few active inputs to a
+    // few active outputs via many intermediate statements can be
+    // compacted by "local Jacobian preaccumulation". After
+    // begin_preaccumulation(), the statements of the region are
+    // recorded as usual; end_preaccumulation() then computes the
+    // Jacobian of the outputs with respect to the variables that the
+    // region read before writing, with a forward or reverse pass over
+    // just the region (whichever needs fewer directions), and replaces
+    // the statements of the region with one statement per output if
+    // this needs fewer operations. The outputs are declared either
+    // with preaccumulation_output() or in the call to
+    // end_preaccumulation(); variables written in the region that are
+    // not outputs must not be used afterwards. Regions cannot be
+    // nested, and a recording containing one is no longer replayable.
+    void begin_preaccumulation();
+    template <class A>
+    void preaccumulation_output(const A& x) {
+      x.push_gradient_indices(preaccumulation_output_);
+    }
+    template <class A>
+    void preaccumulation_output(const A* x, uIndex n) {
+      for (uIndex i = 0; i < n; i++) {
+	x[i].push_gradient_indices(preaccumulation_output_);
+      }
+    }
+    void end_preaccumulation();
+    template <class A>
+    void end_preaccumulation(const A& x) {
+      preaccumulation_output(x);
+      end_preaccumulation();
+    }
+    template <class A>
+    void end_preaccumulation(const A* x, uIndex n) {
+      preaccumulation_output(x, n);
+      end_preaccumulation();
+    }
+
     // For modular codes, some modules may have an existing Jacobian
     // code and possibly be unsuitable for automatic differentiation
     // using Adept (e.g. because they are written in Fortran).  In
@@ -623,12 +1101,10 @@ namespace adept {
     // Have the gradients been initialized?
     bool gradients_are_initialized() const { return gradients_initialized_; }
 
-    // Return the number of statements, operations, and how much
-    // memory has been allocated for each
-    uIndex n_statements() const { return n_statements_; }
-    uIndex n_allocated_statements() const { return n_allocated_statements_; }
-    uIndex n_operations() const { return n_operations_; }
-    uIndex n_allocated_operations() const { return n_allocated_operations_; }
+    // The number of statements, operations, and how much memory has
+    // been allocated for each, are returned by n_statements(),
+    // n_allocated_statements(), n_operations() and
+    // n_allocated_operations(), defined in the storage class
 
     // Return the size of the two dimensions of a Jacobian matrix
     uIndex n_independents() const { return independent_index_.size(); }
@@ -661,12 +1137,15 @@ namespace adept {
     // number (usually -1, 0 or 1)
     Real fraction_multipliers_equal_to(Real val) {
       uIndex sum = 0;
-      for (uIndex i = 0; i < n_operations_; i++) {
-	if (multiplier_[i] == val) {
-	  sum++;
+      for (uIndex iblock = 0; iblock < n_stack_blocks(); iblock++) {
+	internal::StackBlock block = stack_block(iblock);
+	for (uIndex i = 0; i < block.n_operations; i++) {
+	  if (block.multiplier[i] == val) {
+	    sum++;
+	  }
 	}
       }
-      return static_cast<Real>(sum)/static_cast<Real>(n_operations_);
+      return static_cast<Real>(sum)/static_cast<Real>(n_operations());
     }
 
 
@@ -697,6 +1176,36 @@ namespace adept {
     // calculation
     void initialize_gradients();
 
+    // Initialize the list of gradients in n_directions directions
+    // used by the multi-direction tangent-linear and adjoint
+    // calculations
+    void initialize_gradient_directions(uIndex n_directions);
+
+    // After renumber_gradients(), return the new index of the
+    // variable with original index gradient_index, or throw an
+    // exception if it is no longer accessible
+    uIndex renumbered_gradient_index(uIndex gradient_index) const;
+
+    // After renumber_gradients(), convert the original gradient
+    // indices in "index" from element "first" onwards to new ones
+    void renumber_gradient_indices(std::vector<uIndex>& index,
+				   std::size_t first) const;
+
+    // Throw an exception unless "start" and "end" describe a range of
+    // the current recording
+    void check_position_range(const StackPosition& start,
+			      const StackPosition& end) const;
+
+    // Tangent-linear and adjoint computation on the statements of the
+    // recording numbered from first_statement to end_statement-1,
+    // excluding any matrix nodes
+    void forward_statements(uIndex first_statement, uIndex end_statement);
+    void reverse_statements(uIndex first_statement, uIndex end_statement);
+
+    // Throw feature_not_available if the recording contains matrix
+    // nodes, which "function" cannot process
+    void check_no_matrix_nodes(const char* function) const;
+
     // Set to zero the gradients required by a Jacobian calculation
     /*
     void zero_gradient_multipass() {
@@ -721,6 +1230,23 @@ namespace adept {
     void jacobian_reverse_kernel_packet(Real* __restrict gradient_multipass_b) const;
     void jacobian_reverse_kernel_extra(Real* __restrict gradient_multipass_b, uIndex) const;
 
+    // Forward and reverse passes over a gradient list holding
+    // "stride" gradients per variable, used by the multi-direction
+    // tangent-linear and adjoint calculations and by sparse_jacobian
+    void forward_kernel_directions(Real* gradient, uIndex stride) const;
+    void reverse_kernel_directions(Real* gradient, uIndex stride) const;
+    // ...on statements first_statement to end_statement-1 only
+    void forward_statements_directions(Real* gradient, uIndex stride,
+				       uIndex first_statement,
+				       uIndex end_statement) const;
+    void reverse_statements_directions(Real* gradient, uIndex stride,
+				       uIndex first_statement,
+				       uIndex end_statement) const;
+
+    // Compute the Jacobian of a recording containing matrix nodes by
+    // forward or reverse passes in several directions at once
+    void jacobian_matrix_nodes(Real* jacobian_out, bool is_forward) const;
+
     // -------------------------------------------------------------------
     // Stack: 5. Data
     // -------------------------------------------------------------------
@@ -740,11 +1266,18 @@ namespace adept {
     // uIndexs of the independent and dependent variables
     std::vector<uIndex> independent_index_;
     std::vector<uIndex> dependent_index_;
+    // Compressed copy of the recording made by compress_recording()
+    internal::CompressedStack compressed_stack_;
+    // Copy of the recording made by store_single_precision_recording()
+    internal::SinglePrecisionStack single_precision_stack_;
+    // Operations of the recording stored following enable_replay()
+    internal::ReplayStack replay_stack_;
+    // Recording sorted into levels by parallelize_adjoint()
+    internal::ParallelAdjoint parallel_adjoint_;
     // Keep a record of gaps in the gradient array to ensure that gaps
-    // are filled
+    // are filled, sorted in descending order of gradient index so
+    // that the lowest gap, which is filled first, is at the back
     GapList gap_list_;
-    //    Gap* most_recent_gap_;
-    GapListIterator most_recent_gap_;
 
     uIndex i_gradient_;             // Current number of gradients
     uIndex n_allocated_gradients_;  // Number of allocated gradients
@@ -758,6 +1291,34 @@ namespace adept {
 				    // compiled with -fopenmp
     bool openmp_manually_disabled_; // true if user called
 				    // set_max_jacobian_threads(1)
+    Stack* substack_previous_stack_; // Stack active before begin_substack()
+    uIndex substack_end_gradient_;   // End of range of gradient indices
+    bool is_substack_overflowed_;    // Range exceeded in sub-stack
+    // Gradients in multiple directions, with those of each variable
+    // contiguous and padded to a multiple of the packet size
+    Real* __restrict gradient_directions_;
+    uIndex n_gradient_directions_;     // Number of directions, or 0
+    uIndex gradient_direction_stride_; // Padded number of directions
+    std::size_t n_allocated_gradient_directions_;
+    // Preaccumulation region begun by begin_preaccumulation(): its
+    // first statement and operation, the gradient indices of its
+    // outputs, and a map from gradient index to the variables of the
+    // region retained between calls (and otherwise -1)
+    bool is_preaccumulating_;
+    uIndex preaccumulation_statement_;
+    uIndex preaccumulation_operation_;
+    std::vector<uIndex> preaccumulation_output_;
+    std::vector<uIndex> preaccumulation_slot_;
+    // Map from original to renumbered gradient indices after
+    // renumber_gradients() (-1 if the gradient is no longer
+    // accessible), and the number of statements at that point
+    std::vector<uIndex> gradient_index_map_;
+    uIndex renumbered_n_statements_;
+    // Matrix operations recorded as single nodes, whether this is
+    // done, and the number at the start of any preaccumulation region
+    internal::MatrixNodeList matrix_node_;
+    bool is_matrix_node_enabled_;
+    uIndex preaccumulation_matrix_node_;
   }; // End of Stack class
 
 
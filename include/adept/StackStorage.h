@@ -14,73 +14,56 @@
    "statement stack" and the "operation stack".
 
    This file provides the stack storage engine: blocks of dynamically
-   allocated arrays.
+   allocated arrays.  It is selected by defining
+   ADEPT_STACK_STORAGE_BLOCKS.  Each block holds up to
+   ADEPT_STACK_BLOCK_LENGTH statements and operations; when either
+   is full a new block is started, so the existing recording is never
+   copied.  The statement_, multiplier_ and index_ pointers refer to
+   the current block, so the inline functions that push statements
+   and operations are identical to those of StackStorageOrig.  The
+   operations of a statement never straddle two blocks: any
+   operations that have been pushed but not yet terminated by
+   push_lhs are moved to the new block when it is started.
+
+   For recordings too large to hold in memory, a memory budget may be
+   set with set_memory_budget(): whenever a new block is started and
+   the blocks in use exceed the budget, the oldest blocks are written
+   to a scratch file in the directory given by set_spill_directory()
+   and their arrays replaced by a memory mapping of the file.  The
+   kernels then see these blocks like any other, while the operating
+   system pages them in and out; compute_adjoint and
+   compute_tangent_linear use prefetch_stack_block() and
+   release_stack_block() to read ahead of the block being processed
+   and to discard those already processed.
 
 */
 
 #ifndef AdeptStackStorage_H
 #define AdeptStackStorage_H 1
 
+#include <vector>
+#include <string>
+#include <cstddef>
+
 #include <adept/base.h>
 #include <adept/exception.h>
 #include <adept/Statement.h>
+#include <adept/allocation_policy.h>
 
 namespace adept {
   namespace internal {
 
-    // Helper classes
-
-
-    struct StatementBlock {
-      StatementBlock(uIndex n_) : n(0), n_allocated(n_) {
-	data = new Statement[n_];
-      }
-      ~StatementBlock() {
-	delete [] data;
-      }
-      // Data
-      Statement* data;
-      uIndex n;
-      const uIndex n_allocated;
-    };
-
-    struct OperationBlock {
-      StatementBlock(uIndex n_) : n(0), n_allocated(n_) {
-	multiplier = new Real[n_];
-	index      = new uIndex[n_];
-      }
-      ~StatementBlock() {
-	delete [] multiplier;
-	delete [] index;
-      }
-      // Data
-      Real* multiplier;
-      uIndex* index;
-      uIndex n;
-      uIndex n_allocated
-    };
-
-    std::vector<StackBlock> stack_block_;
-    struct StackBlock {
-      StatementBlock* statement_list;
-      OperationBlock* operation_list;
-      uIndex statement_start;
-      uIndex statement_end;
-    };
-
-    std::vector<StatementBlock> statement_data_;
-    std::vector<OperationBlock> operation_data_;
-
-
-
     class StackStorage {
     public:
       // Constructor
-      StackStorage() : 
+      StackStorage() :
 	statement_(0), multiplier_(0), index_(0),
 	n_statements_(0), n_allocated_statements_(0),
-	n_operations_(0), n_allocated_operations_(0) { }
-      
+	n_operations_(0), n_allocated_operations_(0),
+	i_block_(0), n_statements_previous_(0),
+	n_operations_previous_(0), allocation_policy_(ALLOCATE_DEFAULT),
+	memory_budget_(0), spill_file_descriptor_(-1), spill_file_size_(0) { }
+
       // Destructor
       ~StackStorage();
 
@@ -97,18 +80,29 @@ namespace adept {
 #endif
 	  multiplier_[n_operations_] = multiplier;
 	  index_[n_operations_++] = gradient_index;
-	
+
 #ifdef ADEPT_TRACK_NON_FINITE_GRADIENTS
 	  if (!std::isfinite(multiplier) || std::isinf(multiplier)) {
 	    throw non_finite_gradient();
 	  }
 #endif
-	
+
 #ifdef ADEPT_REMOVE_NULL_STATEMENTS
 	}
 #endif
       }
 
+      // Push the gradient indices of a vectorized operation on to the
+      // stack.  We assume here that check_space() as been called
+      // before so there is enough space to hold these elements. The
+      // multipliers will be added later.
+      template <Index Num, Index Stride>
+      void push_rhs_indices(const uIndex& gradient_index) {
+	for (Index i = 0; i < Num; ++i) {
+	  index_[n_operations_+i*Stride] = gradient_index+i;
+	}
+	++n_operations_;
+      }
 
       // Push a statement on to the stack: this is done after a
       // sequence of operation pushes; gradient_index is the index of
@@ -129,9 +123,10 @@ namespace adept {
       // stack with no corresponding right-hand-side, appropriate if
       // an array of active variables contiguous in memory (or
       // separated by a fixed stride) has been assigned to inactive
-      // numbers.
-      void push_lhs_range(const uIndex& first, const uIndex& n, 
-			  const uIndex& stride = 1) {
+      // numbers. Note that the second and third arguments must not be
+      // references, since they may be compile-time constants for
+      // FixedArray objects.
+      void push_lhs_range(const uIndex& first, uIndex n, uIndex stride = 1) {
 	uIndex last_plus_1 = first+n*stride;
 #ifndef ADEPT_MANUAL_MEMORY_ALLOCATION
 	if (n_statements_+n > n_allocated_statements_) {
@@ -145,8 +140,8 @@ namespace adept {
       }
 
       // Check whether the operation stack contains enough space for n
-      // new operations; if not, grow it
-      void check_space(const uIndex& n) {
+      // new operations; if not, start a new block
+      void check_space(uIndex n) {
 	if (n_allocated_operations_ < n_operations_+n+1) {
 	  grow_operation_stack(n);
 	}
@@ -156,43 +151,186 @@ namespace adept {
 	check_space(n);
       }
 
+      // Return the total number of statements and operations in the
+      // recording, and how much memory has been allocated for each
+      uIndex n_statements() const {
+	return n_statements_previous_ + n_statements_;
+      }
+      uIndex n_allocated_statements() const;
+      uIndex n_operations() const {
+	return n_operations_previous_ + n_operations_;
+      }
+      uIndex n_allocated_operations() const;
+
+      // Return the number of blocks in use and a description of one
+      // of them, used by the adjoint, tangent-linear and Jacobian
+      // kernels to loop through the recording block by block
+      uIndex n_stack_blocks() const { return i_block_+1; }
+      StackBlock stack_block(uIndex iblock) const {
+	if (iblock == i_block_) {
+	  StackBlock block = block_[i_block_];
+	  block.n_statements = n_statements_;
+	  block.n_operations = n_operations_;
+	  return block;
+	}
+	else {
+	  return block_[iblock];
+	}
+      }
+
+      // Hint that block "iblock" will shortly be needed, or that it
+      // is no longer needed, so that a block spilled to disk can be
+      // read in advance or removed from memory; these have no effect
+      // on blocks in memory
+      void prefetch_stack_block(uIndex iblock) const {
+	if (spilled_block_[iblock].mapping) {
+	  advise_spilled_block(iblock, true);
+	}
+      }
+      void release_stack_block(uIndex iblock) const {
+	if (spilled_block_[iblock].mapping) {
+	  advise_spilled_block(iblock, false);
+	}
+      }
+
+      // Limit the number of bytes of memory used by the blocks of the
+      // current recording, beyond which the oldest blocks are spilled
+      // to a scratch file; zero (the default) indicates no limit. This
+      // throws feature_not_available on platforms without memory-mapped
+      // files.
+      void set_memory_budget(std::size_t bytes);
+      std::size_t memory_budget() const { return memory_budget_; }
+
+      // Set the directory in which the scratch file is created; the
+      // default is that given by the TMPDIR environment variable, or
+      // /tmp if this is not set.  The file is deleted as soon as it
+      // is opened so that nothing remains if the program exits
+      // abnormally.
+      void set_spill_directory(const std::string& directory) {
+	spill_directory_ = directory;
+      }
+      const std::string& spill_directory() const { return spill_directory_; }
+
+      // Return the number of blocks of the current recording that have
+      // been spilled to the scratch file
+      uIndex n_spilled_blocks() const;
+
+      // Return the policy used to allocate the blocks, set by
+      // Stack::set_allocation_policy()
+      int allocation_policy() const { return allocation_policy_; }
+
     protected:
-      // Called by new_recording()
-      void clear_stack() { 
+      // Called by new_recording(): the blocks are retained so that
+      // their memory can be reused
+      void clear_stack() {
+	if (spill_file_size_ > 0) {
+	  clear_spilled_blocks();
+	}
+	i_block_ = 0;
+	n_statements_previous_ = 0;
+	n_operations_previous_ = 0;
+	if (!block_.empty()) {
+	  use_block(0);
+	}
 	// Set the recording indices to zero
 	n_operations_ = 0;
 	n_statements_ = 0;
       }
 
-      // This function is called by the constructor to initialize
-      // memory, which can be grown subsequently
-      void initialize(uIndex n) {
-	multiplier_ = new Real[n];
-	index_ = new uIndex[n];
-	n_allocated_operations_ = n;
-	statement_ = new Statement[n];
-	n_allocated_statements_ = n;
-      }
+      // Discard the statements and operations after the first
+      // n_statements and n_operations, which must mark the end of a
+      // statement in the current recording; later blocks are
+      // retained for reuse
+      void rewind_stack(uIndex n_statements, uIndex n_operations);
 
-      // Grow the capacity of the operation or statement stacks to
-      // hold a minimum of "min" elements. If min=0 then the stacks
-      // are doubled in size.
+      // Set the number of statements (including the null statement)
+      // and operations of block iblock after its contents have been
+      // compacted in place
+      void resize_stack_block(uIndex iblock, uIndex n_statements,
+			      uIndex n_operations);
+
+      // This function is called by the constructor to allocate the
+      // first block; subsequent blocks are allocated with length
+      // ADEPT_STACK_BLOCK_LENGTH
+      void initialize(uIndex n);
+
+      // Start a new block with space for at least "min" more
+      // operations or statements, moving to it any incomplete
+      // statement
       void grow_operation_stack(uIndex min = 0);
       void grow_statement_stack(uIndex min = 0);
 
+      // Copy the blocks held in memory into arrays allocated
+      // according to the current allocation policy
+      void reallocate_stack();
+
+    private:
+      // Start a new block, moving the operations after the end of the
+      // last statement (and the last statement too if
+      // move_last_statement is true, since append_derivative_dependence
+      // may be about to extend it)
+      void new_block(uIndex min_statements, uIndex min_operations,
+		     bool move_last_statement);
+      // Point statement_, multiplier_ and index_ at block "iblock"
+      void use_block(uIndex iblock) {
+	const StackBlock& block = block_[iblock];
+	statement_  = block.statement;
+	multiplier_ = block.multiplier;
+	index_      = block.index;
+	n_allocated_statements_ = block.n_allocated_statements;
+	n_allocated_operations_ = block.n_allocated_operations;
+      }
+      // Allocate or free the arrays of block "iblock"
+      void allocate_block(uIndex iblock,
+			  uIndex n_statements, uIndex n_operations);
+      void free_block(uIndex iblock);
+
+      // Spill finished blocks to the scratch file until the memory
+      // budget is satisfied
+      void apply_memory_budget();
+      // Write block "iblock" to the scratch file and replace its
+      // arrays with a mapping of the file
+      void spill_block(uIndex iblock);
+      // Unmap all spilled blocks and empty the scratch file
+      void clear_spilled_blocks();
+      void advise_spilled_block(uIndex iblock, bool will_need) const;
+
+      // Memory mapping of a block that has been spilled to disk
+      struct SpilledBlock {
+	SpilledBlock() : mapping(0), length(0) { }
+	void* mapping;      // Zero if the block is in memory
+	std::size_t length; // Number of bytes mapped
+      };
+
     protected:
-      // Data are stored as dynamically allocated arrays
+      // Data are stored as a list of blocks, each containing
+      // dynamically allocated arrays; the following point to the
+      // arrays of the current block
 
-      // The "statement stack" is held as a single array
+      // The "statement stack" of the current block
       Statement* __restrict statement_ ;
-      // The "operation stack" is held as two arrays
+      // The "operation stack" of the current block is held as two
+      // arrays
       Real*      __restrict multiplier_;
       uIndex*    __restrict index_;
 
-      uIndex n_statements_;           // Number of statements
+      uIndex n_statements_;           // Number of statements in block
       uIndex n_allocated_statements_; // Space allocated for statements
-      uIndex n_operations_;           // Number of operations
-      uIndex n_allocated_operations_; // Space allocated for statements
+      uIndex n_operations_;           // Number of operations in block
+      uIndex n_allocated_operations_; // Space allocated for operations
+
+      std::vector<StackBlock> block_; // All allocated blocks
+      uIndex i_block_;                // Index of current block
+      uIndex n_statements_previous_;  // Statements in earlier blocks
+      uIndex n_operations_previous_;  // Operations in earlier blocks
+      int allocation_policy_;         // Combination of ALLOCATE_* flags
+
+      // Spilling of blocks to disk
+      std::size_t memory_budget_;     // Zero means no limit
+      std::string spill_directory_;   // Empty means use default
+      int spill_file_descriptor_;     // -1 if no file open
+      std::size_t spill_file_size_;   // Bytes used in scratch file
+      std::vector<SpilledBlock> spilled_block_; // One per block
     };
 
   } // End namespace internal
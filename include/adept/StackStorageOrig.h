@@ -25,6 +25,7 @@
 #include <adept/base.h>
 #include <adept/exception.h>
 #include <adept/Statement.h>
+#include <adept/allocation_policy.h>
 
 namespace adept {
   namespace internal {
@@ -35,7 +36,8 @@ namespace adept {
       StackStorageOrig() : 
 	statement_(0), multiplier_(0), index_(0),
 	n_statements_(0), n_allocated_statements_(0),
-	n_operations_(0), n_allocated_operations_(0) { }
+	n_operations_(0), n_allocated_operations_(0),
+	allocation_policy_(ALLOCATE_DEFAULT) { }
       
       // Destructor
       ~StackStorageOrig();
@@ -124,6 +126,30 @@ namespace adept {
 	check_space(n);
       }
 
+      // Return the number of statements and operations, and how much
+      // memory has been allocated for each
+      uIndex n_statements() const { return n_statements_; }
+      uIndex n_allocated_statements() const { return n_allocated_statements_; }
+      uIndex n_operations() const { return n_operations_; }
+      uIndex n_allocated_operations() const { return n_allocated_operations_; }
+
+      // Return the policy used to allocate the stacks, set by
+      // Stack::set_allocation_policy()
+      int allocation_policy() const { return allocation_policy_; }
+
+      // The two stacks are presented to the adjoint, tangent-linear
+      // and Jacobian kernels as a single block
+      uIndex n_stack_blocks() const { return 1; }
+      StackBlock stack_block(uIndex) const {
+	return StackBlock(statement_, multiplier_, index_,
+			  n_statements_, n_operations_);
+      }
+      // The stacks are always held in memory so these hints, used by
+      // the block storage engine to read spilled blocks from disk, do
+      // nothing
+      void prefetch_stack_block(uIndex) const { }
+      void release_stack_block(uIndex) const { }
+
     protected:
       // Called by new_recording()
       void clear_stack() { 
@@ -132,16 +158,34 @@ namespace adept {
 	n_statements_ = 0;
       }
 
+      // Discard the statements and operations after the first
+      // n_statements and n_operations, which must mark the end of a
+      // statement in the current recording
+      void rewind_stack(uIndex n_statements, uIndex n_operations) {
+	n_statements_ = n_statements;
+	n_operations_ = n_operations;
+      }
+
+      // Set the number of statements and operations of a block after
+      // its contents have been compacted in place
+      void resize_stack_block(uIndex, uIndex n_statements, uIndex n_operations) {
+	rewind_stack(n_statements, n_operations);
+      }
+
       // This function is called by the constructor to initialize
       // memory, which can be grown subsequently
       void initialize(uIndex n) {
-	multiplier_ = new Real[n];
-	index_ = new uIndex[n];
+	multiplier_ = allocate_array<Real>(n, allocation_policy_);
+	index_ = allocate_array<uIndex>(n, allocation_policy_);
 	n_allocated_operations_ = n;
-	statement_ = new Statement[n];
+	statement_ = allocate_array<Statement>(n, allocation_policy_);
 	n_allocated_statements_ = n;
       }
 
+      // Copy the stacks into arrays allocated according to the
+      // current allocation policy
+      void reallocate_stack();
+
       // Grow the capacity of the operation or statement stacks to
       // hold a minimum of "min" elements. If min=0 then the stacks
       // are doubled in size.
@@ -161,6 +205,7 @@ namespace adept {
       uIndex n_allocated_statements_; // Space allocated for statements
       uIndex n_operations_;           // Number of operations
       uIndex n_allocated_operations_; // Space allocated for statements
+      int allocation_policy_;         // Combination of ALLOCATE_* flags
     };
 
   } // End namespace internal
@@ -24,6 +24,7 @@
 #include <adept/base.h>
 #include <adept/exception.h>
 #include <adept/Statement.h>
+#include <adept/allocation_policy.h>
 
 namespace adept {
   namespace internal {
@@ -33,7 +34,8 @@ namespace adept {
       // Constructor
       StackStorageOrigStl() :
 	n_statements_(0), n_allocated_statements_(0),
-	n_operations_(0), n_allocated_operations_(0) { }
+	n_operations_(0), n_allocated_operations_(0),
+	allocation_policy_(ALLOCATE_DEFAULT) { }
       
       // Destructor (does nothing)
       ~StackStorageOrigStl() { };
@@ -94,6 +96,35 @@ namespace adept {
       void check_space(const uIndex& n) { }
       template<uIndex n> void check_space_static() { }
 
+      // Return the number of statements and operations, and how much
+      // memory has been allocated for each
+      uIndex n_statements() const { return n_statements_; }
+      uIndex n_allocated_statements() const { return statement_.capacity(); }
+      uIndex n_operations() const { return n_operations_; }
+      uIndex n_allocated_operations() const { return multiplier_.capacity(); }
+
+      // Return the policy set by Stack::set_allocation_policy(),
+      // which is ignored by this storage engine
+      int allocation_policy() const { return allocation_policy_; }
+
+      // The two stacks are presented to the adjoint, tangent-linear
+      // and Jacobian kernels as a single block
+      uIndex n_stack_blocks() const { return 1; }
+      StackBlock stack_block(uIndex) const {
+	if (statement_.empty()) {
+	  return StackBlock();
+	}
+	return StackBlock(const_cast<Statement*>(&statement_[0]),
+			  multiplier_.empty() ? 0 : const_cast<Real*>(&multiplier_[0]),
+			  index_.empty() ? 0 : const_cast<uIndex*>(&index_[0]),
+			  n_statements_, n_operations_);
+      }
+      // The stacks are always held in memory so these hints, used by
+      // the block storage engine to read spilled blocks from disk, do
+      // nothing
+      void prefetch_stack_block(uIndex) const { }
+      void release_stack_block(uIndex) const { }
+
     protected:
       // Called by new_recording()
       void clear_stack() { 
@@ -107,6 +138,27 @@ namespace adept {
 	n_statements_ = 0;
       }
 
+      // Discard the statements and operations after the first
+      // n_statements and n_operations, which must mark the end of a
+      // statement in the current recording
+      void rewind_stack(uIndex n_statements, uIndex n_operations) {
+	statement_.resize(n_statements);
+	multiplier_.resize(n_operations);
+	index_.resize(n_operations);
+	n_statements_ = n_statements;
+	n_operations_ = n_operations;
+      }
+
+      // Set the number of statements and operations of a block after
+      // its contents have been compacted in place
+      void resize_stack_block(uIndex, uIndex n_statements, uIndex n_operations) {
+	rewind_stack(n_statements, n_operations);
+      }
+
+      // The std::vector containers are not affected by the allocation
+      // policy
+      void reallocate_stack() { }
+
       // This function is called by the constructor to initialize
       // memory, which can be grown subsequently
       void initialize(uIndex n) {
@@ -134,6 +186,7 @@ namespace adept {
       uIndex n_allocated_statements_; // Space allocated for statements
       uIndex n_operations_;           // Number of operations
       uIndex n_allocated_operations_; // Space allocated for statements
+      int allocation_policy_;         // Combination of ALLOCATE_* flags
     };
 
   } // End namespace internal
@@ -28,6 +28,35 @@ namespace adept {
       uIndex index;
       uIndex end_plus_one;
     };
+
+    // Structure describing one contiguous block of the statement and
+    // operation stacks. The first statement of a block is a null
+    // statement whose "end_plus_one" is zero, so that the operations
+    // of statement "ist" always run from
+    // statement[ist-1].end_plus_one to statement[ist].end_plus_one-1,
+    // and the kernels in Stack.cpp and jacobian.cpp can loop over
+    // statements 1 to n_statements-1 of each block in turn. The
+    // original storage engines present their entire stacks as a
+    // single block.
+    struct StackBlock {
+      StackBlock()
+	: statement(0), multiplier(0), index(0),
+	  n_statements(0), n_operations(0),
+	  n_allocated_statements(0), n_allocated_operations(0) { }
+      StackBlock(Statement* statement_, Real* multiplier_, uIndex* index_,
+		 uIndex n_statements_, uIndex n_operations_)
+	: statement(statement_), multiplier(multiplier_), index(index_),
+	  n_statements(n_statements_), n_operations(n_operations_),
+	  n_allocated_statements(n_statements_),
+	  n_allocated_operations(n_operations_) { }
+      Statement* statement;
+      Real*      multiplier;
+      uIndex*    index;
+      uIndex n_statements;           // Including the null statement
+      uIndex n_operations;
+      uIndex n_allocated_statements;
+      uIndex n_allocated_operations;
+    };
  
   }
 }
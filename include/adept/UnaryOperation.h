@@ -182,6 +182,11 @@ namespace adept {
 	arg.template set_location_<MyArrayNum>(i, index);
       }
 
+      void record_replay_(ReplayStack& replay) const {
+	record_replay_argument(replay, arg);
+	replay.push_operation(Op<Type>::replay_opcode);
+      }
+
     }; // End UnaryOperation type
   
   } // End namespace internal
@@ -200,6 +205,7 @@ namespace adept {
     struct NAME  {							\
       static const bool is_operator = false;				\
       static const bool is_vectorized = ISVEC;				\
+      static const int replay_opcode = REPLAY_##NAME;			\
       const char* operation_string() const { return STRING; }		\
       template <typename T>						\
       T operation(const T& val) const {					\
@@ -294,6 +300,7 @@ namespace adept {
     struct NAME  {							\
       static const bool is_operator = false;				\
       static const bool is_vectorized = ISVEC;				\
+      static const int replay_opcode = REPLAY_##NAME;			\
       const char* operation_string() const { return STRING; }		\
       template <typename T>						\
       T operation(const T& val) const {					\
@@ -0,0 +1,81 @@
+/* allocation_policy.h -- Allocation of the recording and gradient list
+
+    Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+    Author: Robin Hogan <r.j.hogan@ecmwf.int>
+
+    This file is part of the Adept library.
+
+   By default the arrays holding the statement and operation stacks
+   and the gradient list are allocated from the heap.  For very large
+   recordings the adjoint pass can then incur many TLB misses, and on
+   multi-socket machines the pages may reside on a different NUMA
+   node from the thread that uses them.  Stack::set_allocation_policy
+   accepts a combination of the following flags, which apply to
+   arrays of at least MIN_MAPPED_BYTES; smaller arrays are always
+   allocated from the heap:
+
+     ALLOCATE_TRANSPARENT_HUGE_PAGES: map the array aligned to a huge
+       page boundary and advise the kernel to back it with
+       transparent huge pages
+
+     ALLOCATE_EXPLICIT_HUGE_PAGES: map the array from the pool of
+       explicitly reserved huge pages, falling back to transparent
+       huge pages if none are available
+
+     ALLOCATE_FIRST_TOUCH: map fresh pages, rather than reusing heap
+       pages that may already have been placed by another thread, so
+       that each page is placed on the NUMA node of the thread that
+       first writes to it
+
+     ALLOCATE_PREFAULT: touch every page when the array is allocated,
+       so that page faults are not taken during the recording; the
+       pages are then placed on the node of the allocating thread
+
+   Each array is preceded by a header recording how it was allocated,
+   so it must be freed with free_with_policy().
+
+*/
+
+#ifndef AdeptAllocationPolicy_H
+#define AdeptAllocationPolicy_H 1
+
+#include <cstddef>
+
+namespace adept {
+
+  // Flags that may be combined to form an allocation policy
+  enum {
+    ALLOCATE_DEFAULT                = 0,
+    ALLOCATE_TRANSPARENT_HUGE_PAGES = 1,
+    ALLOCATE_EXPLICIT_HUGE_PAGES    = 2,
+    ALLOCATE_FIRST_TOUCH            = 4,
+    ALLOCATE_PREFAULT               = 8,
+    ALLOCATE_ALL_FLAGS              = 15
+  };
+
+  namespace internal {
+
+    // Smallest array to which the allocation policy applies
+    enum { MIN_MAPPED_BYTES = 1048576 };
+
+    // Throw feature_not_available if the policy contains flags that
+    // are unknown or unsupported on this platform
+    void check_allocation_policy(int policy);
+
+    // Allocate the specified number of bytes according to the
+    // policy, or free memory allocated in this way
+    void* allocate_with_policy(std::size_t bytes, int policy);
+    void free_with_policy(void* data);
+
+    // Allocate an array of n objects that need no construction
+    template <typename Type>
+    inline
+    Type* allocate_array(std::size_t n, int policy) {
+      return static_cast<Type*>(allocate_with_policy(n*sizeof(Type), policy));
+    }
+
+  } // End namespace internal
+} // End namespace adept
+
+#endif
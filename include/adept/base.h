@@ -100,7 +100,10 @@
 #define ADEPT_INITIAL_STACK_LENGTH 1048576
 #endif
 
-// The statement and operation stacks
+// If ADEPT_STACK_STORAGE_BLOCKS is defined (see section 2) then the
+// statement and operation stacks are stored in blocks of this length,
+// and a new block is started rather than the stacks being reallocated
+// and copied when they are full
 #ifndef ADEPT_STACK_BLOCK_LENGTH
 #define ADEPT_STACK_BLOCK_LENGTH 1048576
 #endif
@@ -126,6 +129,15 @@
 // used.  Experience says that dynamically allocated arrays are faster.
 //#define ADEPT_STACK_STORAGE_STL 1
 
+// The default dynamically allocated arrays are contiguous, so when
+// they are full they are reallocated at double the size and the
+// recording copied across, which for very large recordings both
+// stalls the forward pass and temporarily doubles the memory
+// required.  If ADEPT_STACK_STORAGE_BLOCKS is defined then the stacks
+// are instead held in a list of blocks of length
+// ADEPT_STACK_BLOCK_LENGTH, and the recording is never copied.
+//#define ADEPT_STACK_STORAGE_BLOCKS 1
+
 // The number of rows/columns of a Jacobian that are calculated at
 // once. The optimum value depends on platform, the size of your
 // Jacobian and the number of OpenMP threads available.
@@ -243,18 +255,6 @@
 #define ADEPT_THREAD_LOCAL_IF_OPENMP
 #endif
 
-// Currently the design of the stack means that automatic
-// differentiation of matrix multiplication is very inefficient. A
-// future version of Adept will redesign the stack to store directives
-// enabling efficient implementation of the derivative of a matrix
-// multiplication, and this will be applicable to different types of
-// matrix (dense, symmetric, banded, upper and lower). But for now,
-// only differentiation of dense active matrices
-// (i.e. Array<2,Real,true>) is implemented.  Therefore other types
-// of active matrix need to be converted to this type before they can
-// be used in matrix multiplication.
-#define ADEPT_ONLY_DIFFERENTIATE_DENSE_MATRIX_MULTIPLICATION 1
-
 
 // ---------------------------------------------------------------------
 // 5: Define basic floating-point and integer types
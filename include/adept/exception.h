@@ -94,6 +94,20 @@ namespace adept {
     { message_ = message; }
   };
 
+  class stack_file_error : public autodiff_exception {
+  public:
+    stack_file_error(const std::string& message
+	= "Error reading or writing a file containing stack information")
+    { message_ = message; }
+  };
+
+  class recording_not_replayable : public autodiff_exception {
+  public:
+    recording_not_replayable(const std::string& message
+	= "The recording cannot be replayed")
+    { message_ = message; }
+  };
+
 
   // -------------------------------------------------------------------
   // array_exception and child classes
@@ -31,6 +31,14 @@ namespace adept {
   SpecialMatrix<Type,SymmEngine<Orient>,false> 
   inv(const SpecialMatrix<Type,SymmEngine<Orient>,false>& A);
  
+  // -------------------------------------------------------------------
+  // Invert active general square matrix A, recorded as the solution
+  // of AX = I
+  // -------------------------------------------------------------------
+  template <typename Type>
+  Array<2,Type,true> 
+  inv(const Array<2,Type,true>& A);
+
   // -------------------------------------------------------------------
   // Invert arbitrary expression
   // -------------------------------------------------------------------
@@ -42,6 +50,18 @@ namespace adept {
     Array<2,Type,false> array = A.cast();
     return inv(array);
   }
+
+  // -------------------------------------------------------------------
+  // Invert arbitrary active expression
+  // -------------------------------------------------------------------
+  template <typename Type, class E>
+  typename internal::enable_if<E::rank==2 && E::is_active
+			       && internal::matrix_op_defined<Type>::value,
+			       Array<2,Type,true> >::type
+  inv(const Expression<Type,E>& A) {
+    Array<2,Type,true> array = A.cast();
+    return inv(array);
+  }
  
 }
 
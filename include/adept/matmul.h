@@ -92,24 +92,38 @@ namespace adept {
 	  && ADEPT_ACTIVE_STACK->is_recording()
 #endif
 	  ) {
-
-	uIndex left_index = left.gradient_index();
-	uIndex right_index = right.gradient_index();
-	uIndex ans_index = ans.gradient_index();
-	Index n = right.dimension(0);
-	const ExpressionSize<2>& left_offset = left.offset();
-	const ExpressionSize<1>& right_offset = right.offset();
-	for (Index i = 0; i < ans.dimension(0); ++i) {
-	  if (LIsActive) {
-	    active_stack()->push_derivative_dependence(left_index+i*left_offset[0], 
-						       right.const_data(), n, left_offset[1], right_offset[0]);
-	  }
-	  if (RIsActive) {
-	    active_stack()->push_derivative_dependence(right_index, 
-						       left.const_data()+i*left_offset[0], 
-						       n, right_offset[0], left_offset[1]);
+	if (ADEPT_ACTIVE_STACK->are_matrix_nodes_enabled()) {
+	  // Record a single node, treating the vectors as matrices
+	  // with one column
+	  active_stack()->push_matrix_node(new MatmulNode(left.dimension(0), 1,
+				  left.dimension(1),
+				  MatrixOperand<T>(left.const_data(), left.offset(0),
+						   left.offset(1), left.gradient_index(),
+						   LIsActive),
+				  MatrixOperand<T>(right.const_data(), right.offset(0),
+						   0, right.gradient_index(),
+						   RIsActive),
+				  ans.gradient_index(), ans.offset(0), 0));
+	}
+	else {
+	  uIndex left_index = left.gradient_index();
+	  uIndex right_index = right.gradient_index();
+	  uIndex ans_index = ans.gradient_index();
+	  Index n = right.dimension(0);
+	  const ExpressionSize<2>& left_offset = left.offset();
+	  const ExpressionSize<1>& right_offset = right.offset();
+	  for (Index i = 0; i < ans.dimension(0); ++i) {
+	    if (LIsActive) {
+	      active_stack()->push_derivative_dependence(left_index+i*left_offset[0], 
+							 right.const_data(), n, left_offset[1], right_offset[0]);
+	    }
+	    if (RIsActive) {
+	      active_stack()->push_derivative_dependence(right_index, 
+							 left.const_data()+i*left_offset[0], 
+							 n, right_offset[0], left_offset[1]);
+	    }
+	    active_stack()->push_lhs(ans_index + i*ans.offset(0));
 	  }
-	  active_stack()->push_lhs(ans_index + i*ans.offset(0));
 	}
       }
 
@@ -183,34 +197,153 @@ namespace adept {
 	    && ADEPT_ACTIVE_STACK->is_recording()
 #endif
 	    ) {
-	  uIndex left_index = left.gradient_index();
-	  uIndex right_index = right.gradient_index();
-	  uIndex ans_index = ans.gradient_index();
-	  Index n = right.dimension(0);
-	  const ExpressionSize<2>& left_offset = left.offset();
-	  const ExpressionSize<2>& right_offset = right.offset();
-
-	  for (Index i = 0; i < ans.dimension(0); ++i) {
-	    for (Index j = 0; j < ans.dimension(1); ++j) {
-	      if (LIsActive) {
-		active_stack()->push_derivative_dependence(left_index+i*left_offset[0], 
-			   right.const_data()+j*right_offset[1], n, 
-			   left_offset[1], right_offset[0]);
-	      }
-	      if (RIsActive) {
-		active_stack()->push_derivative_dependence(right_index+j*right_offset[1], 
-			   left.const_data()+i*left_offset[0], n, 
-			   right_offset[0], left_offset[1]);
+	  if (ADEPT_ACTIVE_STACK->are_matrix_nodes_enabled()) {
+	    // Record a single node whose adjoint is computed with BLAS
+	    active_stack()->push_matrix_node(new MatmulNode(left.dimension(0),
+				    right.dimension(1), left.dimension(1),
+				    MatrixOperand<T>(left.const_data(), left.offset(0),
+						     left.offset(1), left.gradient_index(),
+						     LIsActive),
+				    MatrixOperand<T>(right.const_data(), right.offset(0),
+						     right.offset(1), right.gradient_index(),
+						     RIsActive),
+				    ans.gradient_index(), ans.offset(0), ans.offset(1)));
+	  }
+	  else {
+	    uIndex left_index = left.gradient_index();
+	    uIndex right_index = right.gradient_index();
+	    uIndex ans_index = ans.gradient_index();
+	    Index n = right.dimension(0);
+	    const ExpressionSize<2>& left_offset = left.offset();
+	    const ExpressionSize<2>& right_offset = right.offset();
+
+	    for (Index i = 0; i < ans.dimension(0); ++i) {
+	      for (Index j = 0; j < ans.dimension(1); ++j) {
+		if (LIsActive) {
+		  active_stack()->push_derivative_dependence(left_index+i*left_offset[0], 
+			     right.const_data()+j*right_offset[1], n, 
+			     left_offset[1], right_offset[0]);
+		}
+		if (RIsActive) {
+		  active_stack()->push_derivative_dependence(right_index+j*right_offset[1], 
+			     left.const_data()+i*left_offset[0], n, 
+			     right_offset[0], left_offset[1]);
+		}
+		active_stack()->push_lhs(ans_index + i*ans.offset(0) + j*ans.offset(1));
 	      }
-	      active_stack()->push_lhs(ans_index + i*ans.offset(0) + j*ans.offset(1));
 	    }
 	  }
-
 	}
 	return ans;
       }
     }
 
+    // Record C=S*B where S is an n-by-n symmetric matrix whose lower
+    // triangle is described by "left" and B is n-by-m, either as a
+    // single node or as one statement per element of C that depends
+    // only on the stored elements of S
+    template <typename T>
+    inline
+    void
+    record_matmul_symmetric(Index n, Index m, const MatrixOperand<T>& left,
+			    const MatrixOperand<T>& right, uIndex ans_index,
+			    Index ans_offset0, Index ans_offset1) {
+      if (ADEPT_ACTIVE_STACK->are_matrix_nodes_enabled()) {
+	active_stack()->push_matrix_node(new SymmMatmulNode(n, m, left, right,
+				     ans_index, ans_offset0, ans_offset1));
+	return;
+      }
+      for (Index i = 0; i < n; ++i) {
+	for (Index k = 0; k < m; ++k) {
+	  // Element S(i,j) is stored at (i,j) for j<=i and at (j,i)
+	  // for j>i
+	  if (left.is_active) {
+	    active_stack()->push_derivative_dependence(left.gradient_index
+					+ i*left.offset[0],
+					right.data + k*right.offset[1],
+					i+1, left.offset[1], right.offset[0]);
+	    active_stack()->push_derivative_dependence(left.gradient_index
+					+ (i+1)*left.offset[0] + i*left.offset[1],
+					right.data + (i+1)*right.offset[0]
+					+ k*right.offset[1],
+					n-i-1, left.offset[0], right.offset[0]);
+	  }
+	  if (right.is_active) {
+	    active_stack()->push_derivative_dependence(right.gradient_index
+					+ k*right.offset[1],
+					left.data + i*left.offset[0],
+					i+1, right.offset[0], left.offset[1]);
+	    active_stack()->push_derivative_dependence(right.gradient_index
+					+ (i+1)*right.offset[0] + k*right.offset[1],
+					left.data + (i+1)*left.offset[0]
+					+ i*left.offset[1],
+					n-i-1, right.offset[0], left.offset[0]);
+	  }
+	  active_stack()->push_lhs(ans_index + i*ans_offset0 + k*ans_offset1);
+	}
+      }
+    }
+
+    // Record C=A*B where A is an n-by-n band matrix with kl
+    // sub-diagonals and ku super-diagonals described by "left" and B
+    // is n-by-m, either as a single node or as one statement per
+    // element of C that depends only on the elements of A within the
+    // band
+    template <typename T>
+    inline
+    void
+    record_matmul_band(Index n, Index m, Index kl, Index ku,
+		       const MatrixOperand<T>& left, const MatrixOperand<T>& right,
+		       uIndex ans_index, Index ans_offset0, Index ans_offset1) {
+      if (ADEPT_ACTIVE_STACK->are_matrix_nodes_enabled()) {
+	active_stack()->push_matrix_node(new BandMatmulNode(n, m, kl, ku,
+				     left, right, ans_index,
+				     ans_offset0, ans_offset1));
+	return;
+      }
+      for (Index i = 0; i < n; ++i) {
+	// Using info from BandEngine::get_row_range in
+	// SpecialMatrix.h
+	Index j_start = i<kl ? 0 : i-kl;
+	Index j_end_plus_1 = i+ku+1>n ? n : i+ku+1;
+	for (Index k = 0; k < m; ++k) {
+	  if (left.is_active) {
+	    active_stack()->push_derivative_dependence(left.gradient_index
+					+ i*left.offset[0] + j_start*left.offset[1],
+					right.data + j_start*right.offset[0]
+					+ k*right.offset[1],
+					j_end_plus_1-j_start,
+					left.offset[1], right.offset[0]);
+	  }
+	  if (right.is_active) {
+	    active_stack()->push_derivative_dependence(right.gradient_index
+					+ j_start*right.offset[0] + k*right.offset[1],
+					left.data + i*left.offset[0]
+					+ j_start*left.offset[1],
+					j_end_plus_1-j_start,
+					right.offset[0], left.offset[1]);
+	  }
+	  active_stack()->push_lhs(ans_index + i*ans_offset0 + k*ans_offset1);
+	}
+      }
+    }
+
+    // Describe the stored part of a symmetric matrix as the lower
+    // triangle of a matrix operand, transposing upper-triangle
+    // storage
+    template <typename T>
+    inline
+    MatrixOperand<T>
+    symmetric_operand(const T* ptr, SymmMatrixOrientation orient, Index offset,
+		      uIndex gradient_index, bool is_active) {
+      if (orient == ROW_LOWER_COL_UPPER) {
+	return MatrixOperand<T>(ptr, offset, 1, gradient_index, is_active);
+      }
+      else {
+	return MatrixOperand<T>(ptr, 1, offset, gradient_index, is_active);
+      }
+    }
+
     // Symmetric matrix-vector multiplication
     template <bool LIsActive, typename T, bool RIsActive>
     inline
@@ -221,9 +354,6 @@ namespace adept {
 
       check_inner_dimensions_sqr(left_dim, right);
 
-      if (LIsActive || RIsActive) {
-	throw(invalid_operation("Cannot yet do matmul(SymmMatrix,Vector) when either are active"));
-      }
       BLAS_UPLO uplo;
       if (left_orient == ROW_LOWER_COL_UPPER) {
 	uplo = BlasLower;
@@ -236,6 +366,18 @@ namespace adept {
 		   1.0, left_ptr, left_offset, 
 		   right.const_data(), right.offset(0), 
 		   0.0, ans.data(), ans.offset(0));
+      if ((LIsActive || RIsActive)
+#ifdef ADEPT_RECORDING_PAUSABLE
+	  && ADEPT_ACTIVE_STACK->is_recording()
+#endif
+	  ) {
+	record_matmul_symmetric(left_dim, 1,
+		symmetric_operand(left_ptr, left_orient, left_offset,
+				  left_gradient_index, LIsActive),
+		MatrixOperand<T>(right.const_data(), right.offset(0), 0,
+				 right.gradient_index(), RIsActive),
+		ans.gradient_index(), ans.offset(0), 0);
+      }
       return ans;
     }
 
@@ -249,9 +391,6 @@ namespace adept {
 
       check_inner_dimensions_sqr(left_dim, right);
 
-      if (LIsActive || RIsActive) {
-	throw(invalid_operation("Cannot yet do matmul(SymmMatrix,Matrix) when either are active"));
-      }
       if (!right.is_row_contiguous() && !right.is_column_contiguous()) {
 	Array<2,T,RIsActive> right_;
 	right_ = right;
@@ -283,6 +422,19 @@ namespace adept {
 		     1.0, left_ptr, left_offset, 
 		     right.const_data(), right_stride, 0.0,
 		     ans.data(), ans_stride);
+	if ((LIsActive || RIsActive)
+#ifdef ADEPT_RECORDING_PAUSABLE
+	    && ADEPT_ACTIVE_STACK->is_recording()
+#endif
+	    ) {
+	  record_matmul_symmetric(left_dim, right.dimension(1),
+		  symmetric_operand(left_ptr, left_orient, left_offset,
+				    left_gradient_index, LIsActive),
+		  MatrixOperand<T>(right.const_data(), right.offset(0),
+				   right.offset(1), right.gradient_index(),
+				   RIsActive),
+		  ans.gradient_index(), ans.offset(0), ans.offset(1));
+	}
 	return ans;
       }
     }
@@ -297,10 +449,6 @@ namespace adept {
 		uIndex left_gradient_index, const Array<1,T,RIsActive>& right) {
       check_inner_dimensions_sqr(left_dim, right);
 
-      if (LIsActive) {
-	throw(invalid_operation("Cannot yet do matmul(BandMatrix,Vector) for active BandMatrix"));
-      }
-
       BLAS_ORDER order;
       // BLAS declares the start pointer to be in the "missing data"
       // zone, so we need to subtract from the address of the top-left
@@ -308,51 +456,32 @@ namespace adept {
       const T* left_start;
       if (left_order == ROW_MAJOR) {
 	order = BlasRowMajor;
-	left_start = left_ptr-UDiags;
+	left_start = left_ptr-LDiags;
       }
       else {
 	order = BlasColMajor;
-	left_start = left_ptr-LDiags;
+	left_start = left_ptr-UDiags;
       }
       Array<1,T,(LIsActive||RIsActive)> ans(right.dimension(0));
       cppblas_gbmv(order, BlasNoTrans, left_dim, left_dim, LDiags, UDiags,
 		   1.0, left_start, left_offset+1,
 		   right.const_data(), right.offset(0), 
 		   0.0, ans.data(), ans.offset(0));
-      if (RIsActive) {
-	uIndex right_index = right.gradient_index();
-	uIndex ans_index = ans.gradient_index();
-
-	if (left_order == ROW_MAJOR) {
-	  for (Index i = 0; i < ans.dimension(0); ++i) {
-	    // Using info from BandEngine<ROW_MAJOR>::get_row_range in
-	    // SpecialMatrix.h
-	    Index j_start = i<LDiags ? 0 : i-LDiags;
-	    Index j_end_plus_1 = i+UDiags+1>left_dim ? left_dim : i+UDiags+1;
-	    Index n = j_end_plus_1 - j_start;
-	    Index index_start = i*left_offset + j_start;
-	    Index index_stride = 1;
-	    active_stack()->push_derivative_dependence(right_index + j_start, 
-						       left_ptr+index_start,
-						       n, right.offset(0), index_stride);
-	    active_stack()->push_lhs(ans_index + i*ans.offset(0));
-	  }
-	}
-	else {
-	  for (Index i = 0; i < ans.dimension(0); ++i) {
-	    // Using info from BandEngine<COL_MAJOR>::get_row_range in
-	    // SpecialMatrix.h
-	    Index j_start = i<LDiags ? 0 : i-LDiags;
-	    Index j_end_plus_1 = i+UDiags+1>left_dim ? left_dim : i+UDiags+1;
-	    Index n = j_end_plus_1 - j_start;
-	    Index index_start = i + j_start*left_offset;
-	    Index index_stride = left_offset;
-	    active_stack()->push_derivative_dependence(right_index + j_start, 
-						       left_ptr+index_start,
-						       n, right.offset(0), index_stride);
-	    active_stack()->push_lhs(ans_index + i*ans.offset(0));
-	  }
-	}
+      if ((LIsActive || RIsActive)
+#ifdef ADEPT_RECORDING_PAUSABLE
+	  && ADEPT_ACTIVE_STACK->is_recording()
+#endif
+	  ) {
+	// Element (i,j) of the band matrix is at i*left_offset+j if
+	// row-major and i+j*left_offset if column-major
+	record_matmul_band(left_dim, 1, LDiags, UDiags,
+		MatrixOperand<T>(left_ptr,
+				 left_order == ROW_MAJOR ? left_offset : 1,
+				 left_order == ROW_MAJOR ? 1 : left_offset,
+				 left_gradient_index, LIsActive),
+		MatrixOperand<T>(right.const_data(), right.offset(0), 0,
+				 right.gradient_index(), RIsActive),
+		ans.gradient_index(), ans.offset(0), 0);
       }
       return ans;
     }
@@ -367,9 +496,6 @@ namespace adept {
 		Index LDiags, Index UDiags, Index left_dim, Index left_offset,
 		uIndex left_gradient_index, const Array<2,T,RIsActive>& right) {
       check_inner_dimensions_sqr(left_dim, right);
-      if (LIsActive || RIsActive) {
-	throw(invalid_operation("Cannot yet do matmul(BandMatrix,Matrix) when either are active"));
-      }
       BLAS_ORDER order;
       // BLAS declares the start pointer to be in the "missing data"
       // zone, so we need to subtract from the address of the top-left
@@ -377,11 +503,11 @@ namespace adept {
       const T* left_start;
       if (left_order == ROW_MAJOR) {
 	order = BlasRowMajor;
-	left_start = left_ptr-UDiags;
+	left_start = left_ptr-LDiags;
       }
       else {
 	order = BlasColMajor;
-	left_start = left_ptr-LDiags;
+	left_start = left_ptr-UDiags;
       }
       Array<2,T,(LIsActive||RIsActive)> ans(right.dimension(0),right.dimension(1));
       for (Index i = 0; i < right.dimension(1); ++i) {
@@ -390,6 +516,21 @@ namespace adept {
 		     right.const_data()+i*right.offset(1), right.offset(0), 
 		     0.0, ans.data()+i*ans.offset(1), ans.offset(0));
       }
+      if ((LIsActive || RIsActive)
+#ifdef ADEPT_RECORDING_PAUSABLE
+	  && ADEPT_ACTIVE_STACK->is_recording()
+#endif
+	  ) {
+	record_matmul_band(left_dim, right.dimension(1), LDiags, UDiags,
+		MatrixOperand<T>(left_ptr,
+				 left_order == ROW_MAJOR ? left_offset : 1,
+				 left_order == ROW_MAJOR ? 1 : left_offset,
+				 left_gradient_index, LIsActive),
+		MatrixOperand<T>(right.const_data(), right.offset(0),
+				 right.offset(1), right.gradient_index(),
+				 RIsActive),
+		ans.gradient_index(), ans.offset(0), ans.offset(1));
+      }
       return ans;
     }
     
@@ -503,62 +644,38 @@ namespace adept {
       return Array<Rank,NewType,IsActive>(const_cast<Array<Rank,OldType,IsActive>&>(arg));
     }
 
-#ifdef ADEPT_ONLY_DIFFERENTIATE_DENSE_MATRIX_MULTIPLICATION
-    // If the argument is an active special matrix then it must be
-    // copied to a dense "Array" because differentiation of the
-    // various types of special matrix (symmetric, band, upper, lower
-    // etc) is not yet implemented.
-    template <typename NewType, typename OldType, class Engine>
+    // If the argument is a symmetric or band matrix then convert the
+    // element type; this will only involve a copy of the raw data if
+    // the type is changed, otherwise the new array will simply link
+    // to the old.  Multiplication by these matrices is differentiated
+    // using only their stored elements.
+    template <typename NewType, typename OldType, SymmMatrixOrientation Orient,
+	      bool IsActive>
     inline
-    Array<2,NewType,true>
-    promote_array(const SpecialMatrix<OldType,Engine,true>& arg) {
-      return Array<2,NewType,true>(
-	   const_cast<SpecialMatrix<OldType,Engine,true>&>(arg));
-    }
-
-    // If the argument is an inactive symmetric or band matrix then
-    // convert the element type; this will only involve a copy of the
-    // raw data if the type is changed, otherwise the new array will
-    // simply link to the old
-    template <typename NewType, typename OldType, SymmMatrixOrientation Orient>
-    inline
-    SpecialMatrix<NewType,internal::SymmEngine<Orient>,false>
-    promote_array(const SpecialMatrix<OldType,internal::SymmEngine<Orient>,false>& arg) {
-      return SpecialMatrix<NewType,internal::SymmEngine<Orient>,false>(
-	 const_cast<SpecialMatrix<OldType,internal::SymmEngine<Orient>,false>&>(arg));
+    SpecialMatrix<NewType,internal::SymmEngine<Orient>,IsActive>
+    promote_array(const SpecialMatrix<OldType,internal::SymmEngine<Orient>,IsActive>& arg) {
+      return SpecialMatrix<NewType,internal::SymmEngine<Orient>,IsActive>(
+	 const_cast<SpecialMatrix<OldType,internal::SymmEngine<Orient>,IsActive>&>(arg));
     }
     template <typename NewType, typename OldType, 
-      MatrixStorageOrder Order, Index LDiags, Index UDiags>
+      MatrixStorageOrder Order, Index LDiags, Index UDiags, bool IsActive>
     inline
-    SpecialMatrix<NewType,internal::BandEngine<Order,LDiags,UDiags>,false>
-    promote_array(const SpecialMatrix<OldType,internal::BandEngine<Order,LDiags,UDiags>,false>& arg) {
-      return SpecialMatrix<NewType,internal::BandEngine<Order,LDiags,UDiags>,false>(
-	 const_cast<SpecialMatrix<OldType,internal::BandEngine<Order,LDiags,UDiags>,false>&>(arg));
+    SpecialMatrix<NewType,internal::BandEngine<Order,LDiags,UDiags>,IsActive>
+    promote_array(const SpecialMatrix<OldType,internal::BandEngine<Order,LDiags,UDiags>,IsActive>& arg) {
+      return SpecialMatrix<NewType,internal::BandEngine<Order,LDiags,UDiags>,IsActive>(
+	 const_cast<SpecialMatrix<OldType,internal::BandEngine<Order,LDiags,UDiags>,IsActive>&>(arg));
     } 
 
     // For other special matrices (square and triangular), specific
     // matrix multiplication functions have not yet been added, so we
     // have to convert to a dense array first
-    template <typename NewType, typename OldType, class Engine>
-    inline
-    Array<2,NewType,false>
-    promote_array(const SpecialMatrix<OldType,Engine,false>& arg) {
-      return Array<2,NewType,false>(
-	 const_cast<SpecialMatrix<OldType,Engine,false>&>(arg));
-    } 
-
-#else
-    // The following assumes that the Adept library knows how to
-    // differentiate special matrices: currently it doesn't so this
-    // path is likely to throw a run-time exception.
     template <typename NewType, typename OldType, class Engine, bool IsActive>
     inline
-    SpecialMatrix<NewType,Engine,IsActive>
+    Array<2,NewType,IsActive>
     promote_array(const SpecialMatrix<OldType,Engine,IsActive>& arg) {
-      return SpecialMatrix<NewType,Engine,IsActive>(
-		     const_cast<SpecialMatrix<OldType,Engine,IsActive>&>(arg));
-    }
-#endif
+      return Array<2,NewType,IsActive>(
+	 const_cast<SpecialMatrix<OldType,Engine,IsActive>&>(arg));
+    } 
 
     // If the argument is a fixed array of a different type then copy it
     template <typename NewType, typename OldType, bool IsActive, Index J0,
@@ -611,8 +728,14 @@ namespace adept {
   // ---------------------------------------------------------------------
 
   // In order for A**B to lead to matrix multiplication, *B will
-  // return a MatmulRHS object, and A*[a MatmulRHS object] will send
-  // the two arguments to the matmul function
+  // return a MatmulRHS object, and A*[a MatmulRHS object] will
+  // return a MatmulChain object that records the factors of the
+  // product without multiplying them.  The product is only evaluated
+  // when it is assigned to an array, at which point the order of the
+  // multiplications is chosen to minimize the number of operations,
+  // and any scalar factor or added array is folded into the final
+  // call to BLAS.  If either argument is a symmetric or band matrix
+  // then the matmul function is called immediately instead.
 
   namespace internal {
 
@@ -638,7 +761,786 @@ namespace adept {
       MatmulRHS(const A& a) : array(a) { }
       const A& array;
     };
-  }
+
+    // Is E a special matrix?
+    template <class E>
+    struct is_special_matrix {
+      static const bool value = false;
+    };
+    template <typename T, class Engine, bool IsActive>
+    struct is_special_matrix<SpecialMatrix<T,Engine,IsActive> > {
+      static const bool value = true;
+    };
+
+    // Return an array with the specified dimensions and offsets that
+    // links to the data of array "a"
+    template <int NewRank, int Rank, typename T, bool IsActive>
+    inline
+    Array<NewRank,T,IsActive>
+    relink_array(const Array<Rank,T,IsActive>& a,
+		 const ExpressionSize<NewRank>& dims,
+		 const ExpressionSize<NewRank>& offset) {
+      Array<Rank,T,IsActive>& a_ = const_cast<Array<Rank,T,IsActive>&>(a);
+      if (a_.storage()) {
+	return Array<NewRank,T,IsActive>(a_.data(), a_.storage(), dims, offset);
+      }
+      else {
+	return Array<NewRank,T,IsActive>(a.const_data(), 0, dims, offset,
+					 a.gradient_index());
+      }
+    }
+
+    // Link to a vector as a matrix with one row (if is_row is true)
+    // or one column
+    template <typename T, bool IsActive>
+    inline
+    Array<2,T,IsActive>
+    vector_as_matrix(const Array<1,T,IsActive>& v, bool is_row) {
+      ExpressionSize<2> dims, offset;
+      if (is_row) {
+	dims[0]   = 1;
+	dims[1]   = v.dimension(0);
+	offset[0] = v.dimension(0)*v.offset(0);
+	offset[1] = v.offset(0);
+      }
+      else {
+	dims[0]   = v.dimension(0);
+	dims[1]   = 1;
+	offset[0] = v.offset(0);
+	offset[1] = 1;
+      }
+      return relink_array(v, dims, offset);
+    }
+
+    // Link to a matrix with one row or one column as a vector
+    template <typename T, bool IsActive>
+    inline
+    Array<1,T,IsActive>
+    matrix_as_vector(const Array<2,T,IsActive>& m) {
+      ExpressionSize<1> dims, offset;
+      if (m.dimension(1) == 1) {
+	dims[0]   = m.dimension(0);
+	offset[0] = m.offset(0);
+      }
+      else {
+	dims[0]   = m.dimension(1);
+	offset[0] = m.offset(1);
+      }
+      return relink_array(m, dims, offset);
+    }
+
+    // Passive matrix multiplication ans = alpha*left*right +
+    // beta*ans into an existing matrix, using matrix-vector
+    // multiplication if "left" has one row or "right" has one column
+    template <typename T>
+    inline
+    void
+    matmul_into(T alpha, const Array<2,T,false>& left,
+		const Array<2,T,false>& right, T beta, Array<2,T,false>& ans) {
+      if (!left.is_row_contiguous() && !left.is_column_contiguous()) {
+	Array<2,T,false> left_;
+	left_ = left;
+	matmul_into(alpha, left_, right, beta, ans);
+      }
+      else if (!right.is_row_contiguous() && !right.is_column_contiguous()) {
+	Array<2,T,false> right_;
+	right_ = right;
+	matmul_into(alpha, left, right_, beta, ans);
+      }
+      else if ((!ans.is_row_contiguous() && !ans.is_column_contiguous())
+	       || (left.dimension(0) == 1 && right.dimension(1) != 1
+		   && (left.offset(1) < 1 || ans.offset(1) < 1))) {
+	// Result is strided in both directions, or is a row vector
+	// with a stride that BLAS cannot use, so compute in a
+	// temporary
+	Array<2,T,false> ans_(ans.dimensions());
+	matmul_into(alpha, left, right, static_cast<T>(0.0), ans_);
+	if (beta == 0.0) {
+	  ans = ans_;
+	}
+	else {
+	  ans = beta*ans + ans_;
+	}
+      }
+      else if (right.dimension(1) == 1) {
+	// y = alpha*A*x + beta*y
+	BLAS_ORDER order;
+	Index stride;
+	if (left.is_row_contiguous()) {
+	  order = BlasRowMajor;
+	  stride = left.offset(0);
+	}
+	else {
+	  order = BlasColMajor;
+	  stride = left.offset(1);
+	}
+	cppblas_gemv(order, BlasNoTrans, left.dimension(0), left.dimension(1),
+		     alpha, left.const_data(), stride,
+		     right.const_data(), right.offset(0),
+		     beta, ans.data(), ans.offset(0));
+      }
+      else if (left.dimension(0) == 1) {
+	// y^T = alpha*x^T*B + beta*y^T, computed as y = alpha*B^T*x + beta*y
+	BLAS_ORDER order;
+	Index stride;
+	if (right.is_row_contiguous()) {
+	  order = BlasRowMajor;
+	  stride = right.offset(0);
+	}
+	else {
+	  order = BlasColMajor;
+	  stride = right.offset(1);
+	}
+	cppblas_gemv(order, BlasTrans, right.dimension(0), right.dimension(1),
+		     alpha, right.const_data(), stride,
+		     left.const_data(), left.offset(1),
+		     beta, ans.data(), ans.offset(1));
+      }
+      else {
+	Index left_stride, right_stride, ans_stride;
+	BLAS_TRANSPOSE left_trans, right_trans;
+	BLAS_ORDER order;
+	if (ans.is_row_contiguous()) {
+	  order = BlasRowMajor;
+	  ans_stride = ans.offset(0);
+	}
+	else {
+	  order = BlasColMajor;
+	  ans_stride = ans.offset(1);
+	}
+	if (left.is_row_contiguous()) {
+	  left_trans = order == BlasRowMajor ? BlasNoTrans : BlasTrans;
+	  left_stride = left.offset(0);
+	}
+	else {
+	  left_trans = order == BlasColMajor ? BlasNoTrans : BlasTrans;
+	  left_stride = left.offset(1);
+	}
+	if (right.is_row_contiguous()) {
+	  right_trans = order == BlasRowMajor ? BlasNoTrans : BlasTrans;
+	  right_stride = right.offset(0);
+	}
+	else {
+	  right_trans = order == BlasColMajor ? BlasNoTrans : BlasTrans;
+	  right_stride = right.offset(1);
+	}
+	cppblas_gemm(order, left_trans, right_trans,
+		     left.dimension(0), right.dimension(1), left.dimension(1),
+		     alpha, left.const_data(), left_stride,
+		     right.const_data(), right_stride,
+		     beta, ans.data(), ans_stride);
+      }
+    }
+
+    // Multiply two matrices, either of which may have one row or one
+    // column, in which case matrix-vector multiplication is used
+    template <typename T, bool LIsActive, bool RIsActive>
+    inline
+    Array<2,T,(LIsActive||RIsActive)>
+    matmul_matrices(const Array<2,T,LIsActive>& left,
+		    const Array<2,T,RIsActive>& right) {
+      if (right.dimension(1) == 1) {
+	return vector_as_matrix(matmul_(left, matrix_as_vector(right)), false);
+      }
+      else if (left.dimension(0) == 1) {
+	return vector_as_matrix(matmul_(right.T(), matrix_as_vector(left)), true);
+      }
+      else {
+	return matmul_(left, right);
+      }
+    }
+
+    // A factor in a chain of matrix multiplications: the values are
+    // held in a passive array that shares the storage of the original
+    // array, together with the gradient index if the factor is
+    // active; vectors are stored as matrices with one row or column
+    template <typename T, bool IsActive>
+    struct MatmulFactor {
+      MatmulFactor(const Array<2,T,false>& a)
+	: passive(a), gradient_index(0), is_active(false) { }
+      MatmulFactor(const Array<2,T,IsActive>& a, bool)
+	: passive(const_cast<T*>(a.const_data()),
+		  const_cast<Array<2,T,IsActive>&>(a).storage(),
+		  a.dimensions(), a.offset()),
+	  gradient_index(a.gradient_index()), is_active(true) { }
+
+      // Copy a factor of a passive chain into an active one
+      template <bool OtherIsActive>
+      MatmulFactor(const MatmulFactor<T,OtherIsActive>& rhs)
+	: passive(rhs.passive), gradient_index(rhs.gradient_index),
+	  is_active(rhs.is_active) { }
+
+      const ExpressionSize<2>& dimensions() const {
+	return passive.dimensions();
+      }
+      Index rows() const { return dimensions()[0]; }
+      Index cols() const { return dimensions()[1]; }
+
+      // Passive link to the values
+      const Array<2,T,false>& values() const { return passive; }
+
+      // Active link to the values, which may only be used if
+      // is_active is true
+      Array<2,T,IsActive> active() const {
+	return Array<2,T,IsActive>(passive.const_data(), 0,
+				   passive.dimensions(), passive.offset(),
+				   gradient_index);
+      }
+
+      MatrixOperand<T> operand() const {
+	return MatrixOperand<T>(passive.const_data(), passive.offset(0),
+				passive.offset(1), gradient_index, is_active);
+      }
+
+      bool is_aliased(const T* mem1, const T* mem2) const {
+	return passive.is_aliased_(mem1, mem2);
+      }
+
+      Array<2,T,false> passive;
+      Index gradient_index;
+      bool is_active;
+    };
+
+    // A product of matrices and vectors, optionally multiplied by a
+    // scalar and with an array added, whose evaluation is deferred
+    // until it is assigned to an array; if it is used in an
+    // expression then it is evaluated into a temporary array when
+    // the dimensions of the expression are first requested
+    template <typename Type, int Rank, bool IsActive>
+    class MatmulChain
+      : public Expression<Type, MatmulChain<Type,Rank,IsActive> > {
+
+      template <typename, int, bool> friend class MatmulChain;
+      typedef MatmulFactor<Type,IsActive> Factor;
+      typedef Array<2,Type,IsActive> ActiveMatrix;
+
+    public:
+      // Static definitions to enable the properties of this type of
+      // expression to be discerned at compile time
+      static const bool is_active  = IsActive;
+      static const bool is_lvalue  = false;
+      static const int  rank       = Rank;
+      static const int  n_active   = IsActive * (1 + is_complex<Type>::value);
+      static const int  n_scratch  = 0;
+      static const int  n_arrays   = 1;
+      static const bool is_vectorizable = false;
+
+      MatmulChain() : alpha_(1.0), addend_sign_(0), addend_is_active_(false),
+		      first_is_vector_(false), last_is_vector_(false) { }
+
+      // Convert a passive chain to an active one
+      template <bool OtherIsActive>
+      MatmulChain(const MatmulChain<Type,Rank,OtherIsActive>& rhs)
+	: alpha_(rhs.alpha_), addend_sign_(0), addend_is_active_(false),
+	  first_is_vector_(rhs.first_is_vector_),
+	  last_is_vector_(rhs.last_is_vector_) {
+	push_factors_(rhs);
+	if (rhs.addend_sign_ != 0) {
+	  if (rhs.addend_is_active_) {
+	    store_addend_(rhs.active_addend_);
+	  }
+	  else {
+	    store_addend_(rhs.passive_addend_);
+	  }
+	  addend_sign_ = rhs.addend_sign_;
+	}
+      }
+
+      // Functions used to build the chain
+
+      // Append a matrix or vector to the end of the product
+      template <typename EType, class E>
+      void append(const Expression<EType,E>& rhs) {
+	append_array_(Array<E::rank,Type,E::is_active>(promote_array<Type>(rhs.cast())));
+      }
+
+      // Scalar multiples of arrays are absorbed into the scalar
+      // factor
+      template <typename S, class E>
+      void append(const BinaryOpScalarLeft<Type,S,Multiply,E>& rhs) {
+	scale(rhs.left.value());
+	append(rhs.right);
+      }
+      template <class E, typename S>
+      void append(const BinaryOpScalarRight<Type,E,Multiply,S>& rhs) {
+	scale(rhs.right.value());
+	append(rhs.left);
+      }
+      template <class E, typename S>
+      void append(const BinaryOpScalarRight<Type,E,Divide,S>& rhs) {
+	scale(static_cast<Type>(1.0) / rhs.right.value());
+	append(rhs.left);
+      }
+
+      // Append the factors of another chain, which is evaluated first
+      // if it has an added array or if it starts with a vector that
+      // is not at the start of the new chain
+      template <int OtherRank, bool OtherIsActive>
+      void append(const MatmulChain<Type,OtherRank,OtherIsActive>& rhs) {
+	if (rhs.addend_sign_ != 0 || (!factors_.empty() && rhs.first_is_vector_)) {
+	  Array<OtherRank,Type,OtherIsActive> ans;
+	  ans = rhs;
+	  append_array_(ans);
+	}
+	else {
+	  if (factors_.empty()) {
+	    first_is_vector_ = rhs.first_is_vector_;
+	  }
+	  else {
+	    if (last_is_vector_) {
+	      collapse_to_row_();
+	    }
+	    check_inner_dimensions_(factors_.back(), rhs.factors_.front());
+	  }
+	  push_factors_(rhs);
+	  last_is_vector_ = rhs.last_is_vector_;
+	  alpha_ *= rhs.alpha_;
+	}
+      }
+
+      // Multiply the product by a scalar
+      void scale(Type alpha) { alpha_ *= alpha; }
+
+      // Add (sign=1) or subtract (sign=-1) an array from the product
+      template <typename EType, class E>
+      void add(const Expression<EType,E>& rhs, int sign) {
+	ExpressionSize<Rank> dims, rhs_dims;
+	get_dimensions_(dims);
+	if (!rhs.get_dimensions(rhs_dims) || !compatible(dims, rhs_dims)) {
+	  std::string str = "Expr";
+	  str += rhs_dims.str() + " object added to " + expression_string_();
+	  throw size_mismatch(str ADEPT_EXCEPTION_LOCATION);
+	}
+	if (addend_sign_ == 0) {
+	  store_addend_(Array<Rank,Type,E::is_active>(rhs.cast()));
+	  addend_sign_ = sign;
+	}
+	else {
+	  // Combine with the array that has already been added
+	  Array<Rank,Type,IsActive> sum;
+	  if (addend_is_active_) {
+	    sum = static_cast<Type>(addend_sign_)*active_addend_
+	      + static_cast<Type>(sign)*rhs.cast();
+	  }
+	  else {
+	    sum = static_cast<Type>(addend_sign_)*passive_addend_
+	      + static_cast<Type>(sign)*rhs.cast();
+	  }
+	  active_addend_.clear();
+	  passive_addend_.clear();
+	  store_addend_(sum);
+	  addend_sign_ = 1;
+	}
+      }
+
+      // Evaluate the chain, assigning (mode=0), adding (mode=1) or
+      // subtracting (mode=-1) the result to "dest"; this is called by
+      // the assignment operators of Array
+      template <bool DestIsActive>
+      void assign_to_(Array<Rank,Type,DestIsActive>& dest, int mode) const {
+	ExpressionSize<Rank> dims;
+	get_dimensions_(dims);
+	if (mode == 0 && dest.empty()) {
+	  dest.resize(dims);
+	}
+	else if (!compatible(dims, dest.dimensions())) {
+	  std::string str = "Expr";
+	  str += dims.str() + " object assigned to " + dest.expression_string();
+	  throw size_mismatch(str ADEPT_EXCEPTION_LOCATION);
+	}
+#ifndef ADEPT_NO_ALIAS_CHECKING
+	if (is_aliased_with_factors_(dest)) {
+	  Array<Rank,Type,IsActive> ans;
+	  assign_to_(ans, 0);
+	  if (mode == 0) {
+	    dest = ans;
+	  }
+	  else if (mode > 0) {
+	    dest += ans;
+	  }
+	  else {
+	    dest -= ans;
+	  }
+	  return;
+	}
+#endif
+	// Any added array is placed in the result first so that the
+	// product can then be accumulated into it
+	bool is_accumulated = (mode != 0);
+	if (addend_sign_ != 0) {
+	  int sign = mode < 0 ? -addend_sign_ : addend_sign_;
+	  if (addend_is_active_) {
+	    add_to_(dest, active_addend_, sign, is_accumulated);
+	  }
+	  else {
+	    add_to_(dest, passive_addend_, sign, is_accumulated);
+	  }
+	  is_accumulated = true;
+	}
+	// Perform all but the last multiplication in the optimal
+	// order, and the last directly into the result
+	std::vector<Index> split;
+	optimal_order_(split);
+	Index n = factors_.size();
+	Index isplit = split[n-1];
+	Array<2,Type,DestIsActive> ans = as_matrix_(dest);
+	multiply_into_(product_(split, 0, isplit), product_(split, isplit+1, n-1),
+		       mode < 0 ? -alpha_ : alpha_, is_accumulated, ans);
+      }
+
+      // Functions required by the Expression interface, which
+      // evaluate the chain into a temporary array if necessary
+
+      bool get_dimensions_(ExpressionSize<Rank>& dim) const {
+	if (Rank == 2) {
+	  dim[0] = factors_.front().rows();
+	  dim[Rank-1] = factors_.back().cols();
+	}
+	else if (last_is_vector_) {
+	  dim[0] = factors_.front().rows();
+	}
+	else {
+	  dim[0] = factors_.back().cols();
+	}
+	return true;
+      }
+
+      std::string expression_string_() const {
+	std::stringstream str;
+	if (alpha_ != 1.0) {
+	  str << alpha_ << "*";
+	}
+	str << "(";
+	for (std::size_t i = 0; i < factors_.size(); ++i) {
+	  if (i > 0) {
+	    str << " ** ";
+	  }
+	  str << "Matrix" << factors_[i].dimensions().str();
+	}
+	str << ")";
+	if (addend_sign_ != 0) {
+	  str << (addend_sign_ > 0 ? " + Array" : " - Array")
+	      << (addend_is_active_ ? active_addend_.dimensions().str()
+		                    : passive_addend_.dimensions().str());
+	}
+	return str.str();
+      }
+
+      bool is_aliased_(const Type* mem1, const Type* mem2) const {
+	return result().is_aliased_(mem1, mem2);
+      }
+      bool all_arrays_contiguous_() const {
+	return result().all_arrays_contiguous_();
+      }
+      bool is_aligned_() const {
+	return result().is_aligned_();
+      }
+      template <int n>
+      int alignment_offset_() const {
+	return result().template alignment_offset_<n>();
+      }
+      Type value_with_len_(const Index& j, const Index& len) const {
+	return result().value_with_len_(j,len);
+      }
+      template <int MyArrayNum, int NArrays>
+      void advance_location_(ExpressionSize<NArrays>& loc) const {
+	result_.template advance_location_<MyArrayNum>(loc);
+      }
+      template <int MyArrayNum, int NArrays>
+      Type value_at_location_(const ExpressionSize<NArrays>& loc) const {
+	return result_.template value_at_location_<MyArrayNum>(loc);
+      }
+      template <int MyArrayNum, int NArrays>
+      Packet<Type> packet_at_location_(const ExpressionSize<NArrays>& loc) const {
+	return result_.template packet_at_location_<MyArrayNum>(loc);
+      }
+      template <int MyArrayNum, int MyScratchNum, int NArrays, int NScratch>
+      Type value_at_location_store_(const ExpressionSize<NArrays>& loc,
+				    ScratchVector<NScratch>& scratch) const {
+	return result_.template value_at_location_store_<MyArrayNum,MyScratchNum>(loc, scratch);
+      }
+      template <int MyArrayNum, int MyScratchNum, int NArrays, int NScratch>
+      Type value_stored_(const ExpressionSize<NArrays>& loc,
+			 const ScratchVector<NScratch>& scratch) const {
+	return result_.template value_stored_<MyArrayNum,MyScratchNum>(loc, scratch);
+      }
+      template <int MyArrayNum, int NArrays>
+      void set_location_(const ExpressionSize<Rank>& i, 
+			 ExpressionSize<NArrays>& index) const {
+	result().template set_location_<MyArrayNum>(i, index);
+      }
+      template <int MyArrayNum, int MyScratchNum, int NArrays, int NScratch>
+      void calc_gradient_(Stack& stack, const ExpressionSize<NArrays>& loc,
+			  const ScratchVector<NScratch>& scratch) const {
+	result_.template calc_gradient_<MyArrayNum,MyScratchNum>(stack, loc, scratch);
+      }
+      template <int MyArrayNum, int MyScratchNum, int NArrays, int NScratch, typename MyType>
+      void calc_gradient_(Stack& stack, const ExpressionSize<NArrays>& loc,
+			  const ScratchVector<NScratch>& scratch,
+			  MyType multiplier) const {
+	result_.template calc_gradient_<MyArrayNum,MyScratchNum>(stack, loc, scratch, multiplier);
+      }
+
+    protected:
+
+      // Return the result, evaluating it if this has not already
+      // been done
+      const Array<Rank,Type,IsActive>& result() const {
+	if (result_.empty()) {
+	  assign_to_(result_, 0);
+	}
+	return result_;
+      }
+
+      void append_array_(const Array<2,Type,false>& rhs) {
+	append_factor_(Factor(rhs));
+      }
+      void append_array_(const Array<2,Type,true>& rhs) {
+	append_factor_(Factor(ActiveMatrix(rhs), true));
+      }
+      void append_factor_(const Factor& rhs) {
+	if (factors_.empty()) {
+	  if (rhs.rows() == 0 || rhs.cols() == 0) {
+	    throw empty_array("Attempt to perform matrix multiplication with empty array(s)"
+			      ADEPT_EXCEPTION_LOCATION);
+	  }
+	}
+	else {
+	  if (last_is_vector_) {
+	    collapse_to_row_();
+	  }
+	  check_inner_dimensions_(factors_.back(), rhs);
+	}
+	factors_.push_back(rhs);
+      }
+
+      // A vector is treated as a matrix with one row if it is at the
+      // start of the chain and one column otherwise
+      template <bool VIsActive>
+      void append_array_(const Array<1,Type,VIsActive>& rhs) {
+	if (!rhs.empty() && rhs.offset(0) < 1) {
+	  // BLAS cannot use reversed vectors so make a copy
+	  Array<1,Type,VIsActive> rhs_;
+	  rhs_ = rhs;
+	  append_array_(rhs_);
+	}
+	else if (factors_.empty()) {
+	  append_array_(vector_as_matrix(rhs, true));
+	  first_is_vector_ = true;
+	}
+	else {
+	  append_array_(vector_as_matrix(rhs, false));
+	  last_is_vector_ = true;
+	}
+      }
+
+      void check_inner_dimensions_(const Factor& left, const Factor& right) const {
+	if (right.rows() == 0 || right.cols() == 0) {
+	  throw empty_array("Attempt to perform matrix multiplication with empty array(s)"
+			    ADEPT_EXCEPTION_LOCATION);
+	}
+	if (left.cols() != right.rows()) {
+	  throw inner_dimension_mismatch("Inner dimension mismatch in array multiplication"
+					 ADEPT_EXCEPTION_LOCATION);
+	}
+      }
+
+      // Copy links to the factors of another chain
+      template <int OtherRank, bool OtherIsActive>
+      void push_factors_(const MatmulChain<Type,OtherRank,OtherIsActive>& rhs) {
+	for (std::size_t i = 0; i < rhs.factors_.size(); ++i) {
+	  factors_.push_back(Factor(rhs.factors_[i]));
+	}
+      }
+
+      void store_addend_(const Array<Rank,Type,false>& rhs) {
+	passive_addend_.link(const_cast<Array<Rank,Type,false>&>(rhs));
+	addend_is_active_ = false;
+      }
+      void store_addend_(const Array<Rank,Type,true>& rhs) {
+	active_addend_.link(const_cast<Array<Rank,Type,true>&>(rhs));
+	addend_is_active_ = true;
+      }
+
+      // Replace the product so far, which ends in a vector, by a
+      // single factor containing the result as a row vector, so that
+      // it can be multiplied by a matrix on the right
+      void collapse_to_row_() {
+	std::vector<Index> split;
+	optimal_order_(split);
+	Factor ans = product_(split, 0, factors_.size()-1);
+	ans.passive.in_place_transpose();
+	factors_.clear();
+	factors_.push_back(ans);
+	first_is_vector_ = true;
+	last_is_vector_ = false;
+      }
+
+      // Find the order of multiplication that minimizes the number of
+      // operations, using the standard dynamic-programming solution
+      // to the matrix-chain problem: on exit, split[i*n+j] is the
+      // index of the last factor on the left of the final
+      // multiplication in the product of factors i to j, where n is
+      // the number of factors.  Ties are resolved in favour of
+      // left-to-right evaluation.
+      void optimal_order_(std::vector<Index>& split) const {
+	Index n = factors_.size();
+	std::vector<double> dims(n+1);
+	for (Index i = 0; i < n; ++i) {
+	  dims[i] = factors_[i].rows();
+	}
+	dims[n] = factors_[n-1].cols();
+	std::vector<double> cost(n*n, 0.0);
+	split.assign(n*n, 0);
+	for (Index len = 1; len < n; ++len) {
+	  for (Index i = 0; i+len < n; ++i) {
+	    Index j = i+len;
+	    cost[i*n+j] = -1.0;
+	    for (Index s = j-1; s >= i; --s) {
+	      double c = cost[i*n+s] + cost[(s+1)*n+j]
+		+ dims[i]*dims[s+1]*dims[j+1];
+	      if (cost[i*n+j] < 0.0 || c < cost[i*n+j]) {
+		cost[i*n+j] = c;
+		split[i*n+j] = s;
+	      }
+	    }
+	  }
+	}
+      }
+
+      // Return the product of factors i to j
+      Factor product_(const std::vector<Index>& split, Index i, Index j) const {
+	if (i == j) {
+	  return factors_[i];
+	}
+	Index isplit = split[i*factors_.size()+j];
+	return multiply_(product_(split, i, isplit),
+			 product_(split, isplit+1, j));
+      }
+
+      static Factor multiply_(const Factor& left, const Factor& right) {
+	if (left.is_active) {
+	  if (right.is_active) {
+	    return Factor(matmul_matrices(left.active(), right.active()), true);
+	  }
+	  else {
+	    return Factor(matmul_matrices(left.active(), right.passive), true);
+	  }
+	}
+	else if (right.is_active) {
+	  return Factor(matmul_matrices(left.passive, right.active()), true);
+	}
+	else {
+	  return Factor(matmul_matrices(left.passive, right.passive));
+	}
+      }
+
+      // ans = alpha*left*right, or ans += alpha*left*right if
+      // is_accumulated is true
+      template <bool DestIsActive>
+      static void multiply_into_(const Factor& left, const Factor& right,
+				 Type alpha, bool is_accumulated,
+				 Array<2,Type,DestIsActive>& ans) {
+	bool is_recorded = DestIsActive
+#ifdef ADEPT_RECORDING_PAUSABLE
+	  && ADEPT_ACTIVE_STACK->is_recording()
+#endif
+	  ;
+	if (is_recorded && (left.is_active || right.is_active)
+	    && !ADEPT_ACTIVE_STACK->are_matrix_nodes_enabled()) {
+	  // Record the multiplication one element at a time
+	  Factor product = multiply_(left, right);
+	  if (is_accumulated) {
+	    ans += alpha*product.active();
+	  }
+	  else {
+	    ans = alpha*product.active();
+	  }
+	}
+	else if (DestIsActive && !is_accumulated
+		 && !left.is_active && !right.is_active) {
+	  // Assignment of passive values to an active array, which
+	  // must be recorded in order that its gradients are zeroed
+	  Array<2,Type,false> product(ans.dimensions());
+	  matmul_into(alpha, left.values(), right.values(),
+		      static_cast<Type>(0.0), product);
+	  ans = product;
+	}
+	else {
+	  Array<2,Type,false> ans_values(ans.const_data(), 0, ans.dimensions(),
+					 ans.offset(), 0);
+	  matmul_into(alpha, left.values(), right.values(),
+		      static_cast<Type>(is_accumulated ? 1.0 : 0.0), ans_values);
+	  if (is_recorded && (left.is_active || right.is_active)) {
+	    active_stack()->push_matrix_node(new MatmulNode(left.rows(),
+				    right.cols(), left.cols(),
+				    left.operand(), right.operand(),
+				    ans.gradient_index(), ans.offset(0),
+				    ans.offset(1), alpha, is_accumulated));
+	  }
+	}
+      }
+
+      // Add (sign=1) or subtract (sign=-1) an array to the result, or
+      // assign it if is_accumulated is false
+      template <bool DestIsActive, bool AIsActive>
+      static void add_to_(Array<Rank,Type,DestIsActive>& dest,
+			  const Array<Rank,Type,AIsActive>& rhs,
+			  int sign, bool is_accumulated) {
+	if (is_accumulated) {
+	  if (sign > 0) {
+	    dest += rhs;
+	  }
+	  else {
+	    dest -= rhs;
+	  }
+	}
+	else if (sign < 0) {
+	  dest = -rhs;
+	}
+	else if (DestIsActive != AIsActive || dest.const_data() != rhs.const_data()
+		 || !(dest.offset() == rhs.offset())) {
+	  // Skip assignment of an array to itself, as in A = B**C + A
+	  dest = rhs;
+	}
+      }
+
+      template <bool DestIsActive>
+      bool is_aliased_with_factors_(const Array<Rank,Type,DestIsActive>& dest) const {
+	Type const * ptr_begin;
+	Type const * ptr_end;
+	dest.data_range(ptr_begin, ptr_end);
+	for (std::size_t i = 0; i < factors_.size(); ++i) {
+	  if (factors_[i].is_aliased(ptr_begin, ptr_end)) {
+	    return true;
+	  }
+	}
+	return false;
+      }
+
+      // Link to the result as a matrix
+      template <bool DestIsActive>
+      Array<2,Type,DestIsActive> as_matrix_(const Array<2,Type,DestIsActive>& dest) const {
+	return dest;
+      }
+      template <bool DestIsActive>
+      Array<2,Type,DestIsActive> as_matrix_(const Array<1,Type,DestIsActive>& dest) const {
+	return vector_as_matrix(dest, first_is_vector_);
+      }
+
+    protected:
+      // Data
+      std::vector<Factor> factors_;
+      Type alpha_;
+      Array<Rank,Type,false> passive_addend_;
+      Array<Rank,Type,IsActive> active_addend_;
+      int addend_sign_;
+      bool addend_is_active_;
+      bool first_is_vector_, last_is_vector_;
+      mutable Array<Rank,Type,IsActive> result_;
+    };
+
+  } // End namespace internal
 
   // Dereference operator returns a MatmulRHS object
   template <typename Type, class A>
@@ -650,15 +1552,147 @@ namespace adept {
   }
 
   // Multiply operator with a MatmulRHS object on the right-hand-side
-  // will call the matmul function
+  // will call the matmul function immediately if either argument is
+  // a special matrix...
   template <typename LType, class L, class R>
   inline
-  Array<L::rank+R::rank-2,typename promote<LType,typename R::type>::type,
-	(L::is_active||R::is_active)>
+  typename internal::enable_if<internal::is_special_matrix<L>::value
+			       || internal::is_special_matrix<R>::value,
+    Array<L::rank+R::rank-2,typename promote<LType,typename R::type>::type,
+	  (L::is_active||R::is_active)> >::type
   operator*(const Expression<LType,L>& left, const internal::MatmulRHS<R>& right) {
     return matmul(left.cast(),right.array.cast());
   }
 
+  // ...otherwise it returns a MatmulChain object
+  template <typename LType, class L, class R>
+  inline
+  typename internal::enable_if<!internal::is_special_matrix<L>::value
+			       && !internal::is_special_matrix<R>::value
+			       && (L::rank == 1 || L::rank == 2)
+			       && (L::rank+R::rank > 2),
+    internal::MatmulChain<typename promote<LType,typename R::type>::type,
+			  L::rank+R::rank-2, (L::is_active||R::is_active)> >::type
+  operator*(const Expression<LType,L>& left, const internal::MatmulRHS<R>& right) {
+    internal::MatmulChain<typename promote<LType,typename R::type>::type,
+			  L::rank+R::rank-2, (L::is_active||R::is_active)> ans;
+    ans.append(left.cast());
+    ans.append(right.array.cast());
+    return ans;
+  }
+
+  // Multiplication and division of a MatmulChain by a passive scalar
+  // and negation are absorbed into its scalar factor
+  template <typename S, typename T, int Rank, bool IsActive>
+  inline
+  typename internal::enable_if<internal::is_not_expression<S>::value
+			       && internal::is_same<typename promote<S,T>::type,T>::value,
+			       internal::MatmulChain<T,Rank,IsActive> >::type
+  operator*(const S& left, const internal::MatmulChain<T,Rank,IsActive>& right) {
+    internal::MatmulChain<T,Rank,IsActive> ans(right);
+    ans.scale(left);
+    return ans;
+  }
+
+  template <typename S, typename T, int Rank, bool IsActive>
+  inline
+  typename internal::enable_if<internal::is_not_expression<S>::value
+			       && internal::is_same<typename promote<S,T>::type,T>::value,
+			       internal::MatmulChain<T,Rank,IsActive> >::type
+  operator*(const internal::MatmulChain<T,Rank,IsActive>& left, const S& right) {
+    internal::MatmulChain<T,Rank,IsActive> ans(left);
+    ans.scale(right);
+    return ans;
+  }
+
+  template <typename S, typename T, int Rank, bool IsActive>
+  inline
+  typename internal::enable_if<internal::is_not_expression<S>::value
+			       && internal::is_same<typename promote<S,T>::type,T>::value,
+			       internal::MatmulChain<T,Rank,IsActive> >::type
+  operator/(const internal::MatmulChain<T,Rank,IsActive>& left, const S& right) {
+    internal::MatmulChain<T,Rank,IsActive> ans(left);
+    ans.scale(static_cast<T>(1.0) / right);
+    return ans;
+  }
+
+  template <typename T, int Rank, bool IsActive>
+  inline
+  internal::MatmulChain<T,Rank,IsActive>
+  operator-(const internal::MatmulChain<T,Rank,IsActive>& rhs) {
+    internal::MatmulChain<T,Rank,IsActive> ans(rhs);
+    ans.scale(-1.0);
+    return ans;
+  }
+
+  // Adding an array to or subtracting it from a MatmulChain stores a
+  // link to it, so that it can be placed in the result before the
+  // product is accumulated into it
+  template <typename T, int Rank, bool IsActive, class E>
+  inline
+  typename internal::enable_if<E::rank == Rank,
+			       internal::MatmulChain<T,Rank,(IsActive||E::is_active)> >::type
+  operator+(const internal::MatmulChain<T,Rank,IsActive>& left,
+	    const Expression<T,E>& right) {
+    internal::MatmulChain<T,Rank,(IsActive||E::is_active)> ans(left);
+    ans.add(right, 1);
+    return ans;
+  }
+
+  template <typename T, int Rank, bool IsActive, class E>
+  inline
+  typename internal::enable_if<E::rank == Rank,
+			       internal::MatmulChain<T,Rank,(IsActive||E::is_active)> >::type
+  operator-(const internal::MatmulChain<T,Rank,IsActive>& left,
+	    const Expression<T,E>& right) {
+    internal::MatmulChain<T,Rank,(IsActive||E::is_active)> ans(left);
+    ans.add(right, -1);
+    return ans;
+  }
+
+  template <typename T, int Rank, bool IsActive, class E>
+  inline
+  typename internal::enable_if<E::rank == Rank,
+			       internal::MatmulChain<T,Rank,(IsActive||E::is_active)> >::type
+  operator+(const Expression<T,E>& left,
+	    const internal::MatmulChain<T,Rank,IsActive>& right) {
+    internal::MatmulChain<T,Rank,(IsActive||E::is_active)> ans(right);
+    ans.add(left, 1);
+    return ans;
+  }
+
+  template <typename T, int Rank, bool IsActive, class E>
+  inline
+  typename internal::enable_if<E::rank == Rank,
+			       internal::MatmulChain<T,Rank,(IsActive||E::is_active)> >::type
+  operator-(const Expression<T,E>& left,
+	    const internal::MatmulChain<T,Rank,IsActive>& right) {
+    internal::MatmulChain<T,Rank,(IsActive||E::is_active)> ans(right);
+    ans.scale(-1.0);
+    ans.add(left, 1);
+    return ans;
+  }
+
+  // The sum of two chains evaluates the one on the right
+  template <typename T, int Rank, bool LIsActive, bool RIsActive>
+  inline
+  internal::MatmulChain<T,Rank,(LIsActive||RIsActive)>
+  operator+(const internal::MatmulChain<T,Rank,LIsActive>& left,
+	    const internal::MatmulChain<T,Rank,RIsActive>& right) {
+    internal::MatmulChain<T,Rank,(LIsActive||RIsActive)> ans(left);
+    ans.add(right, 1);
+    return ans;
+  }
+
+  template <typename T, int Rank, bool LIsActive, bool RIsActive>
+  inline
+  internal::MatmulChain<T,Rank,(LIsActive||RIsActive)>
+  operator-(const internal::MatmulChain<T,Rank,LIsActive>& left,
+	    const internal::MatmulChain<T,Rank,RIsActive>& right) {
+    internal::MatmulChain<T,Rank,(LIsActive||RIsActive)> ans(left);
+    ans.add(right, -1);
+    return ans;
+  }
 
 } // End namespace adept
 
@@ -33,8 +33,9 @@ namespace adept {
   // Adept has been configured.
   std::string configuration();
 
-  // Was the library compiled with matrix multiplication support (from
-  // BLAS)?
+  // Is matrix multiplication available?  This is always true since
+  // Adept provides built-in replacements for the BLAS functions it
+  // uses if compiled without BLAS
   bool have_matrix_multiplication();
 
   // Was the library compiled with linear algebra support (e.g. inv
@@ -57,6 +58,22 @@ namespace adept {
   // array threads to one.
   int set_max_blas_threads(int n);
 
+  // -------------------------------------------------------------------
+  // Choose between an external BLAS library and built-in functions
+  // -------------------------------------------------------------------
+
+  // Are matrix operations performed by Adept's built-in replacements
+  // for the BLAS functions rather than by an external BLAS library?
+  bool is_using_builtin_blas();
+
+  // Choose whether to use Adept's built-in replacements for the BLAS
+  // functions rather than an external BLAS library, e.g. to compare
+  // their speed, and return whether they are now used; if Adept was
+  // compiled without BLAS then the built-in functions are always
+  // used.  The built-in matrix-matrix multiplication uses OpenMP
+  // threads for large matrices if Adept was compiled with OpenMP.
+  bool set_use_builtin_blas(bool use_builtin);
+
 } // End namespace adept
 
 #endif
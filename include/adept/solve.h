@@ -47,6 +47,23 @@ namespace adept {
   solve(const SpecialMatrix<T,SymmEngine<Orient>,false>& A,
 	const Array<2,T,false>& B);
 
+  // -------------------------------------------------------------------
+  // Solve Ax = b for general square matrix A where A and/or b are
+  // active; the solution is recorded as a single node whose
+  // tangent-linear and adjoint reuse the LU factorization of A
+  // -------------------------------------------------------------------
+  template <typename T, bool AIsActive, bool BIsActive>
+  typename internal::enable_if<AIsActive || BIsActive, Array<1,T,true> >::type
+  solve(const Array<2,T,AIsActive>& A, const Array<1,T,BIsActive>& b);
+
+  // -------------------------------------------------------------------
+  // Solve AX = B for general square matrix A where A and/or B are
+  // active
+  // -------------------------------------------------------------------
+  template <typename T, bool AIsActive, bool BIsActive>
+  typename internal::enable_if<AIsActive || BIsActive, Array<2,T,true> >::type
+  solve(const Array<2,T,AIsActive>& A, const Array<2,T,BIsActive>& B);
+
   // -------------------------------------------------------------------
   // Solve AX = B for symmetric square matrices A and B
   // -------------------------------------------------------------------
@@ -92,6 +109,39 @@ namespace adept {
     Array<2,PType,false> right = r.cast();
     return solve(left,right);
   } 
+
+  // -------------------------------------------------------------------
+  // Solve Ax = b for general expressions, either of which is active;
+  // active symmetric matrices are treated as general matrices
+  // -------------------------------------------------------------------
+  template <typename LType, class L, typename RType, class R>
+  typename internal::enable_if<L::rank==2 && R::rank==1
+			       && (L::is_active || R::is_active)
+			       && internal::matrix_op_defined<LType>::value
+			       && internal::matrix_op_defined<RType>::value,
+			       Array<1,typename internal::promote<LType,RType>::type,true> >::type
+  solve(const Expression<LType,L>& l, const Expression<RType,R>& r) {
+    typedef typename internal::promote<LType,RType>::type PType;
+    Array<2,PType,L::is_active> left = l.cast();
+    Array<1,PType,R::is_active> right = r.cast();
+    return solve(left,right);
+  }
+
+  // -------------------------------------------------------------------
+  // Solve AX = B for general expressions, either of which is active
+  // -------------------------------------------------------------------
+  template <typename LType, class L, typename RType, class R>
+  typename internal::enable_if<L::rank==2 && R::rank==2
+			       && (L::is_active || R::is_active)
+			       && internal::matrix_op_defined<LType>::value
+			       && internal::matrix_op_defined<RType>::value,
+			       Array<2,typename internal::promote<LType,RType>::type,true> >::type
+  solve(const Expression<LType,L>& l, const Expression<RType,R>& r) {
+    typedef typename internal::promote<LType,RType>::type PType;
+    Array<2,PType,L::is_active> left = l.cast();
+    Array<2,PType,R::is_active> right = r.cast();
+    return solve(left,right);
+  }
 }
 
 #endif
@@ -0,0 +1,221 @@
+/* test_active_solve.cpp - Test differentiation of solve and inv
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// An algorithm that solves linear systems with active matrices and
+// right-hand sides, and inverts an active matrix, is recorded twice:
+// once with each solve stored as a single node holding the LU
+// factorization, and once with Stack::disable_matrix_nodes() so that
+// one statement is stored per element of the solution. The adjoint,
+// tangent linear and Jacobian matrix should agree to within rounding
+// error, and the adjoint should agree with a finite-difference
+// estimate.
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "adept_arrays.h"
+
+using namespace adept;
+
+#define N 5
+#define NRHS 3
+#define NX (N*N + N + N*NRHS)
+
+// Cost function involving x = A\b, X = A\B, inv(A) and a solve with
+// a passive matrix
+template <bool IsActive>
+static
+typename internal::active_scalar<Real,IsActive>::type
+algorithm(const Array<2,Real,IsActive>& A, const Array<1,Real,IsActive>& b,
+	  const Array<2,Real,IsActive>& B) {
+  Matrix P(N,N);
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < N; j++) {
+      P(i,j) = (i == j) ? 2.0 : 0.1*(i-j);
+    }
+  }
+  Array<1,Real,IsActive> x = solve(A, b);
+  Array<2,Real,IsActive> X = solve(A, B);
+  Array<2,Real,IsActive> Ainv = inv(A);
+  Array<1,Real,IsActive> z = solve(P, sin(x));
+  return sum(x*x) + sum(X*X*0.5) + sum(Ainv(0,__)) + sum(z*b);
+}
+
+static
+void
+set_inputs(Matrix& A, Vector& b, Matrix& B) {
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < N; j++) {
+      A(i,j) = (i == j) ? 3.0 + 0.2*i : 0.1*(i+2*j) - 0.3;
+    }
+    b(i) = 0.5 + 0.1*i;
+    for (int j = 0; j < NRHS; j++) {
+      B(i,j) = 0.2*j - 0.1*i + 0.4;
+    }
+  }
+}
+
+// Results of a recording
+struct Results {
+  uIndex n_operations;
+  std::vector<Real> x_ad, y_tl, jac_forward, jac_reverse;
+};
+
+static
+void
+record(Stack& stack, bool use_nodes, Results& r) {
+  Matrix A_(N,N), B_(N,NRHS);
+  Vector b_(N);
+  set_inputs(A_, b_, B_);
+  aMatrix A = A_, B = B_;
+  aVector b = b_;
+  if (use_nodes) {
+    stack.enable_matrix_nodes();
+  }
+  else {
+    stack.disable_matrix_nodes();
+  }
+
+  stack.new_recording();
+  aReal cost = algorithm<true>(A, b, B);
+  r.n_operations = stack.n_operations();
+  std::cout << "   " << stack.n_statements()-1 << " statements, "
+	    << stack.n_operations() << " operations and "
+	    << stack.n_matrix_nodes() << " matrix nodes\n";
+
+  // Adjoint
+  cost.set_gradient(1.0);
+  stack.reverse();
+  r.x_ad.clear();
+  Matrix A_ad = A.get_gradient(), B_ad = B.get_gradient();
+  Vector b_ad = b.get_gradient();
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < N; j++) {
+      r.x_ad.push_back(A_ad(i,j));
+    }
+  }
+  for (int i = 0; i < N; i++) {
+    r.x_ad.push_back(b_ad(i));
+  }
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < NRHS; j++) {
+      r.x_ad.push_back(B_ad(i,j));
+    }
+  }
+
+  // Tangent linear
+  stack.clear_gradients();
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < N; j++) {
+      A(i,j).set_gradient(0.1*(i-j));
+    }
+    b(i).set_gradient(1.0 - 0.2*i);
+  }
+  stack.forward();
+  r.y_tl.assign(1, cost.get_gradient());
+
+  // Jacobian of the cost with respect to all inputs by forward and
+  // reverse passes
+  stack.independent(A);
+  stack.independent(b);
+  stack.independent(B);
+  stack.dependent(cost);
+  r.jac_forward.resize(NX);
+  r.jac_reverse.resize(NX);
+  stack.jacobian_forward(&r.jac_forward[0]);
+  stack.jacobian_reverse(&r.jac_reverse[0]);
+}
+
+// Return true if a and b differ by more than "tol" relative to the
+// largest element of a
+static
+bool
+differs(const std::vector<Real>& a, const std::vector<Real>& b,
+	Real tol = 1.0e-10) {
+  Real max_a = 0.0, max_diff = 0.0;
+  for (std::size_t i = 0; i < a.size(); i++) {
+    max_a = std::max(max_a, std::fabs(a[i]));
+    max_diff = std::max(max_diff, std::fabs(a[i]-b[i]));
+  }
+  return a.size() != b.size() || max_diff > tol*max_a;
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+  Stack stack;
+  Results nodes, elements;
+
+  std::cout << "Recording with matrix nodes:\n";
+  record(stack, true, nodes);
+  std::cout << "Recording with one statement per element:\n";
+  record(stack, false, elements);
+
+  if (nodes.n_operations >= elements.n_operations) {
+    std::cout << "*** Matrix nodes did not reduce the number of operations\n";
+    error = true;
+  }
+  if (differs(nodes.x_ad, elements.x_ad)) {
+    std::cout << "*** Adjoint with matrix nodes differs\n";
+    error = true;
+  }
+  if (differs(nodes.y_tl, elements.y_tl)) {
+    std::cout << "*** Tangent linear with matrix nodes differs\n";
+    error = true;
+  }
+  if (differs(nodes.jac_forward, nodes.x_ad)
+      || differs(nodes.jac_reverse, nodes.x_ad)
+      || differs(elements.jac_forward, nodes.x_ad)) {
+    std::cout << "*** Jacobian with matrix nodes differs from adjoint\n";
+    error = true;
+  }
+
+  // Finite-difference estimate of the adjoint
+  Matrix A(N,N), B(N,NRHS);
+  Vector b(N);
+  set_inputs(A, b, B);
+  const Real cost = algorithm<false>(A, b, B);
+  const Real dx = 1.0e-6;
+  std::vector<Real> x_ad_fd;
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < N; j++) {
+      A(i,j) += dx;
+      x_ad_fd.push_back((algorithm<false>(A, b, B) - cost) / dx);
+      A(i,j) -= dx;
+    }
+  }
+  for (int i = 0; i < N; i++) {
+    b(i) += dx;
+    x_ad_fd.push_back((algorithm<false>(A, b, B) - cost) / dx);
+    b(i) -= dx;
+  }
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < NRHS; j++) {
+      B(i,j) += dx;
+      x_ad_fd.push_back((algorithm<false>(A, b, B) - cost) / dx);
+      B(i,j) -= dx;
+    }
+  }
+  if (differs(nodes.x_ad, x_ad_fd, 1.0e-4)) {
+    std::cout << "*** Adjoint differs from finite-difference estimate\n";
+    error = true;
+  }
+
+  if (error) {
+    std::cerr << "*** Error: solve and inv differentiated incorrectly\n";
+    return 1;
+  }
+  else {
+    std::cout << "Solve and inv differentiated correctly\n";
+    return 0;
+  }
+}
@@ -0,0 +1,123 @@
+/* test_allocation_policy.cpp - Test allocation policies for the recording
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// An algorithm that grows the recording and the gradient list beyond
+// the size to which the allocation policy applies is recorded with
+// each allocation policy in turn, and its adjoint should be identical
+// to that obtained with the default policy. The policy is also
+// changed half way through a recording, which copies the recording
+// into newly allocated memory. An unknown flag should be rejected.
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "adept.h"
+
+using adept::adouble;
+using adept::Real;
+
+#define N 100000
+
+static
+void
+algorithm(const adouble* x, adouble* y, int n) {
+  for (int i = 0; i < n; i++) {
+    adouble a = x[i]*x[(i+1)%N];
+    y[i] = sin(a) + 0.5*x[(i+2)%N]*a;
+  }
+}
+
+// Record the algorithm with the specified policy, changing to the
+// second policy half way through, and return the adjoint
+static
+void
+adjoint(adept::Stack& stack, int policy, int second_policy,
+	const std::vector<Real>& x_val, std::vector<Real>& x_ad) {
+  stack.set_allocation_policy(policy);
+  std::vector<adouble> x(N), y(N);
+  adept::set_values(&x[0], N, &x_val[0]);
+  stack.new_recording();
+  algorithm(&x[0], &y[0], N/2);
+  stack.set_allocation_policy(second_policy);
+  algorithm(&x[0], &y[0], N);
+  for (int i = 0; i < N; i++) {
+    y[i].set_gradient(1.0);
+  }
+  stack.reverse();
+  adept::get_gradients(&x[0], N, &x_ad[0]);
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+  adept::Stack stack;
+  std::vector<Real> x_val(N), x_ad(N), x_ad_policy(N);
+  for (int i = 0; i < N; i++) {
+    x_val[i] = 0.1 + 1.0e-5*i;
+  }
+  adjoint(stack, adept::ALLOCATE_DEFAULT, adept::ALLOCATE_DEFAULT,
+	  x_val, x_ad);
+  std::cout << "Recording of " << stack.n_operations()
+	    << " operations and " << stack.max_gradients() << " gradients\n";
+
+  const int policies[] = {
+    adept::ALLOCATE_TRANSPARENT_HUGE_PAGES,
+    adept::ALLOCATE_EXPLICIT_HUGE_PAGES,
+    adept::ALLOCATE_FIRST_TOUCH,
+    adept::ALLOCATE_PREFAULT,
+    adept::ALLOCATE_TRANSPARENT_HUGE_PAGES | adept::ALLOCATE_PREFAULT
+  };
+  const int n_policies = sizeof(policies)/sizeof(int);
+  for (int ipolicy = 0; ipolicy < n_policies; ipolicy++) {
+    try {
+      adjoint(stack, policies[ipolicy], policies[(ipolicy+1)%n_policies],
+	      x_val, x_ad_policy);
+    }
+    catch (adept::feature_not_available& e) {
+      std::cout << "Allocation policy " << policies[ipolicy]
+		<< " not available: " << e.what() << "\n";
+      continue;
+    }
+    if (x_ad_policy != x_ad) {
+      std::cout << "*** Adjoint with allocation policy " << policies[ipolicy]
+		<< " differs from that with the default policy\n";
+      error = true;
+    }
+    else {
+      std::cout << "Adjoint with allocation policy " << policies[ipolicy]
+		<< " matches that with the default policy\n";
+    }
+  }
+  stack.set_allocation_policy(adept::ALLOCATE_DEFAULT);
+
+  bool is_thrown = false;
+  try {
+    stack.set_allocation_policy(adept::ALLOCATE_ALL_FLAGS + 1);
+  }
+  catch (adept::feature_not_available& e) {
+    std::cout << "Correctly caught exception: " << e.what() << "\n";
+    is_thrown = true;
+  }
+  if (!is_thrown) {
+    std::cout << "*** Unknown allocation flag should be rejected\n";
+    error = true;
+  }
+
+  if (error) {
+    std::cerr << "*** Error: allocation policies give different results\n";
+    return 1;
+  }
+  else {
+    std::cout << "Allocation policies correct\n";
+    return 0;
+  }
+}
@@ -0,0 +1,276 @@
+/* test_binomial_checkpoint.cpp - Test automatic binomial checkpointing
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// First the schedules computed by adept::CheckpointSchedule for a
+// range of numbers of steps and checkpoints are checked to reverse
+// every step exactly once using no more than the permitted number of
+// checkpoints, and to recompute the minimum possible number of steps
+// (found by dynamic programming). Then the adjoint of the "Toon"
+// advection scheme of test_checkpoint.cpp is computed using
+// adept::Checkpointer and compared with the adjoint computed from a
+// recording of the whole simulation.
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "adept.h"
+
+using adept::adouble;
+using adept::Real;
+using adept::uIndex;
+using adept::CheckpointSchedule;
+
+// Number of points in spatial grid of simulation
+#define NX 100
+
+// One timestep of the "Toon" advection scheme in a periodic domain
+struct ToonStep {
+  ToonStep(adouble* q_, double c_) : q(q_), c(c_) { }
+  void operator()(uIndex) {
+    for (int i=0; i<NX-1; i++) flux[i] = (exp(c*log(q[i]/q[i+1]))-1.0)
+                                         * q[i]*q[i+1] / (q[i]-q[i+1]);
+    for (int i=1; i<NX-1; i++) q[i] += flux[i-1]-flux[i];
+    q[0] = q[NX-2]; q[NX-1] = q[1];
+  }
+  adouble* q;
+  adouble flux[NX-1];
+  double c;
+};
+
+// Copy the field to and from checkpoints
+struct ToonCopy {
+  ToonCopy(adouble* q_, uIndex n_checkpoints)
+    : q(q_), saved(n_checkpoints*NX) { }
+  void operator()(uIndex slot, bool store) {
+    for (int i = 0; i < NX; i++) {
+      if (store) {
+	saved[slot*NX+i] = q[i].value();
+      }
+      else {
+	q[i] = saved[slot*NX+i];
+      }
+    }
+  }
+  adouble* q;
+  std::vector<Real> saved;
+};
+
+// Minimum number of steps advanced to reverse n_steps steps when the
+// first state is stored and n_free further checkpoints are available
+static
+uIndex
+min_advances(uIndex n_steps, uIndex n_free,
+	     std::vector<std::vector<uIndex> >& cache) {
+  if (n_steps == 1) {
+    return 0;
+  }
+  else if (n_free == 0) {
+    return (n_steps*(n_steps-1))/2;
+  }
+  uIndex& result = cache[n_free][n_steps];
+  if (result == 0) {
+    result = n_steps*n_steps;
+    for (uIndex mid = 1; mid < n_steps; mid++) {
+      uIndex cost = mid + min_advances(n_steps-mid, n_free-1, cache)
+	+ min_advances(mid, n_free, cache);
+      if (cost < result) {
+	result = cost;
+      }
+    }
+  }
+  return result;
+}
+
+// Check the schedule by following its actions with integer "states"
+static
+void
+check_schedule(uIndex n_steps, uIndex n_checkpoints,
+	       std::vector<std::vector<uIndex> >& cache, bool& error) {
+  CheckpointSchedule schedule(n_steps, n_checkpoints);
+  std::vector<int> slot_step(n_checkpoints, -1);
+  int state = 0;
+  int next_adjoint = n_steps-1;
+  uIndex n_recomputed = 0;
+  uIndex n_forward_stored = 0; // Steps advanced in forward pass before last store
+  for (int ipass = 0; ipass < 2; ipass++) {
+    const std::vector<CheckpointSchedule::Action>& actions
+      = ipass == 0 ? schedule.forward_actions() : schedule.reverse_actions();
+    for (std::size_t i = 0; i < actions.size(); i++) {
+      const CheckpointSchedule::Action& action = actions[i];
+      switch (action.type) {
+      case CheckpointSchedule::CHECKPOINT_STORE:
+	if (action.slot >= n_checkpoints) {
+	  error = true;
+	  return;
+	}
+	slot_step[action.slot] = state;
+	if (ipass == 0) {
+	  n_forward_stored = state;
+	}
+	break;
+      case CheckpointSchedule::CHECKPOINT_RESTORE:
+	if (action.slot >= n_checkpoints || slot_step[action.slot] < 0) {
+	  error = true;
+	  return;
+	}
+	state = slot_step[action.slot];
+	break;
+      case CheckpointSchedule::CHECKPOINT_ADVANCE:
+	if (static_cast<int>(action.step) != state) {
+	  error = true;
+	  return;
+	}
+	state += action.n_steps;
+	if (ipass == 1) {
+	  n_recomputed += action.n_steps;
+	}
+	break;
+      case CheckpointSchedule::CHECKPOINT_ADJOINT:
+	if (ipass == 0 || static_cast<int>(action.step) != state
+	    || state != next_adjoint) {
+	  error = true;
+	  return;
+	}
+	++state;
+	--next_adjoint;
+	break;
+      }
+    }
+    if (ipass == 0 && state != static_cast<int>(n_steps)) {
+      error = true;
+      return;
+    }
+  }
+  if (next_adjoint != -1 || n_recomputed != schedule.n_recomputed_steps()) {
+    error = true;
+  }
+  // Steps advanced in the forward pass up to the last stored state
+  // would also have been advanced in the optimal reversal
+  uIndex optimum = min_advances(n_steps, n_checkpoints-1, cache);
+  if (n_recomputed + n_forward_stored != optimum) {
+    std::cout << "*** Schedule for " << n_steps << " steps and "
+	      << n_checkpoints << " checkpoints recomputes "
+	      << n_recomputed + n_forward_stored << " steps instead of "
+	      << optimum << "\n";
+    error = true;
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+
+  // Check schedules
+  const uIndex max_steps = 80, max_checkpoints = 6;
+  std::vector<std::vector<uIndex> > cache(max_checkpoints,
+			  std::vector<uIndex>(max_steps+1, 0));
+  for (uIndex n_checkpoints = 1; n_checkpoints <= max_checkpoints;
+       n_checkpoints++) {
+    for (uIndex n_steps = 1; n_steps <= max_steps; n_steps++) {
+      check_schedule(n_steps, n_checkpoints, cache, error);
+    }
+  }
+  if (error) {
+    std::cout << "*** Checkpointing schedules incorrect\n";
+  }
+  CheckpointSchedule example(1000, 10);
+  std::cout << "Reversing 1000 steps with 10 checkpoints recomputes "
+	    << example.n_recomputed_steps() << " steps\n";
+
+  // Adjoint of the Toon advection scheme
+  const double pi = 4.0*atan(1.0);
+  const uIndex n_steps = 500;
+  const uIndex n_checkpoints = 8;
+  const double dt = 0.125;
+  Real q_init_save[NX];
+  for (int i = 0; i < NX; i++) {
+    q_init_save[i] = (0.5+0.5*sin((i*2.0*pi)/(NX-1.5)))+0.0001;
+  }
+  adept::Stack stack;
+  adouble q_init[NX], q[NX];
+  Real dJ_dq[NX], dJ_dq_checkpointed[NX];
+  ToonStep step(q, dt);
+
+  // Record the whole simulation
+  adept::set_values(q_init, NX, q_init_save);
+  stack.new_recording();
+  for (int i = 0; i < NX; i++) {
+    q[i] = q_init[i];
+  }
+  for (uIndex j = 0; j < n_steps; j++) {
+    step(j);
+  }
+  adouble J = 0.0;
+  for (int i = 0; i < NX; i++) {
+    J += (q[i]-q_init_save[i])*(q[i]-q_init_save[i]);
+  }
+  J.set_gradient(1.0);
+  stack.reverse();
+  adept::get_gradients(q_init, NX, dJ_dq);
+  uIndex full_operations = stack.n_operations();
+  Real J_full = J.value();
+
+  // Use the checkpointer
+  ToonCopy copy(q, n_checkpoints);
+  adept::Checkpointer<ToonStep,ToonCopy> checkpointer(n_steps, n_checkpoints,
+						      step, copy);
+  adept::set_values(q, NX, q_init_save);
+  checkpointer.forward();
+  stack.new_recording();
+  J = 0.0;
+  for (int i = 0; i < NX; i++) {
+    J += (q[i]-q_init_save[i])*(q[i]-q_init_save[i]);
+  }
+  J.set_gradient(1.0);
+  stack.reverse();
+  adept::get_gradients(q, NX, dJ_dq_checkpointed);
+  checkpointer.reverse(q, NX, dJ_dq_checkpointed);
+
+  std::cout << "Checkpointed adjoint of " << n_steps << " steps with "
+	    << n_checkpoints << " checkpoints recomputed "
+	    << checkpointer.n_recomputed_steps() << " steps; largest recording "
+	    << checkpointer.max_operations() << " operations compared with "
+	    << full_operations << " for the whole simulation\n";
+  if (J.value() != J_full) {
+    std::cout << "*** Cost function of checkpointed simulation differs\n";
+    error = true;
+  }
+  if (checkpointer.n_recomputed_steps()
+      != checkpointer.schedule().n_recomputed_steps()) {
+    std::cout << "*** Number of recomputed steps differs from schedule\n";
+    error = true;
+  }
+  if (checkpointer.max_operations()*(n_steps/2) > full_operations) {
+    std::cout << "*** Recording of a single step is too large\n";
+    error = true;
+  }
+  Real max_error = 0.0, max_gradient = 0.0;
+  for (int i = 0; i < NX; i++) {
+    max_error = std::max(max_error, std::fabs(dJ_dq_checkpointed[i]-dJ_dq[i]));
+    max_gradient = std::max(max_gradient, std::fabs(dJ_dq[i]));
+  }
+  std::cout << "Maximum difference from adjoint of whole simulation: "
+	    << max_error << " (maximum gradient " << max_gradient << ")\n";
+  if (!(max_error <= 1.0e-10*max_gradient)) {
+    std::cout << "*** Checkpointed adjoint differs\n";
+    error = true;
+  }
+
+  if (error) {
+    std::cerr << "*** Error: binomial checkpointing incorrect\n";
+    return 1;
+  }
+  else {
+    std::cout << "Binomial checkpointing correct\n";
+    return 0;
+  }
+}
@@ -0,0 +1,247 @@
+/* test_builtin_blas.cpp - Test Adept's built-in replacements for BLAS
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// Dense, symmetric and band matrices of various shapes, storage
+// orders and strides are multiplied by vectors and matrices in
+// single and double precision, and the results compared to simple
+// loops over the elements.  This is done first with Adept's built-in
+// replacements for the BLAS functions and then, if Adept was
+// compiled with BLAS, with the external BLAS library.  The sizes are
+// chosen to exercise the edges of the blocks used by the built-in
+// matrix-matrix multiplication.
+
+#include <iostream>
+#include <cmath>
+
+#include "adept_arrays.h"
+
+using namespace adept;
+
+// Multiply matrix "a" by matrix "b" using simple loops, where either
+// may be a special matrix
+template <typename T, class AType, class BType>
+static
+Array<2,T>
+reference_matmul(const AType& a, const BType& b) {
+  Array<2,T> a_dense, b_dense;
+  a_dense = a;
+  b_dense = b;
+  Array<2,T> c(a_dense.dimension(0), b_dense.dimension(1));
+  for (int i = 0; i < c.dimension(0); i++) {
+    for (int j = 0; j < c.dimension(1); j++) {
+      T sum = 0.0;
+      for (int p = 0; p < a_dense.dimension(1); p++) {
+	sum += a_dense(i,p) * b_dense(p,j);
+      }
+      c(i,j) = sum;
+    }
+  }
+  return c;
+}
+
+// Multiply matrix "a" by vector "x" using simple loops
+template <typename T, class AType>
+static
+Array<1,T>
+reference_matmul_vector(const AType& a, const Array<1,T>& x) {
+  Array<2,T> a_dense;
+  a_dense = a;
+  Array<1,T> y(a_dense.dimension(0));
+  for (int i = 0; i < y.dimension(0); i++) {
+    T sum = 0.0;
+    for (int p = 0; p < x.dimension(0); p++) {
+      sum += a_dense(i,p) * x(p);
+    }
+    y(i) = sum;
+  }
+  return y;
+}
+
+// Return true if "result" and "reference" differ by more than
+// rounding error, reporting the difference
+template <int Rank, typename T>
+static
+bool
+differs(const char* description, const Array<Rank,T>& result,
+	const Array<Rank,T>& reference) {
+  T tolerance = sizeof(T) == sizeof(float) ? 1.0e-4 : 1.0e-11;
+  T max_diff = maxval(abs(result-reference));
+  T max_ref = maxval(abs(reference));
+  bool is_different = !(max_diff <= tolerance*max_ref);
+  std::cout << "    " << description << ": maximum difference "
+	    << max_diff << (is_different ? " *** ERROR ***" : "") << "\n";
+  return is_different;
+}
+
+// Fill a vector or matrix with values that do not lead to
+// cancellation
+template <typename T>
+static
+void
+fill(Array<1,T>& a, T scale) {
+  for (int i = 0; i < a.dimension(0); i++) {
+    a(i) = scale * (1.0 + 0.5*std::sin(1.0 + i));
+  }
+}
+template <typename T>
+static
+void
+fill(Array<2,T>& a, T scale) {
+  for (int i = 0; i < a.dimension(0); i++) {
+    for (int j = 0; j < a.dimension(1); j++) {
+      a(i,j) = scale * (1.0 + 0.5*std::sin(1.0 + i + 0.37*j));
+    }
+  }
+}
+
+// Test all the multiplications at a particular precision, returning
+// the number of failures
+template <typename T>
+static
+int
+test_precision(const char* precision) {
+  typedef Array<1,T> Vec;
+  typedef Array<2,T> Mat;
+  typedef SpecialMatrix<T,internal::SymmEngine<ROW_LOWER_COL_UPPER>,false> Symm;
+  typedef SpecialMatrix<T,internal::BandEngine<ROW_MAJOR,1,1>,false> Tridiag;
+  typedef SpecialMatrix<T,internal::BandEngine<COL_MAJOR,2,3>,false> Band;
+
+  int n_errors = 0;
+  std::cout << "  " << precision << " precision:\n";
+
+  // Sizes spanning more than one block of rows and of the inner
+  // dimension, and not a multiple of the tile size
+  const int m = 131, k = 263, n = 45;
+  Mat A(m,k), B(k,n), BT(n,k), CT(k,m);
+  Vec x(k), xm(m), x2(2*k);
+  fill(A, static_cast<T>(0.1));
+  fill(B, static_cast<T>(-0.2));
+  fill(BT, static_cast<T>(0.3));
+  fill(x, static_cast<T>(1.0));
+  fill(xm, static_cast<T>(-0.7));
+  fill(x2, static_cast<T>(0.4));
+  // C is a column-major view of the same values as A
+  CT = A.T();
+  Mat C;
+  C >>= CT.T();
+
+  Mat small_a(3,5), small_b(5,1), tiny_a(1,1), tiny_b(1,1);
+  fill(small_a, static_cast<T>(1.0));
+  fill(small_b, static_cast<T>(2.0));
+  tiny_a = 3.0;
+  tiny_b = -2.0;
+
+  // Dense matrix-matrix multiplication with every combination of
+  // storage order and transpose
+  n_errors += differs("matmul(A,B)", Mat(matmul(A,B)),
+		      reference_matmul<T>(A,B));
+  n_errors += differs("matmul(A,BT.T())", Mat(matmul(A,BT.T())),
+		      reference_matmul<T>(A,BT.T()));
+  n_errors += differs("matmul(C,B)", Mat(matmul(C,B)),
+		      reference_matmul<T>(C,B));
+  n_errors += differs("matmul(B.T(),A.T())", Mat(matmul(B.T(),A.T())),
+		      reference_matmul<T>(B.T(),A.T()));
+  n_errors += differs("matmul(A(range,range),B(range,range))",
+		      Mat(matmul(A(range(1,m-1),range(2,k-1)),
+				 B(range(2,k-1),range(0,n-3)))),
+		      reference_matmul<T>(A(range(1,m-1),range(2,k-1)),
+					  B(range(2,k-1),range(0,n-3))));
+  n_errors += differs("matmul(small_a,small_b)", Mat(matmul(small_a,small_b)),
+		      reference_matmul<T>(small_a,small_b));
+  n_errors += differs("matmul(tiny_a,tiny_b)", Mat(matmul(tiny_a,tiny_b)),
+		      reference_matmul<T>(tiny_a,tiny_b));
+
+  // Dense matrix-vector multiplication, including strided vectors
+  n_errors += differs("matmul(A,x)", Vec(matmul(A,x)),
+		      reference_matmul_vector<T>(A,x));
+  n_errors += differs("matmul(C,x)", Vec(matmul(C,x)),
+		      reference_matmul_vector<T>(C,x));
+  n_errors += differs("matmul(xm,A)", Vec(matmul(xm,A)),
+		      reference_matmul_vector<T>(A.T(),xm));
+  Vec x_strided;
+  x_strided >>= x2(stride(0,end,2));
+  n_errors += differs("matmul(A,x(stride))", Vec(matmul(A,x_strided)),
+		      reference_matmul_vector<T>(A,Vec(x_strided)));
+
+  // Symmetric matrices, referenced from the lower and upper triangle
+  Symm S(k);
+  S = 0.0;
+  for (int i = 0; i < k; i++) {
+    for (int j = 0; j <= i; j++) {
+      S(i,j) = 0.5 + 0.25*std::sin(1.0 + i - 0.3*j);
+    }
+  }
+  n_errors += differs("matmul(S,x)", Vec(matmul(S,x)),
+		      reference_matmul_vector<T>(S,x));
+  n_errors += differs("matmul(S,x(stride))", Vec(matmul(S,x_strided)),
+		      reference_matmul_vector<T>(S,Vec(x_strided)));
+  n_errors += differs("matmul(S.T(),x)", Vec(matmul(S.T(),x)),
+		      reference_matmul_vector<T>(S,x));
+  n_errors += differs("matmul(S,B)", Mat(matmul(S,B)),
+		      reference_matmul<T>(S,B));
+  n_errors += differs("matmul(A,S)", Mat(matmul(A,S)),
+		      reference_matmul<T>(A,S));
+
+  // Band matrices in row-major and column-major storage
+  Tridiag R(k);
+  Band D(k);
+  R = 0.0;
+  D = 0.0;
+  for (int i = 0; i < k; i++) {
+    for (int j = std::max(0,i-2); j <= std::min(k-1,i+3); j++) {
+      D(i,j) = 0.3 - 0.05*std::cos(1.0*i) + 0.1*j/k;
+      if (j >= i-1 && j <= i+1) {
+	R(i,j) = 1.0 + 0.2*std::sin(0.5*i+j);
+      }
+    }
+  }
+  n_errors += differs("matmul(R,x)", Vec(matmul(R,x)),
+		      reference_matmul_vector<T>(R,x));
+  n_errors += differs("matmul(D,x)", Vec(matmul(D,x)),
+		      reference_matmul_vector<T>(D,x));
+  n_errors += differs("matmul(D,x(stride))", Vec(matmul(D,x_strided)),
+		      reference_matmul_vector<T>(D,Vec(x_strided)));
+  n_errors += differs("matmul(D.T(),x)", Vec(matmul(D.T(),x)),
+		      reference_matmul_vector<T>(D.T(),x));
+  n_errors += differs("matmul(D,B)", Mat(matmul(D,B)),
+		      reference_matmul<T>(D,B));
+
+  return n_errors;
+}
+
+int
+main(int argc, char** argv)
+{
+  int n_errors = 0;
+
+  std::cout << "Testing built-in replacements for BLAS functions:\n";
+  set_use_builtin_blas(true);
+  n_errors += test_precision<float>("Single");
+  n_errors += test_precision<double>("Double");
+
+  if (!set_use_builtin_blas(false)) {
+    std::cout << "Testing external BLAS library:\n";
+    n_errors += test_precision<float>("Single");
+    n_errors += test_precision<double>("Double");
+  }
+  else {
+    std::cout << "Adept compiled without BLAS so cannot test external BLAS library\n";
+  }
+
+  if (n_errors > 0) {
+    std::cerr << "*** Error: " << n_errors
+	      << " matrix multiplications gave incorrect results\n";
+    return 1;
+  }
+  else {
+    std::cout << "All matrix multiplications gave correct results\n";
+    return 0;
+  }
+}
@@ -0,0 +1,149 @@
+/* test_compressed_stack.cpp - Test compression of the recording
+
+  Copyright (C) 2012-2014 The University of Reading
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// The adjoint and tangent-linear computations using a compressed
+// recording should give identical results to those using the
+// original recording, since the order of the operations is preserved
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "adept_arrays.h"
+
+using namespace adept;
+
+// A mixture of scalar and array statements generating operations with
+// multipliers of +1, -1 and other values, and runs of consecutive
+// gradient indices of various lengths
+static void
+algorithm(const aVector& x, aVector& y) {
+  int n = x.size();
+  aVector z = 2.0*x - x*x;
+  z += x;
+  z.subset(1,n-1) -= x.subset(0,n-2);
+  y = z;
+  for (int i = 1; i < n-1; ++i) {
+    y(i) += 0.5*(z(i-1) - z(i+1)) + sin(z(i))*x(i);
+  }
+  y(n-1) = sum(x) - sum(z*z);
+  y(0) = x(0) + x(1) + x(2) + x(3) + x(4) - x(5) - x(6);
+}
+
+// Set the gradients of an active vector
+static void
+set_gradients(aVector& x, const Vector& x_grad) {
+  for (int i = 0; i < x.size(); ++i) {
+    x(i).set_gradient(x_grad(i));
+  }
+}
+
+int
+main(int argc, const char** argv)
+{
+  const int n = 100;
+  bool error = false;
+  Stack stack;
+
+  aVector x(n), y(n);
+  for (int i = 0; i < n; ++i) {
+    x(i) = 0.1 + 0.01*i;
+  }
+  stack.new_recording();
+  algorithm(x, y);
+
+  std::cout << "Fraction of multipliers equal to +1: "
+	    << stack.fraction_multipliers_equal_to(1.0)
+	    << ", -1: " << stack.fraction_multipliers_equal_to(-1.0) << "\n";
+
+  // Adjoint and tangent-linear using the original recording
+  Vector y_ad(n), x_ad_orig(n), x_tl(n), y_tl_orig(n);
+  for (int i = 0; i < n; ++i) {
+    y_ad(i) = 1.0 + 0.1*i;
+    x_tl(i) = 2.0 - 0.01*i;
+  }
+  set_gradients(y, y_ad);
+  stack.reverse();
+  x_ad_orig = x.get_gradient();
+  stack.clear_gradients();
+  set_gradients(x, x_tl);
+  stack.forward();
+  y_tl_orig = y.get_gradient();
+  stack.clear_gradients();
+
+  // Compress the recording and repeat
+  std::size_t orig_memory = (stack.n_statements()-1)*2*sizeof(uIndex)
+    + stack.n_operations()*(sizeof(Real)+sizeof(uIndex));
+  stack.compress_recording();
+  std::cout << stack;
+  std::cout << "Recording of " << orig_memory << " bytes compressed to "
+	    << stack.compressed_memory() << " bytes\n";
+  if (!stack.recording_is_compressed()) {
+    std::cout << "*** Recording should be compressed\n";
+    error = true;
+  }
+  if (stack.compressed_memory() >= orig_memory) {
+    std::cout << "*** Compressed recording should be smaller than original\n";
+    error = true;
+  }
+
+  Vector x_ad(n), y_tl(n);
+  set_gradients(y, y_ad);
+  stack.reverse();
+  x_ad = x.get_gradient();
+  stack.clear_gradients();
+  set_gradients(x, x_tl);
+  stack.forward();
+  y_tl = y.get_gradient();
+  stack.clear_gradients();
+
+  if (any(x_ad != x_ad_orig)) {
+    std::cout << "*** Adjoint differs: maximum difference "
+	      << maxval(abs(x_ad-x_ad_orig)) << "\n";
+    error = true;
+  }
+  if (any(y_tl != y_tl_orig)) {
+    std::cout << "*** Tangent linear differs: maximum difference "
+	      << maxval(abs(y_tl-y_tl_orig)) << "\n";
+    error = true;
+  }
+
+  // Adding to the recording should cause the uncompressed version to
+  // be used again
+  aReal w = y(0)*y(1);
+  if (stack.recording_is_compressed()) {
+    std::cout << "*** Modified recording should not be compressed\n";
+    error = true;
+  }
+  w.set_gradient(1.0);
+  stack.reverse();
+  Real dw_dx0 = x(0).get_gradient();
+  // dw/dx0 = y1*dy0/dx0 + y0*dy1/dx0, where dy0/dx0 and dy1/dx0 are
+  // obtained from a tangent-linear calculation
+  stack.clear_gradients();
+  x(0).set_gradient(1.0);
+  stack.forward();
+  Real expected = y(1).value()*y(0).get_gradient()
+    + y(0).value()*y(1).get_gradient();
+  if (std::fabs(dw_dx0 - expected) > 1.0e-12*std::fabs(expected)) {
+    std::cout << "*** Derivative after modifying recording: " << dw_dx0
+	      << " should be " << expected << "\n";
+    error = true;
+  }
+
+  if (error) {
+    std::cerr << "*** Error: compressed recording gave wrong results\n";
+    return 1;
+  }
+  else {
+    std::cout << "Compressed recording gave correct results\n";
+    return 0;
+  }
+}
@@ -0,0 +1,201 @@
+/* test_hessian.cpp - Test Hessian-vector products and Hessian matrices
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// The Hessian of a quadratic function is computed with
+// Stack::hessian() and checked to be exact. The Hessian of a cost
+// function using every differentiable unary and binary operation
+// supported by Stack::enable_replay() is then checked against
+// centred finite differences of its gradient, both at the point it
+// was recorded and after Stack::replay() at a new point, and a
+// Hessian-vector product is checked against the Hessian matrix.
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "adept.h"
+
+using adept::adouble;
+using adept::Real;
+
+#define N 6
+
+// Quadratic function 0.5*x'*A*x + b'*x, with A symmetric
+static
+adouble
+quadratic(const std::vector<adouble>& x) {
+  adouble f = 0.0;
+  for (int i = 0; i < N; i++) {
+    f += (i+1.0)*x[i];
+    for (int j = 0; j < N; j++) {
+      f += 0.5*(1.0 + i + j + (i == j ? 10.0 : 0.0))*x[i]*x[j];
+    }
+  }
+  return f;
+}
+
+// Cost function exercising all differentiable operations, for
+// arguments between 0.2 and 0.8
+static
+adouble
+cost(const std::vector<adouble>& x) {
+  adouble f = 0.0;
+  f += log(x[0])*x[1] + log10(x[1]*x[2]) + sin(x[2])*cos(x[3]);
+  f += tan(x[3])*asin(x[4]) + acos(x[5])*atan(x[0]*x[1]);
+  f += sinh(x[1])/cosh(x[2]) + exp(x[3]*x[4]) + sqrt(x[4]+x[5]);
+  f += tanh(x[5]*x[0]) + pow(x[0], x[1]) + pow(x[2], 3.0) + pow(2.0, x[3]);
+  f += atan2(x[4], x[5]);
+  f += max(x[0]*x[0], x[1]) + min(x[2], x[3]*x[4]) + abs(x[5]-x[0])*x[1];
+  f += x[0]/x[3] + 2.0/(x[4]*x[1]) - x[5]*(x[0]-x[2]);
+  f += log2(x[1]+1.0) + expm1(x[2]*x[3]) + exp2(x[4]) + log1p(x[5]*x[0]);
+  f += asinh(x[1]*x[2]) + acosh(x[3]+1.5) + atanh(x[4]*x[5]);
+  f += erf(x[0]*x[2]) + erfc(x[1]*x[3]) + cbrt(x[4]+x[0]);
+  return f;
+}
+
+// Compute the gradient of the cost function at x
+static
+void
+gradient(const std::vector<Real>& x, std::vector<Real>& g) {
+  adept::Stack stack;
+  std::vector<adouble> xa(N);
+  adept::set_values(&xa[0], N, &x[0]);
+  stack.new_recording();
+  adouble f = cost(xa);
+  f.set_gradient(1.0);
+  stack.reverse();
+  adept::get_gradients(&xa[0], N, &g[0]);
+}
+
+// Check the Hessian of the cost function at x against finite
+// differences of its gradient, computed using a separate stack
+static
+void
+check_hessian(adept::Stack& stack, const std::vector<Real>& x,
+	      const Real* hessian, bool& error) {
+  stack.deactivate();
+  const Real h = 1.0e-5;
+  std::vector<Real> xp(x), xm(x), gp(N), gm(N);
+  Real max_error = 0.0, max_hessian = 0.0;
+  for (int j = 0; j < N; j++) {
+    xp[j] = x[j] + h;
+    xm[j] = x[j] - h;
+    gradient(xp, gp);
+    gradient(xm, gm);
+    xp[j] = xm[j] = x[j];
+    for (int i = 0; i < N; i++) {
+      Real fd = (gp[i] - gm[i]) / (2.0*h);
+      max_error = std::max(max_error, std::fabs(hessian[j*N+i] - fd));
+      max_hessian = std::max(max_hessian, std::fabs(fd));
+    }
+  }
+  std::cout << "Maximum difference from finite differences: " << max_error
+	    << " (maximum Hessian element " << max_hessian << ")\n";
+  if (max_error > 1.0e-6*max_hessian) {
+    std::cout << "*** Hessian differs from finite differences\n";
+    error = true;
+  }
+  stack.activate();
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+  adept::Stack stack;
+  stack.enable_replay();
+  std::vector<adouble> x(N);
+  std::vector<Real> hessian(N*N);
+
+  // Quadratic function: Hessian is exactly A
+  for (int i = 0; i < N; i++) {
+    x[i] = 0.1*i - 0.2;
+  }
+  stack.new_recording();
+  adouble f = quadratic(x);
+  stack.independent(&x[0], N);
+  stack.dependent(f);
+  stack.hessian(&hessian[0]);
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < N; j++) {
+      Real expected = 1.0 + i + j + (i == j ? 10.0 : 0.0);
+      if (hessian[i*N+j] != expected) {
+	std::cout << "*** Hessian element (" << i << "," << j << ") of quadratic is "
+		  << hessian[i*N+j] << " instead of " << expected << "\n";
+	error = true;
+      }
+    }
+  }
+
+  // Cost function at the point of the recording
+  std::vector<Real> x0(N), x1(N);
+  for (int i = 0; i < N; i++) {
+    x0[i] = 0.25 + 0.1*i;
+    x1[i] = 0.7 - 0.08*i;
+  }
+  adept::set_values(&x[0], N, &x0[0]);
+  stack.new_recording();
+  f = cost(x);
+  stack.independent(&x[0], N);
+  stack.dependent(f);
+  stack.hessian(&hessian[0]);
+  check_hessian(stack, x0, &hessian[0], error);
+
+  // Hessian-vector product should match the product with the matrix
+  std::vector<Real> v(N), hv(N);
+  for (int i = 0; i < N; i++) {
+    v[i] = 1.0 - 0.3*i;
+  }
+  stack.hessian_vector_product(&v[0], &hv[0]);
+  for (int i = 0; i < N; i++) {
+    Real expected = 0.0;
+    for (int j = 0; j < N; j++) {
+      expected += hessian[j*N+i]*v[j];
+    }
+    if (std::fabs(hv[i] - expected) > 1.0e-12*(1.0 + std::fabs(expected))) {
+      std::cout << "*** Element " << i << " of Hessian-vector product is "
+		<< hv[i] << " instead of " << expected << "\n";
+      error = true;
+    }
+  }
+
+  // Cost function after replaying at a new point
+  stack.replay(&x1[0]);
+  stack.hessian(&hessian[0]);
+  check_hessian(stack, x1, &hessian[0], error);
+
+  // A recording that was not replayable should be detected
+  stack.disable_replay();
+  stack.new_recording();
+  f = cost(x);
+  stack.independent(&x[0], N);
+  stack.dependent(f);
+  bool is_thrown = false;
+  try {
+    stack.hessian(&hessian[0]);
+  }
+  catch (adept::recording_not_replayable& e) {
+    std::cout << "Correctly caught exception: " << e.what() << "\n";
+    is_thrown = true;
+  }
+  if (!is_thrown) {
+    std::cout << "*** Hessian of recording without replay should throw\n";
+    error = true;
+  }
+
+  if (error) {
+    std::cerr << "*** Error: Hessian incorrect\n";
+    return 1;
+  }
+  else {
+    std::cout << "Hessian correct\n";
+    return 0;
+  }
+}
@@ -0,0 +1,128 @@
+/* test_jacobian_sparsity.cpp - Test detection of the sparsity pattern of a Jacobian
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// The sparsity pattern found by Stack::jacobian_sparsity() is
+// compared with the non-zero elements of the full Jacobian, for more
+// dependents than independents (detected with a forward pass) and
+// fewer (detected with a reverse pass), in both cases with enough
+// variables that several passes of bit vectors are needed. The
+// pattern is then reused by sparse_jacobian() for a recording of
+// the same algorithm at a different point.
+
+#include <iostream>
+#include <vector>
+
+#include "adept.h"
+
+using adept::adouble;
+using adept::Real;
+using adept::uIndex;
+
+// Each output depends on a few scattered inputs; the temporary "t"
+// is recreated for each output so its gradient index is reused
+static
+void
+algorithm(const std::vector<adouble>& x, std::vector<adouble>& y) {
+  int n = x.size();
+  int m = y.size();
+  for (int i = 0; i < m; i++) {
+    adouble t = x[(i*7) % n] * x[(i*13+5) % n];
+    y[i] = t + exp(x[(i*31+2) % n]);
+    if (i % 3 == 0) {
+      y[i] *= x[(i*i) % n];
+    }
+  }
+}
+
+// Record the algorithm with n inputs and m outputs, check the
+// sparsity pattern against the full Jacobian and then reuse it at a
+// different point
+static
+void
+check_sparsity(adept::Stack& stack, int n, int m, bool& error) {
+  std::vector<adouble> x(n), y(m);
+  for (int i = 0; i < n; i++) {
+    x[i] = 0.5 + 0.001*i;
+  }
+  stack.new_recording();
+  algorithm(x, y);
+  stack.independent(&x[0], n);
+  stack.dependent(&y[0], m);
+  std::vector<uIndex> row_start, column;
+  stack.jacobian_sparsity(row_start, column);
+
+  std::vector<Real> jac(m*n);
+  stack.jacobian(&jac[0]);
+  std::vector<bool> is_non_zero(m*n, false);
+  for (int i = 0; i < m; i++) {
+    for (uIndex k = row_start[i]; k < row_start[i+1]; k++) {
+      if (k > row_start[i] && column[k] <= column[k-1]) {
+	std::cout << "*** Columns of row " << i << " not in increasing order\n";
+	error = true;
+      }
+      is_non_zero[column[k]*m+i] = true;
+    }
+  }
+  for (int i = 0; i < m*n; i++) {
+    if (is_non_zero[i] != (jac[i] != 0.0)) {
+      std::cout << "*** Sparsity of element (" << i%m << "," << i/m
+		<< ") incorrect\n";
+      error = true;
+      break;
+    }
+  }
+  std::cout << "Jacobian of size " << m << "x" << n << " has "
+	    << column.size() << " non-zero elements\n";
+
+  // Reuse the sparsity pattern with a new recording
+  for (int i = 0; i < n; i++) {
+    x[i] = 1.5 - 0.002*i;
+  }
+  stack.new_recording();
+  algorithm(x, y);
+  stack.independent(&x[0], n);
+  stack.dependent(&y[0], m);
+  stack.jacobian(&jac[0]);
+  std::vector<Real> value;
+  stack.sparse_jacobian(row_start, column, value, true);
+  for (int i = 0; i < m; i++) {
+    for (uIndex k = row_start[i]; k < row_start[i+1]; k++) {
+      if (value[k] != jac[column[k]*m+i]) {
+	std::cout << "*** Element (" << i << "," << column[k]
+		  << ") using reused sparsity is " << value[k]
+		  << " instead of " << jac[column[k]*m+i] << "\n";
+	error = true;
+	return;
+      }
+    }
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+  adept::Stack stack;
+  // Forward detection with more than 512 independents
+  check_sparsity(stack, 600, 700, error);
+  // Reverse detection with more than 512 dependents
+  check_sparsity(stack, 1100, 530, error);
+  // Single word
+  check_sparsity(stack, 40, 30, error);
+
+  if (error) {
+    std::cerr << "*** Error: Jacobian sparsity pattern incorrect\n";
+    return 1;
+  }
+  else {
+    std::cout << "Jacobian sparsity pattern correct\n";
+    return 0;
+  }
+}
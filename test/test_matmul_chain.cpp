@@ -0,0 +1,237 @@
+/* test_matmul_chain.cpp - Test deferred evaluation of matrix products
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// Products of several matrices and vectors written with the "**"
+// pseudo-operator are evaluated only on assignment, in the order
+// that minimizes the number of operations, with scalar factors and
+// added arrays folded into the final BLAS call.  The results are
+// compared to the same products computed left to right with matmul,
+// first for passive arrays, including transposed, strided and
+// aliased arrays, and then for the values and Jacobian matrix of an
+// active algorithm, recorded both with and without matrix nodes.
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "adept_arrays.h"
+
+using namespace adept;
+
+#define M 7
+#define K 5
+#define N 6
+
+// Return true if "result" and "reference" differ by more than
+// rounding error, reporting the difference
+template <int Rank>
+static
+bool
+differs(const char* description, const Array<Rank,Real>& result,
+	const Array<Rank,Real>& reference) {
+  Real max_diff = maxval(abs(result-reference));
+  Real max_ref = maxval(abs(reference));
+  bool is_different = !(max_diff <= 1.0e-10*max_ref);
+  std::cout << "  " << description << ": maximum difference "
+	    << max_diff << (is_different ? " *** ERROR ***" : "") << "\n";
+  return is_different;
+}
+
+// Fill a matrix with values that do not lead to cancellation
+template <bool IsActive>
+static
+void
+fill(Array<2,Real,IsActive>& a, Real scale) {
+  for (int i = 0; i < a.dimension(0); i++) {
+    for (int j = 0; j < a.dimension(1); j++) {
+      a(i,j) = scale * (1.0 + 0.5*std::sin(1.0 + i + 0.37*j));
+    }
+  }
+}
+template <bool IsActive>
+static
+void
+fill(Array<1,Real,IsActive>& a, Real scale) {
+  for (int i = 0; i < a.dimension(0); i++) {
+    a(i) = scale * (1.0 + 0.5*std::sin(2.0 + i));
+  }
+}
+
+// Test passive products, returning the number of failures
+static
+int
+test_passive() {
+  int n_errors = 0;
+  Matrix A(M,K), B(K,N), C(N,M), S(M,M), E(M,N);
+  Vector x(N), xm(M), x2(2*N);
+  fill(A, 0.1);
+  fill(B, -0.2);
+  fill(C, 0.3);
+  fill(S, 0.4);
+  fill(E, 1.5);
+  fill(x, 1.0);
+  fill(xm, -0.7);
+  fill(x2, 0.6);
+
+  std::cout << "Passive products:\n";
+  n_errors += differs("A**B**x", Vector(A ** B ** x),
+		      Vector(matmul(matmul(A,B),x)));
+  n_errors += differs("xm**A**B", Vector(xm ** A ** B),
+		      Vector(matmul(matmul(xm,A),B)));
+  n_errors += differs("A**B**C**S", Matrix(A ** B ** C ** S),
+		      Matrix(matmul(matmul(matmul(A,B),C),S)));
+  n_errors += differs("A**(B**C)", Matrix(A ** (B ** C)),
+		      Matrix(matmul(A,matmul(B,C))));
+  n_errors += differs("(A**B)**x**S", Vector((A ** B ** x) ** S),
+		      Vector(matmul(matmul(matmul(A,B),x),S)));
+  n_errors += differs("A.T()**C.T()**x", Vector(A.T() ** C.T() ** x),
+		      Vector(matmul(matmul(A.T(),C.T()),x)));
+  Vector x_strided;
+  x_strided >>= x2(stride(0,end,2));
+  n_errors += differs("A**B**x(stride)", Vector(A ** B ** x_strided),
+		      Vector(matmul(matmul(A,B),x_strided)));
+  Vector x_reversed(N);
+  x_reversed = x(stride(end,0,-1));
+  n_errors += differs("A**B**x(reversed)", Vector(A ** B ** x(stride(end,0,-1))),
+		      Vector(matmul(matmul(A,B),x_reversed)));
+
+  // Scalar factors and added arrays
+  n_errors += differs("2*A**B-E", Matrix(2.0 * A ** B - E),
+		      Matrix(2.0*matmul(A,B) - E));
+  n_errors += differs("E+(A**B)/4", Matrix(E + (A ** B) / 4.0),
+		      Matrix(E + matmul(A,B)/4.0));
+  n_errors += differs("-(A**B**x)+xm-2*xm", Vector(-(A ** B ** x) + xm - 2.0*xm),
+		      Vector(-matmul(matmul(A,B),x) - xm));
+  n_errors += differs("S**xm-A**B**x", Vector(S ** xm - A ** B ** x),
+		      Vector(matmul(S,xm) - matmul(matmul(A,B),x)));
+
+  // Accumulation, aliasing and use within an expression
+  Matrix D(M,N);
+  D = E;
+  D += 3.0 * A ** B;
+  n_errors += differs("D+=3*A**B", D, Matrix(E + 3.0*matmul(A,B)));
+  D -= A ** B + E;
+  n_errors += differs("D-=A**B+E", D, Matrix(2.0*matmul(A,B)));
+  D = A ** B + D;
+  n_errors += differs("D=A**B+D", D, Matrix(3.0*matmul(A,B)));
+  Vector y(xm), y_ref(xm);
+  y = S ** S ** y - y;
+  y_ref = matmul(matmul(S,S),y_ref) - y_ref;
+  n_errors += differs("y=S**S**y-y", y, y_ref);
+  D = D ** (C ** A) ** B;
+  n_errors += differs("D=D**(C**A)**B", D,
+		      Matrix(matmul(matmul(3.0*matmul(A,B),matmul(C,A)),B)));
+  n_errors += differs("exp(0.1*(A**B))", Matrix(exp(0.1*(A ** B))),
+		      Matrix(exp(0.1*matmul(A,B))));
+
+  // Inner dimensions are checked when the product is formed
+  bool is_thrown = false;
+  try {
+    Matrix F = A ** C ** S;
+  }
+  catch (inner_dimension_mismatch& e) {
+    std::cout << "  Correctly caught exception: " << e.what() << "\n";
+    is_thrown = true;
+  }
+  if (!is_thrown) {
+    std::cout << "  *** Inner dimension mismatch not detected\n";
+    n_errors++;
+  }
+  return n_errors;
+}
+
+// Active algorithm written with the "**" pseudo-operator or with
+// matmul evaluated left to right
+static
+void
+algorithm(const aMatrix& A, const aMatrix& B, const aVector& x,
+	  bool use_chain, aVector& y) {
+  Matrix E(M,N), S(M,M);
+  Vector x2(N);
+  fill(E, 1.5);
+  fill(S, 0.4);
+  fill(x2, 0.6);
+  if (use_chain) {
+    aMatrix D = 2.0 * A ** B - E;
+    y = D ** x + 0.5 * (A ** B ** x);
+    y += A ** (B ** x);
+    y -= x2 ** (B.T() ** A.T());
+    y = S ** y - y;
+  }
+  else {
+    aMatrix D = 2.0*matmul(A,B) - E;
+    y = matmul(D,x) + 0.5*matmul(matmul(A,B),x);
+    y += matmul(A,matmul(B,x));
+    y -= matmul(x2,matmul(B.T(),A.T()));
+    y = matmul(S,y) - y;
+  }
+}
+
+// Record the algorithm and return the values and Jacobian matrix
+static
+void
+record(Stack& stack, bool use_chain, bool use_nodes,
+       Vector& y_value, Matrix& jac) {
+  aMatrix A(M,K), B(K,N);
+  aVector x(N), y(M);
+  fill(A, 0.1);
+  fill(B, -0.2);
+  fill(x, 1.0);
+  if (use_nodes) {
+    stack.enable_matrix_nodes();
+  }
+  else {
+    stack.disable_matrix_nodes();
+  }
+  stack.new_recording();
+  algorithm(A, B, x, use_chain, y);
+  stack.independent(A);
+  stack.independent(B);
+  stack.independent(x);
+  stack.dependent(y);
+  y_value = value(y);
+  jac.resize(M, M*K+K*N+N);
+  stack.jacobian_reverse(jac.data());
+}
+
+// Test active products, returning the number of failures
+static
+int
+test_active() {
+  int n_errors = 0;
+  Stack stack;
+  Vector y_ref, y_nodes, y_elements;
+  Matrix jac_ref, jac_nodes, jac_elements;
+  record(stack, false, false, y_ref, jac_ref);
+  record(stack, true, true, y_nodes, jac_nodes);
+  record(stack, true, false, y_elements, jac_elements);
+
+  std::cout << "Active products:\n";
+  n_errors += differs("Values with matrix nodes", y_nodes, y_ref);
+  n_errors += differs("Values without matrix nodes", y_elements, y_ref);
+  n_errors += differs("Jacobian with matrix nodes", jac_nodes, jac_ref);
+  n_errors += differs("Jacobian without matrix nodes", jac_elements, jac_ref);
+  return n_errors;
+}
+
+int
+main(int argc, char** argv)
+{
+  int n_errors = test_passive() + test_active();
+  if (n_errors > 0) {
+    std::cerr << "*** Error: " << n_errors
+	      << " matrix products gave incorrect results\n";
+    return 1;
+  }
+  else {
+    std::cout << "All matrix products gave correct results\n";
+    return 0;
+  }
+}
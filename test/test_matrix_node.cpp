@@ -0,0 +1,300 @@
+/* test_matrix_node.cpp - Test matrix multiplications recorded as nodes
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// An algorithm containing matrix-matrix, matrix-vector and
+// vector-matrix multiplications of active, passive and transposed
+// arrays is recorded twice: once with each multiplication stored as
+// a single matrix node, and once with Stack::disable_matrix_nodes()
+// so that one statement is stored per element of the result. The
+// adjoint, tangent linear, multi-direction adjoint and Jacobian
+// matrix should agree to within rounding error, the adjoint of the
+// recording in two parts and after discarding a trial step with
+// Stack::rewind() should be unchanged, and functions that cannot
+// process matrix nodes should throw an exception.
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "adept_arrays.h"
+
+using namespace adept;
+
+#define M 6
+#define K 5
+#define N 4
+#define NX (M*K + K*N + N)
+#define NY K
+#define NDIR 3
+
+// First part: C = A*B
+static
+void
+first_part(const aMatrix& A, const aMatrix& B, aMatrix& C) {
+  C = matmul(A, B);
+}
+
+// Second part: y = (A^T*exp(0.1*C))*v + P*sin(v) + v*(0.5*D^T)
+static
+void
+second_part(const aMatrix& A, const aMatrix& C, const aVector& v,
+	    aVector& y) {
+  Matrix P(NY, N);
+  for (int i = 0; i < NY; i++) {
+    for (int j = 0; j < N; j++) {
+      P(i,j) = 0.1*(i+1) - 0.05*j;
+    }
+  }
+  aMatrix E = exp(0.1*C);
+  aMatrix D = matmul(A.T(), E);
+  aVector Dv = matmul(D, v);
+  aVector Ps = matmul(P, sin(v));
+  aMatrix Dt = 0.5*D.T();
+  aVector vD = matmul(v, Dt);
+  y = Dv + Ps + vD;
+}
+
+static
+Real
+seed(int i, int k) {
+  return 1.0 + 0.1*i - 0.3*k;
+}
+
+// Results of a recording
+struct Results {
+  uIndex n_operations;
+  std::vector<Real> x_ad, x_ad_parts, x_ad_rewind, y_tl, x_ad_multi;
+  std::vector<Real> jac_forward, jac_reverse;
+};
+
+static
+void
+record(Stack& stack, bool use_nodes, Results& r) {
+  aMatrix A(M,K), B(K,N), C(M,N);
+  aVector v(N), y(NY);
+  for (int i = 0; i < M; i++) {
+    for (int j = 0; j < K; j++) {
+      A(i,j) = 0.2 + 0.05*i - 0.03*j;
+    }
+  }
+  for (int i = 0; i < K; i++) {
+    for (int j = 0; j < N; j++) {
+      B(i,j) = -0.1 + 0.04*i + 0.07*j;
+    }
+  }
+  for (int i = 0; i < N; i++) {
+    v(i) = 0.5 + 0.1*i;
+  }
+  if (use_nodes) {
+    stack.enable_matrix_nodes();
+  }
+  else {
+    stack.disable_matrix_nodes();
+  }
+
+  stack.new_recording();
+  StackPosition start = stack.get_position();
+  first_part(A, B, C);
+  StackPosition middle = stack.get_position();
+  second_part(A, C, v, y);
+  StackPosition end = stack.get_position();
+  r.n_operations = stack.n_operations();
+  std::cout << "   " << stack.n_statements()-1 << " statements, "
+	    << stack.n_operations() << " operations and "
+	    << stack.n_matrix_nodes() << " matrix nodes\n";
+
+  r.x_ad.resize(NX);
+  r.x_ad_parts.resize(NX);
+  r.x_ad_rewind.resize(NX);
+  r.y_tl.resize(NY);
+  r.x_ad_multi.resize(NX*NDIR);
+
+  // Adjoint of the whole recording, in two parts, and after
+  // recording and discarding a trial step
+  for (int ipass = 0; ipass < 3; ipass++) {
+    if (ipass == 2) {
+      aMatrix trial = matmul(C, transpose(B));
+      stack.rewind(end);
+    }
+    stack.clear_gradients();
+    for (int i = 0; i < NY; i++) {
+      y(i).set_gradient(seed(i,0));
+    }
+    if (ipass == 1) {
+      stack.reverse(middle, end);
+      stack.reverse(start, middle);
+    }
+    else {
+      stack.reverse();
+    }
+    std::vector<Real>& x_ad = ipass == 0 ? r.x_ad
+      : (ipass == 1 ? r.x_ad_parts : r.x_ad_rewind);
+    int ix = 0;
+    for (int i = 0; i < M; i++) {
+      for (int j = 0; j < K; j++) {
+	A(i,j).get_gradient(x_ad[ix++]);
+      }
+    }
+    for (int i = 0; i < K; i++) {
+      for (int j = 0; j < N; j++) {
+	B(i,j).get_gradient(x_ad[ix++]);
+      }
+    }
+    for (int i = 0; i < N; i++) {
+      v(i).get_gradient(x_ad[ix++]);
+    }
+  }
+
+  // Tangent linear
+  stack.clear_gradients();
+  int ix = 0;
+  for (int i = 0; i < M; i++) {
+    for (int j = 0; j < K; j++) {
+      A(i,j).set_gradient(seed(ix++,1));
+    }
+  }
+  for (int i = 0; i < K; i++) {
+    for (int j = 0; j < N; j++) {
+      B(i,j).set_gradient(seed(ix++,1));
+    }
+  }
+  for (int i = 0; i < N; i++) {
+    v(i).set_gradient(seed(ix++,1));
+  }
+  stack.forward();
+  for (int i = 0; i < NY; i++) {
+    y(i).get_gradient(r.y_tl[i]);
+  }
+
+  // Adjoint in several directions at once
+  stack.clear_gradients();
+  for (int i = 0; i < NY; i++) {
+    Real y_ad[NDIR];
+    for (int k = 0; k < NDIR; k++) {
+      y_ad[k] = seed(i,k);
+    }
+    stack.set_gradient_directions(y(i).gradient_index(), NDIR, y_ad);
+  }
+  stack.reverse(NDIR);
+  ix = 0;
+  for (int i = 0; i < M; i++) {
+    for (int j = 0; j < K; j++) {
+      stack.get_gradient_directions(A(i,j).gradient_index(), NDIR,
+				    &r.x_ad_multi[NDIR*ix++]);
+    }
+  }
+  for (int i = 0; i < K; i++) {
+    for (int j = 0; j < N; j++) {
+      stack.get_gradient_directions(B(i,j).gradient_index(), NDIR,
+				    &r.x_ad_multi[NDIR*ix++]);
+    }
+  }
+  for (int i = 0; i < N; i++) {
+    stack.get_gradient_directions(v(i).gradient_index(), NDIR,
+				  &r.x_ad_multi[NDIR*ix++]);
+  }
+
+  // Jacobian matrix by forward and reverse passes
+  stack.clear_independents();
+  stack.clear_dependents();
+  stack.independent(A);
+  stack.independent(B);
+  stack.independent(v);
+  stack.dependent(y);
+  r.jac_forward.resize(NX*NY);
+  r.jac_reverse.resize(NX*NY);
+  stack.jacobian_forward(&r.jac_forward[0]);
+  stack.jacobian_reverse(&r.jac_reverse[0]);
+}
+
+// Return true if a and b differ by more than rounding error
+static
+bool
+differs(const std::vector<Real>& a, const std::vector<Real>& b) {
+  Real max_a = 0.0, max_diff = 0.0;
+  for (std::size_t i = 0; i < a.size(); i++) {
+    max_a = std::max(max_a, std::fabs(a[i]));
+    max_diff = std::max(max_diff, std::fabs(a[i]-b[i]));
+  }
+  return a.size() != b.size() || max_diff > 1.0e-10*max_a;
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+  Stack stack;
+  Results nodes, elements;
+
+  std::cout << "Recording with matrix nodes:\n";
+  record(stack, true, nodes);
+  std::cout << "Recording with one statement per element:\n";
+  record(stack, false, elements);
+
+  if (nodes.n_operations >= elements.n_operations) {
+    std::cout << "*** Matrix nodes did not reduce the number of operations\n";
+    error = true;
+  }
+  if (differs(nodes.x_ad, elements.x_ad)) {
+    std::cout << "*** Adjoint with matrix nodes differs\n";
+    error = true;
+  }
+  if (nodes.x_ad_parts != nodes.x_ad) {
+    std::cout << "*** Adjoint computed in parts differs\n";
+    error = true;
+  }
+  if (nodes.x_ad_rewind != nodes.x_ad) {
+    std::cout << "*** Adjoint after rewinding differs\n";
+    error = true;
+  }
+  if (differs(nodes.y_tl, elements.y_tl)) {
+    std::cout << "*** Tangent linear with matrix nodes differs\n";
+    error = true;
+  }
+  if (differs(nodes.x_ad_multi, elements.x_ad_multi)) {
+    std::cout << "*** Multi-direction adjoint with matrix nodes differs\n";
+    error = true;
+  }
+  if (differs(nodes.jac_forward, elements.jac_forward)
+      || differs(nodes.jac_reverse, elements.jac_reverse)
+      || differs(nodes.jac_forward, nodes.jac_reverse)) {
+    std::cout << "*** Jacobian with matrix nodes differs\n";
+    error = true;
+  }
+
+  // A recording with matrix nodes cannot be compressed
+  aMatrix A(2,2), B(2,2);
+  A = 1.0;
+  B = 2.0;
+  stack.enable_matrix_nodes();
+  stack.new_recording();
+  aMatrix C = matmul(A, B);
+  bool is_thrown = false;
+  try {
+    stack.compress_recording();
+  }
+  catch (feature_not_available& e) {
+    std::cout << "Correctly caught exception: " << e.what() << "\n";
+    is_thrown = true;
+  }
+  if (!is_thrown) {
+    std::cout << "*** Compressing a recording with matrix nodes should be rejected\n";
+    error = true;
+  }
+
+  if (error) {
+    std::cerr << "*** Error: matrix nodes handled incorrectly\n";
+    return 1;
+  }
+  else {
+    std::cout << "Matrix nodes handled correctly\n";
+    return 0;
+  }
+}
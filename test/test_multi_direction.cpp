@@ -0,0 +1,155 @@
+/* test_multi_direction.cpp - Test adjoints and tangent-linears in several directions
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// A recording is made of a simple nonlinear algorithm, and the
+// gradients in NDIR directions are computed with a single call to
+// Stack::compute_adjoint(NDIR) and Stack::compute_tangent_linear(NDIR).
+// They are checked to be identical to those from NDIR separate calls
+// to the single-direction versions. The number of directions is
+// deliberately not a multiple of the packet size.
+
+#include <iostream>
+#include <vector>
+
+#include "adept.h"
+
+using adept::adouble;
+using adept::Real;
+
+// Number of inputs and outputs and number of directions
+#define NX 20
+#define NY 7
+#define NDIR 5
+
+// Nonlinear algorithm in which some variables are overwritten and
+// appear on both sides of a statement
+static
+void
+algorithm(const std::vector<adouble>& x, std::vector<adouble>& y) {
+  adouble s = 0.0;
+  for (int i = 0; i < NX; i++) {
+    s = s*0.9 + sin(x[i])*x[(i+3)%NX];
+  }
+  for (int j = 0; j < NY; j++) {
+    y[j] = exp(-0.1*x[j]) * s;
+    s = s + y[j]*x[NX-1-j];
+    y[j] *= y[j];
+  }
+}
+
+// Seed value of direction k of variable i
+static
+Real
+seed(int i, int k) {
+  return 1.0 + 0.25*k - 0.125*i + ((i+k) % 3 == 0 ? 0.0 : 0.5*k*i);
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+  adept::Stack stack;
+  std::vector<adouble> x(NX), y(NY);
+  for (int i = 0; i < NX; i++) {
+    x[i] = 0.5 + 0.1*i;
+  }
+  stack.new_recording();
+  algorithm(x, y);
+
+  // Adjoint in one direction at a time, and in all directions at once
+  std::vector<Real> x_ad(NX*NDIR), x_ad_multi(NX*NDIR);
+  for (int k = 0; k < NDIR; k++) {
+    stack.clear_gradients();
+    for (int j = 0; j < NY; j++) {
+      y[j].set_gradient(seed(j,k));
+    }
+    stack.reverse();
+    for (int i = 0; i < NX; i++) {
+      x_ad[i*NDIR+k] = x[i].get_gradient();
+    }
+  }
+  stack.clear_gradients();
+  for (int j = 0; j < NY; j++) {
+    Real y_ad[NDIR];
+    for (int k = 0; k < NDIR; k++) {
+      y_ad[k] = seed(j,k);
+    }
+    y[j].set_gradient_directions(NDIR, y_ad);
+  }
+  stack.reverse(NDIR);
+  for (int i = 0; i < NX; i++) {
+    x[i].get_gradient_directions(NDIR, &x_ad_multi[i*NDIR]);
+  }
+  for (int i = 0; i < NX*NDIR; i++) {
+    if (x_ad_multi[i] != x_ad[i]) {
+      std::cout << "*** Adjoint " << i%NDIR << " of x[" << i/NDIR
+		<< "] is " << x_ad_multi[i] << " instead of " << x_ad[i] << "\n";
+      error = true;
+    }
+  }
+
+  // Tangent-linear in one direction at a time, and in all
+  // directions at once
+  std::vector<Real> y_tl(NY*NDIR), y_tl_multi(NY*NDIR);
+  for (int k = 0; k < NDIR; k++) {
+    stack.clear_gradients();
+    for (int i = 0; i < NX; i++) {
+      x[i].set_gradient(seed(i,k));
+    }
+    stack.forward();
+    for (int j = 0; j < NY; j++) {
+      y_tl[j*NDIR+k] = y[j].get_gradient();
+    }
+  }
+  stack.clear_gradients();
+  for (int i = 0; i < NX; i++) {
+    Real x_tl[NDIR];
+    for (int k = 0; k < NDIR; k++) {
+      x_tl[k] = seed(i,k);
+    }
+    stack.set_gradient_directions(x[i].gradient_index(), NDIR, x_tl);
+  }
+  stack.forward(NDIR);
+  for (int j = 0; j < NY; j++) {
+    stack.get_gradient_directions(y[j].gradient_index(), NDIR,
+				  &y_tl_multi[j*NDIR]);
+  }
+  for (int i = 0; i < NY*NDIR; i++) {
+    if (y_tl_multi[i] != y_tl[i]) {
+      std::cout << "*** Tangent-linear " << i%NDIR << " of y[" << i/NDIR
+		<< "] is " << y_tl_multi[i] << " instead of " << y_tl[i] << "\n";
+      error = true;
+    }
+  }
+
+  // Using a different number of directions without first clearing
+  // the gradients should be detected
+  bool is_thrown = false;
+  try {
+    stack.reverse(NDIR+1);
+  }
+  catch (adept::invalid_operation& e) {
+    std::cout << "Correctly caught exception: " << e.what() << "\n";
+    is_thrown = true;
+  }
+  if (!is_thrown) {
+    std::cout << "*** Mismatched number of directions should throw\n";
+    error = true;
+  }
+
+  if (error) {
+    std::cerr << "*** Error: multi-direction gradients differ from single-direction gradients\n";
+    return 1;
+  }
+  else {
+    std::cout << "Multi-direction gradients identical to single-direction gradients\n";
+    return 0;
+  }
+}
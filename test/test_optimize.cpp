@@ -0,0 +1,161 @@
+/* test_optimize.cpp - Test removal of dead statements from a recording
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// An algorithm is recorded that computes a diagnostic and discarded
+// temporaries that do not affect the dependent variables, uses
+// active "parameters" that are not independent variables, and
+// multiplies some variables by zero. The Jacobian and the adjoint
+// are computed before and after Stack::optimize() and should be
+// identical, while the optimized recording should be smaller. The
+// recording is then repeated without identifying the independent
+// variables, in which case the gradients with respect to the
+// parameters should also be unchanged.
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "adept.h"
+
+using adept::adouble;
+using adept::Real;
+
+#define N 8
+
+static
+void
+algorithm(const adouble* x, const adouble* p, adouble* y,
+	  adouble& diagnostic) {
+  diagnostic = 0.0;
+  for (int i = 0; i < N; i++) {
+    adouble t = x[i]*x[(i+1)%N];
+    adouble unused = sin(t)*2.0;
+    diagnostic += t*t + unused;
+    adouble s = p[i]*p[i] + 1.0;
+    y[i] = t*s + 0.0*x[(i+2)%N] + cos(x[i]);
+    if (i > 0) {
+      y[i] += 0.5*y[i-1];
+    }
+  }
+}
+
+// Compute the adjoint of the current recording for unit gradients of
+// the dependent variables
+static
+void
+adjoint(adept::Stack& stack, adouble* x, adouble* p, adouble* y,
+	std::vector<Real>& x_ad, std::vector<Real>& p_ad) {
+  stack.clear_gradients();
+  for (int i = 0; i < N; i++) {
+    y[i].set_gradient(1.0);
+  }
+  stack.reverse();
+  adept::get_gradients(x, N, &x_ad[0]);
+  adept::get_gradients(p, N, &p_ad[0]);
+}
+
+// Report whether two vectors are identical
+static
+void
+check(const char* name, const std::vector<Real>& a,
+      const std::vector<Real>& b, bool& error) {
+  for (std::size_t i = 0; i < a.size(); i++) {
+    if (a[i] != b[i]) {
+      std::cout << "*** Element " << i << " of " << name
+		<< " changed from " << a[i] << " to " << b[i] << "\n";
+      error = true;
+      return;
+    }
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+  adept::Stack stack;
+  adouble x[N], p[N], y[N], diagnostic;
+  std::vector<Real> jac_fwd(N*N), jac_rev(N*N), x_ad(N), p_ad(N);
+  std::vector<Real> jac_fwd_opt(N*N), jac_rev_opt(N*N), x_ad_opt(N), p_ad_opt(N);
+  for (int i = 0; i < N; i++) {
+    x[i] = 0.5 + 0.1*i;
+    p[i] = 1.0 - 0.05*i;
+  }
+
+  // With independent variables: derivatives with respect to x
+  stack.new_recording();
+  algorithm(x, p, y, diagnostic);
+  stack.independent(x, N);
+  stack.dependent(y, N);
+  stack.jacobian_forward(&jac_fwd[0]);
+  stack.jacobian_reverse(&jac_rev[0]);
+  adjoint(stack, x, p, y, x_ad, p_ad);
+  adept::uIndex n_statements = stack.n_statements();
+  adept::uIndex n_operations = stack.n_operations();
+  stack.optimize();
+  std::cout << "Optimization reduced the recording from " << n_statements
+	    << " statements and " << n_operations << " operations to "
+	    << stack.n_statements() << " statements and "
+	    << stack.n_operations() << " operations\n";
+  stack.jacobian_forward(&jac_fwd_opt[0]);
+  stack.jacobian_reverse(&jac_rev_opt[0]);
+  adjoint(stack, x, p, y, x_ad_opt, p_ad_opt);
+  check("forward Jacobian", jac_fwd, jac_fwd_opt, error);
+  check("reverse Jacobian", jac_rev, jac_rev_opt, error);
+  check("adjoint", x_ad, x_ad_opt, error);
+  if (stack.n_statements() >= n_statements
+      || stack.n_operations()*2 > n_operations) {
+    std::cout << "*** Optimization should have reduced the recording more\n";
+    error = true;
+  }
+
+  // Without independent variables: derivatives with respect to all
+  // inputs are retained
+  stack.new_recording();
+  algorithm(x, p, y, diagnostic);
+  stack.dependent(y, N);
+  adjoint(stack, x, p, y, x_ad, p_ad);
+  n_operations = stack.n_operations();
+  stack.optimize();
+  std::cout << "Without independent variables the number of operations was reduced from "
+	    << n_operations << " to " << stack.n_operations() << "\n";
+  adjoint(stack, x, p, y, x_ad_opt, p_ad_opt);
+  check("adjoint", x_ad, x_ad_opt, error);
+  check("adjoint of parameters", p_ad, p_ad_opt, error);
+  if (stack.n_operations() >= n_operations) {
+    std::cout << "*** Optimization should have reduced the recording\n";
+    error = true;
+  }
+
+  // Dependent variables must be identified
+  stack.new_recording();
+  algorithm(x, p, y, diagnostic);
+  bool is_thrown = false;
+  try {
+    stack.optimize();
+  }
+  catch (adept::dependents_or_independents_not_identified& e) {
+    std::cout << "Correctly caught exception: " << e.what() << "\n";
+    is_thrown = true;
+  }
+  if (!is_thrown) {
+    std::cout << "*** Optimization without dependent variables should throw\n";
+    error = true;
+  }
+
+  if (error) {
+    std::cerr << "*** Error: optimized recording incorrect\n";
+    return 1;
+  }
+  else {
+    std::cout << "Optimized recording correct\n";
+    return 0;
+  }
+}
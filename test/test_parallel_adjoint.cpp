@@ -0,0 +1,123 @@
+/* test_parallel_adjoint.cpp - Test the level-scheduled parallel adjoint
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// A large recording is made of a diffusion scheme, whose grid points
+// only interact with their neighbours, and its adjoint is
+// computed serially and after calling Stack::parallelize_adjoint().
+// The gradients should agree to within rounding error. The times of
+// the two adjoint computations are reported.
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "adept.h"
+#include "Timer.h"
+
+using adept::adouble;
+using adept::Real;
+
+// Number of points in spatial grid and number of timesteps
+#define NX 4000
+#define NT 200
+
+// Nonlinear diffusion scheme, in which each grid point interacts only
+// with its neighbours
+static
+void
+diffuse(int nt, double k, const adouble* q_init, adouble* q) {
+  std::vector<adouble> flux(NX-1);           // Fluxes between boxes
+  for (int i=0; i<NX; i++) q[i] = q_init[i]; // Initialize q
+  for (int j=0; j<nt; j++) {                 // Main loop in time
+    for (int i=0; i<NX-1; i++) flux[i] = k*(q[i]-q[i+1])
+				         * (1.0 + 0.5*tanh(q[i]*q[i+1]));
+    for (int i=1; i<NX-1; i++) q[i] += flux[i-1]-flux[i];
+    q[0] = q[NX-2]; q[NX-1] = q[1];          // Treat boundary conditions
+  }
+}
+
+// Compute the adjoint, returning the gradients with respect to q_init
+static
+void
+adjoint(adept::Stack& stack, const std::vector<adouble>& q_init,
+	const std::vector<adouble>& q, std::vector<Real>& q_init_ad) {
+  stack.clear_gradients();
+  for (int i = 0; i < NX; i++) {
+    q[i].set_gradient(1.0 + 0.001*i);
+  }
+  stack.reverse();
+  for (int i = 0; i < NX; i++) {
+    q_init_ad[i] = q_init[i].get_gradient();
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  const double pi = 4.0*atan(1.0);
+  bool error = false;
+  Timer timer;
+  int serial_id = timer.new_activity("Serial adjoint");
+  int parallel_id = timer.new_activity("Parallel adjoint");
+
+  adept::Stack stack;
+  std::vector<adouble> q_init(NX), q(NX);
+  for (int i = 0; i < NX; i++) {
+    q_init[i] = (0.5+0.5*sin((i*2.0*pi)/(NX-1.5)))+0.0001;
+  }
+  stack.new_recording();
+  diffuse(NT, 0.2, &q_init[0], &q[0]);
+
+  std::vector<Real> serial_ad(NX), parallel_ad(NX);
+  timer.start(serial_id);
+  adjoint(stack, q_init, q, serial_ad);
+  timer.stop();
+
+  stack.parallelize_adjoint();
+  std::cout << stack;
+  if (!stack.adjoint_is_parallelized()) {
+    std::cout << "*** Adjoint should be parallelized\n";
+    error = true;
+  }
+  timer.start(parallel_id);
+  adjoint(stack, q_init, q, parallel_ad);
+  timer.stop();
+  std::cout << "Serial adjoint:   " << timer.timing(serial_id) << " s\n";
+  std::cout << "Parallel adjoint: " << timer.timing(parallel_id) << " s using "
+	    << stack.max_jacobian_threads() << " threads\n";
+
+  Real max_ad = 0.0, max_diff = 0.0;
+  for (int i = 0; i < NX; i++) {
+    max_ad = std::max(max_ad, std::fabs(serial_ad[i]));
+    max_diff = std::max(max_diff, std::fabs(parallel_ad[i]-serial_ad[i]));
+  }
+  std::cout << "Maximum difference in gradients: " << max_diff
+	    << " (maximum gradient " << max_ad << ")\n";
+  if (max_diff > 1.0e-12*max_ad) {
+    std::cout << "*** Parallel adjoint differs from serial adjoint\n";
+    error = true;
+  }
+
+  // Modifying the recording should revert to the serial adjoint
+  q[0] = 2.0*q[1];
+  if (stack.adjoint_is_parallelized()) {
+    std::cout << "*** Adjoint should no longer be parallelized after recording is modified\n";
+    error = true;
+  }
+
+  if (error) {
+    std::cerr << "*** Error: parallel adjoint gave different results\n";
+    return 1;
+  }
+  else {
+    std::cout << "Parallel adjoint gave the same results to within rounding error\n";
+    return 0;
+  }
+}
@@ -0,0 +1,210 @@
+/* test_preaccumulation.cpp - Test local Jacobian preaccumulation
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// An algorithm is recorded in which a few inputs are mapped to a few
+// outputs via many intermediate statements, first as it is and then
+// with each such kernel enclosed in a preaccumulation region. The
+// kernels have more inputs than outputs (so the local Jacobian is
+// computed in reverse mode), fewer inputs than outputs (forward
+// mode), outputs that are updated in place, and an input that is
+// destroyed within the region so that its gradient index may be
+// reused before the region ends. The Jacobians of the two
+// recordings should agree while the second recording should be much
+// smaller. As in test_stack_blocks.cpp, the library source is
+// included directly with very short blocks, so that the regions span
+// several blocks and must be removed from them.
+
+#define ADEPT_STACK_STORAGE_BLOCKS 1
+#define ADEPT_INITIAL_STACK_LENGTH 64
+#define ADEPT_STACK_BLOCK_LENGTH 64
+#include "adept_source.h"
+#include "adept.h"
+
+#include <iostream>
+#include <cmath>
+#include <vector>
+
+using adept::adouble;
+using adept::Real;
+using adept::uIndex;
+
+#define NX 12
+
+// Three inputs to two outputs
+static
+void
+kernel_reverse(const adouble& a, const adouble& b, const adouble& c,
+	       adouble& y0, adouble& y1) {
+  adouble s = a, t = b;
+  for (int k = 0; k < 20; k++) {
+    s = s + 0.1*sin(t)*c;
+    t = t - 0.05*s*s + 0.01*c;
+  }
+  y0 = s*t;
+  y1 = exp(-s) + t;
+}
+
+// One input to three outputs
+static
+void
+kernel_forward(const adouble& a, adouble& y0, adouble& y1, adouble& y2) {
+  adouble s = a;
+  for (int k = 0; k < 15; k++) {
+    s = 0.9*s + 0.1*cos(s);
+  }
+  y0 = s;
+  y1 = s*s;
+  y2 = log(1.0 + s*s);
+}
+
+// Three variables updated in place from each other
+static
+void
+kernel_in_place(adouble& u, adouble& v, adouble& w) {
+  for (int k = 0; k < 10; k++) {
+    u += 0.1*v*w;
+    v -= 0.2*u;
+    w = w*cos(0.1*u);
+  }
+}
+
+// Two variables updated in place from a third
+static
+void
+kernel_in_place_from(const adouble& t, adouble& u, adouble& v) {
+  for (int k = 0; k < 10; k++) {
+    u += 0.1*v*t;
+    v -= 0.2*u*t;
+  }
+}
+
+// The algorithm, with or without preaccumulation
+static
+void
+algorithm(adept::Stack& stack, const std::vector<adouble>& x,
+	  std::vector<adouble>& y, bool preaccumulate) {
+  for (int i = 0; i < NX; i += 3) {
+    adouble z[5];
+    if (preaccumulate) {
+      stack.begin_preaccumulation();
+    }
+    kernel_reverse(x[i], x[i+1], x[i+2], z[0], z[1]);
+    if (preaccumulate) {
+      stack.end_preaccumulation(z, 2);
+      stack.begin_preaccumulation();
+    }
+    kernel_forward(z[0]*x[i], z[2], z[3], z[4]);
+    if (preaccumulate) {
+      stack.preaccumulation_output(z[2]);
+      stack.preaccumulation_output(&z[3], 2);
+      stack.end_preaccumulation();
+      stack.begin_preaccumulation();
+    }
+    kernel_in_place(z[1], z[2], z[3]);
+    if (preaccumulate) {
+      stack.end_preaccumulation(&z[1], 3);
+    }
+    adouble* t = new adouble(3.0*x[i]);
+    if (preaccumulate) {
+      stack.begin_preaccumulation();
+    }
+    kernel_in_place_from(*t, z[1], z[2]);
+    delete t;
+    if (preaccumulate) {
+      stack.end_preaccumulation(&z[1], 2);
+    }
+    y[i]   = z[1] + z[4];
+    y[i+1] = z[2] * x[i];
+    y[i+2] = z[3] - z[0];
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+  adept::Stack stack;
+  std::vector<adouble> x(NX), y(NX);
+  std::vector<Real> jac(NX*NX), jac_pre(NX*NX), y_value(NX);
+  uIndex n_operations[2], n_statements[2];
+
+  for (int ipre = 0; ipre < 2; ipre++) {
+    for (int i = 0; i < NX; i++) {
+      x[i] = 0.3 + 0.05*i;
+    }
+    stack.new_recording();
+    algorithm(stack, x, y, ipre == 1);
+    n_operations[ipre] = stack.n_operations();
+    n_statements[ipre] = stack.n_statements();
+    stack.independent(&x[0], NX);
+    stack.dependent(&y[0], NX);
+    stack.jacobian(ipre == 0 ? &jac[0] : &jac_pre[0]);
+    for (int i = 0; i < NX; i++) {
+      if (ipre == 0) {
+	y_value[i] = y[i].value();
+      }
+      else if (y[i].value() != y_value[i]) {
+	std::cout << "*** Output " << i << " differs with preaccumulation\n";
+	error = true;
+      }
+    }
+  }
+
+  std::cout << "Recording without preaccumulation: " << n_statements[0]
+	    << " statements, " << n_operations[0] << " operations\n";
+  std::cout << "Recording with preaccumulation:    " << n_statements[1]
+	    << " statements, " << n_operations[1] << " operations\n";
+  if (n_operations[1]*4 > n_operations[0]) {
+    std::cout << "*** Preaccumulation should have reduced the recording more\n";
+    error = true;
+  }
+  Real max_error = 0.0, max_jac = 0.0;
+  for (int i = 0; i < NX*NX; i++) {
+    max_error = std::max(max_error, std::fabs(jac_pre[i] - jac[i]));
+    max_jac = std::max(max_jac, std::fabs(jac[i]));
+  }
+  std::cout << "Maximum difference in Jacobian: " << max_error
+	    << " (maximum element " << max_jac << ")\n";
+  if (max_error > 1.0e-12*max_jac) {
+    std::cout << "*** Jacobian differs with preaccumulation\n";
+    error = true;
+  }
+
+  // Misuse should be detected
+  int n_thrown = 0;
+  try {
+    stack.end_preaccumulation();
+  }
+  catch (adept::invalid_operation& e) {
+    std::cout << "Correctly caught exception: " << e.what() << "\n";
+    ++n_thrown;
+  }
+  stack.begin_preaccumulation();
+  try {
+    stack.begin_preaccumulation();
+  }
+  catch (adept::invalid_operation& e) {
+    std::cout << "Correctly caught exception: " << e.what() << "\n";
+    ++n_thrown;
+  }
+  if (n_thrown != 2) {
+    std::cout << "*** Mismatched preaccumulation regions should throw\n";
+    error = true;
+  }
+
+  if (error) {
+    std::cerr << "*** Error: preaccumulation incorrect\n";
+    return 1;
+  }
+  else {
+    std::cout << "Preaccumulation correct\n";
+    return 0;
+  }
+}
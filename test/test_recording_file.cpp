@@ -0,0 +1,271 @@
+/* test_recording_file.cpp - Test saving a recording to a file and loading it
+
+  Copyright (C) 2012-2014 The University of Reading
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// A recording is made and saved to a file, with and without
+// compression, then loaded into a second Stack object that has not
+// run the algorithm. Adjoints and Jacobians computed from the loaded
+// recordings should be identical to those from the original.
+// Truncated and corrupted copies of each file should be rejected with
+// an exception, leaving the loaded recording unchanged.
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstdio>
+
+#include "adept.h"
+
+using adept::adouble;
+using adept::Real;
+
+// Number of points in spatial grid of simulation
+#define NX 30
+
+// "Toon" advection scheme as in test_checkpoint.cpp
+static
+void
+toon(int nt, double c, const adouble q_init[NX], adouble q[NX]) {
+  adouble flux[NX-1];                        // Fluxes between boxes
+  for (int i=0; i<NX; i++) q[i] = q_init[i]; // Initialize q
+  for (int j=0; j<nt; j++) {                 // Main loop in time
+    for (int i=0; i<NX-1; i++) flux[i] = (exp(c*log(q[i]/q[i+1]))-1.0)
+                                         * q[i]*q[i+1] / (q[i]-q[i+1]);
+    for (int i=1; i<NX-1; i++) q[i] += flux[i-1]-flux[i];
+    q[0] = q[NX-2]; q[NX-1] = q[1];          // Treat boundary conditions
+  }
+}
+
+// Read the contents of a file
+static
+std::vector<char>
+read_file(const char* filename) {
+  std::ifstream file(filename, std::ios::in | std::ios::binary);
+  std::vector<char> contents((std::istreambuf_iterator<char>(file)),
+			     std::istreambuf_iterator<char>());
+  return contents;
+}
+
+// Read or write an unsigned integer of n_bytes little-endian bytes at
+// the specified offset in the contents of a file
+static
+std::size_t
+get_word(const std::vector<char>& contents, std::size_t offset,
+	 std::size_t n_bytes) {
+  std::size_t value = 0;
+  for (std::size_t i = n_bytes; i > 0; i--) {
+    value = (value << 8) | static_cast<unsigned char>(contents[offset+i-1]);
+  }
+  return value;
+}
+static
+void
+set_word(std::vector<char>& contents, std::size_t offset,
+	 std::size_t n_bytes, std::size_t value) {
+  for (std::size_t i = 0; i < n_bytes; i++) {
+    contents[offset+i] = static_cast<char>(value & 0xff);
+    value >>= 8;
+  }
+}
+
+// Round up to the 64-byte alignment of the arrays in the file
+static
+std::size_t
+align(std::size_t pos) {
+  return (pos + 63) / 64 * 64;
+}
+
+// Try to load a damaged recording file, returning true if it is
+// rejected with an exception and the stack is left unchanged
+static
+bool
+damaged_file_rejected(adept::Stack& stack, const std::vector<char>& contents,
+		      const char* description) {
+  const char* filename = "test_recording_file_damaged.dat";
+  {
+    std::ofstream file(filename, std::ios::out | std::ios::binary);
+    file.write(&contents[0], contents.size());
+  }
+  adept::uIndex n_statements = stack.n_statements();
+  adept::uIndex n_operations = stack.n_operations();
+  bool is_rejected = false;
+  try {
+    stack.load_recording(filename);
+  }
+  catch (adept::stack_file_error& e) {
+    std::cout << "  " << description << ": correctly caught exception: "
+	      << e.what() << "\n";
+    is_rejected = true;
+  }
+  std::remove(filename);
+  if (!is_rejected) {
+    std::cout << "*** " << description << ": damaged file was not rejected\n";
+    return false;
+  }
+  else if (stack.n_statements() != n_statements
+	   || stack.n_operations() != n_operations) {
+    std::cout << "*** " << description << ": damaged file altered the recording\n";
+    return false;
+  }
+  return true;
+}
+
+// Damage a saved recording file in several ways and check that each
+// is rejected by load_recording
+static
+bool
+damaged_files_rejected(adept::Stack& stack, const char* filename) {
+  const std::vector<char> contents = read_file(filename);
+  const std::size_t uindex_size = sizeof(adept::uIndex);
+  const std::size_t header_start = 8;
+  const std::size_t n_statements = get_word(contents, header_start+4*8, 8);
+  const std::size_t n_operations = get_word(contents, header_start+5*8, 8);
+  const std::size_t n_gradients  = get_word(contents, header_start+6*8, 8);
+  const bool compressed = get_word(contents, header_start+1*8, 8) & 1;
+  const std::size_t statement_start = align(header_start + 10*8);
+  const std::size_t operation_start
+    = align(statement_start + 2*uindex_size*n_statements);
+  bool ok = true;
+
+  std::vector<char> damaged(contents.begin(),
+			    contents.begin() + contents.size()/2);
+  ok = damaged_file_rejected(stack, damaged, "Truncated file") && ok;
+
+  damaged = contents;
+  set_word(damaged, header_start+5*8, 8, static_cast<std::size_t>(1) << 40);
+  ok = damaged_file_rejected(stack, damaged, "Too many operations") && ok;
+
+  damaged = contents;
+  set_word(damaged, statement_start + 2*uindex_size*3 + uindex_size,
+	   uindex_size, 0x7ffffff0);
+  ok = damaged_file_rejected(stack, damaged, "Statement beyond operations") && ok;
+
+  damaged = contents;
+  set_word(damaged, statement_start + 2*uindex_size*3, uindex_size,
+	   n_gradients);
+  ok = damaged_file_rejected(stack, damaged, "Statement gradient index") && ok;
+
+  damaged = contents;
+  if (compressed) {
+    // A group header claiming more operations than the statement has
+    set_word(damaged, operation_start, uindex_size, 0x7ffffff8);
+    ok = damaged_file_rejected(stack, damaged, "Group too long") && ok;
+  }
+  else {
+    set_word(damaged, align(operation_start + sizeof(Real)*n_operations)
+	     + uindex_size*(n_operations-1), uindex_size, n_gradients);
+    ok = damaged_file_rejected(stack, damaged, "Operation gradient index") && ok;
+  }
+
+  damaged = contents;
+  set_word(damaged, damaged.size()-uindex_size, uindex_size, n_gradients);
+  ok = damaged_file_rejected(stack, damaged, "Dependent gradient index") && ok;
+  return ok;
+}
+
+int
+main(int argc, char** argv)
+{
+  const double pi = 4.0*atan(1.0);
+  const char* filename = "test_recording_file.dat";
+  bool error = false;
+
+  adept::Stack stack;
+  adouble q_init[NX], q[NX];
+  for (int i = 0; i < NX; i++) {
+    q_init[i] = (0.5+0.5*sin((i*2.0*pi)/(NX-1.5)))+0.0001;
+  }
+  stack.new_recording();
+  toon(20, 0.125, q_init, q);
+  stack.independent(q_init, NX);
+  stack.dependent(q, NX);
+
+  // The gradient indices are all that a process loading the recording
+  // needs to know about the variables
+  std::vector<adept::uIndex> q_init_index(NX), q_index(NX);
+  for (int i = 0; i < NX; i++) {
+    q_init_index[i] = q_init[i].gradient_index();
+    q_index[i] = q[i].gradient_index();
+  }
+
+  // Adjoint and Jacobian from the original recording
+  std::vector<Real> q_ad(NX), q_init_ad(NX), jac(NX*NX);
+  for (int i = 0; i < NX; i++) {
+    q_ad[i] = 1.0 + 0.1*i;
+    q[i].set_gradient(q_ad[i]);
+  }
+  stack.reverse();
+  for (int i = 0; i < NX; i++) {
+    q_init_ad[i] = q_init[i].get_gradient();
+  }
+  stack.jacobian(&jac[0]);
+
+  for (int icompress = 0; icompress < 2; icompress++) {
+    bool compress = (icompress == 1);
+    stack.save_recording(filename, compress);
+
+    // Load the recording into a stack that is not active and has not
+    // run the algorithm
+    adept::Stack loaded_stack(false);
+    loaded_stack.load_recording(filename);
+    std::cout << "Loaded " << (compress ? "compressed" : "uncompressed")
+	      << " recording:\n" << loaded_stack;
+
+    if (loaded_stack.n_statements() != stack.n_statements()
+	|| loaded_stack.n_operations() != stack.n_operations()
+	|| loaded_stack.n_independents() != NX
+	|| loaded_stack.n_dependents() != NX) {
+      std::cout << "*** Loaded recording has the wrong size\n";
+      error = true;
+    }
+    if (compress != loaded_stack.recording_is_compressed()) {
+      std::cout << "*** Loaded recording should be compressed only if it was saved compressed\n";
+      error = true;
+    }
+
+    for (int i = 0; i < NX; i++) {
+      loaded_stack.set_gradients(q_index[i], q_index[i]+1, &q_ad[i]);
+    }
+    loaded_stack.reverse();
+    for (int i = 0; i < NX; i++) {
+      Real ad;
+      loaded_stack.get_gradients(q_init_index[i], q_init_index[i]+1, &ad);
+      if (ad != q_init_ad[i]) {
+	std::cout << "*** Adjoint from loaded recording differs: "
+		  << ad << " instead of " << q_init_ad[i] << "\n";
+	error = true;
+      }
+    }
+
+    std::vector<Real> loaded_jac(NX*NX);
+    loaded_stack.jacobian(&loaded_jac[0]);
+    for (int i = 0; i < NX*NX; i++) {
+      if (loaded_jac[i] != jac[i]) {
+	std::cout << "*** Jacobian from loaded recording differs: "
+		  << loaded_jac[i] << " instead of " << jac[i] << "\n";
+	error = true;
+	break;
+      }
+    }
+
+    if (!damaged_files_rejected(loaded_stack, filename)) {
+      error = true;
+    }
+  }
+  std::remove(filename);
+
+  if (error) {
+    std::cerr << "*** Error: loaded recording gave different results or damaged file not rejected\n";
+    return 1;
+  }
+  else {
+    std::cout << "Loaded recording gave identical results\n";
+    return 0;
+  }
+}
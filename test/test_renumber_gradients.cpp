@@ -0,0 +1,191 @@
+/* test_renumber_gradients.cpp - Test renumbering of gradient indices
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// Active variables are created and destroyed in an irregular order so
+// that the gradient indices used by the algorithm that follows are
+// scattered. The Jacobian, adjoint, tangent-linear and multi-direction
+// adjoint of the recording are computed before and after
+// Stack::renumber_gradients(), both with and without reuse of
+// indices, and should be identical. Gradients are set and retrieved
+// via the original active variables throughout.
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "adept.h"
+
+using adept::adouble;
+using adept::Real;
+
+#define N 10
+#define N_POOL 200
+
+// Algorithm with many temporaries, which updates x in place as well
+// as computing y
+static
+void
+algorithm(adouble* x, adouble* y) {
+  for (int k = 0; k < 5; k++) {
+    for (int i = 0; i < N; i++) {
+      adouble a = x[i]*x[(i+3)%N];
+      adouble b = sin(a) + 0.1*x[(i+1)%N];
+      y[i] = b*b + exp(-a);
+    }
+    for (int i = 0; i < N; i++) {
+      x[i] += 0.01*y[(i+k)%N];
+    }
+  }
+}
+
+// Derivatives of the current recording that are compared
+struct Derivatives {
+  Derivatives() : jac_fwd(N*N), jac_rev(N*N), x_ad(N), y_tl(N),
+		  x_ad_2(2*N) { }
+  std::vector<Real> jac_fwd, jac_rev, x_ad, y_tl, x_ad_2;
+};
+
+// Compute the derivatives
+static
+void
+compute(adept::Stack& stack, adouble* x, adouble* y, Derivatives& d) {
+  stack.jacobian_forward(&d.jac_fwd[0]);
+  stack.jacobian_reverse(&d.jac_rev[0]);
+  stack.clear_gradients();
+  for (int i = 0; i < N; i++) {
+    y[i].set_gradient(1.0 + 0.1*i);
+  }
+  stack.reverse();
+  for (int i = 0; i < N; i++) {
+    d.x_ad[i] = x[i].get_gradient();
+  }
+  stack.clear_gradients();
+  for (int i = 0; i < N; i++) {
+    x[i].set_gradient(1.0 - 0.05*i);
+  }
+  stack.forward();
+  adept::get_gradients(y, N, &d.y_tl[0]);
+  stack.clear_gradients();
+  for (int i = 0; i < N; i++) {
+    Real dir[2] = {1.0, i % 2 == 0 ? 1.0 : -1.0};
+    y[i].set_gradient_directions(2, dir);
+  }
+  stack.reverse(2);
+  for (int i = 0; i < N; i++) {
+    x[i].get_gradient_directions(2, &d.x_ad_2[2*i]);
+  }
+}
+
+// Report whether two vectors are identical
+static
+void
+check(const char* name, const std::vector<Real>& a,
+      const std::vector<Real>& b, bool& error) {
+  for (std::size_t i = 0; i < a.size(); i++) {
+    if (a[i] != b[i]) {
+      std::cout << "*** Element " << i << " of " << name
+		<< " changed from " << a[i] << " to " << b[i] << "\n";
+      error = true;
+      return;
+    }
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+  adept::Stack stack;
+
+  // Scatter the gradient indices by leaving gaps in a pool of active
+  // variables
+  std::vector<adouble*> pool(N_POOL);
+  for (int i = 0; i < N_POOL; i++) {
+    pool[i] = new adouble(i);
+  }
+  for (int i = 0; i < N_POOL; i += 3) {
+    delete pool[i];
+    pool[i] = 0;
+  }
+  adouble x[N], y[N];
+  for (int ireuse = 0; ireuse < 2; ireuse++) {
+    Derivatives d, d_renumbered;
+    stack.new_recording();
+    for (int i = 0; i < N; i++) {
+      x[i] = 0.2 + 0.05*i;
+    }
+    stack.new_recording();
+    adept::uIndex x0_index = x[0].gradient_index();
+    algorithm(x, y);
+    stack.independent(x, N);
+    stack.dependent(y, N);
+    compute(stack, x, y, d);
+    adept::uIndex max_gradients = stack.max_gradients();
+
+    stack.renumber_gradients(ireuse == 1);
+    std::cout << "Renumbering gradients " << (ireuse ? "with" : "without")
+	      << " reuse changed the length of the gradient list from "
+	      << max_gradients << " to " << stack.max_gradients() << "\n";
+    compute(stack, x, y, d_renumbered);
+    check("forward Jacobian", d.jac_fwd, d_renumbered.jac_fwd, error);
+    check("reverse Jacobian", d.jac_rev, d_renumbered.jac_rev, error);
+    check("adjoint", d.x_ad, d_renumbered.x_ad, error);
+    check("tangent linear", d.y_tl, d_renumbered.y_tl, error);
+    check("two-direction adjoint", d.x_ad_2, d_renumbered.x_ad_2, error);
+    if (!stack.gradients_are_renumbered()) {
+      std::cout << "*** Gradients should be reported as renumbered\n";
+      error = true;
+    }
+
+    if (ireuse == 1) {
+      if (stack.max_gradients() >= max_gradients) {
+	std::cout << "*** Reusing indices should shorten the gradient list\n";
+	error = true;
+      }
+      // Intermediate variables are no longer accessible
+      bool is_thrown = false;
+      try {
+	pool[1]->set_gradient(1.0);
+      }
+      catch (adept::gradient_out_of_range& e) {
+	std::cout << "Correctly caught exception: " << e.what() << "\n";
+	is_thrown = true;
+      }
+      if (!is_thrown) {
+	std::cout << "*** Gradient of intermediate variable should be inaccessible\n";
+	error = true;
+      }
+    }
+    else if (x[0].gradient_index() != x0_index) {
+      std::cout << "*** Original gradient indices of active objects should be unchanged\n";
+      error = true;
+    }
+  }
+
+  // The original numbering is restored by new_recording()
+  stack.new_recording();
+  if (stack.gradients_are_renumbered()) {
+    std::cout << "*** new_recording() should restore original gradient indices\n";
+    error = true;
+  }
+
+  for (int i = 0; i < N_POOL; i++) {
+    delete pool[i];
+  }
+
+  if (error) {
+    std::cerr << "*** Error: renumbered gradients incorrect\n";
+    return 1;
+  }
+  else {
+    std::cout << "Renumbered gradients correct\n";
+    return 0;
+  }
+}
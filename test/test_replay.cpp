@@ -0,0 +1,165 @@
+/* test_replay.cpp - Test replaying a recording at new values of the inputs
+
+  Copyright (C) 2012-2014 The University of Reading
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// A recording of a scalar algorithm is made with Stack::enable_replay()
+// and then replayed at a new set of independent variables. The values
+// of the dependent variables and the Jacobian of the replayed
+// recording should be identical to those of a new recording made by
+// running the algorithm at the new point, including when a "max"
+// function selects a different argument. A recording containing an
+// array statement should not be replayable.
+
+#include <iostream>
+#include <vector>
+
+#include "adept_arrays.h"
+
+using adept::adouble;
+using adept::Real;
+
+// Number of independent and dependent variables
+#define NX 4
+#define NY 3
+
+// Algorithm using a range of unary and binary functions, compound
+// assignment and references to array elements
+static
+void
+algorithm(const adouble x[NX], adouble y[NY]) {
+  adouble a = x[0]*x[1] + sin(x[2]);
+  adouble b = exp(0.1*a) / (1.0 + x[3]*x[3]);
+  adouble c = pow(b, 2.5) + atan2(x[1], x[0]);
+  b += 3.0;
+  adouble d = max(a, c) - min(x[2], 0.5);
+  a = 2.0;
+  adept::aVector v(2);
+  v(0) = 2.0 - x[3];
+  v(1) = d*v(0);
+  y[0] = a*d + sqrt(b);
+  y[1] = -c/x[2] + log(b)*3.0;
+  y[2] = x[0]/2.0 + fabs(d - x[3]);
+  y[2] *= v(1);
+}
+
+// Run the algorithm at point x_val, returning y and the Jacobian
+static
+void
+record(adept::Stack& stack, const Real x_val[NX],
+       std::vector<Real>& y_val, std::vector<Real>& jac) {
+  adouble x[NX], y[NY];
+  // The independent variables must be given their values before the
+  // recording starts
+  for (int i = 0; i < NX; i++) {
+    x[i] = x_val[i];
+  }
+  stack.new_recording();
+  algorithm(x, y);
+  stack.independent(x, NX);
+  stack.dependent(y, NY);
+  for (int i = 0; i < NY; i++) {
+    y_val[i] = y[i].value();
+  }
+  stack.jacobian(&jac[0]);
+}
+
+// Compare two vectors element by element, which should be identical
+static
+bool
+differ(const char* name, const std::vector<Real>& a,
+       const std::vector<Real>& b) {
+  for (std::size_t i = 0; i < a.size(); i++) {
+    if (a[i] != b[i]) {
+      std::cout << "*** " << name << " element " << i << " differs: "
+		<< a[i] << " instead of " << b[i] << "\n";
+      return true;
+    }
+  }
+  return false;
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+
+  // At the first point max(a,c) selects a, at the second c
+  const Real x0[NX] = {1.5, 2.0, 0.3, 0.7};
+  const Real x1[NX] = {0.2, 0.4, 1.1, -0.3};
+
+  adept::Stack stack;
+  std::vector<Real> y0(NY), jac0(NX*NY), y1(NY), jac1(NX*NY);
+
+  // Reference values and Jacobians from recordings at both points
+  record(stack, x1, y1, jac1);
+  record(stack, x0, y0, jac0);
+  if (stack.recording_is_replayable()) {
+    std::cout << "*** Recording should not be replayable before enable_replay()\n";
+    error = true;
+  }
+
+  // Make a replayable recording at the first point and replay it at
+  // the second, then at the first again
+  stack.enable_replay();
+  std::vector<Real> y(NY), jac(NX*NY);
+  record(stack, x0, y, jac);
+  std::cout << stack;
+  if (!stack.recording_is_replayable()) {
+    std::cout << "*** Recording should be replayable\n";
+    error = true;
+  }
+  stack.replay(x1, &y[0]);
+  stack.jacobian(&jac[0]);
+  std::cout << "Replayed at second point: y = {"
+	    << y[0] << ", " << y[1] << ", " << y[2] << "}\n";
+  error = differ("Replayed y", y, y1) || error;
+  error = differ("Replayed Jacobian", jac, jac1) || error;
+
+  stack.replay(x0, &y[0]);
+  stack.jacobian(&jac[0]);
+  std::cout << "Replayed at first point: y = {"
+	    << y[0] << ", " << y[1] << ", " << y[2] << "}\n";
+  error = differ("Replayed y", y, y0) || error;
+  error = differ("Replayed Jacobian", jac, jac0) || error;
+
+  // A recording containing an array statement cannot be replayed
+  {
+    adept::aVector x(NX), z(NX);
+    x << x0[0], x0[1], x0[2], x0[3];
+    stack.new_recording();
+    z = 2.0*x;
+    stack.independent(x);
+    stack.dependent(z);
+    if (stack.recording_is_replayable()) {
+      std::cout << "*** Recording with array statement should not be replayable\n";
+      error = true;
+    }
+    bool is_thrown = false;
+    try {
+      stack.replay(x0);
+    }
+    catch (adept::recording_not_replayable& e) {
+      std::cout << "Correctly caught exception: " << e.what() << "\n";
+      is_thrown = true;
+    }
+    if (!is_thrown) {
+      std::cout << "*** Replaying recording with array statement should throw\n";
+      error = true;
+    }
+  }
+
+  if (error) {
+    std::cerr << "*** Error: replayed recording gave different results\n";
+    return 1;
+  }
+  else {
+    std::cout << "Replayed recording gave identical results\n";
+    return 0;
+  }
+}
@@ -0,0 +1,155 @@
+/* test_single_precision.cpp - Test storing a recording in single precision
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// An algorithm is recorded and its adjoint and tangent-linear are
+// computed from the full-precision recording, and again after
+// Stack::store_single_precision_recording(), in which case they
+// should agree to within single-precision rounding. The accuracy
+// reported by Stack::single_precision_error() and the memory used by
+// each recording are printed. Compressing or modifying the recording
+// should discard the single-precision copy.
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "adept.h"
+
+using adept::adouble;
+using adept::Real;
+
+#define N 50
+
+static
+void
+algorithm(const adouble* x, adouble* y) {
+  adouble s = 0.0;
+  for (int i = 0; i < N; i++) {
+    s += x[i]*x[i];
+  }
+  for (int i = 0; i < N; i++) {
+    adouble a = x[i]*x[(i+7)%N] + 0.3*s;
+    y[i] = sin(a)*exp(-0.1*x[(i+1)%N]) + a/(1.0+x[(i+2)%N]*x[(i+2)%N]);
+  }
+}
+
+// Compute the adjoint and tangent-linear of the current recording
+static
+void
+compute(adept::Stack& stack, adouble* x, adouble* y,
+	std::vector<Real>& x_ad, std::vector<Real>& y_tl) {
+  stack.clear_gradients();
+  for (int i = 0; i < N; i++) {
+    y[i].set_gradient(1.0 + 0.1*i);
+  }
+  stack.reverse();
+  adept::get_gradients(x, N, &x_ad[0]);
+  stack.clear_gradients();
+  for (int i = 0; i < N; i++) {
+    x[i].set_gradient(1.0 - 0.01*i);
+  }
+  stack.forward();
+  adept::get_gradients(y, N, &y_tl[0]);
+}
+
+// Return the largest absolute difference between two vectors divided
+// by the largest absolute element of the first
+static
+Real
+relative_difference(const std::vector<Real>& a, const std::vector<Real>& b) {
+  Real max_diff = 0.0, max_a = 0.0;
+  for (std::size_t i = 0; i < a.size(); i++) {
+    max_diff = std::max(max_diff, std::fabs(a[i]-b[i]));
+    max_a = std::max(max_a, std::fabs(a[i]));
+  }
+  return max_diff / max_a;
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+  const Real tolerance = 1.0e-5;
+  adept::Stack stack;
+  adouble x[N], y[N];
+  std::vector<Real> x_ad(N), y_tl(N), x_ad_single(N), y_tl_single(N);
+  for (int i = 0; i < N; i++) {
+    x[i] = 0.5 + 0.02*i;
+  }
+
+  stack.new_recording();
+  algorithm(x, y);
+  stack.independent(x, N);
+  stack.dependent(y, N);
+  compute(stack, x, y, x_ad, y_tl);
+
+  stack.store_single_precision_recording();
+  if (!stack.recording_is_single_precision()) {
+    std::cout << "*** Recording should be reported as single precision\n";
+    error = true;
+  }
+  compute(stack, x, y, x_ad_single, y_tl_single);
+  std::size_t full_memory = stack.n_statements()*sizeof(adept::internal::Statement)
+    + stack.n_operations()*(sizeof(Real)+sizeof(adept::uIndex));
+  std::cout << "Recording of " << stack.n_operations() << " operations uses "
+	    << full_memory << " bytes in full precision, and its"
+	    << " single-precision copy a further "
+	    << stack.single_precision_memory() << " bytes\n";
+  Real adjoint_error = relative_difference(x_ad, x_ad_single);
+  Real tangent_linear_error = relative_difference(y_tl, y_tl_single);
+  Real reported_error = stack.single_precision_error();
+  std::cout << "Relative error of single-precision adjoint: "
+	    << adjoint_error << "\n"
+	    << "Relative error of single-precision tangent linear: "
+	    << tangent_linear_error << "\n"
+	    << "Relative error reported by Stack::single_precision_error(): "
+	    << reported_error << "\n";
+  if (adjoint_error > tolerance || tangent_linear_error > tolerance
+      || reported_error > tolerance) {
+    std::cout << "*** Single-precision results differ by more than "
+	      << tolerance << "\n";
+    error = true;
+  }
+  if (sizeof(Real) > sizeof(float)
+      && stack.single_precision_memory() >= full_memory) {
+    std::cout << "*** Single-precision copy should be smaller than the recording\n";
+    error = true;
+  }
+
+  // Compressing the recording discards the single-precision copy,
+  // restoring the full-precision results
+  stack.compress_recording();
+  if (stack.recording_is_single_precision()) {
+    std::cout << "*** Compressed recording should not be single precision\n";
+    error = true;
+  }
+  compute(stack, x, y, x_ad_single, y_tl_single);
+  if (x_ad_single != x_ad || y_tl_single != y_tl) {
+    std::cout << "*** Compressed recording should give full-precision results\n";
+    error = true;
+  }
+
+  // Modifying the recording also discards the copy
+  stack.store_single_precision_recording();
+  adouble z = x[0]*x[1];
+  if (stack.recording_is_single_precision()) {
+    std::cout << "*** Modified recording should not be single precision\n";
+    error = true;
+  }
+
+  if (error) {
+    std::cerr << "*** Error: single-precision recording incorrect\n";
+    return 1;
+  }
+  else {
+    std::cout << "Single-precision recording correct\n";
+    return 0;
+  }
+}
@@ -0,0 +1,188 @@
+/* test_sparse_jacobian.cpp - Test computation of sparse Jacobian matrices
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// The Jacobian of an algorithm in which each output depends on three
+// neighbouring inputs is computed with Stack::sparse_jacobian() and
+// compared with the full Jacobian from Stack::jacobian(). Adding an
+// output that depends on all inputs makes the forward method
+// inefficient so the reverse method should be chosen, and adding an
+// input on which all outputs depend does the opposite. Finally a
+// large tridiagonal Jacobian is computed and the number of
+// directions required checked.
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "adept.h"
+#include "Timer.h"
+
+using adept::adouble;
+using adept::Real;
+using adept::uIndex;
+
+// Each output depends on three neighbouring inputs, optionally
+// followed by an output that depends on every input, and optionally
+// with every output also depending on the first input
+static
+void
+algorithm(const std::vector<adouble>& x, std::vector<adouble>& y,
+	  bool dense_row, bool dense_column) {
+  int n = x.size();
+  for (int i = 0; i < n; i++) {
+    adouble left = i > 0 ? x[i-1] : adouble(1.0);
+    adouble right = i < n-1 ? x[i+1] : adouble(0.0);
+    y[i] = left*x[i] + sin(right);
+    if (dense_column) {
+      y[i] += 0.5*x[0]*x[0];
+    }
+  }
+  if (dense_row) {
+    adouble s = 0.0;
+    for (int i = 0; i < n; i++) {
+      s += x[i]*x[i];
+    }
+    y[n] = s;
+  }
+}
+
+// Record the algorithm and check that the sparse Jacobian matches
+// the full Jacobian, returning the number of directions used
+static
+uIndex
+check_jacobian(adept::Stack& stack, int n, bool dense_row,
+	       bool dense_column, bool& error) {
+  int m = dense_row ? n+1 : n;
+  std::vector<adouble> x(n), y(m);
+  for (int i = 0; i < n; i++) {
+    x[i] = 0.5 + 0.01*i;
+  }
+  stack.new_recording();
+  algorithm(x, y, dense_row, dense_column);
+  stack.independent(&x[0], n);
+  stack.dependent(&y[0], m);
+  std::vector<Real> jac(m*n);
+  stack.jacobian(&jac[0]);
+
+  std::vector<uIndex> row_start, column, row;
+  std::vector<Real> value;
+  uIndex n_directions = stack.sparse_jacobian(row_start, column, value);
+
+  // Convert to a full matrix and compare
+  std::vector<Real> jac_sparse(m*n, 0.0);
+  for (int i = 0; i < m; i++) {
+    for (uIndex k = row_start[i]; k < row_start[i+1]; k++) {
+      jac_sparse[column[k]*m+i] = value[k];
+    }
+  }
+  for (int i = 0; i < m*n; i++) {
+    if (jac_sparse[i] != jac[i]) {
+      std::cout << "*** Sparse Jacobian element (" << i%m << "," << i/m
+		<< ") is " << jac_sparse[i] << " instead of " << jac[i] << "\n";
+      error = true;
+      break;
+    }
+  }
+
+  // The coordinate form should contain the same elements
+  std::vector<uIndex> column_coo;
+  std::vector<Real> value_coo;
+  stack.sparse_jacobian_coordinate(row, column_coo, value_coo);
+  for (std::size_t k = 0; k < value_coo.size(); k++) {
+    if (value_coo[k] != jac[column_coo[k]*m+row[k]]) {
+      std::cout << "*** Coordinate form of sparse Jacobian incorrect\n";
+      error = true;
+      break;
+    }
+  }
+  std::cout << "Jacobian of size " << m << "x" << n << " with "
+	    << value.size() << " non-zero elements computed using "
+	    << n_directions << " directions\n";
+  return n_directions;
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+  adept::Stack stack;
+
+  // Tridiagonal Jacobian needs three directions
+  if (check_jacobian(stack, 100, false, false, error) != 3) {
+    std::cout << "*** Tridiagonal Jacobian should need 3 directions\n";
+    error = true;
+  }
+  // A dense row can be handled by reverse passes and a dense column
+  // by forward passes
+  if (check_jacobian(stack, 100, true, false, error) > 10) {
+    std::cout << "*** Jacobian with a dense row should be computed in reverse mode\n";
+    error = true;
+  }
+  if (check_jacobian(stack, 100, false, true, error) > 10) {
+    std::cout << "*** Jacobian with a dense column should be computed in forward mode\n";
+    error = true;
+  }
+
+  // Large tridiagonal Jacobian whose elements are known analytically
+  const int n = 10000;
+  std::vector<adouble> x(n), y(n);
+  for (int i = 0; i < n; i++) {
+    x[i] = 0.5 + 0.0001*i;
+  }
+  stack.new_recording();
+  algorithm(x, y, false, false);
+  stack.independent(&x[0], n);
+  stack.dependent(&y[0], n);
+  Timer timer;
+  int sparse_id = timer.new_activity("Sparse Jacobian");
+  std::vector<uIndex> row_start, column;
+  std::vector<Real> value;
+  timer.start(sparse_id);
+  uIndex n_directions = stack.sparse_jacobian(row_start, column, value);
+  timer.stop();
+  std::cout << "Jacobian of size " << n << "x" << n << " with "
+	    << value.size() << " non-zero elements computed using "
+	    << n_directions << " directions in "
+	    << timer.timing(sparse_id) << " s\n";
+  if (n_directions != 3 || value.size() != static_cast<std::size_t>(3*n-2)) {
+    std::cout << "*** Large tridiagonal Jacobian has wrong structure\n";
+    error = true;
+  }
+  for (int i = 0; i < n && !error; i++) {
+    for (uIndex k = row_start[i]; k < row_start[i+1]; k++) {
+      int j = column[k];
+      Real expected;
+      if (j == i-1) {
+	expected = x[i].value();
+      }
+      else if (j == i) {
+	expected = i > 0 ? x[i-1].value() : 1.0;
+      }
+      else {
+	expected = cos(x[i+1].value());
+      }
+      if (value[k] != expected) {
+	std::cout << "*** Element (" << i << "," << j << ") of large Jacobian is "
+		  << value[k] << " instead of " << expected << "\n";
+	error = true;
+	break;
+      }
+    }
+  }
+
+  if (error) {
+    std::cerr << "*** Error: sparse Jacobian incorrect\n";
+    return 1;
+  }
+  else {
+    std::cout << "Sparse Jacobian correct\n";
+    return 0;
+  }
+}
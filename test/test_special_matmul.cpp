@@ -0,0 +1,234 @@
+/* test_special_matmul.cpp - Test differentiation of symmetric and band matmul
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// An algorithm containing multiplications of active and passive
+// symmetric and band matrices with vectors and matrices is recorded
+// three times: with each multiplication stored as a single matrix
+// node, with one statement per element of the result that depends
+// only on the stored elements of the special matrix, and with the
+// special matrices first copied to dense matrices.  The adjoint,
+// tangent linear and Jacobian matrix should agree to within rounding
+// error, and the recording of the special matrices without nodes
+// should contain fewer operations than the dense recording.
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "adept_arrays.h"
+
+using namespace adept;
+
+#define N 7
+#define M 3
+
+// Band matrix with two sub-diagonals and one super-diagonal
+typedef SpecialMatrix<Real,internal::BandEngine<ROW_MAJOR,2,1>,true> aBandMatrix;
+
+// Cost function in which SMatrix is symmetric or dense and TMatrix
+// and UMatrix are band or dense
+template <class SMatrix, class TMatrix, class UMatrix>
+static
+aReal
+algorithm(SMatrix& S, TMatrix& T, UMatrix& U, const aVector& x,
+	  const aMatrix& B) {
+  Matrix P(N,M);
+  SymmMatrix Sp(N);
+  TridiagMatrix Tp(N);
+  Sp = 0.0;
+  Tp = 0.0;
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < M; j++) {
+      P(i,j) = 0.1*(i+1) - 0.05*j;
+    }
+    for (int j = 0; j <= i; j++) {
+      Sp(i,j) = 0.5 / (1.0 + i + j);
+    }
+    Tp(i,i) = 2.0;
+    if (i > 0) {
+      Tp(i,i-1) = -0.5;
+      Tp(i-1,i) = -0.7;
+    }
+  }
+  aVector v1 = matmul(S, x);
+  aMatrix M1 = matmul(S, B);
+  aMatrix M2 = matmul(B.T(), S);
+  aVector v2 = matmul(T, x);
+  aMatrix M3 = matmul(T.T(), B);
+  aVector v3 = matmul(x, T);
+  aMatrix M4 = matmul(U, sin(B));
+  aVector v4 = matmul(U, x);
+  aMatrix M5 = matmul(S, P) + matmul(T, P);
+  aVector v5 = matmul(Sp, x) + matmul(Tp, v4);
+  return sum(v1*v2) + sum(M1*M3) + sum(M2*M2) + sum(v3*v3)
+    + sum(M4*M5) + sum(v4) + sum(v5*x);
+}
+
+// Results of a recording
+struct Results {
+  uIndex n_operations;
+  std::vector<Real> x_ad, y_tl, jac_forward, jac_reverse;
+};
+
+// Method of recording
+enum Method {
+  NODES, ELEMENTS, DENSE
+};
+
+static
+void
+record(Stack& stack, Method method, Results& r) {
+  aSymmMatrix S(N);
+  aTridiagMatrix T(N);
+  aBandMatrix U(N);
+  aVector x(N);
+  aMatrix B(N,M);
+  S = 0.0;
+  T = 0.0;
+  U = 0.0;
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j <= i; j++) {
+      S(i,j) = 1.0 + 0.1*i - 0.2*j;
+    }
+    for (int j = std::max(0,i-2); j <= std::min(N-1,i+1); j++) {
+      U(i,j) = 0.3 - 0.05*i + 0.1*j;
+      if (j >= i-1) {
+	T(i,j) = 0.2 + 0.1*i - 0.15*j;
+      }
+    }
+    x(i) = 0.5 + 0.1*i;
+    for (int j = 0; j < M; j++) {
+      B(i,j) = -0.1 + 0.04*i + 0.07*j;
+    }
+  }
+  if (method == NODES) {
+    stack.enable_matrix_nodes();
+  }
+  else {
+    stack.disable_matrix_nodes();
+  }
+
+  stack.new_recording();
+  aReal cost;
+  if (method == DENSE) {
+    aMatrix S_dense = S, T_dense = T, U_dense = U;
+    cost = algorithm(S_dense, T_dense, U_dense, x, B);
+  }
+  else {
+    cost = algorithm(S, T, U, x, B);
+  }
+  r.n_operations = stack.n_operations();
+  std::cout << "   " << stack.n_statements()-1 << " statements, "
+	    << stack.n_operations() << " operations and "
+	    << stack.n_matrix_nodes() << " matrix nodes\n";
+
+  // Adjoint with respect to the stored elements of the special
+  // matrices
+  cost.set_gradient(1.0);
+  stack.reverse();
+  r.x_ad.clear();
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j <= i; j++) {
+      r.x_ad.push_back(S(i,j).get_gradient());
+    }
+    for (int j = std::max(0,i-2); j <= std::min(N-1,i+1); j++) {
+      r.x_ad.push_back(U(i,j).get_gradient());
+      if (j >= i-1) {
+	r.x_ad.push_back(T(i,j).get_gradient());
+      }
+    }
+    r.x_ad.push_back(x(i).get_gradient());
+    for (int j = 0; j < M; j++) {
+      r.x_ad.push_back(B(i,j).get_gradient());
+    }
+  }
+
+  // Tangent linear
+  stack.clear_gradients();
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j <= i; j++) {
+      S(i,j).set_gradient(0.1*(i-j) + 0.3);
+    }
+    T(i,i).set_gradient(1.0 - 0.2*i);
+    U(i,std::max(0,i-2)).set_gradient(0.5);
+    x(i).set_gradient(0.2*i);
+  }
+  stack.forward();
+  r.y_tl.assign(1, cost.get_gradient());
+
+  // Jacobian with respect to x and B by forward and reverse passes
+  stack.independent(x);
+  stack.independent(B);
+  stack.dependent(cost);
+  r.jac_forward.resize(N+N*M);
+  r.jac_reverse.resize(N+N*M);
+  stack.jacobian_forward(&r.jac_forward[0]);
+  stack.jacobian_reverse(&r.jac_reverse[0]);
+}
+
+// Return true if a and b differ by more than rounding error
+static
+bool
+differs(const std::vector<Real>& a, const std::vector<Real>& b) {
+  Real max_a = 0.0, max_diff = 0.0;
+  for (std::size_t i = 0; i < a.size(); i++) {
+    max_a = std::max(max_a, std::fabs(a[i]));
+    max_diff = std::max(max_diff, std::fabs(a[i]-b[i]));
+  }
+  return a.size() != b.size() || max_diff > 1.0e-10*max_a;
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+  Stack stack;
+  Results nodes, elements, dense;
+
+  std::cout << "Recording special matrices with matrix nodes:\n";
+  record(stack, NODES, nodes);
+  std::cout << "Recording special matrices with one statement per element:\n";
+  record(stack, ELEMENTS, elements);
+  std::cout << "Recording dense copies of special matrices:\n";
+  record(stack, DENSE, dense);
+
+  if (nodes.n_operations >= elements.n_operations) {
+    std::cout << "*** Matrix nodes did not reduce the number of operations\n";
+    error = true;
+  }
+  if (elements.n_operations >= dense.n_operations) {
+    std::cout << "*** Special matrices did not reduce the number of operations\n";
+    error = true;
+  }
+  if (differs(nodes.x_ad, dense.x_ad) || differs(elements.x_ad, dense.x_ad)) {
+    std::cout << "*** Adjoint of special matrix multiplication differs\n";
+    error = true;
+  }
+  if (differs(nodes.y_tl, dense.y_tl) || differs(elements.y_tl, dense.y_tl)) {
+    std::cout << "*** Tangent linear of special matrix multiplication differs\n";
+    error = true;
+  }
+  if (differs(nodes.jac_forward, dense.jac_forward)
+      || differs(nodes.jac_reverse, dense.jac_reverse)
+      || differs(elements.jac_forward, dense.jac_forward)
+      || differs(elements.jac_reverse, dense.jac_reverse)) {
+    std::cout << "*** Jacobian of special matrix multiplication differs\n";
+    error = true;
+  }
+
+  if (error) {
+    std::cerr << "*** Error: special matrix multiplication differentiated incorrectly\n";
+    return 1;
+  }
+  else {
+    std::cout << "Special matrix multiplication differentiated correctly\n";
+    return 0;
+  }
+}
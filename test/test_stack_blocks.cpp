@@ -0,0 +1,197 @@
+/* test_stack_blocks.cpp - Test storage of the stack in blocks
+
+  Copyright (C) 2012-2014 The University of Reading
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// The storage engine requires the Adept library to be recompiled,
+// so as in test_no_lib.cpp the library source is included directly.
+// Very short blocks are used so that a small algorithm spans many of
+// them.
+#define ADEPT_STACK_STORAGE_BLOCKS 1
+#define ADEPT_INITIAL_STACK_LENGTH 64
+#define ADEPT_STACK_BLOCK_LENGTH 64
+#include "adept_source.h"
+#include "adept_arrays.h"
+
+#include <iostream>
+#include <cmath>
+#include <vector>
+
+using adept::adouble;
+
+// Number of points in spatial grid of simulation
+#define NX 20
+
+// "Toon" advection scheme applied to linear advection in a 1D
+// periodic domain, as in test_checkpoint.cpp, but templated so that
+// it can also be run passively for finite differencing
+template <typename Type>
+void
+toon(int nt, double c, const Type q_init[NX], Type q[NX]) {
+  Type flux[NX-1];                           // Fluxes between boxes
+  for (int i=0; i<NX; i++) q[i] = q_init[i]; // Initialize q
+  for (int j=0; j<nt; j++) {                 // Main loop in time
+    for (int i=0; i<NX-1; i++) flux[i] = (exp(c*log(q[i]/q[i+1]))-1.0)
+                                         * q[i]*q[i+1] / (q[i]-q[i+1]);
+    for (int i=1; i<NX-1; i++) q[i] += flux[i-1]-flux[i];
+    q[0] = q[NX-2]; q[NX-1] = q[1];          // Treat boundary conditions
+  }
+}
+
+// Report whether two numbers agree to within a fractional tolerance
+static bool
+check(const char* name, double x, double y, double tol, bool& error) {
+  double diff = std::fabs(x-y) / (std::fabs(x)+std::fabs(y)+1.0e-12);
+  if (diff > tol) {
+    std::cout << "*** " << name << ": " << x << " and " << y
+	      << " differ by fractional amount " << diff << "\n";
+    error = true;
+    return false;
+  }
+  return true;
+}
+
+int
+main(int argc, char** argv)
+{
+  const double pi = 4.0*atan(1.0);
+  const int nt = 20;
+  const double dt = 0.125;
+  bool error = false;
+
+  double q_init_save[NX];
+  for (int i = 0; i < NX; i++) {
+    q_init_save[i] = (0.5+0.5*sin((i*2.0*pi)/(NX-1.5)))+0.0001;
+  }
+
+  adept::Stack stack;
+
+  // Run twice so that the second recording reuses the blocks of the
+  // first, then a third time with a memory budget small enough that
+  // most blocks are spilled to disk
+  for (int irecording = 0; irecording < 3; ++irecording) {
+    if (irecording == 2) {
+      stack.set_spill_directory(".");
+      stack.set_memory_budget(4096);
+    }
+    adouble q_init[NX], q[NX];
+    adept::set_values(q_init, NX, q_init_save);
+    stack.new_recording();
+    toon(nt, dt, q_init, q);
+    adouble J = 0.0;
+    for (int i = 0; i < NX; i++) {
+      J += q[i]*q[i];
+    }
+
+    std::cout << stack;
+    if (stack.n_stack_blocks() < 10) {
+      std::cout << "*** Recording should span many blocks\n";
+      error = true;
+    }
+    if ((irecording == 2) != (stack.n_spilled_blocks() > 0)) {
+      std::cout << "*** Blocks should be spilled only with a memory budget\n";
+      error = true;
+    }
+
+    // Adjoint
+    double dJ_dq[NX];
+    J.set_gradient(1.0);
+    stack.reverse();
+    adept::get_gradients(q_init, NX, dJ_dq);
+
+    // Compare to finite differences
+    for (int i = 0; i < NX; i++) {
+      double qp[NX], qm[NX], qfinal[NX];
+      const double dq = 1.0e-6;
+      for (int j = 0; j < NX; j++) {
+	qp[j] = qm[j] = q_init_save[j];
+      }
+      qp[i] += dq;
+      qm[i] -= dq;
+      double Jp = 0.0, Jm = 0.0;
+      toon(nt, dt, qp, qfinal);
+      for (int j = 0; j < NX; j++) Jp += qfinal[j]*qfinal[j];
+      toon(nt, dt, qm, qfinal);
+      for (int j = 0; j < NX; j++) Jm += qfinal[j]*qfinal[j];
+      check("Adjoint vs finite difference", dJ_dq[i], (Jp-Jm)/(2.0*dq),
+	    1.0e-4, error);
+    }
+
+    // Jacobian of the final field with respect to the initial field,
+    // by forward and reverse passes
+    stack.independent(q_init, NX);
+    stack.dependent(q, NX);
+    std::vector<double> jac_fwd(NX*NX), jac_rev(NX*NX);
+    stack.jacobian_forward(&jac_fwd[0]);
+    stack.jacobian_reverse(&jac_rev[0]);
+    for (int i = 0; i < NX*NX; i++) {
+      check("Forward vs reverse Jacobian", jac_fwd[i], jac_rev[i],
+	    1.0e-8, error);
+    }
+
+    // Tangent-linear: perturb the first element of the initial field
+    // and compare to the first column of the Jacobian
+    stack.clear_gradients();
+    q_init[1].set_gradient(1.0);
+    stack.forward();
+    for (int i = 0; i < NX; i++) {
+      check("Tangent linear vs Jacobian", q[i].get_gradient(),
+	    jac_fwd[1*NX+i], 1.0e-8, error);
+    }
+  }
+  stack.set_memory_budget(0);
+
+  // Statements built with add_derivative_dependence and
+  // append_derivative_dependence that straddle block boundaries
+  {
+    const int n = 300;
+    adouble x = 2.0;
+    std::vector<adouble> y(n);
+    stack.new_recording();
+    for (int i = 0; i < n; i++) {
+      y[i].set_value(x.value()*(i+1));
+      y[i].add_derivative_dependence(x, i+1.0);
+      y[i].append_derivative_dependence(x, 0.5);
+    }
+    adouble sum = 0.0;
+    for (int i = 0; i < n; i++) {
+      sum += y[i];
+    }
+    sum.set_gradient(1.0);
+    stack.reverse();
+    check("Appended derivative dependence", x.get_gradient(),
+	  n*(n+1)/2.0 + 0.5*n, 1.0e-12, error);
+  }
+
+  // An array statement requiring more operations than a whole block
+  {
+    const int n = 500;
+    adept::aVector x(n), y(n);
+    for (int i = 0; i < n; i++) {
+      x(i) = i;
+    }
+    stack.new_recording();
+    y = 3.0*x*x;
+    adouble z = sum(y);
+    z.set_gradient(1.0);
+    stack.reverse();
+    adept::Vector dz_dx = x.get_gradient();
+    for (int i = 0; i < n; i++) {
+      check("Array statement", dz_dx(i), 6.0*i, 1.0e-12, error);
+    }
+  }
+
+  if (error) {
+    std::cerr << "*** Error: stack stored in blocks gave wrong results\n";
+    return 1;
+  }
+  else {
+    std::cout << "Stack stored in blocks gave correct results\n";
+    return 0;
+  }
+}
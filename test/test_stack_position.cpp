@@ -0,0 +1,178 @@
+/* test_stack_position.cpp - Test positions in a recording
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// An algorithm is recorded in two parts with the position between
+// them obtained from Stack::get_position(). The adjoint and tangent
+// linear computed one part at a time should equal those computed
+// from the whole recording. Trial steps of a "line search" are then
+// recorded after the algorithm and discarded with Stack::rewind(),
+// after which the recording should be as it was, and an invalid
+// position should be rejected.
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "adept.h"
+
+using adept::adouble;
+using adept::Real;
+
+#define N 30
+
+static
+void
+first_part(const adouble* x, adouble* u) {
+  for (int i = 0; i < N; i++) {
+    u[i] = x[i]*x[(i+1)%N] + sin(x[(i+3)%N]);
+  }
+}
+
+static
+void
+second_part(const adouble* u, adouble* y) {
+  adouble s = 0.0;
+  for (int i = 0; i < N; i++) {
+    s += u[i]*u[i];
+  }
+  for (int i = 0; i < N; i++) {
+    y[i] = exp(-0.01*s)*u[(i+2)%N] + 2.0*u[i];
+  }
+}
+
+// Trial step: record a cost function of x + step*direction
+static
+adouble
+trial(const adouble* x, Real step) {
+  std::vector<adouble> z(N);
+  adouble cost = 0.0;
+  for (int i = 0; i < N; i++) {
+    z[i] = x[i] + step*(1.0 - 0.05*i);
+    cost += z[i]*z[i]*z[i];
+  }
+  return cost;
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+  adept::Stack stack;
+  adouble x[N], u[N], y[N];
+  std::vector<Real> x_ad(N), x_ad_parts(N), y_tl(N), y_tl_parts(N);
+  for (int i = 0; i < N; i++) {
+    x[i] = 0.3 + 0.02*i;
+  }
+
+  stack.new_recording();
+  adept::StackPosition start = stack.get_position();
+  first_part(x, u);
+  adept::StackPosition middle = stack.get_position();
+  second_part(u, y);
+  adept::StackPosition end = stack.get_position();
+  std::cout << "Recording of " << stack.n_statements() << " statements, of which "
+	    << middle.n_statements << " are in the first part\n";
+
+  // Adjoint of the whole recording and of each part in turn
+  for (int i = 0; i < N; i++) {
+    y[i].set_gradient(1.0 + 0.1*i);
+  }
+  stack.reverse();
+  adept::get_gradients(x, N, &x_ad[0]);
+  stack.clear_gradients();
+  for (int i = 0; i < N; i++) {
+    y[i].set_gradient(1.0 + 0.1*i);
+  }
+  stack.reverse(middle, end);
+  stack.reverse(start, middle);
+  adept::get_gradients(x, N, &x_ad_parts[0]);
+  if (x_ad_parts != x_ad) {
+    std::cout << "*** Adjoint computed in parts differs\n";
+    error = true;
+  }
+
+  // Likewise the tangent linear
+  stack.clear_gradients();
+  for (int i = 0; i < N; i++) {
+    x[i].set_gradient(1.0 - 0.02*i);
+  }
+  stack.forward();
+  adept::get_gradients(y, N, &y_tl[0]);
+  stack.clear_gradients();
+  for (int i = 0; i < N; i++) {
+    x[i].set_gradient(1.0 - 0.02*i);
+  }
+  stack.forward(start, middle);
+  stack.forward(middle, end);
+  adept::get_gradients(y, N, &y_tl_parts[0]);
+  if (y_tl_parts != y_tl) {
+    std::cout << "*** Tangent linear computed in parts differs\n";
+    error = true;
+  }
+
+  // Record and discard trial steps, leaving the last one
+  const adept::uIndex max_gradients = stack.max_gradients();
+  adouble cost;
+  for (int itrial = 0; itrial < 5; itrial++) {
+    stack.rewind(end);
+    if (stack.n_statements() != end.n_statements
+	|| stack.n_operations() != end.n_operations
+	|| stack.max_gradients() < max_gradients) {
+      std::cout << "*** Rewound recording differs from the original\n";
+      error = true;
+    }
+    adept::StackPosition trial_start = stack.get_position();
+    cost = trial(y, 0.1*itrial);
+    stack.clear_gradients();
+    cost.set_gradient(1.0);
+    stack.reverse(trial_start, stack.get_position());
+    std::cout << "Trial step " << itrial << ": cost " << cost.value()
+	      << ", gradient " << y[0].get_gradient() << "\n";
+  }
+  if (stack.max_gradients() < max_gradients) {
+    std::cout << "*** Too few gradients after rewinding\n";
+    error = true;
+  }
+  stack.rewind(end);
+  stack.clear_gradients();
+  for (int i = 0; i < N; i++) {
+    y[i].set_gradient(1.0 + 0.1*i);
+  }
+  stack.reverse();
+  adept::get_gradients(x, N, &x_ad_parts[0]);
+  if (x_ad_parts != x_ad) {
+    std::cout << "*** Adjoint after rewinding differs\n";
+    error = true;
+  }
+
+  // A position beyond the end of the recording is rejected
+  bool is_thrown = false;
+  stack.rewind(middle);
+  try {
+    stack.rewind(end);
+  }
+  catch (adept::invalid_operation& e) {
+    std::cout << "Correctly caught exception: " << e.what() << "\n";
+    is_thrown = true;
+  }
+  if (!is_thrown) {
+    std::cout << "*** Rewinding beyond the end should be rejected\n";
+    error = true;
+  }
+
+  if (error) {
+    std::cerr << "*** Error: positions in recording handled incorrectly\n";
+    return 1;
+  }
+  else {
+    std::cout << "Positions in recording handled correctly\n";
+    return 0;
+  }
+}
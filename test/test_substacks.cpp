@@ -0,0 +1,162 @@
+/* test_substacks.cpp - Test recording a parallel region into sub-stacks
+
+  Copyright (C) 2018 European Centre for Medium-Range Weather Forecasts
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.  This file is offered as-is,
+  without any warranty.
+*/
+
+// The elements of a vector are computed in an OpenMP parallel loop,
+// with each chunk of the loop recorded into its own sub-stack using
+// gradient indices reserved from the parent stack. The sub-stacks are
+// appended to the parent in order, and the Jacobian is checked to be
+// identical to that from recording the same loop serially. If the
+// program is compiled without OpenMP the chunks are simply recorded
+// one after the other.
+
+#include <iostream>
+#include <vector>
+
+#include "adept_arrays.h"
+
+using adept::adouble;
+using adept::aVector;
+using adept::Real;
+
+// Number of elements, number of chunks of the parallel loop, and the
+// maximum number of gradients each chunk may register
+#define N 64
+#define NCHUNK 8
+#define NGRADIENT 16
+
+// Compute element i of y, using scalar and array temporaries
+static
+void
+compute_element(const aVector& x, aVector& y, int i) {
+  adouble a = exp(-x(i)*x(i));
+  aVector t(3);
+  t(0) = a*x((i+1)%N);
+  t(1) = sin(t(0)) + 2.0*x(i);
+  t(2) = t(0) + t(1)*a;
+  y(i) = sum(t*t);
+}
+
+// Record the Jacobian of y with respect to x, serially or in
+// parallel with each chunk of the loop using a sub-stack
+static
+void
+record(adept::Stack& stack, bool use_substacks, std::vector<Real>& jac) {
+  aVector x(N), y(N);
+  for (int i = 0; i < N; i++) {
+    x(i) = 0.1*i - 2.0;
+  }
+  stack.new_recording();
+  if (use_substacks) {
+    std::vector<adept::Stack*> substack(NCHUNK);
+    for (int ichunk = 0; ichunk < NCHUNK; ichunk++) {
+      substack[ichunk] = new adept::Stack(false);
+    }
+    adept::uIndex first_gradient = stack.register_gradients(NCHUNK*NGRADIENT);
+#pragma omp parallel for schedule(static)
+    for (int ichunk = 0; ichunk < NCHUNK; ichunk++) {
+      substack[ichunk]->begin_substack(first_gradient + ichunk*NGRADIENT,
+				       NGRADIENT);
+      for (int i = ichunk*(N/NCHUNK); i < (ichunk+1)*(N/NCHUNK); i++) {
+	compute_element(x, y, i);
+      }
+      substack[ichunk]->end_substack();
+    }
+    for (int ichunk = 0; ichunk < NCHUNK; ichunk++) {
+      stack.append_substack(*substack[ichunk]);
+      delete substack[ichunk];
+    }
+    stack.unregister_gradients(first_gradient, NCHUNK*NGRADIENT);
+  }
+  else {
+    for (int i = 0; i < N; i++) {
+      compute_element(x, y, i);
+    }
+  }
+  stack.independent(x);
+  stack.dependent(y);
+  stack.jacobian(&jac[0]);
+}
+
+int
+main(int argc, char** argv)
+{
+  bool error = false;
+  adept::Stack stack;
+  std::vector<Real> jac_serial(N*N), jac_parallel(N*N);
+
+  record(stack, false, jac_serial);
+  record(stack, true, jac_parallel);
+  std::cout << stack;
+
+  for (int i = 0; i < N*N; i++) {
+    if (jac_parallel[i] != jac_serial[i]) {
+      std::cout << "*** Jacobian element " << i << " from sub-stacks is "
+		<< jac_parallel[i] << " instead of " << jac_serial[i] << "\n";
+      error = true;
+      break;
+    }
+  }
+
+  // Creating more active objects than the range reserved for a
+  // sub-stack, either one at a time or as an array, should be
+  // reported by append_substack() rather than by end_substack(),
+  // which is called inside the parallel region
+  for (int is_array = 0; is_array <= 1; is_array++) {
+    adept::Stack substack(false);
+    adept::uIndex first_gradient = stack.register_gradients(2);
+    adept::uIndex n_statements = stack.n_statements();
+    substack.begin_substack(first_gradient, 2);
+    if (is_array) {
+      aVector v(3);
+      v = 1.0;
+    }
+    else {
+      adouble a = 1.0, b = 2.0, c = 3.0;
+      a = b*c;
+    }
+    bool is_thrown = false;
+    try {
+      substack.end_substack();
+    }
+    catch (adept::gradient_out_of_range& e) {
+      std::cout << "*** end_substack() should not throw\n";
+      error = true;
+    }
+    if (!stack.is_active()) {
+      std::cout << "*** Parent stack should be active after end_substack()\n";
+      error = true;
+    }
+    try {
+      stack.append_substack(substack);
+    }
+    catch (adept::gradient_out_of_range& e) {
+      std::cout << "Correctly caught exception: " << e.what() << "\n";
+      is_thrown = true;
+    }
+    stack.unregister_gradients(first_gradient, 2);
+    if (!is_thrown) {
+      std::cout << "*** Exceeding gradient range of sub-stack should throw\n";
+      error = true;
+    }
+    if (stack.n_statements() != n_statements) {
+      std::cout << "*** Nothing should be appended from a sub-stack that exceeded its range\n";
+      error = true;
+    }
+  }
+
+  if (error) {
+    std::cerr << "*** Error: sub-stacks gave different results\n";
+    return 1;
+  }
+  else {
+    std::cout << "Sub-stacks gave identical results\n";
+    return 0;
+  }
+}